@@ -24,6 +24,23 @@ class Device(DB.Entity):
         return datetime.now() >= self.until
 
 
+class IdentityKey(DB.Entity):
+    """
+    Identity resolving key of a device that uses bluetooth privacy (rotating addresses).
+    """
+    bluetooth_id = PrimaryKey(str)
+    irk = Required(str)
+
+
+class Metric(DB.Entity):
+    """
+    One sample of a door runtime metric (see smartDoor/metrics.h for the keys).
+    """
+    time = Required(datetime, default=datetime.now)
+    name = Required(str)
+    value = Required(int, size=64)
+
+
 def get_bt_device(bt_id):
     """
     getter to get a device from the DB.
@@ -68,6 +85,28 @@ def update_until_time(days, bt_id):
         d.until = None
 
 
+@db_session
+def set_irk(bt_id, irk):
+    """
+    add or update the identity resolving key of a device.
+    :param bt_id: the device identity bluetooth_id.
+    :param irk: the key as 32 hex digits.
+    """
+    k = IdentityKey.get(bluetooth_id=bt_id)
+    if k:
+        k.irk = irk
+    else:
+        IdentityKey(bluetooth_id=bt_id, irk=irk)
+
+
+@db_session
+def list_irks():
+    """
+    :return: dict of identity bluetooth_id to IRK of all the devices in the DB.
+    """
+    return {k.bluetooth_id: k.irk for k in IdentityKey.select() if get_bt_device(k.bluetooth_id)}
+
+
 @db_session
 def list_devices():
     """
@@ -76,6 +115,32 @@ def list_devices():
     return {d.bluetooth_id: (d.name, d.until or '') for d in Device.select() if not d.timeout}
 
 
+@db_session
+def add_metrics(payload):
+    """
+    stores a metrics message of the door.
+    :param payload: the message, "key=value,key=value".
+    """
+    now = datetime.now()
+    for item in payload.split(','):
+        name, _, value = item.partition('=')
+        if value.isdigit():
+            Metric(time=now, name=name, value=int(value))
+
+
+@db_session
+def metrics_series(name, since=None):
+    """
+    :param name: the metric key.
+    :param since: datetime of the first sample, all the samples if None.
+    :return: list of (time, value) of the metric ordered by time.
+    """
+    samples = select(m for m in Metric if m.name == name)
+    if since:
+        samples = samples.filter(lambda m: m.time >= since)
+    return [(m.time, m.value) for m in samples.order_by(Metric.time)]
+
+
 def start():
     """
     starts the database connection.
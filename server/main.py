@@ -9,13 +9,26 @@ def on_mqtt_message(_, telegram_client: telegram.Client, message):
     :param telegram_client: instance of telegram connection.
     :param message: the MQTT message.
     """
+    if message.topic == mqtt.topic_metrics:
+        return db.add_metrics(message.payload.decode())
     if message.topic != mqtt.topic_subscribe:
         return
     msg = message.payload.decode()
     if msg.startswith('connected'):
+        mqtt.send_irks(db.list_irks())
+        mqtt.send_filter(mqtt.filter_rules)
         return telegram.send_message('--**The door lock device is connected**--')
     elif msg.startswith('disconnected'):
         return telegram.send_message('--**The door lock device is disconnected**--‼')
+    elif msg.startswith('prefetch '):
+        bt_id = msg.split()[1]
+        return mqtt.send_verdict(bt_id, db.get_bt_device(bt_id))
+    elif msg.startswith('opened '):
+        bt_id = msg.split()[1]
+        with db.db_session:
+            device = db.Device.get(bluetooth_id=bt_id)
+            name = device.name if device else bt_id
+        return telegram.send_message(f'The door unlocked now by: `{name}`')
     device = db.get_bt_device(msg)
     if device:
         with db.db_session:
@@ -1,6 +1,7 @@
 import time
+from datetime import datetime
 
-from paho.mqtt.client import Client, connack_string, error_string
+from paho.mqtt.client import Client, MQTTv311, MQTTv5, connack_string, error_string
 from typing import Optional
 import configparser
 import telegram
@@ -12,15 +13,21 @@ client: Optional[Client] = None
 broker = _config['mqtt']['broker']
 topic_publish = _config['mqtt']['publish']
 topic_subscribe = _config['mqtt']['subscribe']
+topic_metrics = _config['mqtt'].get('metrics', 'smart_door_lock/iot/metrics')
+verdict_ttl = _config['mqtt'].getint('verdict_ttl', 300)
+protocol = MQTTv5 if _config['mqtt'].getint('protocol', 5) == 5 else MQTTv311
+filter_rules = [r.strip() for r in _config.get('filter', 'rules', fallback='').splitlines() if r.strip()]
 
 
-def _on_connect(mqtt_client, telegram_client, _, return_code):
+def _on_connect(mqtt_client, telegram_client, _, return_code, properties=None):
     """
     mqtt handler that send message to telegram when the server is connected
     """
     msg = 'Server failed to connect. CONNECTION_ERROR <'
     if return_code == 0:
         msg = '--**Server is Connected**--'
+    elif protocol == MQTTv5:
+        msg += str(return_code) + '>'  # v5 reason code
     else:
         msg += connack_string(return_code) + '>'
     telegram.send_message(msg)
@@ -32,10 +39,11 @@ def connect(subscribe=topic_subscribe):
     :param subscribe: topic to subscribe
     """
     global client
-    client = Client('TgServer', userdata=telegram.bot)
+    client = Client('TgServer', userdata=telegram.bot, protocol=protocol)
     client.on_connect = _on_connect
     client.connect(broker, 1883)
     client.subscribe(subscribe, 1)
+    client.subscribe(topic_metrics, 0)
 
 
 def publish(msg: str, c: Client = None, qos=1):
@@ -54,6 +62,56 @@ def publish(msg: str, c: Client = None, qos=1):
     return msg_inf.rc, error_string(msg_inf.rc), msg_inf
 
 
+def send_verdict(bt_id, device, c: Client = None, qos=1):
+    """
+    answer a prefetch request of the door with the device authorization.
+    the verdict is valid for verdict_ttl seconds or until the device permission ends.
+    :param bt_id: the device bluetooth_id.
+    :param device: the device from the DB or None if it is unknown.
+    :param c: mqtt client
+    :param qos: qos
+    :return: result of the sending
+    """
+    if not c:
+        global client
+        c = client
+    ttl = verdict_ttl
+    if device and device.until:
+        ttl = max(0, min(ttl, int((device.until - datetime.now()).total_seconds())))
+    msg_inf = c.publish(topic_publish, f'verdict {bt_id} {int(bool(device))} {ttl}', qos)
+    return msg_inf.rc, error_string(msg_inf.rc), msg_inf
+
+
+def send_irks(irks, c: Client = None, qos=1):
+    """
+    replace the identity resolving keys stored on the door.
+    :param irks: dict of identity bluetooth_id to IRK.
+    :param c: mqtt client
+    :param qos: qos
+    """
+    if not c:
+        global client
+        c = client
+    c.publish(topic_publish, 'irk_clear', qos)
+    for bt_id, irk in irks.items():
+        c.publish(topic_publish, f'irk {bt_id} {irk}', qos)
+
+
+def send_filter(rules, c: Client = None, qos=1):
+    """
+    replace the advertisement payload filter of the door (see smartDoor/adv_filter.h).
+    :param rules: list of filter commands, e.g. 'mfr 004C' or 'uuid FD6F'.
+    :param c: mqtt client
+    :param qos: qos
+    """
+    if not c:
+        global client
+        c = client
+    c.publish(topic_publish, 'filter_clear', qos)
+    for rule in rules:
+        c.publish(topic_publish, f'filter {rule}', qos)
+
+
 def open_door(c: Client = None, qos=1):
     """
     funcion to send 'open_door' to the device.
@@ -0,0 +1,87 @@
+"""
+Pushes a firmware update to the door over MQTT (see smartDoor/ota.h).
+    python ota.py 000b57fffe0c1a2b smartDoor.gbl
+The door id is the unique id of its chip (Simplicity Commander: Unique ID), in 16 hex digits.
+The image is sent in chunks, each one after the door acknowledged the previous one.
+After a reconnect the door acknowledges again where it stopped and the transfer resumes from there.
+"""
+import argparse
+import configparser
+import hashlib
+import queue
+import struct
+import sys
+
+from paho.mqtt.client import Client
+
+_config = configparser.ConfigParser()
+_config.read('config.ini')
+
+broker = _config['mqtt']['broker']
+topic_cmd = _config['mqtt']['publish']
+topic_ota = _config['mqtt'].get('ota', 'smart_door_lock/iot/ota')
+topic_ota_ack = _config['mqtt'].get('ota_ack', 'smart_door_lock/iot/ota_ack')
+CHUNK_SIZE = 1024  # multiple of 4, the door writes the flash in words
+HEADER = struct.Struct('<I')  # offset of the chunk data in the image
+
+
+def push(client, answers, door, image, timeout, retries):
+    """
+    sends the image and waits until the door checked it.
+    :param client: connected mqtt client.
+    :param door: the door id.
+    :param answers: queue of the door answers.
+    :param image: the firmware image (.gbl).
+    :param timeout: seconds to wait for an answer before sending the chunk again.
+    :param retries: answers that may be missed in a row.
+    :return: the last answer of the door
+    """
+    begin = f'ota_begin {door} {len(image)} {hashlib.sha256(image).hexdigest()}'
+    client.publish(topic_cmd, begin, 1)
+    offset, missed, started = 0, 0, False
+    while True:
+        try:
+            answer = answers.get(timeout=timeout)
+            missed = 0
+        except queue.Empty:
+            missed += 1
+            if missed > retries:
+                return 'no answer'
+            if not started:
+                client.publish(topic_cmd, begin, 1)
+                continue
+            answer = f'ota_ack {offset}'  # the chunk or its ack was lost, send it again
+        started = True
+        if not answer.startswith('ota_ack '):
+            return answer
+        offset = int(answer.split()[1])
+        if offset >= len(image):
+            continue  # the door checks the image, ota_done or ota_fail follows
+        print(f'\r{offset * 100 // len(image):3}% {offset}/{len(image)}', end='', flush=True)
+        client.publish(f'{topic_ota}/{door}', HEADER.pack(offset) + image[offset:offset + CHUNK_SIZE], 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('door', help='id of the door to update')
+    parser.add_argument('image', help='the firmware image (Gecko bootloader .gbl)')
+    parser.add_argument('--timeout', type=float, default=60, help='seconds to wait for an ack')
+    parser.add_argument('--retries', type=int, default=10, help='acks that may be missed in a row')
+    args = parser.parse_args()
+    image = open(args.image, 'rb').read()
+    answers = queue.Queue()
+    client = Client('TgServerOta')
+    client.on_message = lambda c, u, m: answers.put(m.payload.decode())
+    client.connect(broker, 1883)
+    client.subscribe(f'{topic_ota_ack}/{args.door}', 1)
+    client.loop_start()
+    result = push(client, answers, args.door.lower(), image, args.timeout, args.retries)
+    client.loop_stop()
+    client.disconnect()
+    print(f'\n{result}')
+    if result != 'ota_done':
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
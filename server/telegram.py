@@ -93,13 +93,18 @@ def callback_handler(c, q):
         db.add_device(*q.data.split()[1:])
         q.message.reply('**Device added successfully**')
     elif q.data.startswith('remove'):
+        bt_id = q.data.split()[-1]
         with db.db_session:
-            d = db.get_bt_device(q.data.split()[-1])
+            d = db.get_bt_device(bt_id)
             if d:
                 d.delete()
+        # the door drops its cached verdict instead of opening for the device until it ends
+        mqtt.send_verdict(bt_id, None)
     elif q.data.startswith('until'):
         data = q.data.split()[1:]
         db.update_until_time(int(data[0]), data[1])
+        with db.db_session:
+            mqtt.send_verdict(data[1], db.get_bt_device(data[1]))
     else:
         d = db.get_bt_device(q.data)
         if d:
@@ -159,6 +164,26 @@ def force_lock_or_open(c, m):
     m.stop_propagation()
 
 
+@bot.on_message(filters.private & filters.command('irk') & filters.user(OWNER))
+def set_irk(c, m):
+    """
+    set the identity resolving key of a device that rotates its bluetooth address.
+    usage: /irk <bluetooth_id> <32 hex digits>
+    :param c: telegram client.
+    :param m: message.
+    """
+    if len(m.command) != 3 or len(m.command[2]) != 32 or not all(
+            ch in '0123456789abcdefABCDEF' for ch in m.command[2]):
+        m.reply('**usage:** `/irk <bluetooth_id> <32 hex digits>`')
+    elif not db.get_bt_device(m.command[1].upper()):
+        m.reply('**Unknown device, add it first**')
+    else:
+        db.set_irk(m.command[1].upper(), m.command[2].lower())
+        mqtt.send_irks(db.list_irks())
+        m.reply('**Identity key saved**')
+    m.stop_propagation()
+
+
 @bot.on_message(filters.private & filters.command('list') & filters.user(OWNER))
 def list_devices(c, m):
     """
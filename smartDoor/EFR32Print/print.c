@@ -8,6 +8,12 @@ static unsigned char _curLine = 0;
 unsigned char _isInit = 0;
 static GLIB_Context_t glibContext;
 
+/* text framebuffer: lines are drawn with GLIB only when they change */
+static char _text[LCD_MAX_LINES][LCD_MAX_COLS + 1];
+static uint32_t _dirty = 0;  /* bit i: line i changed since it was drawn */
+static bool _pushPending = false;  /* lines were drawn but the display wasn't updated yet */
+static bool _flushPending = false;  /* lcd_flush_async was called */
+
 
 /**
  * call this function before printing to the screen, and provide font size. (default = small)
@@ -45,6 +51,8 @@ void lcd_init(FontSize size) {
     LINE_SIZE = (glibContext.clippingRegion.yMax /
                     glibContext.font.fontWidth) - 1;
     if (size == big) LINE_SIZE++;
+    NUM_OF_LINES = min(NUM_OF_LINES, LCD_MAX_LINES);
+    LINE_SIZE = min(LINE_SIZE, LCD_MAX_COLS);
 }
 
 
@@ -53,7 +61,107 @@ void lcd_init(FontSize size) {
  */
 void cleanScreen() {
     _curLine = 0;
-    GLIB_clear(&glibContext);
+    for (int i = 0; i < NUM_OF_LINES; i++) {
+        lcd_set_line(i, "");
+    }
+}
+
+
+/**
+ * replaces the text of a line in the framebuffer, the line is marked dirty only if it changed.
+ * @param line: line number.
+ * @param text: the new text, truncated to the line size.
+ */
+static void set_line(int line, const char *text) {
+    char padded[LCD_MAX_COLS + 1];
+    int len = min((int) strlen(text), LINE_SIZE);
+    if (line < 0 || line >= NUM_OF_LINES) return;
+    /* pad with spaces, the opaque background of the spaces erases the old text */
+    memset(padded, ' ', LINE_SIZE);
+    memcpy(padded, text, len);
+    padded[LINE_SIZE] = '\0';
+    if (strcmp(_text[line], padded) != 0) {
+        strcpy(_text[line], padded);
+        _dirty |= 1UL << line;
+    }
+}
+
+
+/**
+ * draws a dirty line into the GLIB frame.
+ * @param line: line number.
+ */
+static void draw_line(int line) {
+    uint32_t status;
+    status = GLIB_drawStringOnLine(&glibContext, _text[line], line,
+                                   GLIB_ALIGN_LEFT, 5, 5, true);
+    EFM_ASSERT(status == GLIB_OK);
+    _dirty &= ~(1UL << line);
+    _pushPending = true;
+}
+
+
+/**
+ * sends the frame to the display. the memory LCD DMD driver only refreshes the whole
+ * frame, so the changed lines are pushed together, once per flush.
+ */
+static void push(void) {
+    if (_pushPending) {
+        DMD_updateDisplay();
+        _pushPending = false;
+    }
+}
+
+
+/**
+ * writes a formatted line of the status screen (see lcd_set_line in print.h).
+ */
+void lcd_set_line(int line, const char *format, ...) {
+    char line_buf[LCD_MAX_COLS + 1];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line_buf, sizeof(line_buf), format, args);
+    va_end(args);
+    set_line(line, line_buf);
+}
+
+
+/**
+ * draws the dirty lines and updates the display.
+ */
+void lcd_flush(void) {
+    for (int i = 0; i < NUM_OF_LINES; i++) {
+        if (_dirty & (1UL << i)) {
+            draw_line(i);
+        }
+    }
+    _flushPending = false;
+    push();
+}
+
+
+/**
+ * asks for a flush that lcd_process does in small steps.
+ */
+void lcd_flush_async(void) {
+    _flushPending = true;
+}
+
+
+/**
+ * does one step of a pending lcd_flush_async: draws one dirty line, or updates the
+ * display once all of them are drawn.
+ * @return: 1 if there is more work pending else 0
+ */
+int lcd_process(void) {
+    if (!_flushPending) return 0;
+    if (_dirty) {
+        draw_line(__builtin_ctz(_dirty));
+        return 1;
+    }
+    push();
+    _flushPending = false;
+    return 0;
 }
 
 
@@ -84,10 +192,8 @@ int remove_char(char* string, char rm) {
  * this function do not brake the line in '\n'
  */
 void lcd_puts(const char* string) {
-    uint32_t status;
-    status = GLIB_drawStringOnLine(&glibContext, string, _curLine++,
-                                   GLIB_ALIGN_LEFT, 5, 5, true);
-    EFM_ASSERT(status == GLIB_OK);
+    if (_curLine >= NUM_OF_LINES) cleanScreen();
+    set_line(_curLine++, string);
 }
 
 
@@ -130,5 +236,5 @@ void lcd_printf(const char *format, ...) {
         }
         line = strtok(NULL,"\n");
     }
-    DMD_updateDisplay();
+    lcd_flush();
 }
@@ -5,12 +5,15 @@
 #include <stdarg.h>
 #include <strings.h>
 #include <string.h>
+#include <stdbool.h>
 #include "em_assert.h"
 #include "glib.h"
 #include "dmd.h"
 #include "sl_board_control.h"
 
 #define min(x, y) (((x) < (y)) ? (x):(y))
+#define LCD_MAX_LINES 16  /* text framebuffer size, at most 32 lines */
+#define LCD_MAX_COLS 24
 
 
 typedef enum FontSize {
@@ -51,4 +54,29 @@ void lcd_puts(const char*);
  */
 void lcd_printf(const char *, ...);
 
+/**
+ * writes a formatted line at a fixed position, e.g. a field of a status screen.
+ * nothing is drawn until the next lcd_flush / lcd_flush_async, and only if the text changed.
+ * @param line: line number.
+ * @param format: printf format, the text is truncated to the line size.
+ */
+void lcd_set_line(int line, const char *format, ...);
+
+/**
+ * draws the lines that changed since the last flush and updates the display.
+ */
+void lcd_flush(void);
+
+/**
+ * schedules a flush that is done in small steps by lcd_process.
+ */
+void lcd_flush_async(void);
+
+/**
+ * does one step of a pending lcd_flush_async: draws one changed line, or updates
+ * the display once all of them are drawn. call it when idle.
+ * @return: 1 if there is more work pending else 0
+ */
+int lcd_process(void);
+
 #endif /* PRINT_H_ */
@@ -1,14 +1,222 @@
 #include "MQTTClient.h"
 #include "wolfmqtt/mqtt_types.h"
+#include "trace.h"
+#include "timer.h"
+#include "metrics.h"
+#ifdef MQTT_NET_TLS
+#include "wolfssl/ssl.h"
+#ifdef TLS_SESSION_NVM
+#include "nvm3_default.h"
+#endif
+#endif
 
 
 typedef struct _SocketContext {
     char *host;
     MQTTCtx* mqttCtx;
+#ifdef MQTT_NET_TLS
+    WOLFSSL *ssl;    /* NULL while the connection is plaintext */
+    int timeout_ms;  /* timeout of the socket reads done by wolfSSL */
+#endif
 } SocketContext;
 
 static char IMEI[64];
 static SocketContext g_sock;
+static uint64_t last_write = 0;  /* cur_time of the last write to the broker */
+static uint64_t last_read = 0;   /* cur_time of the last read from the broker */
+
+#ifdef WOLFMQTT_V5
+typedef struct _TopicAlias {
+    const char *topic;
+    byte sent;  /* the broker already knows the alias of this topic */
+} TopicAlias;
+
+static TopicAlias topic_aliases[MQTT_TOPIC_ALIASES];
+static word16 alias_max = 0;  /* Topic Alias Maximum of the broker (CONNACK) */
+#endif
+
+#ifdef MQTT_NET_TLS
+#define TLS_HANDSHAKE_TIMEOUT_MS 30000  /* a full handshake is a few KB, slow over 2G */
+
+static WOLFSSL_CTX *tls_ctx = NULL;
+static WOLFSSL_SESSION *tls_session = NULL;  /* last session, resumed on the next connect */
+static uint32_t tls_bytes = 0;  /* bytes on the socket, for the handshake size */
+
+
+#ifdef TLS_SESSION_NVM
+/**
+ * stores the session in NVM3, so it can be resumed after a reset too.
+ * @param session: the session.
+ */
+static void tls_session_save(WOLFSSL_SESSION *session) {
+    unsigned char buf[TLS_SESSION_MAX_SIZE];
+    unsigned char *p = buf;
+    int len = wolfSSL_i2d_SSL_SESSION(session, NULL);
+    if (len <= 0 || len > TLS_SESSION_MAX_SIZE) {
+        return;
+    }
+    wolfSSL_i2d_SSL_SESSION(session, &p);
+    nvm3_writeData(nvm3_defaultHandle, TLS_SESSION_NVM_KEY, buf, len);
+}
+
+
+/**
+ * @return: the session stored by tls_session_save, NULL if there is none
+ */
+static WOLFSSL_SESSION *tls_session_load(void) {
+    unsigned char buf[TLS_SESSION_MAX_SIZE];
+    const unsigned char *p = buf;
+    uint32_t type;
+    size_t len;
+    if (nvm3_getObjectInfo(nvm3_defaultHandle, TLS_SESSION_NVM_KEY, &type, &len) != ECODE_NVM3_OK ||
+        len > TLS_SESSION_MAX_SIZE ||
+        nvm3_readData(nvm3_defaultHandle, TLS_SESSION_NVM_KEY, buf, len) != ECODE_NVM3_OK) {
+        return NULL;
+    }
+    return wolfSSL_d2i_SSL_SESSION(NULL, &p, (long) len);
+}
+#endif // TLS_SESSION_NVM
+
+
+/**
+ * wolfSSL receive callback, reads the TLS records from the modem socket.
+ * @return: number of bytes read, or one of the WOLFSSL_CBIO_ERR codes
+ */
+static int tls_recv(WOLFSSL *ssl, char *buf, int sz, void *ctx) {
+    SocketContext *sock = (SocketContext *) ctx;
+    (void) ssl;
+    int n = SocketRead((unsigned char *) buf, sz, sock->timeout_ms);
+    if (n == 0) {
+        /* wolfSSL keeps its state, the read is retried on the next call */
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    }
+    if (n < 0) {
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    }
+    tls_bytes += n;
+    return n;
+}
+
+
+/**
+ * wolfSSL send callback, writes the TLS records to the modem socket.
+ * @return: number of bytes written, or one of the WOLFSSL_CBIO_ERR codes
+ */
+static int tls_send(WOLFSSL *ssl, char *buf, int sz, void *ctx) {
+    (void) ssl;
+    (void) ctx;
+    int n = SocketWrite((unsigned char *) buf, sz);
+    if (n < 0) {
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    }
+    tls_bytes += n;
+    return n;
+}
+
+
+/**
+ * creates the wolfSSL context once, it is kept across reconnects.
+ * @return: 0 on success, -1 otherwise
+ */
+static int tls_init(void) {
+    if (tls_ctx) {
+        return 0;
+    }
+    wolfSSL_Init();
+    tls_ctx = wolfSSL_CTX_new(wolfTLSv1_2_client_method());
+    if (!tls_ctx) {
+        return -1;
+    }
+    wolfSSL_CTX_SetIORecv(tls_ctx, tls_recv);
+    wolfSSL_CTX_SetIOSend(tls_ctx, tls_send);
+#ifdef TLS_CA_CERT
+    if (wolfSSL_CTX_load_verify_buffer(tls_ctx, (const byte *) TLS_CA_CERT, sizeof(TLS_CA_CERT) - 1,
+                                       WOLFSSL_FILETYPE_PEM) != WOLFSSL_SUCCESS) {
+        PRINT_DEBUG("MQTTClient: bad CA certificate")
+        wolfSSL_CTX_free(tls_ctx);  /* so the next connect doesn't reuse a context that trusts nothing */
+        tls_ctx = NULL;
+        return -1;
+    }
+    wolfSSL_CTX_set_verify(tls_ctx, WOLFSSL_VERIFY_PEER, NULL);
+#else
+    PRINT_DEBUG("MQTTClient: TLS without TLS_CA_CERT, the broker isn't verified")
+    wolfSSL_CTX_set_verify(tls_ctx, WOLFSSL_VERIFY_NONE, NULL);
+#endif
+#ifdef TLS_SESSION_NVM
+    tls_session = tls_session_load();
+#endif
+    return 0;
+}
+
+
+/**
+ * runs the TLS handshake over the connected socket, resuming the last session if there is one.
+ * the handshake time and size are published as metrics.
+ * @param sock: the socket context.
+ * @param timeout_ms: timeout of every socket read.
+ * @return: MQTT_CODE_SUCCESS, or a negative MqttPacketResponseCodes
+ */
+static int tls_connect(SocketContext *sock, int timeout_ms) {
+    uint64_t start = cur_time();
+    int rc;
+    tls_bytes = 0;
+    if (tls_init() == -1 || !(sock->ssl = wolfSSL_new(tls_ctx))) {
+        return MQTT_CODE_ERROR_SYSTEM;
+    }
+    wolfSSL_SetIOReadCtx(sock->ssl, sock);
+    wolfSSL_SetIOWriteCtx(sock->ssl, sock);
+#ifdef HAVE_SNI
+    wolfSSL_UseSNI(sock->ssl, WOLFSSL_SNI_HOST_NAME, sock->host, (word16) strlen(sock->host));
+#endif
+#ifdef HAVE_SESSION_TICKET
+    wolfSSL_UseSessionTicket(sock->ssl);
+#endif
+    if (tls_session) {
+        wolfSSL_set_session(sock->ssl, tls_session);
+    }
+    sock->timeout_ms = timeout_ms;
+    do {
+        rc = wolfSSL_connect(sock->ssl);
+    } while (rc != WOLFSSL_SUCCESS && wolfSSL_get_error(sock->ssl, rc) == WOLFSSL_ERROR_WANT_READ &&
+             cur_time() - start < TLS_HANDSHAKE_TIMEOUT_MS);
+    if (rc != WOLFSSL_SUCCESS) {
+        PRINTF_DEBUG("MQTTClient: TLS handshake failed %d\n", wolfSSL_get_error(sock->ssl, rc))
+        wolfSSL_free(sock->ssl);
+        sock->ssl = NULL;
+        /* don't insist on a session the broker may have dropped */
+        wolfSSL_SESSION_free(tls_session);
+        tls_session = NULL;
+        return MQTT_CODE_ERROR_NETWORK;
+    }
+    metric_set(METRIC_TLS_HANDSHAKE_MS, (uint32_t) (cur_time() - start));
+    metric_set(METRIC_TLS_HANDSHAKE_BYTES, tls_bytes);
+    if (wolfSSL_session_reused(sock->ssl)) {
+        METRIC_INC(METRIC_TLS_RESUMED);
+    } else {
+        wolfSSL_SESSION_free(tls_session);
+        tls_session = wolfSSL_get1_session(sock->ssl);
+#ifdef TLS_SESSION_NVM
+        if (tls_session) {
+            tls_session_save(tls_session);
+        }
+#endif
+    }
+    return MQTT_CODE_SUCCESS;
+}
+
+
+/**
+ * closes the TLS connection (close_notify) and frees it.
+ * @param sock: the socket context.
+ */
+static void tls_close(SocketContext *sock) {
+    if (sock->ssl) {
+        wolfSSL_shutdown(sock->ssl);
+        wolfSSL_free(sock->ssl);
+        sock->ssl = NULL;
+    }
+}
+#endif // MQTT_NET_TLS
 
 
 /**
@@ -35,7 +243,17 @@ static int NetConnect(void *context, const char* host, word16 port, int timeout_
         PRINT_DEBUG("HTTP: Failed connecting to host")
         return MQTT_CODE_ERROR_NETWORK;
     }
+#ifdef MQTT_NET_TLS
+    if (sock->mqttCtx->use_tls) {
+        int rc = tls_connect(sock, timeout_ms);
+        if (rc != MQTT_CODE_SUCCESS) {
+            SocketClose();
+            return rc;
+        }
+    }
+#endif
     PRINT_DEBUG("MQTTClient: Connected successfully")
+    last_write = last_read = cur_time();
     return MQTT_CODE_SUCCESS;
 }
 
@@ -49,7 +267,19 @@ static int NetConnect(void *context, const char* host, word16 port, int timeout_
 static int NetRead(void *context, byte* buf, int buf_len, int timeout_ms) {
     int n;
     bzero(buf, buf_len);
+    TRACE_POINT(TRACE_NET_READ_START, buf_len);
+#ifdef MQTT_NET_TLS
+    SocketContext *sock = (SocketContext *)context;
+    if (sock->ssl) {
+        sock->timeout_ms = timeout_ms;
+        n = wolfSSL_read(sock->ssl, buf, buf_len);
+        if (n <= 0) {
+            n = (wolfSSL_get_error(sock->ssl, n) == WOLFSSL_ERROR_WANT_READ) ? 0 : -1;
+        }
+    } else
+#endif
     n = SocketRead(buf, buf_len, timeout_ms);
+    TRACE_POINT(TRACE_NET_READ_END, n);
     if (n == 0) {
         PRINT_DEBUG("MQTTClient: socket timeout")
         return MQTT_CODE_ERROR_TIMEOUT;
@@ -58,6 +288,7 @@ static int NetRead(void *context, byte* buf, int buf_len, int timeout_ms) {
         PRINT_DEBUG("MQTTClient: Failed reading")
         return MQTT_CODE_ERROR_NETWORK;
     }
+    last_read = cur_time();
     return n;
 }
 
@@ -69,10 +300,21 @@ static int NetRead(void *context, byte* buf, int buf_len, int timeout_ms) {
  * timeout_ms defines the timeout in milliseconds
  */
 static int NetWrite(void *context, const byte* buf, int buf_len, int timeout_ms) {
-    if (SocketWrite(buf, buf_len) < buf_len) {
+    int n;
+    TRACE_POINT(TRACE_NET_WRITE_START, buf_len);
+#ifdef MQTT_NET_TLS
+    SocketContext *sock = (SocketContext *)context;
+    if (sock->ssl) {
+        n = wolfSSL_write(sock->ssl, buf, buf_len);
+    } else
+#endif
+    n = SocketWrite(buf, buf_len);
+    TRACE_POINT(TRACE_NET_WRITE_END, n);
+    if (n < buf_len) {
         PRINT_DEBUG( "MQTTClient: Failed writing")
         return MQTT_CODE_ERROR_NETWORK;
     }
+    last_write = cur_time();
     return buf_len;
 }
 
@@ -82,6 +324,9 @@ static int NetWrite(void *context, const byte* buf, int buf_len, int timeout_ms)
  * Returns 0, and a negative number otherwise (one of MqttPacketResponseCodes)
  */
 static int NetDisconnect(void *context) {
+#ifdef MQTT_NET_TLS
+    tls_close((SocketContext *)context);
+#endif
     if (SocketClose() < 0) {
         PRINT_DEBUG("MQTTClient: Disconnection failed")
         return MQTT_CODE_ERROR_SYSTEM;
@@ -115,6 +360,9 @@ int MqttClientNet_Init(MqttNet* net, MQTTCtx* mqttCtx) {
 int MqttClientNet_DeInit(MqttNet* net) {
     if (net) {
         if (net->context) {
+#ifdef MQTT_NET_TLS
+            tls_close(&g_sock);
+#endif
             bzero(&g_sock,sizeof(g_sock));
         }
         bzero(net,sizeof(MqttNet));
@@ -122,3 +370,96 @@ int MqttClientNet_DeInit(MqttNet* net) {
     }
     return MQTT_CODE_SUCCESS;
 }
+
+
+/**
+ * @return: cur_time() of the last successful write to the broker
+ */
+uint64_t MqttClientNet_LastWrite(void) {
+    return last_write;
+}
+
+
+/**
+ * @return: cur_time() of the last successful read from the broker
+ */
+uint64_t MqttClientNet_LastRead(void) {
+    return last_read;
+}
+
+
+/**
+ * @return: 1 if the broker sent something that a read picks up without waiting, 0 otherwise
+ */
+int MqttClientNet_Pending(void) {
+#ifdef MQTT_NET_TLS
+    /* a TLS record may hold more than the last read took */
+    if (g_sock.ssl && wolfSSL_pending(g_sock.ssl) > 0) {
+        return 1;
+    }
+#endif
+    return SocketPending(SOCKET_MAIN);
+}
+
+
+#ifdef WOLFMQTT_V5
+/**
+ * starts a new alias mapping after CONNECT, aliases are valid for one connection only.
+ * @param ack: the CONNACK, holds the Topic Alias Maximum of the broker.
+ */
+void MqttClientAlias_Reset(MqttConnectAck *ack) {
+    bzero(topic_aliases, sizeof(topic_aliases));
+    alias_max = 0;
+    for (MqttProp *prop = ack->props; prop; prop = prop->next) {
+        if (prop->type == MQTT_PROP_TOPIC_ALIAS_MAX) {
+            alias_max = prop->data_short;
+        }
+    }
+}
+
+
+/**
+ * replaces the topic of a publish with a topic alias. the first publish on a topic carries
+ * both the topic and the alias, the next ones only the 2 bytes alias.
+ * the caller must call MqttClientAlias_Done after the publish.
+ * @param publish: the publish, topic_name is set.
+ */
+void MqttClientAlias_Apply(MqttPublish *publish) {
+    int i = 0;
+    publish->props = NULL;
+    while (i < MQTT_TOPIC_ALIASES && topic_aliases[i].topic &&
+           XSTRCMP(topic_aliases[i].topic, publish->topic_name) != 0) {
+        i++;
+    }
+    if (i == MQTT_TOPIC_ALIASES || i >= alias_max) {
+        return;
+    }
+    MqttProp *prop = MqttClient_PropsAdd(&publish->props);
+    if (!prop) {
+        return;
+    }
+    prop->type = MQTT_PROP_TOPIC_ALIAS;
+    prop->data_short = (word16) (i + 1);
+    topic_aliases[i].topic = publish->topic_name;
+    if (topic_aliases[i].sent) {
+        publish->topic_name = "";
+    }
+}
+
+
+/**
+ * frees the alias property of a publish.
+ * @param publish: the publish.
+ * @param rc: the publish result, the alias is known to the broker only if it succeeded.
+ */
+void MqttClientAlias_Done(MqttPublish *publish, int rc) {
+    if (!publish->props) {
+        return;
+    }
+    if (rc == MQTT_CODE_SUCCESS) {
+        topic_aliases[publish->props->data_short - 1].sent = 1;
+    }
+    MqttClient_PropsFree(publish->props);
+    publish->props = NULL;
+}
+#endif // WOLFMQTT_V5
@@ -6,6 +6,19 @@
 #include "wolfmqtt/mqtt_client.h"
 #include "socket.h"
 
+/*
+ * TLS to the broker with wolfSSL, done inside the Net callbacks (MQTTClient.c) when
+ * MQTTCtx.use_tls is set. the session is cached and resumed on reconnects.
+ * define TLS_CA_CERT as the PEM of the broker CA to verify the broker.
+ * define TLS_SESSION_NVM to keep the session in NVM3 across resets (needs HAVE_EXT_CACHE).
+ */
+//#define MQTT_NET_TLS
+#define TLS_SESSION_NVM_KEY 0x5D01
+#define TLS_SESSION_MAX_SIZE 512
+
+/* with WOLFMQTT_V5 the uplink topics are sent as 2 bytes topic aliases */
+#define MQTT_TOPIC_ALIASES 4
+
 
 /* MQTT Client state */
 typedef enum _MQTTCtxState {
@@ -41,7 +54,7 @@ typedef struct _MQTTCtx {
     MqttMessage lwt_msg;
     MqttSubscribe subscribe;
     MqttUnsubscribe unsubscribe;
-    MqttTopic topics[1];
+    MqttTopic topics[2];
     MqttPublish publish;
     MqttDisconnect disconnect;
     MqttPing ping;
@@ -82,4 +95,42 @@ int MqttClientNet_Init(MqttNet* net, MQTTCtx* mqttCtx);
  */
 int MqttClientNet_DeInit(MqttNet* net);
 
+/**
+ * @return: cur_time() of the last successful write to the broker
+ */
+uint64_t MqttClientNet_LastWrite(void);
+
+/**
+ * @return: cur_time() of the last successful read from the broker
+ */
+uint64_t MqttClientNet_LastRead(void);
+
+/**
+ * @return: 1 if the broker sent something that a read picks up without waiting, 0 otherwise
+ */
+int MqttClientNet_Pending(void);
+
+#ifdef WOLFMQTT_V5
+/**
+ * starts a new alias mapping after CONNECT, aliases are valid for one connection only.
+ * @param ack: the CONNACK, holds the Topic Alias Maximum of the broker.
+ */
+void MqttClientAlias_Reset(MqttConnectAck *ack);
+
+/**
+ * replaces the topic of a publish with a topic alias. the first publish on a topic carries
+ * both the topic and the alias, the next ones only the 2 bytes alias.
+ * the caller must call MqttClientAlias_Done after the publish.
+ * @param publish: the publish, topic_name is set.
+ */
+void MqttClientAlias_Apply(MqttPublish *publish);
+
+/**
+ * frees the alias property of a publish.
+ * @param publish: the publish.
+ * @param rc: the publish result, the alias is known to the broker only if it succeeded.
+ */
+void MqttClientAlias_Done(MqttPublish *publish, int rc);
+#endif
+
 #endif //EX1_MQTTCLIENT_H
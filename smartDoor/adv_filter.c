@@ -0,0 +1,267 @@
+#include "adv_filter.h"
+#include <string.h>
+#include "metrics.h"
+
+#define AD_UUID16_SOME 0x02
+#define AD_UUID16_ALL 0x03
+#define AD_UUID128_SOME 0x06
+#define AD_UUID128_ALL 0x07
+#define AD_SERVICE_DATA16 0x16
+#define AD_SERVICE_DATA128 0x21
+#define AD_MANUFACTURER 0xFF
+#define UUID16_SIZE 2
+#define UUID128_SIZE 16
+#define COMPANY_SIZE 2
+#define UUID16_OFFSET 12  /* of the 16 bit UUID in a little endian 128 bit UUID on the base */
+
+/* the bluetooth base UUID 00000000-0000-1000-8000-00805F9B34FB, little endian */
+static const uint8_t base_uuid[UUID128_SIZE] = {
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+typedef enum rule_kind {
+    rule_uuid16 = 1, //!< 16 bit service UUID
+    rule_uuid128,    //!< 128 bit service UUID
+    rule_mfr         //!< company ID and data prefix
+} rule_kind;
+
+typedef struct adv_rule {
+    uint8_t kind;       // rule_kind
+    uint8_t len;        // bytes of value
+    uint8_t value[16];  // as it appears in the advert: little endian UUID or company ID, then the prefix
+} adv_rule;
+
+static adv_rule rules[ADV_FILTER_MAX_RULES];
+static volatile uint8_t rule_count = 0;  // written after the rule, see adv_filter_command
+static volatile uint8_t type_mask = ADV_FILTER_ALL_TYPES;  // bit per allowed address type
+
+
+/**
+ * checks the elements of a UUID list against a UUID rule.
+ * @param rule: the rule.
+ * @param size: size of an element.
+ * @param val: the list.
+ * @param len: length of the list.
+ * @return: 1 if an element matches else 0
+ */
+static int match_list(const adv_rule *rule, uint8_t size, const uint8_t *val, uint8_t len) {
+    for (uint8_t i = 0; i + size <= len; i += size) {
+        if (memcmp(val + i, rule->value, size) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @param rule: the rule.
+ * @param type: the AD type.
+ * @param val: the AD data.
+ * @param len: length of the AD data.
+ * @return: 1 if the AD structure matches the rule else 0
+ */
+static int match_rule(const adv_rule *rule, uint8_t type, const uint8_t *val, uint8_t len) {
+    switch (rule->kind) {
+        case rule_uuid16:
+            if (type == AD_UUID16_SOME || type == AD_UUID16_ALL) {
+                return match_list(rule, UUID16_SIZE, val, len);
+            }
+            return type == AD_SERVICE_DATA16 && len >= UUID16_SIZE && memcmp(val, rule->value, UUID16_SIZE) == 0;
+        case rule_uuid128:
+            if (type == AD_UUID128_SOME || type == AD_UUID128_ALL) {
+                return match_list(rule, UUID128_SIZE, val, len);
+            }
+            return type == AD_SERVICE_DATA128 && len >= UUID128_SIZE && memcmp(val, rule->value, UUID128_SIZE) == 0;
+        case rule_mfr:
+            return type == AD_MANUFACTURER && len >= rule->len && memcmp(val, rule->value, rule->len) == 0;
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * walks the AD structures of the payload until one matches a rule.
+ * @param data: the advertisement data.
+ * @param len: length of data.
+ * @param count: number of rules.
+ * @return: 1 if an AD structure matches else 0
+ */
+static int match_payload(const uint8_t *data, uint8_t len, uint8_t count) {
+    for (uint16_t i = 0; i + 1 < len; i += data[i] + 1) {
+        uint8_t ad_len = data[i];
+        if (ad_len == 0 || i + 1 + ad_len > len) {
+            break;  /* end of the significant part, or a broken structure */
+        }
+        for (uint8_t r = 0; r < count; r++) {
+            if (match_rule(rules + r, data[i + 1], data + i + 2, ad_len - 1)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * @param address_type: the advertiser address type of the scan report.
+ * @param data: the advertisement data, AD structures.
+ * @param len: length of data.
+ * @return: 1 if the advert passes the filter else 0
+ */
+int adv_filter_match(uint8_t address_type, const uint8_t *data, uint8_t len) {
+    uint8_t mask = type_mask;
+    uint8_t count = __atomic_load_n(&rule_count, __ATOMIC_ACQUIRE);
+    int pass = (mask == ADV_FILTER_ALL_TYPES || (address_type < 8 && (mask & (1 << address_type)))) &&
+               (count == 0 || match_payload(data, len, count));
+    METRIC_INC(pass ? METRIC_FILTER_PASSED : METRIC_FILTER_IGNORED);
+    return pass;
+}
+
+
+/**
+ * @param c: a character.
+ * @return: the value of the hex digit, -1 if it isn't one
+ */
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+/**
+ * reads one word of hex digits, dashes are skipped.
+ * @param str: in: the text, out: after the word.
+ * @param out: output, the bytes in the order they are written.
+ * @param max: size of out.
+ * @return: number of bytes, -1 if the word isn't whole bytes of hex or is too long
+ */
+static int parse_hex(const char **str, uint8_t *out, int max) {
+    const char *s = *str;
+    int n = 0;
+    while (*s == ' ') {
+        s++;
+    }
+    while (*s && *s != ' ') {
+        if (*s == '-') {
+            s++;
+            continue;
+        }
+        int hi = hex_digit(s[0]);
+        int lo = (hi < 0) ? -1 : hex_digit(s[1]);
+        if (lo < 0 || n == max) {
+            return -1;
+        }
+        out[n++] = (uint8_t) ((hi << 4) | lo);
+        s += 2;
+    }
+    *str = s;
+    return n;
+}
+
+
+/**
+ * @param rule: output, the rule for the uuid / mfr arguments.
+ * @param args: the arguments after the keyword.
+ * @param mfr: 1 for a manufacturer rule, 0 for a UUID.
+ * @return: 0 on success, -1 if they don't parse
+ */
+static int parse_rule(adv_rule *rule, const char *args, int mfr) {
+    uint8_t id[UUID128_SIZE];
+    int n = parse_hex(&args, id, sizeof(id));
+    if (mfr ? n != COMPANY_SIZE : (n != UUID16_SIZE && n != UUID128_SIZE)) {
+        return -1;
+    }
+    /* written most significant first, sent little endian */
+    for (int i = 0; i < n; i++) {
+        rule->value[i] = id[n - 1 - i];
+    }
+    rule->len = (uint8_t) n;
+    rule->kind = mfr ? rule_mfr : ((n == UUID16_SIZE) ? rule_uuid16 : rule_uuid128);
+    if (rule->kind == rule_uuid128 && memcmp(rule->value, base_uuid, UUID16_OFFSET) == 0 &&
+        rule->value[UUID16_OFFSET + 2] == 0 && rule->value[UUID16_OFFSET + 3] == 0) {
+        /* a short UUID written out in full, adverts carry it in the short form */
+        rule->value[0] = rule->value[UUID16_OFFSET];
+        rule->value[1] = rule->value[UUID16_OFFSET + 1];
+        rule->len = UUID16_SIZE;
+        rule->kind = rule_uuid16;
+    }
+    if (mfr) {
+        int prefix = parse_hex(&args, rule->value + COMPANY_SIZE, ADV_FILTER_PREFIX_MAX);
+        if (prefix < 0) {
+            return -1;
+        }
+        rule->len += prefix;
+    }
+    while (*args == ' ') {
+        args++;
+    }
+    return (*args == '\0') ? 0 : -1;
+}
+
+
+/**
+ * @param args: address types separated by spaces, 0 to 7.
+ * @return: the mask of the types, 0 if they don't parse
+ */
+static uint8_t parse_types(const char *args) {
+    uint8_t mask = 0;
+    while (*args) {
+        if (*args == ' ') {
+            args++;
+            continue;
+        }
+        if (*args < '0' || *args > '7' || (args[1] != ' ' && args[1] != '\0')) {
+            return 0;
+        }
+        mask |= (uint8_t) (1 << (*args - '0'));
+        args++;
+    }
+    return mask;
+}
+
+
+/**
+ * changes the filter, the arguments of the filter command of the server.
+ * the scan reads the rules without a lock: a new rule is written before the count grows.
+ * @param args: the arguments.
+ * @return: 0 on success, -1 if they don't parse or the rules are full
+ */
+int adv_filter_command(const char *args) {
+    if (strncmp(args, "addr ", 5) == 0) {
+        uint8_t mask = parse_types(args + 5);
+        if (mask == 0) {
+            return -1;
+        }
+        type_mask = mask;
+        return 0;
+    }
+    int mfr = (strncmp(args, "mfr ", 4) == 0);
+    if (!mfr && strncmp(args, "uuid ", 5) != 0) {
+        return -1;
+    }
+    uint8_t count = rule_count;
+    if (count == ADV_FILTER_MAX_RULES || parse_rule(rules + count, args + (mfr ? 4 : 5), mfr) == -1) {
+        return -1;
+    }
+    __atomic_store_n(&rule_count, count + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/**
+ * removes all the rules and allows all the address types.
+ */
+void adv_filter_clear(void) {
+    __atomic_store_n(&rule_count, 0, __ATOMIC_RELEASE);
+    type_mask = ADV_FILTER_ALL_TYPES;
+}
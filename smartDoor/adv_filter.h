@@ -0,0 +1,44 @@
+#ifndef ADV_FILTER_H_
+#define ADV_FILTER_H_
+
+#include <stdint.h>
+
+/*
+ * pre-filter of the scan reports by their advertisement payload, runs before the device lists
+ * (see sighting.h), so TVs, beacons and watches that no enrolled phone looks like are dropped
+ * for the cost of walking their AD structures.
+ * an advert passes if its address type is allowed and, once there are rules, one of its
+ * AD structures matches a rule: a service UUID (16 or 128 bit, in a UUID list or service data)
+ * or a manufacturer ID followed by a data prefix. without rules every payload passes.
+ * the server sets the rules with the filter commands (see adv_filter_command).
+ */
+
+#define ADV_FILTER_MAX_RULES 8
+#define ADV_FILTER_PREFIX_MAX 8  /* manufacturer data bytes after the company ID */
+#define ADV_FILTER_ALL_TYPES 0xFF
+
+/**
+ * @param address_type: the advertiser address type of the scan report.
+ * @param data: the advertisement data, AD structures.
+ * @param len: length of data.
+ * @return: 1 if the advert passes the filter else 0
+ */
+int adv_filter_match(uint8_t address_type, const uint8_t *data, uint8_t len);
+
+/**
+ * changes the filter, the arguments of the filter command of the server:
+ *     uuid <uuid>               adds a service UUID, e.g. 180F or 0000fd6f-0000-1000-8000-00805f9b34fb
+ *     mfr <company> [prefix]    adds a manufacturer ID (hex, e.g. 004C) and the data that must follow it (hex)
+ *     addr <type> [type ...]    allows only these address types (0 public, 1 random, 2 and 3 identity)
+ * the rules may change while the scan runs, a rule is visible once it is complete.
+ * @param args: the arguments.
+ * @return: 0 on success, -1 if they don't parse or the rules are full
+ */
+int adv_filter_command(const char *args);
+
+/**
+ * removes all the rules and allows all the address types.
+ */
+void adv_filter_clear(void);
+
+#endif /* ADV_FILTER_H_ */
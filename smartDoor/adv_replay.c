@@ -0,0 +1,206 @@
+#if defined(__linux__)
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "adv_trace.h"
+#include "adv_filter.h"
+#include "sighting.h"
+#include "timer.h"
+#include "metrics.h"
+
+/*
+ * replays a recorded advertisement trace (see adv_trace.h) through the scan handler of the
+ * door (adv_filter.c, sighting.c) on a host, at the speed of the recording, faster, or as fast
+ * as it goes. the arguments after the speed are filter commands (see adv_filter_command).
+ * the clock follows the trace, so the sightings are the same at any speed. the sender takes
+ * the devices as soon as they are due, like a door with an idle link.
+ * prints one "key=value,..." line:
+ *     adv      scan reports replayed
+ *     ms       length of the trace
+ *     advps    scan reports the handler processes per second of cpu
+ *     sight    devices sent from the door tier (send_device)
+ *     pref     devices taken from the prefetch tier, send_prefetch asks for the ones without a verdict
+ *     acc,dup  door tier reports added to the device list / dropped as duplicates (already waiting,
+ *              or sent in the last BT_DEVICE_LIFETIME), acc - sight are still waiting at the end
+ *     dupr     door tier reports that didn't become a sighting, permille
+ *     fok,fign reports in range that passed / failed the payload filter
+ *     fns      cost of the filter per report in range, nanoseconds (a second pass over the trace)
+ * build:
+ *     gcc -O2 -iquote smartDoor -o adv_replay smartDoor/adv_replay.c smartDoor/sighting.c
+ *         smartDoor/timer.c smartDoor/timer_linux.c smartDoor/rpa.c smartDoor/metrics.c
+ *         smartDoor/adv_filter.c -lpthread
+ *     ./adv_replay lobby.advt 0 "mfr 004C" "addr 1"
+ */
+
+#define REPLAY_START 1000  // the trace starts here on the replay clock, a timestamp of 0 means no device
+#define FILTER_ROUNDS 20   // passes over the trace to time the filter
+
+
+static volatile bool sightings_due = false;
+
+
+/**
+ * @return: microseconds on the monotonic clock (cur_time follows the trace)
+ */
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * sleeps until the monotonic clock reaches until_us.
+ */
+static void sleep_until(uint64_t until_us) {
+    uint64_t now = monotonic_us();
+    if (until_us > now) {
+        struct timespec ts = {(time_t) ((until_us - now) / 1000000), (long) ((until_us - now) % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+
+/**
+ * a new device is waiting in a tier.
+ */
+static void replay_notify(void) {
+    sightings_due = true;
+}
+
+
+/**
+ * @param f: the trace file, positioned at the start.
+ * @return: 0 if it starts with a trace header of this version, -1 otherwise
+ */
+static int read_header(FILE *f) {
+    adv_trace_header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != ADV_TRACE_MAGIC ||
+        header.version != ADV_TRACE_VERSION || header.record_size != sizeof(adv_record)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * times the filter alone on the reports in range, the metrics it counts are restored after.
+ * @param recs: the trace.
+ * @param count: number of records.
+ * @return: nanoseconds per report in range
+ */
+static uint32_t filter_cost(const adv_record *recs, uint32_t count) {
+    uint32_t passed = metric_get(METRIC_FILTER_PASSED), ignored = metric_get(METRIC_FILTER_IGNORED);
+    uint64_t runs = 0, start_us = monotonic_us();
+    volatile int sink = 0;
+    for (int round = 0; round < FILTER_ROUNDS; round++) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (recs[i].rssi > PREFETCH_RSSI_THRESHOLD) {
+                sink += adv_filter_match(recs[i].address_type, recs[i].data, recs[i].data_len);
+                runs++;
+            }
+        }
+    }
+    uint64_t elapsed_us = monotonic_us() - start_us;
+    metric_set(METRIC_FILTER_PASSED, passed);
+    metric_set(METRIC_FILTER_IGNORED, ignored);
+    return runs ? (uint32_t) (elapsed_us * 1000 / runs) : 0;
+}
+
+
+/**
+ * @param path: the trace file.
+ * @param count: output, number of records.
+ * @return: the records (malloc), NULL if the file isn't a trace
+ */
+static adv_record *read_trace(const char *path, uint32_t *count) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    adv_record *recs = NULL;
+    uint32_t size = 0;
+    *count = 0;
+    if (read_header(f) == 0) {
+        adv_record rec;
+        while (fread(&rec, sizeof(rec), 1, f) == 1) {
+            if (*count == size) {
+                size = size ? size * 2 : 1024;
+                adv_record *grown = realloc(recs, size * sizeof(adv_record));
+                if (grown == NULL) {
+                    break;
+                }
+                recs = grown;
+            }
+            recs[(*count)++] = rec;
+        }
+        if (recs == NULL) {
+            recs = malloc(sizeof(adv_record));  /* an empty trace */
+        }
+    }
+    fclose(f);
+    return recs;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [speed, 1 for real time, 0 for as fast as possible] [filter command ...]\n",
+                argv[0]);
+        return 2;
+    }
+    double speed = (argc >= 3) ? atof(argv[2]) : 1;
+    for (int i = 3; i < argc; i++) {
+        if (adv_filter_command(argv[i]) == -1) {
+            fprintf(stderr, "bad filter: %s\n", argv[i]);
+            return 2;
+        }
+    }
+    uint32_t count;
+    adv_record *recs = read_trace(argv[1], &count);
+    if (recs == NULL) {
+        fprintf(stderr, "%s: not an advertisement trace\n", argv[1]);
+        return 1;
+    }
+    sighting_set_notify(replay_notify);
+    timer_advance(REPLAY_START);
+
+    bt_device devices[BT_LST_SIZE];
+    uint32_t sent = 0, prefetched = 0;
+    uint64_t busy_us = 0, start_us = monotonic_us();
+    for (uint32_t i = 0; i < count; i++) {
+        adv_record *rec = recs + i;
+        if (speed > 0) {
+            sleep_until(start_us + (uint64_t) (rec->time * 1000.0 / speed));
+        }
+        uint64_t run_start = monotonic_us();
+        timer_advance(REPLAY_START + rec->time);
+        /* as in the scan report case of sl_bt_on_event */
+        METRIC_INC(METRIC_ADVERTS_SEEN);
+        if (rec->rssi > PREFETCH_RSSI_THRESHOLD && adv_filter_match(rec->address_type, rec->data, rec->data_len)) {
+            sighting_report(rec->addr, rec->address_type, rec->rssi);
+        }
+        if (sightings_due) {
+            sightings_due = false;
+            sent += sighting_take(devices);
+            prefetched += sighting_take_prefetch(devices);
+        }
+        busy_us += monotonic_us() - run_start;
+    }
+
+    uint32_t accepted = metric_get(METRIC_ADVERTS_ACCEPTED);
+    uint32_t deduped = metric_get(METRIC_SIGHTINGS_DEDUPED);
+    uint32_t door_adverts = accepted + deduped;
+    printf("adv=%lu,ms=%lu,advps=%lu,sight=%lu,pref=%lu,acc=%lu,dup=%lu,dupr=%lu,fok=%lu,fign=%lu,fns=%lu\n",
+           (unsigned long) count, (unsigned long) (count ? recs[count - 1].time : 0),
+           (unsigned long) (busy_us ? count * 1000000ULL / busy_us : 0),
+           (unsigned long) sent, (unsigned long) prefetched, (unsigned long) accepted, (unsigned long) deduped,
+           (unsigned long) (door_adverts ? (door_adverts - sent) * 1000ULL / door_adverts : 0),
+           (unsigned long) metric_get(METRIC_FILTER_PASSED), (unsigned long) metric_get(METRIC_FILTER_IGNORED),
+           (unsigned long) filter_cost(recs, count));
+    free(recs);
+    return 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,91 @@
+#include "adv_trace.h"
+#include <string.h>
+#include <stdbool.h>
+#include "timer.h"
+
+#ifdef ADV_TRACE_ENABLE
+#define ADV_TRACE_MASK (ADV_TRACE_RING_SIZE - 1)
+#define ADV_CHUNK_RECORDS 10
+
+static adv_record adv_ring[ADV_TRACE_RING_SIZE];
+static volatile uint32_t adv_head = 0;
+static volatile bool adv_paused = false;
+#endif
+
+
+/**
+ * writes a scan report to the ring, the oldest one is overwritten.
+ * @param addr: the advertiser address.
+ * @param address_type: the advertiser address type.
+ * @param rssi: signal strength of the report.
+ * @param data: the advertisement data.
+ * @param len: length of data.
+ */
+void adv_trace_capture(const uint8_t *addr, uint8_t address_type, int8_t rssi, const uint8_t *data, uint8_t len) {
+#ifdef ADV_TRACE_ENABLE
+    if (adv_paused) {
+        return;
+    }
+    adv_record *rec = adv_ring + (adv_head & ADV_TRACE_MASK);
+    if (len > ADV_DATA_MAX) {
+        len = ADV_DATA_MAX;
+    }
+    rec->time = (uint32_t) cur_time();
+    memcpy(rec->addr, addr, sizeof(rec->addr));
+    rec->address_type = address_type;
+    rec->rssi = rssi;
+    rec->data_len = len;
+    memcpy(rec->data, data, len);
+    adv_head++;
+#else
+    (void) addr;
+    (void) address_type;
+    (void) rssi;
+    (void) data;
+    (void) len;
+#endif
+}
+
+
+/**
+ * sends the ring in chunks of at most max_len bytes, oldest record first.
+ * @param out: sends a chunk.
+ * @param max_len: max chunk size in bytes.
+ * @return: 0 on success else -1
+ */
+int adv_trace_dump(trace_out out, uint32_t max_len) {
+#ifdef ADV_TRACE_ENABLE
+    static uint8_t chunk[sizeof(adv_dump_header) + ADV_CHUNK_RECORDS * sizeof(adv_record)];
+    if (max_len > sizeof(chunk)) {
+        max_len = sizeof(chunk);
+    }
+    uint32_t per_chunk = (max_len - sizeof(adv_dump_header)) / sizeof(adv_record);
+    if (max_len <= sizeof(adv_dump_header) || per_chunk == 0) {
+        return -1;
+    }
+    adv_paused = true;
+    adv_dump_header header = {.head = adv_head};
+    uint32_t first = (header.head > ADV_TRACE_RING_SIZE) ? header.head - ADV_TRACE_RING_SIZE : 0;
+    int rc = 0;
+    while (first < header.head && rc == 0) {
+        uint32_t count = header.head - first;
+        if (count > per_chunk) {
+            count = per_chunk;
+        }
+        header.first = first;
+        memcpy(chunk, &header, sizeof(header));
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(chunk + sizeof(header) + i * sizeof(adv_record),
+                   adv_ring + ((first + i) & ADV_TRACE_MASK), sizeof(adv_record));
+        }
+        rc = out(chunk, sizeof(header) + count * sizeof(adv_record));
+        first += count;
+    }
+    adv_paused = false;
+    return rc;
+#else
+    (void) out;
+    (void) max_len;
+    return -1;
+#endif
+}
@@ -0,0 +1,77 @@
+#ifndef ADV_TRACE_H_
+#define ADV_TRACE_H_
+
+#include <stdint.h>
+#include "trace.h"
+
+/*
+ * recorded bluetooth advertisements, to replay a real scan on a host (see adv_replay.c).
+ * the door keeps the last scan reports in a ring (ADV_TRACE_ENABLE) and sends it on the
+ * adv_dump command, tools/adv_trace.py turns the dump into a trace file or makes up one.
+ *
+ * trace file: an adv_trace_header, then adv_record entries sorted by time, time in
+ * milliseconds since the first record. all fields little endian.
+ */
+
+//#define ADV_TRACE_ENABLE
+#define ADV_TRACE_RING_SIZE 32  /* records, must be a power of 2 */
+#define ADV_DATA_MAX 31         /* legacy advertisement payload, longer data is cut */
+#define ADV_TRACE_MAGIC 0x54564441  /* "ADVT" */
+#define ADV_TRACE_VERSION 1
+
+/**
+ * one scan report, as the stack gave it to sl_bt_on_event.
+ */
+typedef struct adv_record {
+    uint32_t time;          // milliseconds, cur_time in the ring
+    uint8_t addr[6];        // little endian, as in the scan report
+    uint8_t address_type;
+    int8_t rssi;
+    uint8_t data_len;
+    uint8_t data[ADV_DATA_MAX];  // AD structures
+} adv_record;
+
+/**
+ * start of a trace file.
+ */
+typedef struct adv_trace_header {
+    uint32_t magic;        // ADV_TRACE_MAGIC
+    uint16_t version;      // ADV_TRACE_VERSION
+    uint16_t record_size;  // sizeof(adv_record)
+} adv_trace_header;
+
+/**
+ * header of every dump chunk, followed by the records.
+ */
+typedef struct adv_dump_header {
+    uint32_t head;   // index of the next record to be written
+    uint32_t first;  // index of the first record in this chunk
+} adv_dump_header;
+
+#ifdef ADV_TRACE_ENABLE
+#define ADV_CAPTURE(ADDR, TYPE, RSSI, DATA, LEN) adv_trace_capture((ADDR), (TYPE), (RSSI), (DATA), (LEN))
+#else
+#define ADV_CAPTURE(ADDR, TYPE, RSSI, DATA, LEN)
+#endif
+
+/**
+ * writes a scan report to the ring, the oldest one is overwritten.
+ * called from the bluetooth event handler only (one writer).
+ * @param addr: the advertiser address.
+ * @param address_type: the advertiser address type.
+ * @param rssi: signal strength of the report.
+ * @param data: the advertisement data.
+ * @param len: length of data.
+ */
+void adv_trace_capture(const uint8_t *addr, uint8_t address_type, int8_t rssi, const uint8_t *data, uint8_t len);
+
+/**
+ * sends the ring in chunks of at most max_len bytes, oldest record first.
+ * capturing is paused while dumping.
+ * @param out: sends a chunk.
+ * @param max_len: max chunk size in bytes.
+ * @return: 0 on success else -1 (also when the firmware is built without ADV_TRACE_ENABLE)
+ */
+int adv_trace_dump(trace_out out, uint32_t max_len);
+
+#endif /* ADV_TRACE_H_ */
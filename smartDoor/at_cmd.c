@@ -0,0 +1,68 @@
+#include "at_cmd.h"
+#include <string.h>
+
+
+/**
+ * appends n bytes.
+ * @param b: the builder.
+ * @param s: the bytes.
+ * @param n: number of bytes.
+ */
+void at_append(at_builder *b, const char *s, unsigned int n) {
+    if (b->overflow || n > b->size - b->len) {
+        b->overflow = true;
+        return;
+    }
+    memcpy(b->buf + b->len, s, n);
+    b->len += n;
+}
+
+
+/**
+ * appends a C string.
+ * @param b: the builder.
+ * @param s: the string.
+ */
+void at_append_str(at_builder *b, const char *s) {
+    at_append(b, s, strlen(s));
+}
+
+
+/**
+ * appends a number in decimal.
+ * @param b: the builder.
+ * @param value: the number.
+ */
+void at_append_uint(at_builder *b, unsigned int value) {
+    char digits[AT_INT_SIZE];
+    unsigned int i = sizeof(digits);
+    do {
+        digits[--i] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value);
+    at_append(b, digits + i, sizeof(digits) - i);
+}
+
+
+/**
+ * appends a number in decimal.
+ * @param b: the builder.
+ * @param value: the number.
+ */
+void at_append_int(at_builder *b, int value) {
+    if (value < 0) {
+        AT_LIT(b, "-");
+        at_append_uint(b, 0U - (unsigned int) value);
+        return;
+    }
+    at_append_uint(b, (unsigned int) value);
+}
+
+
+/**
+ * @param b: the builder.
+ * @return: length of the command, -1 if it didn't fit the buffer
+ */
+int at_length(const at_builder *b) {
+    return b->overflow ? -1 : (int) b->len;
+}
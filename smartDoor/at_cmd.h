@@ -0,0 +1,67 @@
+#ifndef AT_CMD_H_
+#define AT_CMD_H_
+
+#include <stdbool.h>
+
+/*
+ * AT command builder.
+ * fixed commands are string literals, AT_CMD adds the line end and expands to the
+ * "buffer, length" pair that SerialSend takes, with the length computed by the compiler.
+ * commands with parameters are appended into a caller buffer (no formatting, no allocation).
+ */
+
+#define AT_END "\r\n"
+#define AT_RAW(S) (char *) (S), (sizeof(S) - 1)
+#define AT_CMD(S) AT_RAW(S AT_END)
+#define AT_INT_SIZE 11  /* "-2147483648" */
+
+/**
+ * a command being built into buf.
+ */
+typedef struct at_builder {
+    char *buf;
+    unsigned int size;
+    unsigned int len;
+    bool overflow;       // something didn't fit, the command must not be sent
+} at_builder;
+
+#define AT_BUILDER(BUF, SIZE) {(BUF), (SIZE), 0, false}
+/* appends a string literal, the length is computed by the compiler */
+#define AT_LIT(B, S) at_append((B), (S), sizeof(S) - 1)
+
+/**
+ * appends n bytes.
+ * @param b: the builder.
+ * @param s: the bytes.
+ * @param n: number of bytes.
+ */
+void at_append(at_builder *b, const char *s, unsigned int n);
+
+/**
+ * appends a C string.
+ * @param b: the builder.
+ * @param s: the string.
+ */
+void at_append_str(at_builder *b, const char *s);
+
+/**
+ * appends a number in decimal.
+ * @param b: the builder.
+ * @param value: the number.
+ */
+void at_append_int(at_builder *b, int value);
+
+/**
+ * appends a number in decimal.
+ * @param b: the builder.
+ * @param value: the number.
+ */
+void at_append_uint(at_builder *b, unsigned int value);
+
+/**
+ * @param b: the builder.
+ * @return: length of the command, -1 if it didn't fit the buffer
+ */
+int at_length(const at_builder *b);
+
+#endif /* AT_CMD_H_ */
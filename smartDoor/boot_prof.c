@@ -0,0 +1,118 @@
+#include "boot_prof.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "timer.h"
+#ifdef BOOT_PROF_NVM
+#include "nvm3_default.h"
+#endif
+
+/* short keys, the message goes over a metered cellular link */
+static const char *boot_keys[BOOT_PHASE_COUNT] = {
+    "uart", "mdm", "ops", "reg", "prof", "sock", "conn", "sub", "pub"
+};
+
+static boot_timeline history[BOOT_HISTORY];  // this boot first, then the older ones
+static int history_len = 0;
+static bool done = false;                    // this boot is connected, stop stamping
+
+
+/**
+ * stamps the end of a phase, only the first time in this boot.
+ * @param phase: the phase.
+ */
+void boot_mark(boot_phase phase) {
+    if (done || history[0].ms[phase]) {
+        return;
+    }
+    uint32_t now = (uint32_t) cur_time();
+    history[0].ms[phase] = now ? now : 1;  /* 0 means not reached */
+}
+
+
+/**
+ * counts a connection attempt.
+ */
+void boot_attempt(void) {
+    if (!done) {
+        history[0].attempts++;
+    }
+}
+
+
+#ifdef BOOT_PROF_NVM
+/**
+ * reads the stored timelines after this boot, newest first, and numbers this boot after them.
+ */
+static void history_load(void) {
+    boot_timeline stored[BOOT_HISTORY];
+    uint32_t type;
+    size_t len;
+    int n = 0;
+    for (int i = 0; i < BOOT_HISTORY; i++) {
+        if (nvm3_getObjectInfo(nvm3_defaultHandle, BOOT_PROF_NVM_KEY + i, &type, &len) != ECODE_NVM3_OK ||
+            len != sizeof(stored[0]) ||
+            nvm3_readData(nvm3_defaultHandle, BOOT_PROF_NVM_KEY + i, stored + n, len) != ECODE_NVM3_OK) {
+            continue;
+        }
+        /* insertion sort, newest first */
+        boot_timeline t = stored[n];
+        int j = n++;
+        for (; j > 0 && stored[j - 1].seq < t.seq; j--) {
+            stored[j] = stored[j - 1];
+        }
+        stored[j] = t;
+    }
+    /* this boot replaces the oldest one in NVM3 */
+    history_len = (n < BOOT_HISTORY) ? n : BOOT_HISTORY - 1;
+    memcpy(history + 1, stored, history_len * sizeof(stored[0]));
+    history[0].seq = n ? stored[0].seq + 1 : 0;
+}
+#endif
+
+
+/**
+ * ends the profiling of this boot and stores the timeline, call once connected.
+ */
+void boot_done(void) {
+    if (done) {
+        return;
+    }
+    done = true;
+    size_t build_len = strlen(BUILD_ID);
+    memcpy(history[0].build, BUILD_ID, (build_len < BOOT_BUILD_SIZE - 1) ? build_len : BOOT_BUILD_SIZE - 1);
+#ifdef BOOT_PROF_NVM
+    history_load();
+    nvm3_writeData(nvm3_defaultHandle, BOOT_PROF_NVM_KEY + history[0].seq % BOOT_HISTORY,
+                   history, sizeof(history[0]));
+#endif
+    history_len++;
+}
+
+
+/**
+ * formats a stored timeline as "seq=N,build=...,try=N,uart=ms,mdm=ms,...".
+ * @param idx: 0 for this boot, 1 for the one before it, up to BOOT_HISTORY - 1.
+ * @param buf: output.
+ * @param len: size of buf, BOOT_MSG_SIZE is enough.
+ * @return: the message length, -1 if there is no such timeline or buf is too small
+ */
+int boot_format(int idx, char *buf, int len) {
+    if (!done || idx < 0 || idx >= history_len) {
+        return -1;
+    }
+    const boot_timeline *t = history + idx;
+    int size = snprintf(buf, len, "seq=%lu,build=%.*s,try=%lu", (unsigned long) t->seq,
+                        BOOT_BUILD_SIZE, t->build, (unsigned long) t->attempts);
+    if (size < 0 || size >= len) {
+        return -1;
+    }
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+        int n = snprintf(buf + size, len - size, ",%s=%lu", boot_keys[i], (unsigned long) t->ms[i]);
+        if (n < 0 || n >= len - size) {
+            return -1;
+        }
+        size += n;
+    }
+    return size;
+}
@@ -0,0 +1,75 @@
+#ifndef BOOT_PROF_H_
+#define BOOT_PROF_H_
+
+#include <stdint.h>
+
+/*
+ * boot to connected profiler.
+ * every phase of the first connection after a reset stamps the monotonic clock (cur_time) when it
+ * ends, failed attempts count in the phase that retried. once connected the timeline is stored
+ * with the firmware build and published with the previous ones, see tools/boot_report.py.
+ */
+
+//#define BOOT_PROF_NVM           /* keep the last BOOT_HISTORY timelines in NVM3 across resets */
+#define BOOT_PROF_NVM_KEY 0x5E00  /* NVM3 keys BOOT_PROF_NVM_KEY to BOOT_PROF_NVM_KEY + BOOT_HISTORY - 1 */
+#define BOOT_HISTORY 4
+#define BOOT_BUILD_SIZE 21        /* BUILD_ID, cut to 20 characters */
+#ifndef BUILD_ID
+/* set by the build so every image has its own, e.g. -DBUILD_ID=\"$(git describe --always --dirty=+)\" */
+#define BUILD_ID "dev"
+#endif
+#define BOOT_MSG_SIZE 200
+
+/**
+ * boot phases in the order they end, keep in sync with boot_keys (boot_prof.c)
+ * and tools/boot_report.py
+ */
+typedef enum boot_phase {
+    BOOT_UART = 0,      //!< serial port and timers up
+    BOOT_MODEM,         //!< modem answers ATE0 / AT^SCFG
+    BOOT_OPERATORS,     //!< operator scan (AT+COPS=?)
+    BOOT_REGISTERED,    //!< registered with an operator
+    BOOT_PROFILES,      //!< connection and service profiles set up (AT^SICS / AT^SISS)
+    BOOT_SOCKET,        //!< socket open (AT^SISO / AT^SIST)
+    BOOT_MQTT_CONNECT,  //!< MQTT CONNACK
+    BOOT_SUBSCRIBE,     //!< SUBACK
+    BOOT_PUBLISH,       //!< first publish sent
+    BOOT_PHASE_COUNT
+} boot_phase;
+
+/**
+ * the phases of one boot, as stored in NVM3.
+ */
+typedef struct boot_timeline {
+    uint32_t seq;                    // boot number, counts up over the stored timelines
+    uint32_t attempts;               // connection attempts until connected
+    uint32_t ms[BOOT_PHASE_COUNT];   // cur_time at the end of every phase, 0 if it wasn't reached
+    char build[BOOT_BUILD_SIZE];     // BUILD_ID of the firmware
+} boot_timeline;
+
+/**
+ * stamps the end of a phase, only the first time in this boot.
+ * @param phase: the phase.
+ */
+void boot_mark(boot_phase phase);
+
+/**
+ * counts a connection attempt.
+ */
+void boot_attempt(void);
+
+/**
+ * ends the profiling of this boot and stores the timeline, call once connected.
+ */
+void boot_done(void);
+
+/**
+ * formats a stored timeline as "seq=N,build=...,try=N,uart=ms,mdm=ms,...".
+ * @param idx: 0 for this boot, 1 for the one before it, up to BOOT_HISTORY - 1.
+ * @param buf: output.
+ * @param len: size of buf, BOOT_MSG_SIZE is enough.
+ * @return: the message length, -1 if there is no such timeline or buf is too small
+ */
+int boot_format(int idx, char *buf, int len);
+
+#endif /* BOOT_PROF_H_ */
@@ -1,5 +1,12 @@
 #include "cellular.h"
+#include "metrics.h"
+#include "ram.h"
+#include "at_cmd.h"
+#include "boot_prof.h"
+#include "timer.h"
 #include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,25 +14,54 @@
 #define SEND_FAILUR "Cellular: failed to send command"
 #define RECV_FAILUR "Cellular: failed to receive data"
 #define RECV_WRONG_RESPONSE "Cellular: incorrect response"
-#define STOP_TRANSPARENT "+++", 3
-#define AT "AT\r\n", 4
-#define ECHO_OFF "ATE0\r\n", 6
-#define CSQ "AT+CSQ\r\n", 8
-#define CCID "AT+CCID\r\n", 9
-#define CGSN "AT+CGSN\r\n", 9
-#define CREG "AT+CREG?\r\n", 10
-#define SMONI "AT^SMONI\r\n", 10
-#define COPS "AT+COPS=?\r\n", 11
-#define SISO_COMM "AT^SISO=0\r\n", 11
-#define SIST_COMM "AT^SIST=0\r\n", 11
-#define SISC_COMM "AT^SISC=0\r\n", 11
-#define SISS_CONNID "AT^SISS=0,\"conId\",\"0\"\r\n", 23
-#define SICS_CONTYPE "AT^SICS=0,conType,\"GPRS0\"\r\n", 27
-#define SICS_APN "AT^SICS=0,apn,\"postm2m.lu\"\r\n" , 28
-#define SCFG "AT^SCFG=\"Tcp/WithURCs\",\"on\"\r\n", 29
-#define SISS_SRVTYPE "AT^SISS=0,\"SrvType\",\"Socket\"\r\n", 30
-#define FORAMT_SICS_INACT "AT^SICS=0,inactTO,\"%d\"\r\n"
-#define SISS_SOCKTCP_FORMAT "AT^SISS=0,\"address\",\"socktcp://%s:%d;etx;timer=%d\"\r\n"
+#define SCRATCH_FULL "Cellular: scratch arena is full"
+#define LONG_RESPONSE_SIZE 1024  /* AT+COPS=? and AT^SMONI responses, allocated from the scratch arena */
+#define STOP_TRANSPARENT AT_RAW("+++")
+#define AT AT_CMD("AT")
+#define ECHO_OFF AT_CMD("ATE0")
+#define CSQ AT_CMD("AT+CSQ")
+#define CCID AT_CMD("AT+CCID")
+#define CGSN AT_CMD("AT+CGSN")
+#define CREG AT_CMD("AT+CREG?")
+#define SMONI AT_CMD("AT^SMONI")
+#define COPS AT_CMD("AT+COPS=?")
+#define COPS_AUTO AT_CMD("AT+COPS=0")
+#define COPS_DEREG AT_CMD("AT+COPS=2")
+#define SISO_COMM AT_CMD("AT^SISO=0")
+#define SIST_COMM AT_CMD("AT^SIST=0")
+#define SICS_CONTYPE AT_CMD("AT^SICS=0,conType,\"GPRS0\"")
+#define SICS_APN AT_CMD("AT^SICS=0,apn,\"" CELLULAR_APN "\"")
+#define SCFG AT_CMD("AT^SCFG=\"Tcp/WithURCs\",\"on\"")
+#define FLOW_CONTROL_ON AT_CMD("AT\\Q3")
+#define FLOW_CONTROL_OFF AT_CMD("AT\\Q0")
+/* prefixes of the commands with parameters, see at_cmd.h */
+#define IPR_PREFIX "AT+IPR="
+#define COPS_MANUAL_PREFIX "AT+COPS=1,2,\""
+#define SICS_INACT_PREFIX "AT^SICS=0,inactTO,\""
+/* commands of a service profile: <prefix><profile><suffix> */
+#define SISO_PREFIX "AT^SISO="
+#define SISC_PREFIX "AT^SISC="
+#define SISS_PREFIX "AT^SISS="
+#define SISS_SRVTYPE ",\"SrvType\",\"Socket\""
+#define SISS_CONNID ",\"conId\",\"0\""
+#define SISS_ADDRESS ",\"address\",\"socktcp://"
+#define SISS_TIMER ";etx;timer="
+#define SISX_PREFIX "AT^SISX=\"HostByName\",0,\""
+#define SISX_RESPONSE "\"HostByName\",\""
+#define SISX_RESPONSE_SIZE 100
+#ifdef CELLULAR_SOCKET_URC
+#define SISW_PREFIX "AT^SISW="
+#define SISR_PREFIX "AT^SISR="
+#define SISW_RESPONSE "^SISW: "
+#define SISR_RESPONSE "^SISR: "
+#define URC_SISW "^SISW: %d,%d"
+#define URC_SISR "^SISR: %d,%d"
+#define URC_SIS "^SIS: %d,%d,%d"
+#define SIS_MAX_CHUNK 1500  /* most bytes in one AT^SISW / AT^SISR */
+#define LINE_SIZE 40
+#define URC_LINE_TIME 50  /* wait for the rest of a URC that is half in */
+#endif
+#define RESPONSE_LINE_SIZE 40  /* enough of a line to tell the final result code */
 #define ROUNDS 7
 #define SHORT_TIME 3000
 #define MEDIUM_TIME 60000
@@ -34,6 +70,118 @@
 
 
 char transparentMode = 0;
+static unsigned int cur_baud = CELLULAR_BAUD;
+#ifdef CELLULAR_SOCKET_URC
+/**
+ * a service profile used as a socket.
+ */
+typedef struct sis_socket {
+    bool open;
+    volatile bool writable;    // ^SISW URC: the modem takes data
+    volatile bool data_ready;  // ^SISR URC came, read before waiting
+    uint16_t rx_pos;           // next byte of rx to return
+    uint16_t rx_len;           // bytes in rx
+    uint8_t rx[CELLULAR_SOCKET_RX_SIZE];  // data read from the modem and not returned yet
+} sis_socket;
+
+static sis_socket sockets[CELLULAR_MAX_SOCKETS];
+
+static void handle_urc(const char *line);
+#endif
+
+
+/**
+ * drops the pending input before a command.
+ * with CELLULAR_SOCKET_URC the complete lines are handed to handle_urc first, the input may
+ * hold a ^SISR URC and a socket is flagged only when its URC really came.
+ */
+static void flush_input(void) {
+#ifdef CELLULAR_SOCKET_URC
+    char line[LINE_SIZE];
+    unsigned int len = 0;
+    unsigned char c;
+    uint64_t deadline = cur_time() + URC_LINE_TIME;
+    /* a line that is half in waits URC_LINE_TIME for its end */
+    while ((SerialAvailable() > 0 || len > 0) && cur_time() < deadline &&
+           SerialRecv(&c, 1, (unsigned int) (deadline - cur_time())) == 1) {
+        if (c == '\n') {
+            line[len] = '\0';
+            if (len > 0) {
+                handle_urc(line);
+            }
+            len = 0;
+        } else if (c != '\r' && len < sizeof(line) - 1) {
+            line[len++] = (char) c;
+        }
+    }
+#endif
+    SerialFlushInputBuff();
+}
+
+
+/**
+ * @param line: a line of the modem without "\r\n".
+ * @return: true if it is a final result code, the last line of a response
+ */
+static bool is_final_result(const char *line) {
+    return strcmp(line, "OK") == 0 || strcmp(line, "ERROR") == 0 || strcmp(line, "NO CARRIER") == 0 ||
+           strncmp(line, "CONNECT", 7) == 0 || strncmp(line, "+CME ERROR", 10) == 0;
+}
+
+
+/**
+ * reads the response of a command until its final result code (OK, ERROR, CONNECT...),
+ * so a command takes as long as the modem needs and not the whole timeout.
+ * with CELLULAR_SOCKET_URC the URCs that come meanwhile are handled and left out of buf.
+ * @param buf: output, the response, null terminated. holds max_len + 1 chars.
+ * @param max_len: most chars to keep, the rest of a longer response is read and dropped.
+ * @param timeout_ms: how long to wait for the final result code.
+ * @return: chars in buf (what came before the timeout if the final result code didn't), -1 on failure
+ */
+static int read_response(char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    uint64_t deadline = cur_time() + timeout_ms;
+    char line[RESPONSE_LINE_SIZE];
+    unsigned int len = 0, line_len = 0;
+#ifdef CELLULAR_SOCKET_URC
+    unsigned int line_start = 0;
+#endif
+    unsigned char c;
+    while (cur_time() < deadline) {
+        int rc = SerialRecv(&c, 1, (unsigned int) (deadline - cur_time()));
+        if (rc == -1) {
+            return -1;
+        }
+        if (rc == 0) {
+            break;
+        }
+        if (len < max_len) {
+            buf[len++] = (char) c;
+        }
+        if (c != '\n') {
+            if (c != '\r' && line_len < sizeof(line) - 1) {
+                line[line_len++] = (char) c;
+            }
+            continue;
+        }
+        line[line_len] = '\0';
+        line_len = 0;
+        if (is_final_result(line)) {
+            break;
+        }
+#ifdef CELLULAR_SOCKET_URC
+        if (line[0] == '^' && strncmp(line, "^SISX", 5) != 0) {
+            handle_urc(line);
+            if (len < max_len) {
+                len = line_start;
+            }
+        }
+        line_start = len;
+#endif
+    }
+    buf[len] = '\0';
+    return (int) len;
+}
+
 
 typedef enum {
     all = 0,
@@ -64,12 +212,12 @@ int initialization_options(Options op) {
             }
         case echo_and_scfg:
             bzero(buf, 55);
-            SerialFlushInputBuff();
+            flush_input();
             if (SerialSend(ECHO_OFF) == -1) {
                 PRINT_DEBUG(SEND_FAILUR ": ATE0")
                 return -1;
             }
-            if (SerialRecv(buf, 50, SHORT_TIME) == -1) {
+            if (read_response(buf, 50, SHORT_TIME) == -1) {
                 PRINT_DEBUG(RECV_FAILUR)
                 return -1;
             }
@@ -79,12 +227,12 @@ int initialization_options(Options op) {
             }
         case scfg:
             bzero(buf,55);
-            SerialFlushInputBuff();
+            flush_input();
             if(SerialSend(SCFG) == -1) {
                 PRINT_DEBUG(SEND_FAILUR ": AT^SCFG")
                 return -1;
             }
-            if (SerialRecv(buf, 50, SHORT_TIME) == -1)  {
+            if (read_response(buf, 50, SHORT_TIME) == -1)  {
                 PRINT_DEBUG(RECV_FAILUR)
                 return -1;
             }
@@ -105,12 +253,12 @@ int initialization_options(Options op) {
             }
             break;
         case turn_echo_off:
-            SerialFlushInputBuff();
+            flush_input();
             if (SerialSend(ECHO_OFF) == -1) {
                 PRINT_DEBUG(SEND_FAILUR ": ATE0")
                 return -1;
             }
-            if (SerialRecv(buf, 50, SHORT_TIME) == -1) {
+            if (read_response(buf, 50, SHORT_TIME) == -1) {
                 PRINT_DEBUG(RECV_FAILUR)
                 return -1;
             }
@@ -132,11 +280,114 @@ int initialization_options(Options op) {
  */
 int CellularInit(char *port) {
     PRINT_DEBUG("Cellular: initial connection")
-    if(SerialInit(port, 115200) == -1) {
+    cur_baud = CELLULAR_BAUD;
+    if(SerialInit(port, CELLULAR_BAUD) == -1) {
         PRINT_DEBUG("Cellular: init fails")
         return -1;
     }
-    return initialization_options(echo_and_scfg);
+    boot_mark(BOOT_UART);
+    if (initialization_options(echo_and_scfg) == -1) {
+#if defined(CELLULAR_FLOW_CONTROL) && defined(CELLULAR_FAST_BAUD)
+        /* the modem keeps AT+IPR across resets, it may still be on the fast rate */
+        PRINT_DEBUG("Cellular: trying the fast baud rate")
+        if (SerialSetFlowControl(1) == 0 && SerialSetBaud(CELLULAR_FAST_BAUD) == 0 &&
+            initialization_options(echo_and_scfg) == 0) {
+            cur_baud = CELLULAR_FAST_BAUD;
+            return CellularSetFlowControl(1);
+        }
+        SerialSetFlowControl(0);
+        SerialSetBaud(CELLULAR_BAUD);
+#endif
+        return -1;
+    }
+#if defined(CELLULAR_FLOW_CONTROL)
+    if (CellularSetFlowControl(1) == 0) {
+#if defined(CELLULAR_FAST_BAUD)
+        /* not fatal, we keep working on CELLULAR_BAUD as long as the modem still answers there */
+        if (CellularSetBaud(CELLULAR_FAST_BAUD) == -1 && CellularCheckModem() == -1) {
+            PRINT_DEBUG("Cellular: lost the modem switching the baud rate")
+            return -1;
+        }
+#endif
+    }
+#endif
+    return 0;
+}
+
+
+/**
+ * sends a command that the modem answers with OK.
+ * @param cmd: the command.
+ * @param len: length of cmd.
+ * @return 0 on success else -1
+ */
+static int send_ok_command(const char *cmd, unsigned int len) {
+    char buf[21] = {0};
+    flush_input();
+    if (SerialSend((char *) cmd, len) == -1) {
+        PRINT_DEBUG(SEND_FAILUR)
+        return -1;
+    }
+    if (read_response(buf, 20, SHORT_TIME) == -1) {
+        PRINT_DEBUG(RECV_FAILUR)
+        return -1;
+    }
+    if (!strstr(buf, "OK")) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE)
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * Turns RTS/CTS flow control on or off in the modem (AT\Q) and in the serial port.
+ * Returns 0 on success, and -1 on failure
+ */
+int CellularSetFlowControl(int enable) {
+    PRINTF_DEBUG("Cellular: flow control %s\n", enable ? "on" : "off");
+    if (enable ? send_ok_command(FLOW_CONTROL_ON) : send_ok_command(FLOW_CONTROL_OFF)) {
+        return -1;
+    }
+    return SerialSetFlowControl(enable);
+}
+
+
+/**
+ * Switches the modem and the serial port to another baud rate (AT+IPR).
+ * If the modem doesn't answer on the new rate both sides go back to the old one.
+ * Returns 0 on success, and -1 on failure (the link keeps the old rate)
+ */
+int CellularSetBaud(unsigned int baud) {
+    char cmd[sizeof(IPR_PREFIX AT_END) + AT_INT_SIZE];
+    at_builder b = AT_BUILDER(cmd, sizeof(cmd));
+    PRINTF_DEBUG("Cellular: switching to %u baud\n", baud);
+    AT_LIT(&b, IPR_PREFIX);
+    at_append_uint(&b, baud);
+    AT_LIT(&b, AT_END);
+    int len = at_length(&b);
+    /* the OK comes on the old rate */
+    if (len == -1 || send_ok_command(cmd, len) == -1) {
+        return -1;
+    }
+    int switched = SerialSetBaud(baud);
+    if (switched == 0 && CellularWaitUntilModemResponds() == 0) {
+        cur_baud = baud;
+        return 0;
+    }
+    PRINT_DEBUG("Cellular: no response on the new baud rate")
+    /* the modem switched after its OK, ask it on the new rate to go back before we do,
+     * its OK comes on the new rate too */
+    b.len = 0;
+    AT_LIT(&b, IPR_PREFIX);
+    at_append_uint(&b, cur_baud);
+    AT_LIT(&b, AT_END);
+    if (switched == 0 && at_length(&b) != -1) {
+        send_ok_command(cmd, b.len);
+    }
+    SerialSetBaud(cur_baud);
+    CellularCheckModem();
+    return -1;
 }
 
 
@@ -156,12 +407,12 @@ void CellularDisable(void) {
 int CellularCheckModem(void) {
     PRINT_DEBUG("Cellular: checking modem response")
     char buf[11] = {0};
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(AT) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT")
         return -1;
     }
-    int rc = SerialRecv(buf, 10, SHORT_TIME);
+    int rc = read_response(buf, 10, SHORT_TIME);
     if(rc == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
@@ -188,6 +439,7 @@ int CellularWaitUntilModemResponds(void) {
             PRINTF_DEBUG("Cellular: response after %d rounds\n", i + 1);
             return 0;
         }
+        METRIC_INC(METRIC_AT_RETRIES);
     }
     PRINT_DEBUG("Cellular: cellular is not response")
     return -1;
@@ -206,13 +458,13 @@ int CellularGetRegistrationStatus(int *status) {
         PRINT_DEBUG("Cellular: function input is null")
         return -1;
     }
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(CREG) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT+CREG?")
         return -1;
     }
     char buf[30] = {0};
-    int rc = SerialRecv(buf, 25, SHORT_TIME);
+    int rc = read_response(buf, 25, SHORT_TIME);
     if (rc < 11) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
@@ -244,6 +496,7 @@ int CellularWaitUntilRegistered(void) {
                 return 0;
             }
         }
+        METRIC_INC(METRIC_AT_RETRIES);
     }
     PRINT_DEBUG("Cellular: wrong registration")
     return -1;
@@ -314,26 +567,36 @@ int CellularGetOperators(OPERATOR_INFO *opList, int maxops, int *numOpsFound) {
         PRINT_DEBUG("Cellular: invalid input")
         return -1;
     }
-    char buf[1024] = {0}, *ptr;
-    SerialFlushInputBuff();
+    SCRATCH_SCOPE();
+    char *buf = scratch_alloc(LONG_RESPONSE_SIZE), *ptr;
+    if (!buf) {
+        PRINT_DEBUG(SCRATCH_FULL)
+        return -1;
+    }
+    flush_input();
     if(SerialSend(COPS) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT+COPS=?")
         return -1;
     }
 
-    if(SerialRecv(buf, 1023, LONG_TIME) == -1) {
+    if(read_response(buf, LONG_RESPONSE_SIZE - 1, LONG_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
     int count = 0;
-    while(buf[count++] != ' ' && count < 1023) {}
+    while(buf[count++] != ' ' && count < LONG_RESPONSE_SIZE - 1) {}
 
     ptr = buf + count;
     *numOpsFound = maxops;
     for (int i = 0; i < maxops; ++i) {
+        if (*ptr != '(') {
+            /* ",," ends the operators, the supported modes and formats follow */
+            *numOpsFound = i;
+            break;
+        }
         count = 0;
-        while (ptr[count++] != ')' && ((ptr + count) - buf) < 1024){}
-        if (((ptr + count) - buf) >= 1024) {
+        while (ptr[count++] != ')' && ((ptr + count) - buf) < LONG_RESPONSE_SIZE){}
+        if (((ptr + count) - buf) >= LONG_RESPONSE_SIZE) {
             *numOpsFound = i;
             break;
         }
@@ -361,29 +624,34 @@ int CellularGetOperators(OPERATOR_INFO *opList, int maxops, int *numOpsFound) {
 int CellularSetOperator(int mode, int operatorCode) {
     PRINT_DEBUG("Cellular: setting operator")
     char buf[50] = {0};
-    char* tmp;
+    at_builder b = AT_BUILDER(buf, sizeof(buf));
     switch (mode) {
         case SET_OPT_MODE_AUTO:
-            tmp = "AT+COPS=0\r\n";
+            at_append(&b, COPS_AUTO);
             break;
         case SET_OPT_MODE_MANUAL:
-            snprintf(buf,50,"AT+COPS=1,2,\"%d\"\r\n",operatorCode);
-            tmp = buf;
+            AT_LIT(&b, COPS_MANUAL_PREFIX);
+            at_append_int(&b, operatorCode);
+            AT_LIT(&b, "\"" AT_END);
             break;
         case SET_OPT_MODE_DEREG:
-            tmp = "AT+COPS=2\r\n";
+            at_append(&b, COPS_DEREG);
             break;
         default:
             PRINT_DEBUG("Cellular: incorrect mode")
             return -1;
     }
-    SerialFlushInputBuff();
-    if(SerialSend(tmp, strlen(tmp)) == -1) {
+    if (at_length(&b) == -1) {
+        PRINT_DEBUG("Cellular: AT+COPS is too long")
+        return -1;
+    }
+    flush_input();
+    if(SerialSend(buf, b.len) == -1) {
         PRINT_DEBUG("Cellular: error in sending command to modem")
         return -1;
     }
     bzero(buf, 50);
-    if(SerialRecv(buf, 10, LONG_TIME) == -1) {
+    if(read_response(buf, 10, LONG_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -408,13 +676,13 @@ int CellularGetSignalQuality(int *csq) {
         PRINT_DEBUG("Cellular: invalid input")
         return -1;
     }
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(CSQ) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT+CSQ")
         return -1;
     }
     char buf[50] = {0};
-    if (SerialRecv(buf, 49, SHORT_TIME) == -1) {
+    if (read_response(buf, 49, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -449,13 +717,13 @@ int CellularGetICCID(char* iccid, int maxlen) {
         PRINT_DEBUG("Cellular: function input is not valid")
         return -1;
     }
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(CCID) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT+CCID")
         return -1;
     }
     char buf[50] = {0};
-    int rc = SerialRecv(buf, 49, SHORT_TIME);
+    int rc = read_response(buf, 49, SHORT_TIME);
     if (rc == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
@@ -491,14 +759,14 @@ int CellularGetIMEI(char* imei, int maxlen) {
         PRINT_DEBUG("Cellular: function input is not valid")
         return -1;
     }
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(CGSN) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT+CGSN")
         return -1;
     }
     char buf[50] = {0};
     int rc = 0;
-    if ((rc = SerialRecv(buf, 49, SHORT_TIME)) == -1) {
+    if ((rc = read_response(buf, 49, SHORT_TIME)) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -582,13 +850,18 @@ int CellularGetSignalInfo(SIGNAL_INFO *sigInfo) {
         PRINT_DEBUG("Cellular: invalid input")
         return -1;
     }
-    SerialFlushInputBuff();
+    SCRATCH_SCOPE();
+    char *buf = scratch_alloc(LONG_RESPONSE_SIZE);
+    if (!buf) {
+        PRINT_DEBUG(SCRATCH_FULL)
+        return -1;
+    }
+    flush_input();
     if(SerialSend(SMONI) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SMONI")
         return -1;
     }
-    char buf[1024] = {0};
-    int rc = SerialRecv(buf, 1023, LONG_TIME);
+    int rc = read_response(buf, LONG_RESPONSE_SIZE - 1, LONG_TIME);
     if (rc == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
@@ -618,14 +891,14 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec) {
         return -1;
     }
     PRINT_DEBUG("Cellular: sending AT^SICS 1")
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(SICS_CONTYPE) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SICS 1")
         return -1;
     }
 
     char buf[10] = {0};
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1){
+    if(read_response(buf, 9, SHORT_TIME) == -1){
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -633,17 +906,24 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec) {
         PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SICS 1")
         return -1;
     }
-    char buf_send[1024] = {0};
-    int f_size = snprintf(buf_send, 1023, FORAMT_SICS_INACT, inact_time_sec);
+    char buf_send[sizeof(SICS_INACT_PREFIX "\"" AT_END) + AT_INT_SIZE];
+    at_builder b = AT_BUILDER(buf_send, sizeof(buf_send));
+    AT_LIT(&b, SICS_INACT_PREFIX);
+    at_append_int(&b, inact_time_sec);
+    AT_LIT(&b, "\"" AT_END);
+    if (at_length(&b) == -1) {
+        PRINT_DEBUG("Cellular: AT^SICS 2 is too long")
+        return -1;
+    }
     PRINT_DEBUG("Cellular: sending AT^SICS 2")
-    SerialFlushInputBuff();
-    if(SerialSend(buf_send,f_size) == -1) {
+    flush_input();
+    if(SerialSend(buf_send, b.len) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SICS 2")
         return -1;
     }
 
     bzero(buf,10);
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
+    if(read_response(buf, 9, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -652,14 +932,14 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec) {
         return -1;
     }
     PRINT_DEBUG("Cellular: sending AT^SICS 3")
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(SICS_APN) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SICS 3")
         return -1;
     }
 
     bzero(buf,10);
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
+    if(read_response(buf, 9, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
     }
     if (!strstr(buf,"OK")) {
@@ -671,6 +951,25 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec) {
 }
 
 
+/**
+ * builds "<prefix><profile><suffix>\r\n", the commands of a service profile.
+ * @param b: the builder.
+ * @param prefix: e.g. "AT^SISO=".
+ * @param profile: the service profile.
+ * @param suffix: the rest of the command.
+ * @return: length of the command, -1 if it didn't fit the buffer
+ */
+static int profile_command(at_builder *b, const char *prefix, int profile, const char *suffix) {
+    b->len = 0;
+    b->overflow = false;
+    at_append_str(b, prefix);
+    at_append_int(b, profile);
+    at_append_str(b, suffix);
+    AT_LIT(b, AT_END);
+    return at_length(b);
+}
+
+
 /**
 * Initialize an internal service profile (AT^SISS)
 * with keepintvl=keepintvl_sec (the timer)
@@ -679,83 +978,411 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec) {
 * (if CellularSetupInternetConnectionProfile is already initialized.
 * Return error, -1, otherwise)
 * and Address=socktcp://IP:port;etx;time=keepintvl_sec.
+* profile is the service profile, 0 to CELLULAR_MAX_SOCKETS - 1.
 * Return 0 on success, and -1 on failure.
 */
-int CellularSetupInternetServiceProfile(char *IP, int port, int keepintvl_sec) {
-    PRINT_DEBUG("Cellular: set internet service profile")
-    if (!IP || keepintvl_sec < 0) {
+int CellularSetupServiceProfile(int profile, char *IP, int port, int keepintvl_sec) {
+    PRINTF_DEBUG("Cellular: set internet service profile %d\n", profile)
+    if (!IP || keepintvl_sec < 0 || profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
         PRINT_DEBUG("Cellular: invalid input")
         return -1;
     }
+    char cmd[sizeof(SISS_PREFIX SISS_SRVTYPE AT_END) + AT_INT_SIZE];
+    at_builder b = AT_BUILDER(cmd, sizeof(cmd));
     PRINT_DEBUG("Cellular: sending AT^SISS 1")
-    SerialFlushInputBuff();
-    if(SerialSend(SISS_SRVTYPE) == -1) {
-        PRINT_DEBUG(SEND_FAILUR ": AT^SISS 1")
+    int len = profile_command(&b, SISS_PREFIX, profile, SISS_SRVTYPE);
+    if (len == -1 || send_ok_command(cmd, len) == -1) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISS 1")
+        return -1;
+    }
+    PRINT_DEBUG("Cellular: sending AT^SISS 2")
+    len = profile_command(&b, SISS_PREFIX, profile, SISS_CONNID);
+    if (len == -1 || send_ok_command(cmd, len) == -1) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " AT^SISS 2")
         return -1;
     }
 
-    char buf[10] = {0};
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
-        PRINT_DEBUG(RECV_FAILUR)
+    SCRATCH_SCOPE();
+    uint32_t send_size = sizeof(SISS_PREFIX SISS_ADDRESS ":" SISS_TIMER "\"" AT_END) + strlen(IP) + 3 * AT_INT_SIZE;
+    char *buf_send = scratch_alloc(send_size);
+    if (!buf_send) {
+        PRINT_DEBUG(SCRATCH_FULL)
         return -1;
     }
-    if (!strstr(buf,"OK")) {
-        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISS 1")
+    at_builder addr = AT_BUILDER(buf_send, send_size);
+    AT_LIT(&addr, SISS_PREFIX);
+    at_append_int(&addr, profile);
+    AT_LIT(&addr, SISS_ADDRESS);
+    at_append_str(&addr, IP);
+    AT_LIT(&addr, ":");
+    at_append_int(&addr, port);
+    AT_LIT(&addr, SISS_TIMER);
+    at_append_int(&addr, keepintvl_sec);
+    AT_LIT(&addr, "\"" AT_END);
+    if (at_length(&addr) == -1) {
+        PRINT_DEBUG("Cellular: AT^SISS 3 is too long")
         return -1;
     }
-    PRINT_DEBUG("Cellular: sending AT^SISS 2")
-    SerialFlushInputBuff();
-    if(SerialSend(SISS_CONNID) == -1) {
-        PRINT_DEBUG(SEND_FAILUR ": AT^SISS 2")
+    PRINT_DEBUG("Cellular: sending AT^SISS 3")
+    if (send_ok_command(buf_send, addr.len) == -1) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISS 3")
         return -1;
     }
+    return 0;
+}
 
-    bzero(buf,10);
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
+
+/**
+* Initialize the internal service profile 0, see CellularSetupServiceProfile.
+* Return 0 on success, and -1 on failure.
+*/
+int CellularSetupInternetServiceProfile(char *IP, int port, int keepintvl_sec) {
+    return CellularSetupServiceProfile(0, IP, port, keepintvl_sec);
+}
+
+
+/**
+ * Resolves host to an IP address with the DNS of the network (AT^SISX="HostByName")
+ * over the internet connection profile 0.
+ * ip is a buffer of maxlen chars allocated by the caller, the address is placed
+ * into it as a null-terminated string.
+ * Returns 0 on success, -1 on failure
+ */
+int CellularResolveHost(const char *host, char *ip, int maxlen) {
+    PRINTF_DEBUG("Cellular: resolve %s\n", host)
+    if (host == NULL || ip == NULL || maxlen <= 0) {
+        PRINT_DEBUG("Cellular: invalid input")
+        return -1;
+    }
+    char buf[SISX_RESPONSE_SIZE] = {0};
+    at_builder b = AT_BUILDER(buf, sizeof(buf));
+    AT_LIT(&b, SISX_PREFIX);
+    at_append_str(&b, host);
+    AT_LIT(&b, "\"" AT_END);
+    if (at_length(&b) == -1) {
+        PRINT_DEBUG("Cellular: host name is too long")
+        return -1;
+    }
+    flush_input();
+    if (SerialSend(buf, b.len) == -1) {
+        PRINT_DEBUG(SEND_FAILUR ": AT^SISX")
+        return -1;
+    }
+    /* the modem asks the network, the answer takes a round trip or more, the read ends at the OK */
+    if (read_response(buf, sizeof(buf) - 1, MEDIUM_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
-
-    if (!strstr(buf,"OK")) {
-        PRINT_DEBUG(RECV_WRONG_RESPONSE " AT^SISS 2")
+    char *start = strstr(buf, SISX_RESPONSE);
+    if (!start) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISX")
         return -1;
     }
-
-    char buf_send[1024] = {0};
-    int f_size = snprintf(buf_send,1023, SISS_SOCKTCP_FORMAT, IP, port, keepintvl_sec);
-    PRINT_DEBUG("Cellular: sending AT^SISS 3")
-    SerialFlushInputBuff();
-    if(SerialSend(buf_send,f_size) == -1) {
-        PRINT_DEBUG(SEND_FAILUR ": AT^SISS 3")
+    start += strlen(SISX_RESPONSE);
+    char *end = strchr(start, '"');
+    if (!end || end == start || end - start >= maxlen) {
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISX")
         return -1;
     }
+    memcpy(ip, start, end - start);
+    ip[end - start] = '\0';
+    PRINTF_DEBUG("Cellular: %s is %s\n", host, ip)
+    return 0;
+}
 
-    bzero(buf, 10);
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
+
+#ifdef CELLULAR_SOCKET_URC
+/**
+ * reads one line of the modem, empty lines are skipped.
+ * @param line: output, the line without "\r\n", truncated to size - 1 chars.
+ * @param size: size of line.
+ * @param deadline: cur_time to give up at.
+ * @return: length of the line, -1 on timeout
+ */
+static int read_line(char *line, unsigned int size, uint64_t deadline) {
+    unsigned int len = 0;
+    unsigned char c;
+    while (cur_time() < deadline) {
+        if (SerialRecv(&c, 1, (unsigned int) (deadline - cur_time())) != 1) {
+            break;
+        }
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            if (len == 0) {
+                continue;
+            }
+            line[len] = '\0';
+            return (int) len;
+        }
+        if (len < size - 1) {
+            line[len++] = (char) c;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * updates the state of the sockets from a URC, the URCs of all the profiles
+ * come on the same uart so every wait goes through here.
+ * @param line: a line that isn't the response we wait for.
+ */
+static void handle_urc(const char *line) {
+    int profile = 0, cause = 0, info = 0;
+    if (sscanf(line, URC_SISR, &profile, &cause) == 2) {
+        /* 1: data to read. 2: closed by the peer, the buffered data can still be read,
+         * then AT^SISR answers -1 */
+        if (profile >= 0 && profile < CELLULAR_MAX_SOCKETS && (cause == 1 || cause == 2)) {
+            sockets[profile].data_ready = true;
+        }
+    } else if (sscanf(line, URC_SISW, &profile, &cause) == 2) {
+        if (profile >= 0 && profile < CELLULAR_MAX_SOCKETS && cause == 1) {
+            sockets[profile].writable = true;
+        }
+    } else if (sscanf(line, URC_SIS, &profile, &cause, &info) == 3 && cause == 0 && info > 0 && info <= 2000) {
+        /* ^SIS info ids up to 2000 are errors, the service is down */
+        PRINTF_DEBUG("Cellular: socket %d error %d\n", profile, info)
+        if (profile >= 0 && profile < CELLULAR_MAX_SOCKETS) {
+            sockets[profile].open = false;
+        }
+    }
+}
+
+
+/**
+ * reads lines until one starts with prefix, URCs that come meanwhile are handled.
+ * @param prefix: the expected line.
+ * @param line: output, the line.
+ * @param size: size of line.
+ * @param timeout_ms: how long to wait.
+ * @return: 0 if the line came, -1 on timeout or ERROR
+ */
+static int wait_line(const char *prefix, char *line, unsigned int size, unsigned int timeout_ms) {
+    uint64_t deadline = cur_time() + timeout_ms;
+    while (read_line(line, size, deadline) != -1) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return 0;
+        }
+        if (strstr(line, "ERROR")) {
+            PRINTF_DEBUG(RECV_WRONG_RESPONSE " got: %s\n", line)
+            return -1;
+        }
+        handle_urc(line);
+    }
+    return -1;
+}
+
+
+/**
+ * handles URCs until a flag of a socket is set.
+ * @param flag: sockets[profile].data_ready or sockets[profile].writable.
+ * @param sock: the socket, the wait ends if it is closed.
+ * @param timeout_ms: how long to wait.
+ * @return: 0 if the flag is set, -1 on timeout or if the socket closed
+ */
+static int wait_flag(volatile bool *flag, sis_socket *sock, unsigned int timeout_ms) {
+    uint64_t deadline = cur_time() + timeout_ms;
+    char line[LINE_SIZE];
+    while (!*flag && sock->open) {
+        if (read_line(line, sizeof(line), deadline) == -1) {
+            return -1;
+        }
+        handle_urc(line);
+    }
+    return *flag ? 0 : -1;
+}
+
+
+/**
+ * sends AT^SISW=<profile>,<len> or AT^SISR=<profile>,<len> and waits for its response.
+ * @param prefix: "AT^SISW=" or "AT^SISR=".
+ * @param response: "^SISW: " or "^SISR: ".
+ * @param profile: the service profile.
+ * @param len: bytes to write / read.
+ * @param cnf_len: output, bytes the modem accepts / delivers.
+ * @return: 0 on success else -1
+ */
+static int socket_command(const char *prefix, const char *response, int profile, unsigned int len, int *cnf_len) {
+    char cmd[sizeof(SISW_PREFIX "," AT_END) + 2 * AT_INT_SIZE];
+    char expect[sizeof(SISW_RESPONSE ",") + AT_INT_SIZE];
+    char line[LINE_SIZE];
+    at_builder b = AT_BUILDER(cmd, sizeof(cmd));
+    at_builder e = AT_BUILDER(expect, sizeof(expect) - 1);
+    at_append_str(&b, prefix);
+    at_append_int(&b, profile);
+    AT_LIT(&b, ",");
+    at_append_uint(&b, len);
+    AT_LIT(&b, AT_END);
+    at_append_str(&e, response);
+    at_append_int(&e, profile);
+    AT_LIT(&e, ",");
+    if (at_length(&b) == -1 || at_length(&e) == -1) {
+        PRINT_DEBUG("Cellular: socket command is too long")
+        return -1;
+    }
+    expect[e.len] = '\0';
+    /* a ^SISR URC left in the input would pass for the response of AT^SISR */
+    flush_input();
+    if (SerialSend(cmd, b.len) == -1) {
+        PRINT_DEBUG(SEND_FAILUR)
+        return -1;
+    }
+    if (wait_line(expect, line, sizeof(line), SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
-    if (!strstr(buf,"OK")) {
-        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISS 3")
+    *cnf_len = atoi(line + e.len);
+    return 0;
+}
+
+
+/**
+* Connects the socket of a service profile (establishes TCP connection to the
+* host and port of the profile).
+* the socket stays in command mode, ^SISW: <profile>,1 tells that the connection is up.
+* Returns 0 on success, -1 on failure.
+*/
+int CellularConnectProfile(int profile) {
+    char cmd[sizeof(SISO_PREFIX AT_END) + AT_INT_SIZE];
+    char line[LINE_SIZE];
+    at_builder b = AT_BUILDER(cmd, sizeof(cmd));
+    if (profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
+        PRINT_DEBUG("Cellular: invalid input")
+        return -1;
+    }
+    sis_socket *sock = sockets + profile;
+    int len = profile_command(&b, SISO_PREFIX, profile, "");
+    if (len == -1 || SerialSend(cmd, len) == -1) {
+        PRINT_DEBUG(SEND_FAILUR ": AT^SISO")
+        return -1;
+    }
+    sock->open = true;
+    sock->writable = false;
+    sock->data_ready = false;
+    sock->rx_len = sock->rx_pos = 0;
+    if (wait_line("OK", line, sizeof(line), SHORT_TIME) == -1 ||
+        wait_flag(&sock->writable, sock, MEDIUM_TIME) == -1) {
+        PRINT_DEBUG("Cellular: socket didn't open")
+        sock->open = false;
         return -1;
     }
     return 0;
 }
 
 
+/**
+* Writes len bytes from payload buffer to the connection of a service profile
+* in chunks of up to SIS_MAX_CHUNK bytes (AT^SISW).
+* Returns the number of bytes written on success, -1 on failure
+*/
+int CellularWriteProfile(int profile, unsigned char *payload, unsigned int len) {
+    char line[LINE_SIZE];
+    unsigned int sent = 0;
+    int cnf_len = 0;
+    if (profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
+        return -1;
+    }
+    sis_socket *sock = sockets + profile;
+    while (sent < len && sock->open) {
+        if (socket_command(SISW_PREFIX, SISW_RESPONSE, profile, MIN(len - sent, SIS_MAX_CHUNK), &cnf_len) == -1) {
+            break;
+        }
+        if (cnf_len == 0) {
+            /* the modem buffer is full, it tells when there is room again */
+            sock->writable = false;
+            if (wait_flag(&sock->writable, sock, SHORT_TIME) == -1) {
+                break;
+            }
+            continue;
+        }
+        if (SerialSend((char *) payload + sent, cnf_len) == -1 ||
+            wait_line("OK", line, sizeof(line), SHORT_TIME) == -1) {
+            break;
+        }
+        sent += cnf_len;
+    }
+    if (sent == 0 && len > 0) {
+        PRINT_DEBUG("Cellular: failed to write")
+        return -1;
+    }
+    return (int) sent;
+}
+
+
+/**
+* Reads up to max_len bytes from the connection of a service profile
+* to the provided buf buffer, for up to timeout_ms
+* (doesn’t block longer than that,
+* even if not all max_len bytes were received).
+* the modem is read CELLULAR_SOCKET_RX_SIZE bytes at a time into the receive buffer
+* of the socket, so small reads (e.g. MQTT headers) don't cost an AT^SISR each.
+* waits for a ^SISR URC when the modem has no data, so other commands can run meanwhile.
+* Returns the number of bytes read on success, -1 on failure.
+*/
+int CellularReadProfile(int profile, unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    uint64_t deadline = cur_time() + timeout_ms;
+    char line[LINE_SIZE];
+    int cnf_len = 0;
+    if (profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
+        return -1;
+    }
+    sis_socket *sock = sockets + profile;
+    while (sock->rx_pos == sock->rx_len && sock->open) {
+        if (!sock->data_ready) {
+            uint64_t now = cur_time();
+            if (now >= deadline || wait_flag(&sock->data_ready, sock, (unsigned int) (deadline - now)) == -1) {
+                return sock->open ? 0 : -1;
+            }
+        }
+        if (socket_command(SISR_PREFIX, SISR_RESPONSE, profile, CELLULAR_SOCKET_RX_SIZE, &cnf_len) == -1) {
+            return -1;
+        }
+        if (cnf_len < 0) {
+            PRINT_DEBUG("Cellular: socket closed by the peer")
+            sock->open = false;
+            return -1;
+        }
+        int rc = (cnf_len > 0) ? SerialRecv(sock->rx, cnf_len, SHORT_TIME) : 0;
+        if (wait_line("OK", line, sizeof(line), SHORT_TIME) == -1 || rc != cnf_len) {
+            PRINT_DEBUG(RECV_FAILUR)
+            return -1;
+        }
+        sock->rx_pos = 0;
+        sock->rx_len = (uint16_t) rc;
+        if (rc < CELLULAR_SOCKET_RX_SIZE) {
+            /* less than asked: the modem is drained, its next ^SISR URC tells about new data */
+            sock->data_ready = false;
+        }
+    }
+    if (sock->rx_pos == sock->rx_len) {
+        return -1;
+    }
+    unsigned int n = MIN(max_len, (unsigned int) (sock->rx_len - sock->rx_pos));
+    memcpy(buf, sock->rx + sock->rx_pos, n);
+    sock->rx_pos += n;
+    return (int) n;
+}
+#else
 /**
 * Connects to the socket (establishes TCP connection to the pre-
 defined host and port).
+* in transparent mode only profile 0 can be used.
 * Returns 0 on success, -1 on failure.
 */
-int CellularConnect(void) {
-    SerialFlushInputBuff();
+int CellularConnectProfile(int profile) {
+    if (profile != 0) {
+        PRINT_DEBUG("Cellular: more sockets need CELLULAR_SOCKET_URC")
+        return -1;
+    }
+    flush_input();
     if(SerialSend(SISO_COMM) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SISO=0")
         return -1;
     }
     char buf[20] = {0};
-    if(SerialRecv(buf, 18, SHORT_TIME) == -1) {
+    if(read_response(buf, 18, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -763,13 +1390,13 @@ int CellularConnect(void) {
         PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISO=0")
         return -1;
     }
-    SerialFlushInputBuff();
+    flush_input();
     if(SerialSend(SIST_COMM) == -1) {
         PRINT_DEBUG(SEND_FAILUR ": AT^SIST=0")
         return -1;
     }
     bzero(buf,20);
-    if(SerialRecv(buf, 18, SHORT_TIME) == -1) {
+    if(read_response(buf, 18, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
@@ -786,8 +1413,11 @@ int CellularConnect(void) {
 * Writes len bytes from payload buffer to the established connection
 * Returns the number of bytes written on success, -1 on failure
 */
-int CellularWrite(unsigned char *payload, unsigned int len) {
-    SerialFlushInputBuff();
+int CellularWriteProfile(int profile, unsigned char *payload, unsigned int len) {
+    if (profile != 0) {
+        return -1;
+    }
+    /* no flush_input, the input is data of the connection */
     int rc = SerialSend(payload, len);
     if(rc == -1){
         PRINT_DEBUG("Cellular: failed to write")
@@ -803,27 +1433,56 @@ int CellularWrite(unsigned char *payload, unsigned int len) {
 * if not all max_len bytes were received).
 * Returns the number of bytes read on success, -1 on failure.
 */
-int CellularRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+int CellularReadProfile(int profile, unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    if (profile != 0) {
+        return -1;
+    }
     int rc = SerialRecv(buf, max_len, timeout_ms);
     if(rc == -1) {
         PRINT_DEBUG(RECV_FAILUR)
     }
     return rc;
 }
+#endif // CELLULAR_SOCKET_URC
+
+
+/**
+* Returns 1 if the modem sent something for a read on the profile to pick up
+* (data, or with CELLULAR_SOCKET_URC a URC that may announce data), 0 otherwise.
+* Doesn't talk to the modem, safe with interrupts masked.
+*/
+int CellularReadPending(int profile) {
+    if (profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
+        return 0;
+    }
+#ifdef CELLULAR_SOCKET_URC
+    const sis_socket *sock = sockets + profile;
+    if (sock->rx_pos < sock->rx_len || sock->data_ready) {
+        return 1;
+    }
+#endif
+    return SerialAvailable() > 0;
+}
 
 
 /**
-* Closes the established connection.
+* Closes the connection of a service profile.
 * Returns 0 on success, -1 on failure.
 */
-int CellularClose() {
+int CellularCloseProfile(int profile) {
     char buf[20] = {0};
-    if (transparentMode) {
+    char cmd[sizeof(SISC_PREFIX AT_END) + AT_INT_SIZE];
+    at_builder b = AT_BUILDER(cmd, sizeof(cmd));
+    if (profile < 0 || profile >= CELLULAR_MAX_SOCKETS) {
+        PRINT_DEBUG("Cellular: invalid input")
+        return -1;
+    }
+    if (transparentMode && profile == 0) {
         if (SerialSend(STOP_TRANSPARENT) == -1) {
             PRINT_DEBUG("Cellular: failed to send +++")
             return -1;
         }
-        if (SerialRecv(buf, 15, SHORT_TIME) == -1) {
+        if (read_response(buf, 15, SHORT_TIME) == -1) {
             PRINT_DEBUG(RECV_FAILUR)
             return -1;
         }
@@ -834,18 +1493,58 @@ int CellularClose() {
         bzero(buf, 10);
         transparentMode = 0;
     }
-    SerialFlushInputBuff();
-    if(SerialSend(SISC_COMM) == -1) {
-        PRINT_DEBUG(SEND_FAILUR ": AT^SISC=0")
+#ifdef CELLULAR_SOCKET_URC
+    bzero(sockets + profile, sizeof(sis_socket));
+#endif
+    flush_input();
+    int len = profile_command(&b, SISC_PREFIX, profile, "");
+    if (len == -1 || SerialSend(cmd, len) == -1) {
+        PRINT_DEBUG(SEND_FAILUR ": AT^SISC")
         return -1;
     }
-    if(SerialRecv(buf, 9, SHORT_TIME) == -1) {
+    if(read_response(buf, 9, SHORT_TIME) == -1) {
         PRINT_DEBUG(RECV_FAILUR)
         return -1;
     }
     if (!strstr(buf,"OK")) {
-        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISC=0")
+        PRINT_DEBUG(RECV_WRONG_RESPONSE " from AT^SISC")
         return -1;
     }
     return 0;
 }
+
+
+/**
+* Connects to the socket of service profile 0.
+* Returns 0 on success, -1 on failure.
+*/
+int CellularConnect(void) {
+    return CellularConnectProfile(0);
+}
+
+
+/**
+* Writes len bytes from payload buffer to the connection of service profile 0.
+* Returns the number of bytes written on success, -1 on failure
+*/
+int CellularWrite(unsigned char *payload, unsigned int len) {
+    return CellularWriteProfile(0, payload, len);
+}
+
+
+/**
+* Reads up to max_len bytes from the connection of service profile 0, for up to timeout_ms.
+* Returns the number of bytes read on success, -1 on failure.
+*/
+int CellularRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    return CellularReadProfile(0, buf, max_len, timeout_ms);
+}
+
+
+/**
+* Closes the connection of service profile 0.
+* Returns 0 on success, -1 on failure.
+*/
+int CellularClose() {
+    return CellularCloseProfile(0);
+}
@@ -9,6 +9,28 @@
 #define SET_OPT_MODE_MANUAL 1
 #define SET_OPT_MODE_DEREG 2
 
+#define CELLULAR_BAUD 115200
+#define CELLULAR_APN "postm2m.lu"
+/* the modem closes the connection profile after this long without traffic (AT^SICS inactTO) */
+#define CELLULAR_INACT_TIMEOUT_SEC 900
+/* uncomment when the RTS/CTS lines of the modem are wired (the concept board shield doesn't have them) */
+//#define CELLULAR_FLOW_CONTROL
+/* baud rate to switch to once flow control is on (needs CELLULAR_FLOW_CONTROL) */
+//#define CELLULAR_FAST_BAUD 921600
+/*
+ * non-transparent sockets: the data goes through AT^SISW / AT^SISR and a ^SISR URC tells
+ * that there is data to read, so AT commands can still be sent while connected.
+ * comment out to use the transparent mode (AT^SIST), it has no per packet overhead.
+ */
+//#define CELLULAR_SOCKET_URC
+/* service profiles used as sockets (the EHS6 has 10), the transparent mode has one connection */
+#ifdef CELLULAR_SOCKET_URC
+#define CELLULAR_MAX_SOCKETS 2
+#else
+#define CELLULAR_MAX_SOCKETS 1
+#endif
+#define CELLULAR_SOCKET_RX_SIZE 256  /* receive buffer of each socket (CELLULAR_SOCKET_URC) */
+
 
 typedef enum __OP_STATUS {
     UNKNOWN_OPERATOR = 0,
@@ -41,6 +63,19 @@ int CellularInit(char *port);
  */
 void CellularDisable(void);
 
+/**
+ * Turns RTS/CTS flow control on or off in the modem (AT\Q) and in the serial port.
+ * Returns 0 on success, and -1 on failure
+ */
+int CellularSetFlowControl(int enable);
+
+/**
+ * Switches the modem and the serial port to another baud rate (AT+IPR).
+ * If the modem doesn't answer on the new rate both sides go back to the old one.
+ * Returns 0 on success, and -1 on failure (the link keeps the old rate)
+ */
+int CellularSetBaud(unsigned int baud);
+
 /**
  * Checks if the modem is responding to AT commands
  * Return 0 if it does, returns -1 otherwise
@@ -173,4 +208,53 @@ int CellularSetupInternetConnectionProfile(int inact_time_sec);
 */
 int CellularSetupInternetServiceProfile(char *IP, int port, int keepintvl_sec);
 
+/**
+* Initialize an internal service profile (AT^SISS) like CellularSetupInternetServiceProfile.
+* profile is the service profile, 0 to CELLULAR_MAX_SOCKETS - 1.
+* Return 0 on success, and -1 on failure.
+*/
+int CellularSetupServiceProfile(int profile, char *IP, int port, int keepintvl_sec);
+
+/**
+* Resolves host to an IP address with the DNS of the network (AT^SISX="HostByName"),
+* needs the internet connection profile (CellularSetupInternetConnectionProfile).
+* ip is a buffer of maxlen chars allocated by the caller, the address is placed
+* into it as a null-terminated string.
+* Returns 0 on success, -1 on failure
+*/
+int CellularResolveHost(const char *host, char *ip, int maxlen);
+
+/**
+* Connects the socket of a service profile, profiles other than 0 need CELLULAR_SOCKET_URC.
+* Returns 0 on success, -1 on failure.
+*/
+int CellularConnectProfile(int profile);
+
+/**
+* Closes the connection of a service profile.
+* Returns 0 on success, -1 on failure.
+*/
+int CellularCloseProfile(int profile);
+
+/**
+* Writes len bytes from payload buffer to the connection of a service profile.
+* Returns the number of bytes written on success, -1 on failure
+*/
+int CellularWriteProfile(int profile, unsigned char *payload, unsigned int len);
+
+/**
+* Reads up to max_len bytes from the connection of a service profile, for up to timeout_ms.
+* with CELLULAR_SOCKET_URC the data of every profile is buffered apart, so a slow
+* transfer on one profile doesn't hold the others.
+* Returns the number of bytes read on success, -1 on failure.
+*/
+int CellularReadProfile(int profile, unsigned char *buf, unsigned int max_len, unsigned int timeout_ms);
+
+/**
+* Returns 1 if the modem sent something for a read on the profile to pick up
+* (data, or with CELLULAR_SOCKET_URC a URC that may announce data), 0 otherwise.
+* Doesn't talk to the modem, safe with interrupts masked.
+*/
+int CellularReadPending(int profile);
+
 #endif //EX9_CELLULAR_H
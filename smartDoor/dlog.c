@@ -0,0 +1,197 @@
+#include "dlog.h"
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+#include "em_device.h"
+#include "sl_sleeptimer.h"
+#ifdef DLOG_SWO
+#include "em_cmu.h"
+#include "em_gpio.h"
+#else
+#include "print.h"
+#endif
+
+#define DLOG_MASK (DLOG_RING_SIZE - 1)
+#define DLOG_NO_STR (-1)
+
+typedef struct dlog_record {
+    const char *fmt;
+    uint32_t tick;
+    uint32_t seq;       // index of the record, written last (see dlog_write)
+    uint8_t nargs;
+    uint8_t str_mask;   // bit i is set if args[i] is a %s argument in RAM
+    int8_t str_arg;     // the argument copied to str, DLOG_NO_STR if none
+    uint32_t args[DLOG_MAX_ARGS];
+    char str[DLOG_STR_SIZE];
+} dlog_record;
+
+static dlog_record dlog_ring[DLOG_RING_SIZE];
+static volatile uint32_t dlog_head = 0;
+static uint32_t dlog_tail = 0;
+static uint32_t dlog_lost = 0;
+
+
+/**
+ * @return: true if p points into the firmware image (stays valid until the record is drained)
+ */
+static bool in_flash(uint32_t p) {
+    return p < FLASH_BASE + FLASH_SIZE;
+}
+
+
+/**
+ * finds the %s arguments that point to RAM.
+ * @param fmt: printf format.
+ * @param args: the arguments.
+ * @param nargs: number of arguments.
+ * @return: bit i is set if args[i] is such an argument
+ */
+static uint8_t ram_strings(const char *fmt, const uint32_t *args, int nargs) {
+    uint8_t mask = 0;
+    int i = 0;
+    while (*fmt && i < nargs) {
+        if (*fmt++ != '%') {
+            continue;
+        }
+        if (*fmt == '%') {
+            fmt++;
+            continue;
+        }
+        fmt += strspn(fmt, "-+ #0123456789.lhzjt");
+        if (*fmt == 's' && !in_flash(args[i])) {
+            mask |= 1 << i;
+        }
+        if (*fmt) {
+            fmt++;
+        }
+        i++;
+    }
+    return mask;
+}
+
+
+/**
+ * stores a log record. safe to call from interrupts and main context:
+ * the slot is reserved with an atomic increment and the sequence is written last,
+ * like the trace ring (see trace_write).
+ * @param fmt: printf format, must be a string literal.
+ * @param nargs: number of arguments.
+ */
+void dlog_write(const char *fmt, int nargs, ...) {
+    uint32_t idx = __atomic_fetch_add(&dlog_head, 1, __ATOMIC_RELAXED);
+    dlog_record *rec = dlog_ring + (idx & DLOG_MASK);
+    va_list args;
+    rec->seq = ~idx;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    rec->fmt = fmt;
+    rec->tick = sl_sleeptimer_get_tick_count();
+    rec->nargs = (uint8_t) nargs;
+    va_start(args, nargs);
+    for (int i = 0; i < nargs; i++) {
+        rec->args[i] = va_arg(args, uint32_t);
+    }
+    va_end(args);
+    rec->str_mask = ram_strings(fmt, rec->args, nargs);
+    rec->str_arg = DLOG_NO_STR;
+    if (rec->str_mask) {
+        rec->str_arg = (int8_t) __builtin_ctz(rec->str_mask);
+        strncpy(rec->str, (const char *) rec->args[rec->str_arg], DLOG_STR_SIZE - 1);
+        rec->str[DLOG_STR_SIZE - 1] = '\0';
+    }
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    rec->seq = idx;
+}
+
+
+#ifdef DLOG_SWO
+/**
+ * routes SWO to its pin (PF2), the debugger configures the rest of the trace unit.
+ */
+static void swo_init(void) {
+    CMU_ClockEnable(cmuClock_GPIO, true);
+    CMU_OscillatorEnable(cmuOsc_AUXHFRCO, true, true);
+    GPIO_DbgLocationSet(0);
+    GPIO_DbgSWOEnable(true);
+    GPIO_PinModeSet(gpioPortF, 2, gpioModePushPull, 0);
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+}
+
+
+/**
+ * sends a record on the SWO stimulus port, dropped if no debugger enabled the port.
+ * @param rec: the record.
+ */
+static void output(const dlog_record *rec) {
+    static bool is_init = false;
+    dlog_frame frame = {
+        .magic = DLOG_FRAME_MAGIC,
+        .nargs = rec->nargs,
+        .lost = (uint8_t) ((dlog_lost > 0xFF) ? 0xFF : dlog_lost),
+        .tick = rec->tick,
+        .fmt = (uint32_t) rec->fmt,
+    };
+    if (!is_init) {
+        swo_init();
+        is_init = true;
+    }
+    memcpy(frame.args, rec->args, sizeof(frame.args));
+    memcpy(frame.str, rec->str, sizeof(frame.str));
+    if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << DLOG_SWO_PORT))) {
+        return;
+    }
+    const uint32_t *word = (const uint32_t *) &frame;
+    for (uint32_t i = 0; i < sizeof(frame) / sizeof(uint32_t); i++) {
+        while (ITM->PORT[DLOG_SWO_PORT].u32 == 0) {
+        }
+        ITM->PORT[DLOG_SWO_PORT].u32 = word[i];
+    }
+}
+#else
+/**
+ * renders a record on the LCD.
+ * @param rec: the record.
+ */
+static void output(const dlog_record *rec) {
+    uint32_t args[DLOG_MAX_ARGS] = {0};
+    memcpy(args, rec->args, rec->nargs * sizeof(uint32_t));
+    for (int i = 0; i < rec->nargs; i++) {
+        if (rec->str_mask & (1 << i)) {
+            args[i] = (uint32_t) ((i == rec->str_arg) ? rec->str : "?");
+        }
+    }
+    lcd_init(small);
+    if (dlog_lost) {
+        lcd_printf("(%lu lost)\n", (unsigned long) dlog_lost);
+    }
+    lcd_printf(rec->fmt, args[0], args[1], args[2], args[3]);
+}
+#endif // DLOG_SWO
+
+
+/**
+ * renders up to DLOG_DRAIN_BATCH pending records on the LCD (or streams them on SWO).
+ * records that were overwritten before they were drained are counted as lost.
+ * @return: number of records still pending
+ */
+uint32_t dlog_drain(void) {
+    dlog_record rec;
+    for (int n = 0; n < DLOG_DRAIN_BATCH && dlog_tail != dlog_head; n++) {
+        uint32_t head = dlog_head;
+        if (head - dlog_tail > DLOG_RING_SIZE) {
+            dlog_lost += head - dlog_tail - DLOG_RING_SIZE;
+            dlog_tail = head - DLOG_RING_SIZE;
+        }
+        memcpy(&rec, dlog_ring + (dlog_tail & DLOG_MASK), sizeof(rec));
+        __atomic_signal_fence(__ATOMIC_ACQUIRE);
+        if (dlog_ring[dlog_tail & DLOG_MASK].seq != dlog_tail || rec.seq != dlog_tail) {
+            /* overwritten by an interrupt while we copied it */
+            dlog_lost++;
+            dlog_tail++;
+            continue;
+        }
+        output(&rec);
+        dlog_lost = 0;
+        dlog_tail++;
+    }
+    return dlog_head - dlog_tail;
+}
@@ -0,0 +1,54 @@
+#ifndef DLOG_H_
+#define DLOG_H_
+
+#include <stdint.h>
+
+/*
+ * deferred debug log: DLOG() only stores the format pointer and the raw arguments in a ring,
+ * the text is rendered later by dlog_drain() when the application is idle.
+ * arguments must be 32 bit (int, unsigned, char, pointers), at most DLOG_MAX_ARGS.
+ * %s arguments in flash are kept as pointers, the first %s argument in RAM is copied
+ * (up to DLOG_STR_SIZE - 1 chars) because the buffer may be gone when the ring is drained.
+ */
+
+//#define DLOG_SWO  /* stream binary records on the SWO pin instead of rendering on the LCD */
+#define DLOG_RING_SIZE 64  /* records, must be a power of 2 */
+#define DLOG_MAX_ARGS 4
+#define DLOG_STR_SIZE 16
+#define DLOG_DRAIN_BATCH 4  /* records rendered per dlog_drain call */
+#define DLOG_SWO_PORT 1  /* ITM stimulus port of the binary stream */
+#define DLOG_FRAME_MAGIC 0x5AA5
+
+/**
+ * binary record as streamed on SWO, keep in sync with tools/dlog_decode.py
+ */
+typedef struct dlog_frame {
+    uint16_t magic;                   // DLOG_FRAME_MAGIC
+    uint8_t nargs;
+    uint8_t lost;                     // records lost before this one (saturates at 255)
+    uint32_t tick;                    // sleeptimer tick count
+    uint32_t fmt;                     // address of the format string in the firmware image
+    uint32_t args[DLOG_MAX_ARGS];
+    char str[DLOG_STR_SIZE];          // copy of the first %s argument that was in RAM
+} dlog_frame;
+
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+#define DLOG(FMT, ...) dlog_write((FMT), DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+/**
+ * stores a log record. safe to call from interrupts and main context.
+ * use the DLOG macro, it fills nargs.
+ * @param fmt: printf format, must be a string literal.
+ * @param nargs: number of arguments.
+ */
+void dlog_write(const char *fmt, int nargs, ...);
+
+/**
+ * renders up to DLOG_DRAIN_BATCH pending records on the LCD (or streams them on SWO).
+ * call it from the main loop when there is nothing else to do.
+ * @return: number of records still pending
+ */
+uint32_t dlog_drain(void);
+
+#endif /* DLOG_H_ */
@@ -1,4 +1,5 @@
 #include <smart_door.h>
+#include "ram.h"
 #include "sl_component_catalog.h"
 #include "sl_system_init.h"
 #if defined(SL_CATALOG_POWER_MANAGER_PRESENT)
@@ -13,6 +14,7 @@
 
 
 int main(void) {
+  stack_paint();
   app_init();
   run_app();
   return 0;
@@ -0,0 +1,79 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <string.h>
+
+/* short keys, the message goes over a metered cellular link */
+static const char *metric_keys[METRIC_COUNT] = {
+    "adv", "acc", "pub", "dup", "urx", "utx", "uirq", "ovf",
+    "atr", "rcn", "rct", "pubms", "pubmax", "ping", "act", "slp",
+    "tlsms", "tlsb", "tlsr", "stk", "scr", "dns", "conms", "slice", "btlat", "doorlat",
+    "qdrop", "cpudr", "cpubt", "cpumdm", "cpumq", "cputl",
+    "stkdr", "stkbt", "stkmdm", "stkmq", "stktl", "fok", "fign", "scrgap"
+};
+
+static volatile uint32_t metrics[METRIC_COUNT];
+
+
+/**
+ * adds to a counter. safe to call from interrupts.
+ * @param id: the counter.
+ * @param n: amount to add.
+ */
+void metric_add(metric_id id, uint32_t n) {
+    __atomic_fetch_add(metrics + id, n, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * sets a gauge.
+ * @param id: the gauge.
+ * @param value: the new value.
+ */
+void metric_set(metric_id id, uint32_t value) {
+    metrics[id] = value;
+}
+
+
+/**
+ * sets a gauge only if value is bigger than the current value.
+ * @param id: the gauge.
+ * @param value: the new value.
+ */
+void metric_max(metric_id id, uint32_t value) {
+    if (value > metrics[id]) {
+        metrics[id] = value;
+    }
+}
+
+
+/**
+ * @param id: the counter or gauge.
+ * @return: the current value
+ */
+uint32_t metric_get(metric_id id) {
+    return metrics[id];
+}
+
+
+/**
+ * writes the metrics from *next on as one compact "key=value,key=value" message, as many as fit.
+ * @param buf: output buffer.
+ * @param len: size of buf.
+ * @param next: in: the first metric to write, out: the first one left for the next message,
+ * METRIC_COUNT once all of them were written.
+ * @return: the message length, -1 if buf is too small for a single metric
+ */
+int metrics_format(char *buf, int len, int *next) {
+    char entry[METRIC_ENTRY_SIZE];
+    int size = 0;
+    for (; *next < METRIC_COUNT; (*next)++) {
+        int n = snprintf(entry, sizeof(entry), "%s%s=%lu", size ? "," : "",
+                         metric_keys[*next], (unsigned long) metrics[*next]);
+        if (n < 0 || n >= len - size) {
+            break;
+        }
+        memcpy(buf + size, entry, n + 1);
+        size += n;
+    }
+    return size ? size : -1;
+}
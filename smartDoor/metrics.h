@@ -0,0 +1,96 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+
+/**
+ * runtime counters and gauges, keep the keys in metric_keys (metrics.c) in the same order.
+ * counters are cumulative since boot, the server computes the rates.
+ */
+typedef enum metric_id {
+    METRIC_ADVERTS_SEEN = 0,     //!< scan reports received
+    METRIC_ADVERTS_ACCEPTED,     //!< scan reports added to the device list
+    METRIC_SIGHTINGS_PUBLISHED,  //!< devices published to the server
+    METRIC_SIGHTINGS_DEDUPED,    //!< devices dropped as duplicates: already waiting, or sent in the last BT_DEVICE_LIFETIME
+    METRIC_UART_RX_BYTES,        //!< bytes received from the modem
+    METRIC_UART_TX_BYTES,        //!< bytes sent to the modem
+    METRIC_UART_IRQS,            //!< USART interrupts
+    METRIC_UART_RX_OVERFLOWS,    //!< bytes lost because rxBuf was full
+    METRIC_AT_RETRIES,           //!< AT commands that had to be repeated
+    METRIC_RECONNECTS,           //!< MQTT connection attempts that failed
+    METRIC_RECONNECT_TIER,       //!< gauge: step of the last failed connection (see run_mqtt)
+    METRIC_PUBLISH_MS,           //!< gauge: latency of the last publish
+    METRIC_PUBLISH_MAX_MS,       //!< gauge: worst publish latency
+    METRIC_PING_RTT_MS,          //!< gauge: round trip of the last MQTT ping
+    METRIC_ACTIVE_MS,            //!< gauge: time the core was awake
+    METRIC_SLEEP_MS,             //!< gauge: time the core slept waiting on the uart
+    METRIC_TLS_HANDSHAKE_MS,     //!< gauge: duration of the last TLS handshake
+    METRIC_TLS_HANDSHAKE_BYTES,  //!< gauge: bytes sent and received by the last TLS handshake
+    METRIC_TLS_RESUMED,          //!< TLS handshakes that resumed a session
+    METRIC_STACK_PEAK,           //!< gauge: most bytes of stack used since boot
+    METRIC_SCRATCH_PEAK,         //!< gauge: most bytes of the scratch arena used at once
+    METRIC_DNS_LOOKUPS,          //!< host names resolved over the cellular link
+    METRIC_CONNECT_MS,           //!< gauge: duration of the last socket bring up, SocketInit to SocketConnect
+    METRIC_SLICE_MAX_MS,         //!< gauge: longest run of a scheduler task, bounds the latency of the others
+    METRIC_BT_LATENCY_MS,        //!< gauge: worst wait of a bluetooth event for the bluetooth task
+    METRIC_DOOR_LATENCY_MS,      //!< gauge: worst time from a door command arriving to the door moving
+    METRIC_QUEUE_DROPS,          //!< items dropped because their task queue was full (see rtos.h)
+    METRIC_CPU_DOOR,             //!< gauge: cpu share of the door task in the last metrics period, permille
+    METRIC_CPU_BT,               //!< gauge: cpu share of the bluetooth task, permille
+    METRIC_CPU_MODEM,            //!< gauge: cpu share of the modem task, permille
+    METRIC_CPU_MQTT,             //!< gauge: cpu share of the MQTT task, permille
+    METRIC_CPU_TELEMETRY,        //!< gauge: cpu share of the telemetry task, permille
+    METRIC_STACK_DOOR,           //!< gauge: fewest bytes of stack the door task had left since boot
+    METRIC_STACK_BT,             //!< gauge: fewest bytes of stack the bluetooth task had left
+    METRIC_STACK_MODEM,          //!< gauge: fewest bytes of stack the modem task had left
+    METRIC_STACK_MQTT,           //!< gauge: fewest bytes of stack the MQTT task had left
+    METRIC_STACK_TELEMETRY,      //!< gauge: fewest bytes of stack the telemetry task had left
+    METRIC_FILTER_PASSED,        //!< scan reports that passed the payload filter (see adv_filter.h)
+    METRIC_FILTER_IGNORED,       //!< scan reports the payload filter dropped
+    METRIC_SCREEN_GAP_MS,        //!< gauge: worst time between two status screen refreshes (STATUS_SCREEN)
+    METRIC_COUNT
+} metric_id;
+
+#define METRIC_INC(ID) metric_add((ID), 1)
+#define METRIC_ENTRY_SIZE 20  // ",key=4294967295" with the longest key and the '\0'
+
+/**
+ * adds to a counter. safe to call from interrupts.
+ * @param id: the counter.
+ * @param n: amount to add.
+ */
+void metric_add(metric_id id, uint32_t n);
+
+/**
+ * sets a gauge.
+ * @param id: the gauge.
+ * @param value: the new value.
+ */
+void metric_set(metric_id id, uint32_t value);
+
+/**
+ * sets a gauge only if value is bigger than the current value.
+ * @param id: the gauge.
+ * @param value: the new value.
+ */
+void metric_max(metric_id id, uint32_t value);
+
+/**
+ * @param id: the counter or gauge.
+ * @return: the current value
+ */
+uint32_t metric_get(metric_id id);
+
+/**
+ * writes the metrics from *next on as one compact "key=value,key=value" message, as many as fit.
+ * call it again with the same next until it is METRIC_COUNT to send them all, a message of
+ * METRIC_ENTRY_SIZE bytes or more always takes at least one.
+ * @param buf: output buffer.
+ * @param len: size of buf.
+ * @param next: in: the first metric to write (0 for a new round), out: the first one left for
+ * the next message, METRIC_COUNT once all of them were written.
+ * @return: the message length, -1 if buf is too small for a single metric
+ */
+int metrics_format(char *buf, int len, int *next);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,108 @@
+#if defined(__linux__)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "socket.h"
+#include "serial_io.h"
+#include "timer.h"
+#include "metrics.h"
+
+/*
+ * throughput and cpu benchmark of the modem stack on a Linux gateway (serial_io_linux.c).
+ * sends BENCH bytes through the modem to an echo server and reads them back, then prints
+ * one "key=value,..." line: the run itself and the metrics, with the same uart keys the
+ * door publishes on its metrics topic (urx, utx, uirq, act, slp).
+ * build it with the modem stack and the host ports, e.g.:
+ *     gcc -iquote smartDoor -o modem_bench smartDoor/modem_bench.c smartDoor/serial_io_linux.c
+ *         smartDoor/timer.c smartDoor/timer_linux.c smartDoor/cellular.c smartDoor/socket_linux_modem.c
+ *         smartDoor/at_cmd.c smartDoor/ram.c smartDoor/metrics.c smartDoor/boot_prof.c -lpthread
+ *     SMART_DOOR_SERIAL=/dev/ttyACM0 ./modem_bench tcpbin.com 4242 65536
+ */
+
+#define BENCH_CHUNK 256
+#define BENCH_TIMEOUT 10000
+#define BENCH_MSG_SIZE 512
+
+
+/**
+ * @return: microseconds of cpu the process used, user and system
+ */
+static uint64_t cpu_us(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+/**
+ * echoes total bytes through the connection.
+ * @param total: bytes to send.
+ * @return: bytes that came back
+ */
+static unsigned int echo(unsigned int total) {
+    unsigned char out[BENCH_CHUNK], in[BENCH_CHUNK];
+    unsigned int sent = 0, received = 0;
+    while (sent < total) {
+        unsigned int len = (total - sent < BENCH_CHUNK) ? total - sent : BENCH_CHUNK;
+        for (unsigned int i = 0; i < len; i++) {
+            out[i] = (unsigned char) (sent + i);
+        }
+        if (SocketWrite(out, len) != (int) len) {
+            break;
+        }
+        sent += len;
+        unsigned int chunk = 0;
+        while (chunk < len) {
+            int rc = SocketRead(in + chunk, len - chunk, BENCH_TIMEOUT);
+            if (rc <= 0) {
+                return received + chunk;
+            }
+            chunk += rc;
+        }
+        if (memcmp(in, out, len) != 0) {
+            fprintf(stderr, "echo mismatch at %u\n", sent - len);
+            return received;
+        }
+        received += len;
+    }
+    return received;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <echo host> <port> <bytes>\n", argv[0]);
+        return 2;
+    }
+    unsigned int total = (unsigned int) strtoul(argv[3], NULL, 10);
+    if (SocketInit(argv[1], atoi(argv[2])) == -1 || SocketConnect() == -1) {
+        fprintf(stderr, "no connection\n");
+        return 1;
+    }
+    uint64_t start = cur_time_us(), cpu_start = cpu_us();
+    unsigned int received = echo(total);
+    uint64_t wall = cur_time_us() - start, cpu = cpu_us() - cpu_start;
+    SocketClose();
+    SocketDeInit();
+
+    uint64_t active_us, sleep_us;
+    char buf[BENCH_MSG_SIZE];
+    SerialGetPowerStats(&active_us, &sleep_us);
+    metric_set(METRIC_ACTIVE_MS, (uint32_t) (active_us / 1000));
+    metric_set(METRIC_SLEEP_MS, (uint32_t) (sleep_us / 1000));
+    int n = snprintf(buf, sizeof(buf), "bytes=%u,ms=%lu,bps=%lu,cpu=%lu,", received,
+                     (unsigned long) (wall / 1000), (unsigned long) (wall ? received * 2 * 1000000ULL / wall : 0),
+                     (unsigned long) (wall ? cpu * 1000 / wall : 0));
+    int next = 0;
+    if (metrics_format(buf + n, sizeof(buf) - n, &next) > 0) {
+        puts(buf);
+    }
+    while (next < METRIC_COUNT && metrics_format(buf, sizeof(buf), &next) > 0) {
+        puts(buf);  /* what didn't fit on the first line */
+    }
+    return received == total ? 0 : 1;
+}
+
+#endif // __linux__
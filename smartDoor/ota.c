@@ -0,0 +1,261 @@
+#include "ota.h"
+#include <stdio.h>
+#include <string.h>
+#include "ota_flash.h"
+#include "mbedtls/sha256.h"
+
+typedef enum ota_state {
+    ota_idle = 0,
+    ota_erase,
+    ota_receiving,
+    ota_done,
+    ota_failed
+} ota_state;
+
+static ota_state state = ota_idle;
+static const char *error = "";
+static uint32_t image_size = 0;
+static uint32_t erased = 0;                 // bytes of the storage erased for the image
+static uint8_t digest[OTA_DIGEST_SIZE];     // SHA-256 of the image from ota_begin
+static uint32_t acked = 0;                  // bytes of complete chunks, where a resent chunk starts
+static uint32_t offset = 0;                 // next byte of the current chunk
+static bool skip = false;                   // the current chunk doesn't start at acked, ignore it
+static uint8_t page[OTA_WRITE_SIZE];        // bytes before offset that aren't in the flash yet
+static uint32_t page_len = 0;
+static mbedtls_sha256_context sha;          // hash of the image up to offset
+static mbedtls_sha256_context sha_acked;    // hash of the image up to acked
+
+
+/**
+ * stops the update.
+ * @param reason: sent to the server in "ota_fail <reason>".
+ */
+static void fail(const char *reason) {
+    state = ota_failed;
+    error = reason;
+}
+
+
+/**
+ * writes the staged bytes to the storage slot, padded to a word with 0xFF.
+ * a chunk that is sent again writes the same bytes again, which the flash allows.
+ * @return: 0 on success, -1 if the write failed
+ */
+static int flush_page(void) {
+    uint32_t len = page_len;
+    if (len == 0) {
+        return 0;
+    }
+    while (len & 3) {
+        page[len++] = 0xFF;
+    }
+    if (ota_flash_write(offset - page_len, page, len) == -1) {
+        fail("write");
+        return -1;
+    }
+    page_len = 0;
+    return 0;
+}
+
+
+/**
+ * checks the hash of the whole image and lets the bootloader check the image itself.
+ */
+static void finish(void) {
+    uint8_t result[OTA_DIGEST_SIZE];
+    mbedtls_sha256_context tmp;
+    mbedtls_sha256_init(&tmp);
+    mbedtls_sha256_clone(&tmp, &sha);
+    mbedtls_sha256_finish(&tmp, result);
+    mbedtls_sha256_free(&tmp);
+    if (memcmp(result, digest, OTA_DIGEST_SIZE) != 0) {
+        fail("hash");
+        return;
+    }
+    if (ota_flash_verify() == -1) {
+        fail("image");
+        return;
+    }
+    state = ota_done;
+}
+
+
+/**
+ * starts an update, the storage is erased by ota_erase_step.
+ * @param args: "<image size> <64 hex digits of the image SHA-256>"
+ * @return: 0 on success, -1 if args are bad or the image doesn't fit the storage
+ */
+int ota_begin(const char *args) {
+    uint32_t room = 0;
+    unsigned long size = 0;
+    unsigned int byte = 0;
+    char hex[2 * OTA_DIGEST_SIZE + 1] = {0};
+    if (sscanf(args, "%lu %64s", &size, hex) != 2 || strlen(hex) != 2 * OTA_DIGEST_SIZE || size == 0) {
+        fail("args");
+        return -1;
+    }
+    for (int i = 0; i < OTA_DIGEST_SIZE; i++) {
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            fail("args");
+            return -1;
+        }
+        digest[i] = (uint8_t) byte;
+    }
+    if (ota_flash_open(&room) == -1 || size > room) {
+        fail("size");
+        return -1;
+    }
+    image_size = (uint32_t) size;
+    erased = 0;
+    acked = 0;
+    offset = 0;
+    page_len = 0;
+    skip = false;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_init(&sha_acked);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_clone(&sha_acked, &sha);
+    state = ota_erase;
+    return 0;
+}
+
+
+/**
+ * @return: true while the storage is erased for the update, see ota_erase_step
+ */
+bool ota_erasing(void) {
+    return state == ota_erase;
+}
+
+
+/**
+ * erases the next OTA_ERASE_SIZE bytes the image needs, the chunks come once it is done.
+ * @return: true while there is more to erase
+ */
+bool ota_erase_step(void) {
+    if (state != ota_erase) {
+        return false;
+    }
+    if (ota_flash_erase(erased, OTA_ERASE_SIZE) == -1) {
+        fail("erase");
+        return false;
+    }
+    erased += OTA_ERASE_SIZE;
+    if (erased < image_size) {
+        return true;
+    }
+    state = ota_receiving;
+    return false;
+}
+
+
+/**
+ * handles a piece of a chunk message.
+ * @param data: the piece.
+ * @param len: length of the piece.
+ * @param first: the piece starts the chunk (holds the header).
+ * @param last: the piece ends the chunk.
+ */
+void ota_chunk(const uint8_t *data, uint32_t len, bool first, bool last) {
+    if (state != ota_receiving) {
+        return;
+    }
+    if (first) {
+        if (len < OTA_HEADER_SIZE) {
+            skip = true;
+            return;
+        }
+        uint32_t at = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+        data += OTA_HEADER_SIZE;
+        len -= OTA_HEADER_SIZE;
+        /* chunks before acked are duplicates, chunks after it come after a lost one */
+        skip = (at != acked);
+        if (!skip) {
+            offset = acked;
+            page_len = 0;
+            mbedtls_sha256_clone(&sha, &sha_acked);
+        }
+    }
+    if (skip) {
+        return;
+    }
+    if (len > image_size - offset) {
+        len = image_size - offset;
+    }
+    mbedtls_sha256_update(&sha, data, len);
+    while (len > 0) {
+        uint32_t n = (len < OTA_WRITE_SIZE - page_len) ? len : OTA_WRITE_SIZE - page_len;
+        memcpy(page + page_len, data, n);
+        page_len += n;
+        offset += n;
+        data += n;
+        len -= n;
+        if (page_len == OTA_WRITE_SIZE && flush_page() == -1) {
+            return;
+        }
+    }
+    if (!last) {
+        return;
+    }
+    if (flush_page() == -1) {
+        return;
+    }
+    if ((offset & 3) && offset != image_size) {
+        /* the next chunk would start in the middle of a flash word */
+        fail("align");
+        return;
+    }
+    acked = offset;
+    mbedtls_sha256_clone(&sha_acked, &sha);
+    if (acked == image_size) {
+        finish();
+    }
+}
+
+
+/**
+ * @return: true while an update is in progress, the server waits for an ack after a reconnect
+ */
+bool ota_active(void) {
+    return state == ota_receiving;
+}
+
+
+/**
+ * formats the answer to the server: "ota_ack <offset>", "ota_done" or "ota_fail <reason>".
+ * @param buf: output.
+ * @param size: size of buf, OTA_STATUS_SIZE is enough.
+ */
+void ota_status(char *buf, uint32_t size) {
+    switch (state) {
+        case ota_receiving:
+            snprintf(buf, size, "ota_ack %lu", (unsigned long) acked);
+            break;
+        case ota_done:
+            snprintf(buf, size, "ota_done");
+            break;
+        case ota_failed:
+            snprintf(buf, size, "ota_fail %s", error);
+            break;
+        default:
+            snprintf(buf, size, "ota_idle");
+            break;
+    }
+}
+
+
+/**
+ * reboots into the new image if the update is done, call it after the "ota_done" answer was sent.
+ * @return: -1 if there is nothing to install or the bootloader refused the image, 0 on a host
+ * (see ota_flash_install)
+ */
+int ota_install(void) {
+    if (state != ota_done) {
+        return -1;
+    }
+    if (ota_flash_install() == -1) {
+        fail("install");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef OTA_H_
+#define OTA_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * firmware update over MQTT, see server/ota.py.
+ * the server starts with "ota_begin <door id> <size> <sha256 hex>" on the command topic, which the
+ * doors share, then sends the image in chunks on "ota/<door id>": 4 bytes little endian offset of
+ * the data, then the data.
+ * ota_begin only checks the arguments, the main loop erases the storage (see ota_flash.h) a page
+ * at a time with ota_erase_step, and the door answers once it is done.
+ * a chunk may be bigger than the MQTT rx buffer, wolfMQTT delivers it in pieces and every piece
+ * is written to the storage right away.
+ * the door answers every chunk with "ota_ack <offset>" (bytes of complete chunks) on
+ * "ota_ack/<door id>", a chunk that was cut by a reconnect is sent again from that offset.
+ * when the whole image is acked and its SHA-256 matches the door answers "ota_done" and installs it.
+ */
+
+#define OTA_HEADER_SIZE 4
+#define OTA_WRITE_SIZE 64    /* bytes written to the flash at once, multiple of 4 */
+#define OTA_DIGEST_SIZE 32
+#define OTA_STATUS_SIZE 32
+
+/**
+ * starts an update, the storage is erased by ota_erase_step.
+ * @param args: "<image size> <64 hex digits of the image SHA-256>"
+ * @return: 0 on success, -1 if args are bad or the image doesn't fit the storage
+ */
+int ota_begin(const char *args);
+
+/**
+ * @return: true while the storage is erased for the update, see ota_erase_step
+ */
+bool ota_erasing(void);
+
+/**
+ * erases the next OTA_ERASE_SIZE bytes the image needs, the chunks come once it is done.
+ * call it from the main loop, a page takes tens of ms.
+ * @return: true while there is more to erase
+ */
+bool ota_erase_step(void);
+
+/**
+ * handles a piece of a chunk message.
+ * @param data: the piece.
+ * @param len: length of the piece.
+ * @param first: the piece starts the chunk (holds the header).
+ * @param last: the piece ends the chunk.
+ */
+void ota_chunk(const uint8_t *data, uint32_t len, bool first, bool last);
+
+/**
+ * @return: true while an update is in progress, the server waits for an ack after a reconnect
+ */
+bool ota_active(void);
+
+/**
+ * formats the answer to the server: "ota_ack <offset>", "ota_done" or "ota_fail <reason>".
+ * @param buf: output.
+ * @param size: size of buf, OTA_STATUS_SIZE is enough.
+ */
+void ota_status(char *buf, uint32_t size);
+
+/**
+ * reboots into the new image if the update is done, call it after the "ota_done" answer was sent.
+ * @return: -1 if there is nothing to install or the bootloader refused the image, 0 on a host
+ * (see ota_flash_install)
+ */
+int ota_install(void);
+
+#endif /* OTA_H_ */
@@ -0,0 +1,51 @@
+#ifndef OTA_FLASH_H_
+#define OTA_FLASH_H_
+
+#include <stdint.h>
+
+/*
+ * the storage the firmware updates are written to, ota.c uses nothing else of the platform:
+ * the Gecko bootloader storage slot on the door (ota_flash_btl.c), a file on a Linux host
+ * (ota_flash_linux.c, for the tests). it behaves like flash: erased bytes are 0xFF and a write
+ * can only clear bits, so a page must be erased before it is written.
+ */
+
+#define OTA_ERASE_SIZE 2048  /* bytes ota_flash_erase takes at once, a flash page of the EFR32BG1 */
+
+/**
+ * gets the storage ready, can be called again.
+ * @param size: output, bytes an image may have.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_open(uint32_t *size);
+
+/**
+ * erases a part of the storage.
+ * @param offset: start, a multiple of OTA_ERASE_SIZE.
+ * @param len: bytes, a multiple of OTA_ERASE_SIZE.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_erase(uint32_t offset, uint32_t len);
+
+/**
+ * writes erased storage.
+ * @param offset: start, a multiple of 4.
+ * @param data: the bytes.
+ * @param len: a multiple of 4.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_write(uint32_t offset, const uint8_t *data, uint32_t len);
+
+/**
+ * lets the platform check the image in the storage (the bootloader checks the .gbl signature).
+ * @return: 0 if it can be installed, -1 otherwise
+ */
+int ota_flash_verify(void);
+
+/**
+ * reboots into the image in the storage.
+ * @return: -1 if the platform refused it, 0 where there is nothing to reboot (the host)
+ */
+int ota_flash_install(void);
+
+#endif /* OTA_FLASH_H_ */
@@ -0,0 +1,80 @@
+#include "ota_flash.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include "btl_interface.h"
+#include "btl_interface_storage.h"
+
+/*
+ * the storage of the updates on the door: slot OTA_SLOT of the Gecko bootloader.
+ */
+
+#define OTA_SLOT 0
+
+static BootloaderStorageSlot_t slot;
+
+
+/**
+ * gets the storage ready, can be called again.
+ * @param size: output, bytes an image may have.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_open(uint32_t *size) {
+    static bool is_init = false;
+    if (!is_init) {
+        bootloader_init();
+        is_init = true;
+    }
+    if (bootloader_getStorageSlotInfo(OTA_SLOT, &slot) != BOOTLOADER_OK) {
+        return -1;
+    }
+    *size = slot.length;
+    return 0;
+}
+
+
+/**
+ * erases a part of the storage.
+ * @param offset: start, a multiple of OTA_ERASE_SIZE.
+ * @param len: bytes, a multiple of OTA_ERASE_SIZE.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_erase(uint32_t offset, uint32_t len) {
+    if (offset + len > slot.length) {
+        return -1;
+    }
+    return bootloader_eraseRawStorage(slot.address + offset, len) == BOOTLOADER_OK ? 0 : -1;
+}
+
+
+/**
+ * writes erased storage.
+ * @param offset: start, a multiple of 4.
+ * @param data: the bytes.
+ * @param len: a multiple of 4.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_write(uint32_t offset, const uint8_t *data, uint32_t len) {
+    return bootloader_writeStorage(OTA_SLOT, offset, (uint8_t *) data, len) == BOOTLOADER_OK ? 0 : -1;
+}
+
+
+/**
+ * lets the bootloader check the image in the slot (its signature and CRC).
+ * @return: 0 if it can be installed, -1 otherwise
+ */
+int ota_flash_verify(void) {
+    return bootloader_verifyImage(OTA_SLOT, NULL) == BOOTLOADER_OK ? 0 : -1;
+}
+
+
+/**
+ * reboots into the image in the slot, the bootloader installs it.
+ * @return: -1 if the bootloader refused it
+ */
+int ota_flash_install(void) {
+    if (bootloader_setImageToBootload(OTA_SLOT) != BOOTLOADER_OK) {
+        return -1;
+    }
+    bootloader_rebootAndInstall();
+    return -1;
+}
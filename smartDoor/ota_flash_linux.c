@@ -0,0 +1,111 @@
+#include "ota_flash.h"
+#if defined(__linux__)
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * the storage of the updates on a Linux host: a file of OTA_FLASH_FILE_SIZE bytes, written
+ * like flash (a write clears bits, an erase sets them), so a write before the erase shows up
+ * in the image. a new file starts with every bit cleared.
+ */
+
+#ifndef OTA_FLASH_FILE
+#define OTA_FLASH_FILE "ota_slot.bin"  /* used when OTA_FLASH_ENV isn't set */
+#endif
+#define OTA_FLASH_ENV "SMART_DOOR_OTA_FILE"
+#define OTA_FLASH_FILE_SIZE (128 * 1024)
+
+static FILE *file = NULL;
+
+
+/**
+ * gets the storage ready, can be called again.
+ * @param size: output, bytes an image may have.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_open(uint32_t *size) {
+    if (!file) {
+        const char *path = getenv(OTA_FLASH_ENV);
+        path = path ? path : OTA_FLASH_FILE;
+        file = fopen(path, "r+b");
+        if (!file && (file = fopen(path, "w+b")) != NULL) {
+            for (uint32_t i = 0; i < OTA_FLASH_FILE_SIZE; i++) {
+                fputc(0, file);
+            }
+        }
+        if (!file) {
+            return -1;
+        }
+    }
+    *size = OTA_FLASH_FILE_SIZE;
+    return 0;
+}
+
+
+/**
+ * erases a part of the storage.
+ * @param offset: start, a multiple of OTA_ERASE_SIZE.
+ * @param len: bytes, a multiple of OTA_ERASE_SIZE.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_erase(uint32_t offset, uint32_t len) {
+    if (!file || offset % OTA_ERASE_SIZE || len % OTA_ERASE_SIZE || offset + len > OTA_FLASH_FILE_SIZE ||
+        fseek(file, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        fputc(0xFF, file);
+    }
+    return fflush(file) == 0 ? 0 : -1;
+}
+
+
+/**
+ * writes erased storage, the bits that are cleared already stay cleared.
+ * @param offset: start, a multiple of 4.
+ * @param data: the bytes.
+ * @param len: a multiple of 4.
+ * @return: 0 on success, -1 otherwise
+ */
+int ota_flash_write(uint32_t offset, const uint8_t *data, uint32_t len) {
+    uint8_t old[OTA_ERASE_SIZE];
+    if (!file || (offset & 3) || (len & 3) || offset + len > OTA_FLASH_FILE_SIZE) {
+        return -1;
+    }
+    while (len > 0) {
+        uint32_t n = len < sizeof(old) ? len : sizeof(old);
+        if (fseek(file, offset, SEEK_SET) != 0 || fread(old, 1, n, file) != n) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            old[i] &= data[i];
+        }
+        if (fseek(file, offset, SEEK_SET) != 0 || fwrite(old, 1, n, file) != n) {
+            return -1;
+        }
+        offset += n;
+        data += n;
+        len -= n;
+    }
+    return fflush(file) == 0 ? 0 : -1;
+}
+
+
+/**
+ * the host has no bootloader to check the image, the SHA-256 of ota.c is the check.
+ * @return: 0
+ */
+int ota_flash_verify(void) {
+    return 0;
+}
+
+
+/**
+ * the host doesn't reboot, the image stays in the file.
+ * @return: 0
+ */
+int ota_flash_install(void) {
+    return 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,49 @@
+#ifndef PT_H_
+#define PT_H_
+
+#include <stdint.h>
+
+/*
+ * protothreads: stackless coroutines for the cooperative scheduler (see sched.h).
+ * a protothread is a function that returns where it waits and continues from there on its
+ * next call, the resume point is a switch case on the line number.
+ * local variables are lost across a wait or a yield, keep that state in statics.
+ * no switch statements between PT_BEGIN and PT_END across a wait.
+ */
+
+typedef struct pt {
+    uint16_t lc;  // line to resume at, 0 at the start
+} pt;
+
+#define PT_WAITING 0
+#define PT_YIELDED 1
+#define PT_ENDED 2
+
+#define PT_INIT(P) ((P)->lc = 0)
+
+#define PT_BEGIN(P) { char pt_yielded = 1; (void) pt_yielded; switch ((P)->lc) { case 0:
+
+#define PT_END(P) } PT_INIT(P); return PT_ENDED; }
+
+/* returns PT_WAITING until COND holds */
+#define PT_WAIT_UNTIL(P, COND)          \
+    do {                                \
+        (P)->lc = __LINE__;             \
+        case __LINE__:                  \
+        if (!(COND)) {                  \
+            return PT_WAITING;          \
+        }                               \
+    } while (0)
+
+/* gives the other tasks a turn, continues on the next call */
+#define PT_YIELD(P)                     \
+    do {                                \
+        pt_yielded = 0;                 \
+        (P)->lc = __LINE__;             \
+        case __LINE__:                  \
+        if (!pt_yielded) {              \
+            return PT_YIELDED;          \
+        }                               \
+    } while (0)
+
+#endif /* PT_H_ */
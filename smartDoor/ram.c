@@ -0,0 +1,109 @@
+#include "ram.h"
+#include <string.h>
+#if !defined(__linux__)
+#include "em_device.h"
+
+/* stack bounds from the GCC linker script of the Gecko SDK */
+extern uint32_t __StackLimit;
+extern uint32_t __StackTop;
+#endif
+
+static uint32_t scratch[SCRATCH_SIZE / sizeof(uint32_t)];
+static uint32_t scratch_top = 0;   // bytes in use
+static uint32_t scratch_max = 0;
+
+
+/**
+ * @return: the current top of the arena, pass it to scratch_restore.
+ */
+scratch_mark scratch_save(void) {
+    return scratch_top;
+}
+
+
+/**
+ * frees everything allocated after mark.
+ * @param mark: returned by scratch_save.
+ */
+void scratch_restore(scratch_mark mark) {
+    scratch_top = mark;
+}
+
+
+/**
+ * SCRATCH_SCOPE cleanup handler.
+ * @param mark: the mark taken at the start of the scope.
+ */
+void scratch_release(scratch_mark *mark) {
+    scratch_restore(*mark);
+}
+
+
+/**
+ * allocates zeroed memory from the arena, 4 bytes aligned.
+ * @param size: bytes.
+ * @return: the memory, NULL if the arena is full
+ */
+void *scratch_alloc(uint32_t size) {
+    size = (size + 3) & ~3U;
+    if (size > SCRATCH_SIZE - scratch_top) {
+        return NULL;
+    }
+    void *mem = (uint8_t *) scratch + scratch_top;
+    scratch_top += size;
+    if (scratch_top > scratch_max) {
+        scratch_max = scratch_top;
+    }
+    memset(mem, 0, size);
+    return mem;
+}
+
+
+/**
+ * @return: the most bytes of the arena used at once since boot
+ */
+uint32_t scratch_peak(void) {
+    return scratch_max;
+}
+
+
+#if !defined(__linux__)
+/**
+ * fills the unused part of the stack with STACK_PAINT, call it first thing in main.
+ */
+void stack_paint(void) {
+    uint32_t *end = (uint32_t *) __get_MSP() - STACK_PAINT_MARGIN;
+    for (uint32_t *p = &__StackLimit; p < end; p++) {
+        *p = STACK_PAINT;
+    }
+}
+
+
+/**
+ * @return: the most bytes of stack used since stack_paint
+ */
+uint32_t stack_peak(void) {
+    const uint32_t *p = &__StackLimit;
+    while (p < &__StackTop && *p == STACK_PAINT) {
+        p++;
+    }
+    return (uint32_t) ((const uint8_t *) &__StackTop - (const uint8_t *) p);
+}
+#else
+/* a gateway process has no stack of its own to paint, the stack is the one of the thread */
+
+
+/**
+ * fills the unused part of the stack with STACK_PAINT, call it first thing in main.
+ */
+void stack_paint(void) {
+}
+
+
+/**
+ * @return: the most bytes of stack used since stack_paint
+ */
+uint32_t stack_peak(void) {
+    return 0;
+}
+#endif
@@ -0,0 +1,65 @@
+#ifndef RAM_H_
+#define RAM_H_
+
+#include <stdint.h>
+
+/*
+ * RAM budget helpers:
+ * a scratch arena for the short lived buffers of the AT layer (replaces big stack buffers),
+ * and stack painting to measure the worst stack usage since boot.
+ * the arena is for the main context only, don't use it from interrupts.
+ */
+
+#define SCRATCH_SIZE 1536  /* AT+COPS=? response (1 KB) + operator list of SocketInit */
+#define STACK_PAINT 0xDEADBEEF
+#define STACK_PAINT_MARGIN 16  /* words below the stack pointer left alone by stack_paint */
+
+typedef uint32_t scratch_mark;
+
+/**
+ * frees everything allocated in the enclosing block when it ends, on every return path.
+ * allocate with scratch_alloc after it in the same block.
+ */
+#define SCRATCH_SCOPE() \
+    scratch_mark _scratch_scope __attribute__((cleanup(scratch_release), unused)) = scratch_save()
+
+/**
+ * @return: the current top of the arena, pass it to scratch_restore.
+ */
+scratch_mark scratch_save(void);
+
+/**
+ * frees everything allocated after mark.
+ * @param mark: returned by scratch_save.
+ */
+void scratch_restore(scratch_mark mark);
+
+/**
+ * SCRATCH_SCOPE cleanup handler.
+ * @param mark: the mark taken at the start of the scope.
+ */
+void scratch_release(scratch_mark *mark);
+
+/**
+ * allocates zeroed memory from the arena, 4 bytes aligned.
+ * @param size: bytes.
+ * @return: the memory, NULL if the arena is full
+ */
+void *scratch_alloc(uint32_t size);
+
+/**
+ * @return: the most bytes of the arena used at once since boot
+ */
+uint32_t scratch_peak(void);
+
+/**
+ * fills the unused part of the stack with STACK_PAINT, call it first thing in main.
+ */
+void stack_paint(void);
+
+/**
+ * @return: the most bytes of stack used since stack_paint
+ */
+uint32_t stack_peak(void);
+
+#endif /* RAM_H_ */
@@ -0,0 +1,217 @@
+#include "rpa.h"
+#include <string.h>
+#include <stdbool.h>
+#if !defined(__linux__)
+#include "em_device.h"  /* host builds (adv_replay.c) use the software AES */
+#endif
+
+#if defined(CRYPTO_PRESENT)
+#include "em_cmu.h"
+#include "em_crypto.h"
+#if defined(CRYPTO)
+#define RPA_CRYPTO CRYPTO
+#define RPA_CRYPTO_CLOCK cmuClock_CRYPTO
+#else
+#define RPA_CRYPTO CRYPTO0
+#define RPA_CRYPTO_CLOCK cmuClock_CRYPTO0
+#endif
+#endif // CRYPTO_PRESENT
+
+#define RPA_HASH_SIZE 3
+#define RPA_NO_IDENTITY (-1)
+
+typedef struct irk_entry {
+    uint8_t identity[RPA_ADDR_SIZE];
+    uint8_t irk[RPA_IRK_SIZE];
+} irk_entry;
+
+typedef struct rpa_cache_entry {
+    uint8_t addr[RPA_ADDR_SIZE];
+    int8_t irk_idx;  // index in irk_lst, RPA_NO_IDENTITY if no key resolves addr
+    bool valid;
+} rpa_cache_entry;
+
+static irk_entry irk_lst[RPA_MAX_IRKS];
+static int irk_count = 0;
+static rpa_cache_entry rpa_cache[RPA_CACHE_SIZE];
+
+
+#if !defined(CRYPTO_PRESENT)
+static const uint8_t sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+
+/**
+ * multiplies by x in GF(2^8).
+ */
+static uint8_t xtime(uint8_t b) {
+    return (uint8_t) ((b << 1) ^ ((b & 0x80) ? 0x1b : 0x00));
+}
+
+
+/**
+ * software AES-128 single block encryption, used when the part has no CRYPTO peripheral.
+ * @param key: 16 bytes key.
+ * @param in: 16 bytes plain text.
+ * @param out: 16 bytes cipher text.
+ */
+static void aes128_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out) {
+    uint8_t round_key[16];
+    uint8_t s[16];
+    uint8_t rcon = 0x01;
+    memcpy(round_key, key, 16);
+    for (int i = 0; i < 16; i++) {
+        s[i] = in[i] ^ round_key[i];
+    }
+    for (int round = 1; round <= 10; round++) {
+        /* next round key */
+        uint8_t t[4] = {sbox[round_key[13]], sbox[round_key[14]], sbox[round_key[15]], sbox[round_key[12]]};
+        t[0] ^= rcon;
+        rcon = xtime(rcon);
+        for (int i = 0; i < 16; i++) {
+            round_key[i] ^= (i < 4) ? t[i] : round_key[i - 4];
+        }
+        /* SubBytes + ShiftRows */
+        uint8_t tmp[16];
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                tmp[c * 4 + r] = sbox[s[((c + r) & 3) * 4 + r]];
+            }
+        }
+        /* MixColumns (skipped in the last round) + AddRoundKey */
+        for (int c = 0; c < 4; c++) {
+            uint8_t *col = tmp + c * 4;
+            if (round != 10) {
+                uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+                uint8_t first = col[0];
+                col[0] ^= all ^ xtime(col[0] ^ col[1]);
+                col[1] ^= all ^ xtime(col[1] ^ col[2]);
+                col[2] ^= all ^ xtime(col[2] ^ col[3]);
+                col[3] ^= all ^ xtime(col[3] ^ first);
+            }
+            for (int r = 0; r < 4; r++) {
+                s[c * 4 + r] = col[r] ^ round_key[c * 4 + r];
+            }
+        }
+    }
+    memcpy(out, s, 16);
+}
+#endif // !CRYPTO_PRESENT
+
+
+/**
+ * the bluetooth random address hash function: ah(k, r) = e(k, padding || r) mod 2^24.
+ * @param irk: the key, most significant octet first.
+ * @param prand: the 3 random bytes of the address (little endian, as in the address).
+ * @param hash: output, 3 bytes hash (little endian, as in the address).
+ */
+static void rpa_hash(const uint8_t *irk, const uint8_t *prand, uint8_t *hash) {
+    uint8_t plain[16] = {0};
+    uint8_t cipher[16];
+    plain[13] = prand[2];
+    plain[14] = prand[1];
+    plain[15] = prand[0];
+#if defined(CRYPTO_PRESENT)
+    CRYPTO_AES_ECB128(RPA_CRYPTO, cipher, plain, sizeof(plain), irk, true);
+#else
+    aes128_encrypt(irk, plain, cipher);
+#endif
+    hash[0] = cipher[15];
+    hash[1] = cipher[14];
+    hash[2] = cipher[13];
+}
+
+
+/**
+ * checks if addr is a resolvable private address (two most significant bits are 01).
+ * @param addr: bluetooth address as received from the stack (little endian).
+ * @param addr_type: the address type from the scan report (1 for random).
+ * @return: 1 if the address can be resolved with an IRK else 0
+ */
+int rpa_is_resolvable(const uint8_t *addr, uint8_t addr_type) {
+    return addr_type == 1 && (addr[RPA_ADDR_SIZE - 1] & 0xC0) == 0x40;
+}
+
+
+/**
+ * stores the identity resolving key of an enrolled device.
+ * adding a key drops the address cache, so addresses that failed to resolve are tried again.
+ * @param identity: the identity address of the device (little endian).
+ * @param irk: the IRK, most significant octet first (as shown by most phones / tools).
+ * @return: 0 on success, -1 if the table is full
+ */
+int rpa_add_irk(const uint8_t *identity, const uint8_t *irk) {
+    int idx = 0;
+    while (idx < irk_count && memcmp(irk_lst[idx].identity, identity, RPA_ADDR_SIZE) != 0) {
+        idx++;
+    }
+    if (idx == RPA_MAX_IRKS) {
+        return -1;
+    }
+#if defined(CRYPTO_PRESENT)
+    CMU_ClockEnable(RPA_CRYPTO_CLOCK, true);
+#endif
+    memcpy(irk_lst[idx].identity, identity, RPA_ADDR_SIZE);
+    memcpy(irk_lst[idx].irk, irk, RPA_IRK_SIZE);
+    if (idx == irk_count) {
+        irk_count++;
+    }
+    memset(rpa_cache, 0, sizeof(rpa_cache));
+    return 0;
+}
+
+
+/**
+ * removes all the stored keys and the address cache.
+ */
+void rpa_clear(void) {
+    memset(irk_lst, 0, sizeof(irk_lst));
+    memset(rpa_cache, 0, sizeof(rpa_cache));
+    irk_count = 0;
+}
+
+
+/**
+ * resolves a resolvable private address to the identity address of an enrolled device.
+ * results (including misses) are cached, so the same address isn't resolved again on every advert.
+ * @param addr: resolvable private address (little endian).
+ * @param identity: output, the identity address (little endian).
+ * @return: 0 if resolved, -1 otherwise
+ */
+int rpa_resolve(const uint8_t *addr, uint8_t *identity) {
+    rpa_cache_entry *entry = rpa_cache + (addr[0] & (RPA_CACHE_SIZE - 1));
+    if (!entry->valid || memcmp(entry->addr, addr, RPA_ADDR_SIZE) != 0) {
+        uint8_t hash[RPA_HASH_SIZE];
+        entry->irk_idx = RPA_NO_IDENTITY;
+        for (int i = 0; i < irk_count; i++) {
+            rpa_hash(irk_lst[i].irk, addr + RPA_HASH_SIZE, hash);
+            if (memcmp(hash, addr, RPA_HASH_SIZE) == 0) {
+                entry->irk_idx = (int8_t) i;
+                break;
+            }
+        }
+        memcpy(entry->addr, addr, RPA_ADDR_SIZE);
+        entry->valid = true;
+    }
+    if (entry->irk_idx == RPA_NO_IDENTITY) {
+        return -1;
+    }
+    memcpy(identity, irk_lst[entry->irk_idx].identity, RPA_ADDR_SIZE);
+    return 0;
+}
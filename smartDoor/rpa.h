@@ -0,0 +1,42 @@
+#ifndef RPA_H_
+#define RPA_H_
+
+#include <stdint.h>
+
+#define RPA_MAX_IRKS 8
+#define RPA_CACHE_SIZE 32
+#define RPA_IRK_SIZE 16
+#define RPA_ADDR_SIZE 6
+
+/**
+ * checks if the address is a resolvable private address (two most significant bits are 01).
+ * @param addr: bluetooth address as received from the stack (little endian).
+ * @param addr_type: the address type from the scan report (1 for random).
+ * @return: 1 if the address can be resolved with an IRK else 0
+ */
+int rpa_is_resolvable(const uint8_t *addr, uint8_t addr_type);
+
+/**
+ * stores the identity resolving key of an enrolled device.
+ * adding a key drops the address cache, so addresses that failed to resolve are tried again.
+ * @param identity: the identity address of the device (little endian).
+ * @param irk: the IRK, most significant octet first (as shown by most phones / tools).
+ * @return: 0 on success, -1 if the table is full
+ */
+int rpa_add_irk(const uint8_t *identity, const uint8_t *irk);
+
+/**
+ * removes all the stored keys and the address cache.
+ */
+void rpa_clear(void);
+
+/**
+ * resolves a resolvable private address to the identity address of an enrolled device.
+ * results (including misses) are cached, so the same address isn't resolved again on every advert.
+ * @param addr: resolvable private address (little endian).
+ * @param identity: output, the identity address (little endian).
+ * @return: 0 if resolved, -1 otherwise
+ */
+int rpa_resolve(const uint8_t *addr, uint8_t *identity);
+
+#endif /* RPA_H_ */
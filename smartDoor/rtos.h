@@ -0,0 +1,153 @@
+#ifndef RTOS_H_
+#define RTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "metrics.h"
+#ifdef SL_COMPONENT_CATALOG_PRESENT
+#include "sl_component_catalog.h"
+#endif // SL_COMPONENT_CATALOG_PRESENT
+
+/*
+ * preemptive tasks, queues and events over the kernel of the build:
+ * CMSIS-RTOS2 (FreeRTOS or Micrium) when the Silicon Labs kernel component is in the project
+ * (rtos_cmsis.c), POSIX threads on a host build compiled with RTOS_POSIX (rtos_posix.c).
+ * without a kernel the application runs on the cooperative scheduler instead (see sched.h).
+ */
+#if defined(SL_CATALOG_KERNEL_PRESENT) || defined(RTOS_POSIX)
+#define RTOS_PRESENT
+#endif
+
+#define RTOS_FOREVER UINT32_MAX
+#define RTOS_MAX_TASKS 8
+
+/* a higher priority preempts a lower one */
+typedef enum rtos_prio {
+    RTOS_PRIO_TELEMETRY = 0,  //!< metrics, traces, the status screen
+    RTOS_PRIO_LINK,           //!< modem bring-up and the MQTT link
+    RTOS_PRIO_BT,             //!< bluetooth sightings
+    RTOS_PRIO_DOOR            //!< door commands
+} rtos_prio;
+
+typedef struct rtos_task rtos_task;
+
+struct rtos_task {
+    const char *name;
+    void (*fn)(rtos_task *task);  // the task body, the task ends when it returns
+    rtos_prio prio;
+    uint32_t stack_size;
+    metric_id cpu_metric;  // gauge of the cpu share in permille (see rtos_cpu_report), METRIC_COUNT for none
+    metric_id stack_metric;  // gauge of the stack left (see rtos_stack_report), METRIC_COUNT for none
+    void *handle;
+    uint64_t reported_run;  // run time the kernel counted for the task at the last rtos_cpu_report
+};
+
+#define RTOS_TASK(NAME, FN, PRIO, STACK, CPU_METRIC, STACK_METRIC) \
+    {(NAME), (FN), (PRIO), (STACK), (CPU_METRIC), (STACK_METRIC), NULL, 0}
+
+typedef struct rtos_event {
+    void *handle;
+} rtos_event;
+
+typedef struct rtos_queue {
+    void *handle;
+} rtos_queue;
+
+typedef struct rtos_mutex {
+    void *handle;
+} rtos_mutex;
+
+/**
+ * creates a task, it starts running once rtos_start is called (right away if it already was).
+ * @param task: the task, static.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_task_create(rtos_task *task);
+
+/**
+ * starts the kernel, doesn't return.
+ */
+void rtos_start(void);
+
+/**
+ * @param ev: the event.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_event_init(rtos_event *ev);
+
+/**
+ * wakes the task waiting on the event, or the next one that waits. safe to call from interrupts.
+ * @param ev: the event.
+ */
+void rtos_event_signal(rtos_event *ev);
+
+/**
+ * waits until the event is signalled, signals that came while nobody waited are kept as one.
+ * @param ev: the event.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout.
+ * @return: 0 when signalled, -1 on timeout
+ */
+int rtos_event_wait(rtos_event *ev, uint32_t timeout_ms);
+
+/**
+ * @param q: the queue.
+ * @param count: maximum items in the queue.
+ * @param item_size: bytes per item.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_queue_init(rtos_queue *q, uint32_t count, uint32_t item_size);
+
+/**
+ * copies an item to the end of the queue, doesn't wait for room. safe to call from interrupts.
+ * @param q: the queue.
+ * @param item: item_size bytes.
+ * @return: 0 on success, -1 if the queue is full (the item is counted in METRIC_QUEUE_DROPS)
+ */
+int rtos_queue_put(rtos_queue *q, const void *item);
+
+/**
+ * takes the first item of the queue, waits for one if it is empty.
+ * @param q: the queue.
+ * @param item: output, item_size bytes.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout, 0 to not wait.
+ * @return: 0 on success, -1 on timeout
+ */
+int rtos_queue_get(rtos_queue *q, void *item, uint32_t timeout_ms);
+
+/**
+ * @param m: the mutex, recursive, the owner inherits the priority of the tasks waiting on it.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_mutex_init(rtos_mutex *m);
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_lock(rtos_mutex *m);
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_unlock(rtos_mutex *m);
+
+/**
+ * sets the cpu_metric of every task to its share of the cpu since the last report, in permille.
+ * the shares come from the run time the kernel counts per thread, so the time a task was
+ * preempted isn't its own and the shares add up to 1000 at most. FreeRTOS needs
+ * configGENERATE_RUN_TIME_STATS and configUSE_TRACE_FACILITY, Micrium OS OS_CFG_TASK_PROFILE_EN,
+ * the gauges stay 0 without them.
+ */
+void rtos_cpu_report(void);
+
+/**
+ * @param task: a created task.
+ * @return: the fewest bytes of its stack the task had left since it started (its high water mark)
+ */
+uint32_t rtos_stack_free(const rtos_task *task);
+
+/**
+ * sets the stack_metric of every task to rtos_stack_free, a task near 0 needs a bigger stack.
+ */
+void rtos_stack_report(void);
+
+#endif /* RTOS_H_ */
@@ -0,0 +1,275 @@
+#include "rtos.h"
+#if defined(SL_CATALOG_KERNEL_PRESENT)
+#include <stddef.h>
+#include "cmsis_os2.h"
+#include "sl_system_kernel.h"
+#if defined(SL_CATALOG_FREERTOS_KERNEL_PRESENT)
+#include "FreeRTOS.h"
+#include "task.h"
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+#define RUN_TIME_STATS
+#endif
+#elif defined(SL_CATALOG_MICRIUMOS_KERNEL_PRESENT)
+#include "os.h"
+#if (OS_CFG_TASK_PROFILE_EN == DEF_ENABLED) && (OS_CFG_TS_EN == DEF_ENABLED)
+#define RUN_TIME_STATS
+#endif
+#endif
+#ifndef RUN_TIME_STATS
+#warning "no run time stats in the kernel configuration, rtos_cpu_report leaves the cpu gauges at 0"
+#endif
+
+static rtos_task *tasks[RTOS_MAX_TASKS];
+static int task_count = 0;
+static uint32_t report_clock = 0;  // run_clock of the last rtos_cpu_report
+
+static const osPriority_t prio_map[] = {
+    [RTOS_PRIO_TELEMETRY] = osPriorityBelowNormal,
+    [RTOS_PRIO_LINK] = osPriorityNormal,
+    [RTOS_PRIO_BT] = osPriorityAboveNormal,
+    [RTOS_PRIO_DOOR] = osPriorityHigh,
+};
+
+
+#ifdef RUN_TIME_STATS
+#if defined(SL_CATALOG_FREERTOS_KERNEL_PRESENT)
+/**
+ * @return: the run time counter of the kernel, the time base of run_time
+ */
+static uint32_t run_clock(void) {
+    return (uint32_t) portGET_RUN_TIME_COUNTER_VALUE();
+}
+
+
+/**
+ * @param task: a created task.
+ * @return: the time the task ran, counted by the kernel when it switches the task out
+ */
+static uint32_t run_time(const rtos_task *task) {
+    TaskStatus_t status;
+    /* the thread id of the CMSIS-RTOS2 wrapper is the task handle, eReady skips the state lookup */
+    vTaskGetInfo((TaskHandle_t) task->handle, &status, pdFALSE, eReady);
+    return (uint32_t) status.ulRunTimeCounter;
+}
+#else
+/**
+ * @return: the timestamp of the kernel, the time base of run_time
+ */
+static uint32_t run_clock(void) {
+    return (uint32_t) OS_TS_GET();
+}
+
+
+/**
+ * @param task: a created task.
+ * @return: the time the task ran, counted by the kernel when it switches the task out
+ */
+static uint32_t run_time(const rtos_task *task) {
+    /* the thread of the CMSIS-RTOS2 wrapper starts with the OS_TCB */
+    return (uint32_t) ((const OS_TCB *) task->handle)->CyclesTotal;
+}
+#endif
+#endif // RUN_TIME_STATS
+
+
+/**
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout.
+ * @return: the timeout in kernel ticks, rounded up
+ */
+static uint32_t to_ticks(uint32_t timeout_ms) {
+    if (timeout_ms == RTOS_FOREVER) {
+        return osWaitForever;
+    }
+    return (uint32_t) (((uint64_t) timeout_ms * osKernelGetTickFreq() + 999) / 1000);
+}
+
+
+/**
+ * entry of every task thread.
+ * @param arg: the task.
+ */
+static void task_entry(void *arg) {
+    rtos_task *task = (rtos_task *) arg;
+    task->fn(task);
+    osThreadExit();
+}
+
+
+/**
+ * creates a task, it starts running once rtos_start is called (right away if it already was).
+ * @param task: the task, static.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_task_create(rtos_task *task) {
+    if (task_count == RTOS_MAX_TASKS) {
+        return -1;
+    }
+    osThreadAttr_t attr = {0};
+    attr.name = task->name;
+    attr.stack_size = task->stack_size;
+    attr.priority = prio_map[task->prio];
+    tasks[task_count++] = task;
+    task->handle = osThreadNew(task_entry, task, &attr);
+    if (task->handle == NULL) {
+        task_count--;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * starts the kernel, doesn't return.
+ */
+void rtos_start(void) {
+    sl_system_kernel_start();
+}
+
+
+/**
+ * @param ev: the event.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_event_init(rtos_event *ev) {
+    ev->handle = osSemaphoreNew(1, 0, NULL);
+    return ev->handle ? 0 : -1;
+}
+
+
+/**
+ * wakes the task waiting on the event, or the next one that waits. safe to call from interrupts.
+ * @param ev: the event.
+ */
+void rtos_event_signal(rtos_event *ev) {
+    /* fails with osErrorResource when the event is already signalled, it stays signalled once */
+    osSemaphoreRelease(ev->handle);
+}
+
+
+/**
+ * waits until the event is signalled, signals that came while nobody waited are kept as one.
+ * @param ev: the event.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout.
+ * @return: 0 when signalled, -1 on timeout
+ */
+int rtos_event_wait(rtos_event *ev, uint32_t timeout_ms) {
+    osStatus_t rc = osSemaphoreAcquire(ev->handle, to_ticks(timeout_ms));
+    return (rc == osOK) ? 0 : -1;
+}
+
+
+/**
+ * @param q: the queue.
+ * @param count: maximum items in the queue.
+ * @param item_size: bytes per item.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_queue_init(rtos_queue *q, uint32_t count, uint32_t item_size) {
+    q->handle = osMessageQueueNew(count, item_size, NULL);
+    return q->handle ? 0 : -1;
+}
+
+
+/**
+ * copies an item to the end of the queue, doesn't wait for room. safe to call from interrupts.
+ * @param q: the queue.
+ * @param item: item_size bytes.
+ * @return: 0 on success, -1 if the queue is full (the item is counted in METRIC_QUEUE_DROPS)
+ */
+int rtos_queue_put(rtos_queue *q, const void *item) {
+    if (osMessageQueuePut(q->handle, item, 0, 0) != osOK) {
+        METRIC_INC(METRIC_QUEUE_DROPS);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * takes the first item of the queue, waits for one if it is empty.
+ * @param q: the queue.
+ * @param item: output, item_size bytes.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout, 0 to not wait.
+ * @return: 0 on success, -1 on timeout
+ */
+int rtos_queue_get(rtos_queue *q, void *item, uint32_t timeout_ms) {
+    osStatus_t rc = osMessageQueueGet(q->handle, item, NULL, to_ticks(timeout_ms));
+    return (rc == osOK) ? 0 : -1;
+}
+
+
+/**
+ * @param m: the mutex, recursive, the owner inherits the priority of the tasks waiting on it.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_mutex_init(rtos_mutex *m) {
+    osMutexAttr_t attr = {0};
+    attr.attr_bits = osMutexRecursive | osMutexPrioInherit;
+    m->handle = osMutexNew(&attr);
+    return m->handle ? 0 : -1;
+}
+
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_lock(rtos_mutex *m) {
+    osMutexAcquire(m->handle, osWaitForever);
+}
+
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_unlock(rtos_mutex *m) {
+    osMutexRelease(m->handle);
+}
+
+
+/**
+ * sets the cpu_metric of every task to its share of the cpu since the last report, in permille.
+ * the kernel counts the run time of a task when it switches it out, the reporting task misses
+ * the time since its last switch. the counters are 32 bit, the report must come before they wrap.
+ */
+void rtos_cpu_report(void) {
+#ifdef RUN_TIME_STATS
+    int32_t lock = osKernelLock();  /* the counters of all the tasks from the same moment */
+    uint32_t now = run_clock();
+    uint32_t period = now - report_clock;
+    for (int i = 0; i < task_count && period; i++) {
+        rtos_task *task = tasks[i];
+        uint32_t run = run_time(task);
+        uint32_t busy = run - (uint32_t) task->reported_run;
+        task->reported_run = run;
+        if (task->cpu_metric != METRIC_COUNT) {
+            metric_set(task->cpu_metric, (uint32_t) ((uint64_t) busy * 1000 / period));
+        }
+    }
+    report_clock = now;
+    osKernelRestoreLock(lock);
+#endif
+}
+
+
+/**
+ * @param task: a created task.
+ * @return: the fewest bytes of its stack the task had left since it started (its high water mark)
+ */
+uint32_t rtos_stack_free(const rtos_task *task) {
+    /* the kernel fills the stack when it creates the thread and finds the first byte that changed */
+    return osThreadGetStackSpace((osThreadId_t) task->handle);
+}
+
+
+/**
+ * sets the stack_metric of every task to rtos_stack_free, a task near 0 needs a bigger stack.
+ */
+void rtos_stack_report(void) {
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i]->stack_metric != METRIC_COUNT) {
+            metric_set(tasks[i]->stack_metric, rtos_stack_free(tasks[i]));
+        }
+    }
+}
+
+#endif // SL_CATALOG_KERNEL_PRESENT
@@ -0,0 +1,439 @@
+#include "rtos.h"
+#if defined(RTOS_POSIX)
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * host port of rtos.h. the "interrupts" of a host build (the serial reader, the timers) are
+ * threads too, so the functions that are safe to call from interrupts just take the lock.
+ * the priorities map to SCHED_FIFO when the process may use it, otherwise they are ignored.
+ * the cpu shares come from the cpu clock of every thread, the run time the kernel counts for it.
+ * a task gets HOST_STACK_EXTRA more stack than its stack_size (x86-64 frames and libc are bigger
+ * than the target ones), rtos_stack_free still counts against stack_size from where the body starts.
+ * link with -z now for it, the lazy binding of the first call to a libc function takes a few KB.
+ * add the smartDoor directory with -iquote, on the include path our sched.h hides <sched.h>.
+ */
+
+#define HOST_STACK_EXTRA (64 * 1024)
+#define STACK_FILL 0xA5
+
+typedef struct posix_thread {
+    uint8_t *stack;               // lowest address of the stack, it grows down towards it
+    size_t size;
+    volatile uintptr_t entry_sp;  // the frame the task body was called from
+    clockid_t cpu_clock;          // the run time of the thread, valid while has_clock
+    bool has_clock;
+    uint64_t run_end;             // the run time when the task body returned
+} posix_thread;
+
+typedef struct posix_event {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool signalled;
+} posix_event;
+
+typedef struct posix_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t item_size;
+    uint32_t head;
+    uint32_t used;
+    uint8_t data[];
+} posix_queue;
+
+static rtos_task *tasks[RTOS_MAX_TASKS];
+static int task_count = 0;
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;  // the cpu clocks, one goes away with its thread
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static bool started = false;
+static uint64_t report_time = 0;  // now_us of the last rtos_cpu_report
+
+
+/**
+ * @return: microseconds on the monotonic clock
+ */
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * @param th: the thread of a task, run_lock held.
+ * @return: microseconds the thread ran
+ */
+static uint64_t run_time(const posix_thread *th) {
+    struct timespec ts;
+    if (!th->has_clock || clock_gettime(th->cpu_clock, &ts) == -1) {
+        return th->run_end;
+    }
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * @param timeout_ms: the timeout from now.
+ * @param ts: output, the absolute CLOCK_MONOTONIC deadline.
+ */
+static void deadline(uint32_t timeout_ms, struct timespec *ts) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+
+/**
+ * @param cond: the condition variable, waits on CLOCK_MONOTONIC.
+ */
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+/**
+ * waits on cond until pred(arg) holds.
+ * @param cond: the condition variable.
+ * @param lock: held by the caller.
+ * @param pred: the condition to wait for.
+ * @param arg: argument for pred.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout.
+ * @return: 0 when pred holds, -1 on timeout
+ */
+static int cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, bool (*pred)(void *), void *arg,
+                     uint32_t timeout_ms) {
+    struct timespec ts;
+    if (timeout_ms != RTOS_FOREVER) {
+        deadline(timeout_ms, &ts);
+    }
+    int rc = 0;
+    while (!pred(arg) && rc == 0) {
+        rc = (timeout_ms == RTOS_FOREVER) ? pthread_cond_wait(cond, lock) : pthread_cond_timedwait(cond, lock, &ts);
+    }
+    return pred(arg) ? 0 : -1;
+}
+
+
+/**
+ * @return: true once rtos_start was called
+ */
+static bool is_started(void *arg) {
+    (void) arg;
+    return started;
+}
+
+
+/**
+ * entry of every task thread.
+ * @param arg: the task.
+ * @return: NULL
+ */
+static void *task_entry(void *arg) {
+    rtos_task *task = (rtos_task *) arg;
+    posix_thread *th = task->handle;
+    th->entry_sp = (uintptr_t) __builtin_frame_address(0);
+    pthread_mutex_lock(&run_lock);
+    th->has_clock = (pthread_getcpuclockid(pthread_self(), &th->cpu_clock) == 0);
+    pthread_mutex_unlock(&run_lock);
+    pthread_mutex_lock(&start_lock);
+    cond_wait(&start_cond, &start_lock, is_started, NULL, RTOS_FOREVER);
+    pthread_mutex_unlock(&start_lock);
+    task->fn(task);
+    pthread_mutex_lock(&run_lock);
+    th->run_end = run_time(th);
+    th->has_clock = false;
+    pthread_mutex_unlock(&run_lock);
+    return NULL;
+}
+
+
+/**
+ * creates a task, it starts running once rtos_start is called (right away if it already was).
+ * @param task: the task, static.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_task_create(rtos_task *task) {
+    if (task_count == RTOS_MAX_TASKS) {
+        return -1;
+    }
+    posix_thread *th = calloc(1, sizeof(posix_thread));
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = (task->stack_size + HOST_STACK_EXTRA + page - 1) / page * page;
+    if (th == NULL || posix_memalign((void **) &th->stack, page, size) != 0) {
+        free(th);
+        return -1;
+    }
+    memset(th->stack, STACK_FILL, size);
+    th->size = size;
+    task->handle = th;
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct sched_param param = {0};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1 + task->prio;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    pthread_attr_setstack(&attr, th->stack, size);
+    tasks[task_count++] = task;
+    int rc = pthread_create(&thread, &attr, task_entry, task);
+    if (rc != 0) {
+        /* no permission for real time priorities, run with the default scheduling */
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(&thread, &attr, task_entry, task);
+    }
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        task_count--;
+        task->handle = NULL;
+        free(th->stack);
+        free(th);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+
+/**
+ * starts the kernel, doesn't return.
+ */
+void rtos_start(void) {
+    report_time = now_us();
+    pthread_mutex_lock(&start_lock);
+    started = true;
+    pthread_cond_broadcast(&start_cond);
+    pthread_mutex_unlock(&start_lock);
+    while (1) {
+        pause();
+    }
+}
+
+
+/**
+ * @param ev: the event.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_event_init(rtos_event *ev) {
+    posix_event *e = calloc(1, sizeof(posix_event));
+    if (e == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&e->lock, NULL);
+    cond_init(&e->cond);
+    ev->handle = e;
+    return 0;
+}
+
+
+/**
+ * wakes the task waiting on the event, or the next one that waits. safe to call from interrupts.
+ * @param ev: the event.
+ */
+void rtos_event_signal(rtos_event *ev) {
+    posix_event *e = ev->handle;
+    pthread_mutex_lock(&e->lock);
+    e->signalled = true;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+}
+
+
+/**
+ * @return: true if the event is signalled
+ */
+static bool event_set(void *arg) {
+    return ((posix_event *) arg)->signalled;
+}
+
+
+/**
+ * waits until the event is signalled, signals that came while nobody waited are kept as one.
+ * @param ev: the event.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout.
+ * @return: 0 when signalled, -1 on timeout
+ */
+int rtos_event_wait(rtos_event *ev, uint32_t timeout_ms) {
+    posix_event *e = ev->handle;
+    pthread_mutex_lock(&e->lock);
+    int rc = cond_wait(&e->cond, &e->lock, event_set, e, timeout_ms);
+    e->signalled = false;
+    pthread_mutex_unlock(&e->lock);
+    return rc;
+}
+
+
+/**
+ * @param q: the queue.
+ * @param count: maximum items in the queue.
+ * @param item_size: bytes per item.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_queue_init(rtos_queue *q, uint32_t count, uint32_t item_size) {
+    posix_queue *pq = calloc(1, sizeof(posix_queue) + count * item_size);
+    if (pq == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&pq->lock, NULL);
+    cond_init(&pq->cond);
+    pq->count = count;
+    pq->item_size = item_size;
+    q->handle = pq;
+    return 0;
+}
+
+
+/**
+ * copies an item to the end of the queue, doesn't wait for room. safe to call from interrupts.
+ * @param q: the queue.
+ * @param item: item_size bytes.
+ * @return: 0 on success, -1 if the queue is full (the item is counted in METRIC_QUEUE_DROPS)
+ */
+int rtos_queue_put(rtos_queue *q, const void *item) {
+    posix_queue *pq = q->handle;
+    pthread_mutex_lock(&pq->lock);
+    if (pq->used == pq->count) {
+        pthread_mutex_unlock(&pq->lock);
+        METRIC_INC(METRIC_QUEUE_DROPS);
+        return -1;
+    }
+    uint32_t tail = (pq->head + pq->used) % pq->count;
+    memcpy(pq->data + tail * pq->item_size, item, pq->item_size);
+    pq->used++;
+    pthread_cond_signal(&pq->cond);
+    pthread_mutex_unlock(&pq->lock);
+    return 0;
+}
+
+
+/**
+ * @return: true if the queue has items
+ */
+static bool queue_used(void *arg) {
+    return ((posix_queue *) arg)->used > 0;
+}
+
+
+/**
+ * takes the first item of the queue, waits for one if it is empty.
+ * @param q: the queue.
+ * @param item: output, item_size bytes.
+ * @param timeout_ms: RTOS_FOREVER to wait without a timeout, 0 to not wait.
+ * @return: 0 on success, -1 on timeout
+ */
+int rtos_queue_get(rtos_queue *q, void *item, uint32_t timeout_ms) {
+    posix_queue *pq = q->handle;
+    pthread_mutex_lock(&pq->lock);
+    int rc = cond_wait(&pq->cond, &pq->lock, queue_used, pq, timeout_ms);
+    if (rc == 0) {
+        memcpy(item, pq->data + pq->head * pq->item_size, pq->item_size);
+        pq->head = (pq->head + 1) % pq->count;
+        pq->used--;
+    }
+    pthread_mutex_unlock(&pq->lock);
+    return rc;
+}
+
+
+/**
+ * @param m: the mutex, recursive, the owner inherits the priority of the tasks waiting on it.
+ * @return: 0 on success, -1 otherwise
+ */
+int rtos_mutex_init(rtos_mutex *m) {
+    pthread_mutex_t *lock = malloc(sizeof(pthread_mutex_t));
+    if (lock == NULL) {
+        return -1;
+    }
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    m->handle = lock;
+    return 0;
+}
+
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_lock(rtos_mutex *m) {
+    pthread_mutex_lock(m->handle);
+}
+
+
+/**
+ * @param m: the mutex.
+ */
+void rtos_mutex_unlock(rtos_mutex *m) {
+    pthread_mutex_unlock(m->handle);
+}
+
+
+/**
+ * sets the cpu_metric of every task to its share of the cpu since the last report, in permille.
+ * on a host with more cores than one the shares may add up to more than 1000.
+ */
+void rtos_cpu_report(void) {
+    pthread_mutex_lock(&run_lock);
+    uint64_t now = now_us();
+    uint64_t period = now - report_time;
+    for (int i = 0; i < task_count && period; i++) {
+        rtos_task *task = tasks[i];
+        uint64_t run = run_time(task->handle);
+        uint64_t busy = run - task->reported_run;
+        task->reported_run = run;
+        if (task->cpu_metric != METRIC_COUNT) {
+            metric_set(task->cpu_metric, (uint32_t) (busy * 1000 / period));
+        }
+    }
+    report_time = now;
+    pthread_mutex_unlock(&run_lock);
+}
+
+
+/**
+ * @param task: a created task.
+ * @return: the fewest bytes of its stack the task had left since it started (its high water mark)
+ */
+uint32_t rtos_stack_free(const rtos_task *task) {
+    const posix_thread *th = task->handle;
+    if (th->entry_sp == 0) {
+        return task->stack_size;  /* not started yet */
+    }
+    size_t untouched = 0;
+    while (untouched < th->size && th->stack[untouched] == STACK_FILL) {
+        untouched++;
+    }
+    uintptr_t used = th->entry_sp - (uintptr_t) (th->stack + untouched);
+    return used < task->stack_size ? (uint32_t) (task->stack_size - used) : 0;
+}
+
+
+/**
+ * sets the stack_metric of every task to rtos_stack_free, a task near 0 needs a bigger stack.
+ */
+void rtos_stack_report(void) {
+    for (int i = 0; i < task_count; i++) {
+        if (tasks[i]->stack_metric != METRIC_COUNT) {
+            metric_set(tasks[i]->stack_metric, rtos_stack_free(tasks[i]));
+        }
+    }
+}
+
+#endif // RTOS_POSIX
@@ -0,0 +1,127 @@
+#include "sched.h"
+#include <stddef.h>
+#include "em_core.h"
+#include "em_emu.h"
+#include "timer.h"
+
+static sched_task *tasks = NULL;
+static sched_task *last = NULL;
+static sched_task *running = NULL;  /* the task in its fn, NULL between the tasks */
+
+
+/**
+ * adds a task, it runs on the first pass.
+ * @param task: the task, static.
+ */
+void sched_add(sched_task *task) {
+    task->next = NULL;
+    task->yielded = true;
+    task->idle_since = cur_time();
+    if (last) {
+        last->next = task;
+    } else {
+        tasks = task;
+    }
+    last = task;
+}
+
+
+/**
+ * @param task: a task.
+ * @return: cur_time the running task was last seen not ready, the earliest its wake could have
+ * happened (e.g. the arrival of the message it is handling)
+ */
+uint64_t sched_idle_since(const sched_task *task) {
+    return task->idle_since;
+}
+
+
+/**
+ * @param task: an added task.
+ * @return: true if the task should run now, it has work or it yielded
+ */
+bool sched_is_ready(const sched_task *task) {
+    return task->yielded || (task->ready && task->ready());
+}
+
+
+/**
+ * @return: true if any task should run now
+ */
+static bool any_ready(void) {
+    for (sched_task *task = tasks; task; task = task->next) {
+        if (sched_is_ready(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * runs the task once.
+ * @param task: a ready task.
+ * @param now: cur_time.
+ */
+static void dispatch(sched_task *task, uint64_t now) {
+    sched_task *outer = running;
+    running = task;
+    int rc = task->fn(task);
+    running = outer;
+    uint64_t end = cur_time();
+    task->yielded = (rc == PT_YIELDED);
+    if (task->latency_metric != SCHED_NO_METRIC) {
+        metric_max(task->latency_metric, (uint32_t) (now - task->idle_since));
+    }
+    metric_max(METRIC_SLICE_MAX_MS, (uint32_t) (end - now));
+    task->idle_since = end;
+}
+
+
+/**
+ * runs a task now if it is ready, from inside a long wait of another task.
+ * @param task: an added task, never the one that is running.
+ * @return: true if it ran
+ */
+bool sched_poll(sched_task *task) {
+    uint64_t now = cur_time();
+    if (task == running || !sched_is_ready(task)) {
+        return false;
+    }
+    dispatch(task, now);
+    return true;
+}
+
+
+/**
+ * runs the tasks forever.
+ * @param each_pass: called after every pass over the tasks (e.g. to drain the debug log), returns
+ * true while it has more work so the scheduler doesn't sleep. NULL for none.
+ */
+void sched_run(bool (*each_pass)(void)) {
+    while (1) {
+        bool ran = false;
+        for (sched_task *task = tasks; task; task = task->next) {
+            uint64_t now = cur_time();
+            if (!sched_is_ready(task)) {
+                task->idle_since = now;
+                continue;
+            }
+            dispatch(task, now);
+            ran = true;
+        }
+        if (each_pass && each_pass()) {
+            ran = true;
+        }
+        if (ran) {
+            continue;
+        }
+        /* an interrupt between the check and WFI leaves its flag pending, WFI returns at once */
+        CORE_DECLARE_IRQ_STATE;
+        CORE_ENTER_CRITICAL();
+        if (!any_ready()) {
+            EMU_EnterEM1();
+        }
+        CORE_EXIT_CRITICAL();
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pt.h"
+#include "metrics.h"
+
+/*
+ * cooperative scheduler.
+ * a task is a protothread (pt.h) with a ready predicate, the scheduler calls every ready task
+ * in the order they were added, and sleeps in EM1 when none is ready. the predicates are
+ * levels (bytes in the uart buffer, a pending bluetooth event, a flag set by a timer), they
+ * are checked again with interrupts masked right before sleeping, so the interrupt that made
+ * one of them true always wakes the core.
+ * a task holds the core until it waits or yields, the longest run is the worst latency of
+ * all the other tasks (METRIC_SLICE_MAX_MS).
+ */
+
+#define SCHED_NO_METRIC METRIC_COUNT
+
+typedef struct sched_task sched_task;
+
+/**
+ * the protothread of a task.
+ * @param task: the task, task->pt is its protothread.
+ * @return: PT_WAITING, PT_YIELDED or PT_ENDED
+ */
+typedef int (*sched_fn)(sched_task *task);
+
+/**
+ * @return: true if the task has work, must be cheap and safe with interrupts masked
+ */
+typedef bool (*sched_ready)(void);
+
+struct sched_task {
+    const char *name;
+    sched_fn fn;
+    sched_ready ready;         // NULL if the task runs only when it yields (or once at the start)
+    metric_id latency_metric;  // gauge of the worst wake to run latency, SCHED_NO_METRIC for none
+    pt pt;
+    bool yielded;              // run again on the next pass
+    uint64_t idle_since;       // cur_time the task was last seen not ready, its wake came after it
+    sched_task *next;
+};
+
+#define SCHED_TASK(NAME, FN, READY, METRIC) {(NAME), (FN), (READY), (METRIC), {0}, true, 0, NULL}
+
+/**
+ * adds a task, it runs on the first pass.
+ * @param task: the task, static.
+ */
+void sched_add(sched_task *task);
+
+/**
+ * @param task: a task.
+ * @return: cur_time the running task was last seen not ready, the earliest its wake could have
+ * happened (e.g. the arrival of the message it is handling)
+ */
+uint64_t sched_idle_since(const sched_task *task);
+
+/**
+ * @param task: an added task.
+ * @return: true if the task should run now, it has work or it yielded
+ */
+bool sched_is_ready(const sched_task *task);
+
+/**
+ * runs a task now if it is ready, from inside a long wait of another task (e.g. the bluetooth
+ * events while the modem answers, see SerialSetWaitHook). its latency metric counts as usual.
+ * @param task: an added task, never the one that is running.
+ * @return: true if it ran
+ */
+bool sched_poll(sched_task *task);
+
+/**
+ * runs the tasks forever.
+ * @param each_pass: called after every pass over the tasks (e.g. to drain the debug log), returns
+ * true while it has more work so the scheduler doesn't sleep. NULL for none.
+ */
+void sched_run(bool (*each_pass)(void));
+
+#endif /* SCHED_H_ */
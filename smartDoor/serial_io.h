@@ -1,13 +1,26 @@
 #ifndef SERIAL_IO_H
 #define SERIAL_IO_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 //#define DEBUG
+//#define DEBUG_SYNC  /* print on the LCD right away instead of deferring to dlog_drain (see dlog.h) */
 #ifdef DEBUG
+#ifdef DEBUG_SYNC
 #define PRINT_DEBUG(MSG) lcd_printf("%s\n", MSG);
 #define PRINTF_DEBUG(FORMAT, ...) lcd_printf(FORMAT, ##__VA_ARGS__);
+#define DEBUG_DRAIN()
+#else
+#include "dlog.h"
+#define PRINT_DEBUG(MSG) DLOG("%s\n", MSG);
+#define PRINTF_DEBUG(FORMAT, ...) DLOG(FORMAT, ##__VA_ARGS__);
+#define DEBUG_DRAIN() dlog_drain()
+#endif
 #else
 #define PRINT_DEBUG(MSG)
 #define PRINTF_DEBUG(FORMAT, ...)
+#define DEBUG_DRAIN()
 #endif
 
 
@@ -19,6 +32,20 @@
  */
 int SerialInit(char* port, unsigned int baud);
 
+/**
+ * Enables or disables RTS/CTS hardware flow control.
+ * @param enable: 1 to enable, 0 to disable.
+ * @return 0 on success, -1 otherwise.
+ */
+int SerialSetFlowControl(int enable);
+
+/**
+ * Changes the baud rate, the pending output is sent with the old rate first.
+ * @param baud: the new baud rate.
+ * @return 0 on success, -1 otherwise.
+ */
+int SerialSetBaud(unsigned int baud);
+
 /**
  * @brief Receives data from serial connection.
  * @param buf: the buffer that receives the input.
@@ -41,6 +68,35 @@ int SerialSend(char *buf, unsigned int size);
  */
 void SerialFlushInputBuff(void);
 
+/**
+ * @return number of received bytes waiting in the input buffer, safe with interrupts masked.
+ */
+unsigned int SerialAvailable(void);
+
+/**
+ * Sets a function the rx interrupt calls after it received data, e.g. to wake the task that reads it.
+ * @param cb: the function, called from the interrupt, NULL for none.
+ */
+void SerialSetRxNotify(void (*cb)(void));
+
+/**
+ * Sets work to do while a read or a write waits on the uart, e.g. the bluetooth events while an
+ * AT exchange waits for the modem. the wait calls run whenever ready returns true, and checks
+ * ready again with interrupts masked before it sleeps. run isn't re-entered by its own waits.
+ * only the waits without a kernel call it, with one the other tasks run anyway.
+ * @param ready: true if run has work, cheap and safe with interrupts masked. NULL for none.
+ * @param run: does the work.
+ */
+void SerialSetWaitHook(bool (*ready)(void), void (*run)(void));
+
+/**
+ * Reports how the time since SerialInit was split between running and sleeping
+ * while waiting on the uart.
+ * @param active_us: output, microseconds the core was awake.
+ * @param sleep_us: output, microseconds the core slept waiting on the uart.
+ */
+void SerialGetPowerStats(uint64_t *active_us, uint64_t *sleep_us);
+
 /**
  * Disable the serial connection of the uart.
  * return: 0 if succeeded in closing the port and -1 otherwise.
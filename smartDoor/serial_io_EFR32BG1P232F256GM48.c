@@ -1,8 +1,28 @@
 #include "em_usart.h"
+#include "em_core.h"
+#include "em_emu.h"
 #include "serial_io.h"
 #include "timer.h"
+#include "metrics.h"
+#include "rtos.h"
+#ifdef SL_COMPONENT_CATALOG_PRESENT
+#include "sl_component_catalog.h"
+#endif // SL_COMPONENT_CATALOG_PRESENT
+#if defined(SL_CATALOG_POWER_MANAGER_PRESENT)
+#include "sl_power_manager.h"
+#endif // SL_CATALOG_POWER_MANAGER_PRESENT
 
 #define CIRCULAR_BUF_SIZE 256
+#define RX_LOW_WATERMARK (CIRCULAR_BUF_SIZE / 2)  /* resume receiving below this level */
+#define TX_TIMEOUT 2000  /* ms a send may take on top of its line time, e.g. CTS held down by a hung modem */
+
+/* RTS/CTS pins, the defaults are the WSTK virtual COM port lines (CTS PA2, RTS PA3) */
+#ifndef SERIAL_CTS_LOC
+#define SERIAL_CTS_LOC _USART_ROUTELOC1_CTSLOC_LOC30
+#endif
+#ifndef SERIAL_RTS_LOC
+#define SERIAL_RTS_LOC _USART_ROUTELOC1_RTSLOC_LOC30
+#endif
 
 
 static USART_TypeDef* uart;
@@ -15,44 +35,201 @@ volatile struct circular_buf {
     bool overflow;  /* buffer overflow indicator */
 } rxBuf = {0}, txBuf = {0};
 
+static bool flow_control = false;  /* RTS/CTS enabled, see SerialSetFlowControl */
+static unsigned int line_baud = 0;  /* current baud rate, for the send timeouts */
+static uint64_t init_time_us = 0;  /* time SerialInit was called */
+static uint64_t sleep_time_us = 0;  /* time spent sleeping in uart_wait */
+static void (*rx_notify)(void) = NULL;  /* see SerialSetRxNotify */
+static bool (*hook_ready)(void) = NULL;  /* see SerialSetWaitHook */
+static void (*hook_run)(void) = NULL;
+static bool in_hook = false;
+#ifdef RTOS_PRESENT
+static rtos_event uart_event;  /* signalled by the USART interrupts and the wait timer */
+#define UART_WAKE() rtos_event_signal(&uart_event)
+#else
+#define UART_WAKE()
+#endif
+
+typedef bool (*wait_cond)(uint32_t arg);
+
+
+/**
+ * @return: true while there is nothing to read
+ */
+static bool rx_empty(uint32_t arg) {
+    (void) arg;
+    return rxBuf.pendingBytes < 1;
+}
+
+
+/**
+ * @param data_len: amount of bytes we want to write.
+ * @return: true while data_len bytes don't fit in the tx buffer
+ */
+static bool tx_full(uint32_t data_len) {
+    return (txBuf.pendingBytes + data_len) > CIRCULAR_BUF_SIZE;
+}
+
+
+/**
+ * @return: true while the tx buffer isn't sent yet
+ */
+static bool tx_pending(uint32_t arg) {
+    (void) arg;
+    return txBuf.pendingBytes > 0;
+}
+
+
+/**
+ * timer callback of the uart waits, marks the wait as expired (the interrupt itself wakes the core).
+ */
+static void wait_timeout(soft_timer *timer, void *data) {
+    (void) timer;
+    *((volatile bool *) data) = true;
+    UART_WAKE();
+}
+
+
+/**
+ * @return: true if the wait hook has work and isn't running already, safe with interrupts masked
+ */
+static bool hook_pending(void) {
+    return hook_ready && !in_hook && hook_ready();
+}
+
+
+/**
+ * sleeps in EM1 while cond(arg) holds, the USART interrupts or the wait timer wake the core.
+ * the USART needs the HF clocks so we never go deeper than EM1 while waiting.
+ * cond is checked with interrupts masked right before sleeping, so an interrupt that
+ * arrives in between still wakes the core (WFI returns on a pending interrupt).
+ * without a kernel the wait hook runs in between (see SerialSetWaitHook), its ready predicate
+ * is checked with cond so the interrupt that makes it true wakes the core too.
+ * with a kernel the task blocks on uart_event instead and the other tasks run meanwhile,
+ * an interrupt between the check and the wait leaves the event signalled.
+ * @param cond: the condition to wait on.
+ * @param arg: argument for cond.
+ * @param expired: set by the wait timer (see wait_timeout), NULL to wait without a timeout.
+ * @return: 0 when cond doesn't hold anymore, -1 on timeout
+ */
+static int uart_wait(wait_cond cond, uint32_t arg, volatile bool *expired) {
+    if (!cond(arg)) {
+        return 0;
+    }
+#if defined(SL_CATALOG_POWER_MANAGER_PRESENT)
+    sl_power_manager_add_em_requirement(SL_POWER_MANAGER_EM1);
+#endif
+    while (cond(arg) && !(expired && *expired)) {
+#ifndef RTOS_PRESENT
+        if (hook_pending()) {
+            in_hook = true;
+            hook_run();
+            in_hook = false;
+            continue;
+        }
+#endif
+        uint64_t sleep_start = cur_time_us();
+#ifdef RTOS_PRESENT
+        rtos_event_wait(&uart_event, RTOS_FOREVER);
+#else
+        CORE_DECLARE_IRQ_STATE;
+        CORE_ENTER_CRITICAL();
+        if (cond(arg) && !(expired && *expired) && !hook_pending()) {
+            EMU_EnterEM1();
+        }
+        CORE_EXIT_CRITICAL();
+#endif
+        sleep_time_us += cur_time_us() - sleep_start;
+    }
+#if defined(SL_CATALOG_POWER_MANAGER_PRESENT)
+    sl_power_manager_remove_em_requirement(SL_POWER_MANAGER_EM1);
+#endif
+    return cond(arg) ? -1 : 0;
+}
+
+
+/**
+ * re-enables the rx interrupt once the reader made room in rxBuf.
+ * while the interrupt is off the USART rx buffer fills up and the hardware deasserts RTS,
+ * so the modem holds its data instead of it being dropped.
+ */
+static void rx_resume(void) {
+    if (!flow_control) {
+        return;
+    }
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_CRITICAL();
+    if (rxBuf.pendingBytes <= RX_LOW_WATERMARK) {
+        USART_IntEnable(uart, USART_IF_RXDATAV);
+    }
+    CORE_EXIT_CRITICAL();
+}
+
 
 /**
  * function that sends data using circular buf.
  * @param data: pointer to string.
  * @param data_len: lenth of the string.
+ * @param expired: set by the wait timer when the send times out.
+ * @return: 0 when the data is in the buffer, -1 if it doesn't fit or there was no room in time
  */
-void UartPutData(const uint8_t * data, uint32_t data_len) {
-    if (data_len > CIRCULAR_BUF_SIZE) {
-        return;
-    }
-    if ((txBuf.pendingBytes + data_len) > CIRCULAR_BUF_SIZE) {
-        while ((txBuf.pendingBytes + data_len) > CIRCULAR_BUF_SIZE) {}
+int UartPutData(const uint8_t * data, uint32_t data_len, volatile bool *expired) {
+    if (data_len > CIRCULAR_BUF_SIZE || uart_wait(tx_full, data_len, expired) == -1) {
+        return -1;
     }
     uint32_t i = 0;
     while (i < data_len) {
         txBuf.data[txBuf.wrI] = *(data + i);
         txBuf.wrI = (txBuf.wrI + 1) & (CIRCULAR_BUF_SIZE - 1);
-        txBuf.pendingBytes++;
         i++;
     }
+    /* the tx interrupt decrements it, and it sends only the bytes that are counted */
+    CORE_ATOMIC_SECTION(txBuf.pendingBytes += data_len;)
     USART_IntEnable(uart, USART_IF_TXBL);
+    return 0;
+}
+
+
+/**
+ * waits until the tx buffer and the shift register are empty, the last stop bit is out.
+ * @param expired: set by the wait timer when the send times out.
+ * @return: 0 when everything was sent, -1 on timeout (e.g. CTS stayed down)
+ */
+static int tx_drain(volatile bool *expired) {
+    if (uart_wait(tx_pending, 0, expired) == -1) {
+        return -1;
+    }
+    while (!(uart->STATUS & USART_STATUS_TXC)) {
+        if (*expired) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * starts the wait timer of a send.
+ * @param timer: the timer, stopped by the caller.
+ * @param size: bytes to send.
+ * @param expired: set when the send took longer than its line time and TX_TIMEOUT.
+ */
+static void tx_timer_start(soft_timer *timer, unsigned int size, volatile bool *expired) {
+    uint32_t line_ms = line_baud ? (uint32_t) ((uint64_t) size * 10 * 1000 / line_baud) : 0;
+    soft_timer_start(timer, TX_TIMEOUT + line_ms, wait_timeout, (void *) expired);
 }
 
 
 /**
+ * copies the pending input to data, waits for input if there is none.
  * @param data: the buffer that receives the input.
  * @param data_len: maximum bytes to read into dataPtr .
- * @param timeout_ms: read operation timeout milliseconds.
- * @return: amount of bytes read into buf, -1 on error.
+ * @param expired: set by the wait timer when the read operation times out.
+ * @return: amount of bytes read into buf, -1 on timeout.
  */
-uint32_t UartGetData(uint8_t * data, uint32_t data_len, unsigned int timeout_ms) {
-    unsigned int wait_start = cur_time();
-    if (rxBuf.pendingBytes < 1) {
-        while (rxBuf.pendingBytes < 1) {
-            if (cur_time() - wait_start >= timeout_ms) {
-                return -1;
-            }
-        }
+static uint32_t uart_get_data(uint8_t * data, uint32_t data_len, volatile bool *expired) {
+    if (uart_wait(rx_empty, 0, expired) == -1) {
+        return -1;
     }
     if (data_len > rxBuf.pendingBytes) {
         data_len = rxBuf.pendingBytes;
@@ -61,13 +238,33 @@ uint32_t UartGetData(uint8_t * data, uint32_t data_len, unsigned int timeout_ms)
     while (i < data_len) {
         *(data + i) = rxBuf.data[rxBuf.rdI];
         rxBuf.rdI = (rxBuf.rdI + 1) & (CIRCULAR_BUF_SIZE -1);
-        rxBuf.pendingBytes--;
         i++;
     }
+    /* the rx interrupt keeps adding bytes meanwhile, update the count in one step */
+    CORE_ATOMIC_SECTION(rxBuf.pendingBytes -= i;)
+    rx_resume();
     return i;
 }
 
 
+/**
+ * @param data: the buffer that receives the input.
+ * @param data_len: maximum bytes to read into dataPtr .
+ * @param timeout_ms: read operation timeout milliseconds.
+ * @return: amount of bytes read into buf, -1 on error.
+ */
+uint32_t UartGetData(uint8_t * data, uint32_t data_len, unsigned int timeout_ms) {
+    soft_timer timer = {0};
+    volatile bool expired = (timeout_ms == 0);
+    if (!expired) {
+        soft_timer_start(&timer, timeout_ms, wait_timeout, (void *) &expired);
+    }
+    uint32_t rc = uart_get_data(data, data_len, &expired);
+    soft_timer_stop(&timer);
+    return rc;
+}
+
+
 /**
  * @brief Initialises the serial connection.
  * @param port: the port to connected to. e.g: /dev/ttyUSB0, /dev/ttyS1 for Linux and COM8, COM10, COM53 for Windows.
@@ -78,6 +275,14 @@ int SerialInit(char* port, unsigned int baud) {
     (void) port;
     uart = USART0;
     our_timer_init();
+    init_time_us = cur_time_us();
+    sleep_time_us = 0;
+    line_baud = baud;
+#ifdef RTOS_PRESENT
+    if (uart_event.handle == NULL && rtos_event_init(&uart_event) == -1) {
+        return -1;
+    }
+#endif
     CMU_ClockEnable(cmuClock_HFPER, true);
     CMU_ClockEnable(cmuClock_USART0, true);
     CMU_ClockEnable(cmuClock_GPIO, true);
@@ -103,6 +308,7 @@ int SerialInit(char* port, unsigned int baud) {
     uart_init.prsRxCh      = usartPrsRxCh0;  /* Select PRS channel if enabled */
     USART_InitAsync(uart, &uart_init);
 
+    flow_control = false;
     uart->ROUTEPEN |= USART_ROUTEPEN_RXPEN | USART_ROUTEPEN_TXPEN;
     uart->ROUTELOC0 = (USART0->ROUTELOC0 & ~(_USART_ROUTELOC0_TXLOC_MASK | _USART_ROUTELOC0_RXLOC_MASK)) |
                       (_USART_ROUTELOC0_TXLOC_LOC0 << _USART_ROUTELOC0_TXLOC_SHIFT) |
@@ -122,6 +328,56 @@ int SerialInit(char* port, unsigned int baud) {
 }
 
 
+/**
+ * Enables or disables RTS/CTS hardware flow control.
+ * CTS stops the transmitter while the modem is busy, RTS is deasserted by the USART
+ * when its rx buffer is full, which happens when rxBuf is full (see rx_resume).
+ * @param enable: 1 to enable, 0 to disable.
+ * @return 0 on success, -1 otherwise.
+ */
+int SerialSetFlowControl(int enable) {
+    GPIO_Port_TypeDef cts_port = (GPIO_Port_TypeDef) AF_USART0_CTS_PORT(SERIAL_CTS_LOC);
+    GPIO_Port_TypeDef rts_port = (GPIO_Port_TypeDef) AF_USART0_RTS_PORT(SERIAL_RTS_LOC);
+    if (enable) {
+        GPIO_PinModeSet(cts_port, AF_USART0_CTS_PIN(SERIAL_CTS_LOC), gpioModeInput, 0);
+        GPIO_PinModeSet(rts_port, AF_USART0_RTS_PIN(SERIAL_RTS_LOC), gpioModePushPull, 0);
+        uart->ROUTELOC1 = (SERIAL_CTS_LOC << _USART_ROUTELOC1_CTSLOC_SHIFT) |
+                          (SERIAL_RTS_LOC << _USART_ROUTELOC1_RTSLOC_SHIFT);
+        uart->CTRLX |= USART_CTRLX_CTSEN;
+        uart->ROUTEPEN |= USART_ROUTEPEN_CTSPEN | USART_ROUTEPEN_RTSPEN;
+    } else {
+        uart->ROUTEPEN &= ~(USART_ROUTEPEN_CTSPEN | USART_ROUTEPEN_RTSPEN);
+        uart->CTRLX &= ~USART_CTRLX_CTSEN;
+        GPIO_PinModeSet(cts_port, AF_USART0_CTS_PIN(SERIAL_CTS_LOC), gpioModeDisabled, 0);
+        GPIO_PinModeSet(rts_port, AF_USART0_RTS_PIN(SERIAL_RTS_LOC), gpioModeDisabled, 0);
+        USART_IntEnable(uart, USART_IF_RXDATAV);
+    }
+    flow_control = enable;
+    return 0;
+}
+
+
+/**
+ * Changes the baud rate, the pending output is sent with the old rate first.
+ * @param baud: the new baud rate.
+ * @return 0 on success, -1 otherwise (the output didn't go out in time, the rate is unchanged).
+ */
+int SerialSetBaud(unsigned int baud) {
+    soft_timer timer = {0};
+    volatile bool expired = false;
+    tx_timer_start(&timer, txBuf.pendingBytes, &expired);
+    int rc = tx_drain(&expired);
+    soft_timer_stop(&timer);
+    if (rc == -1) {
+        return -1;
+    }
+    USART_BaudrateAsyncSet(uart, 0, baud, usartOVS16);
+    line_baud = baud;
+    SerialFlushInputBuff();
+    return 0;
+}
+
+
 /**
  * @brief Receives data from serial connection.
  * @param buf: the buffer that receives the input.
@@ -130,25 +386,23 @@ int SerialInit(char* port, unsigned int baud) {
  * @return amount of bytes read into buf, -1 on error.
 */
 int SerialRecv(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
-    uint32_t start = cur_time();
+    soft_timer timer = {0};
+    volatile bool expired = (timeout_ms == 0);
     uint32_t read_size = 0;
     unsigned int total_read = 0;
     int rc;
-    while(total_read < max_len) {
-        uint32_t interval = cur_time() - start;
-        if (interval >= timeout_ms) {
-            return total_read;
-        }
+    if (!expired) {
+        soft_timer_start(&timer, timeout_ms, wait_timeout, (void *) &expired);
+    }
+    while(total_read < max_len && !expired) {
         read_size = (max_len - total_read > CIRCULAR_BUF_SIZE) ? CIRCULAR_BUF_SIZE:(max_len - total_read);
-        rc = UartGetData(buf + total_read, read_size, timeout_ms - interval);
-        if (rc < 0) {
-            return total_read;
+        rc = uart_get_data(buf + total_read, read_size, &expired);
+        if (rc <= 0) {
+            break;
         }
         total_read += rc;
-        if (!rc) {
-            return total_read;
-        }
     }
+    soft_timer_stop(&timer);
     return total_read;
 }
 
@@ -157,22 +411,33 @@ int SerialRecv(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms
  * @brief Sends data through the serial connection.
  * @param buf: the buffer that contains the data to send
  * @param size: number of bytes to send
- * @return amount of bytes written into buf, -1 on error
+ * @return amount of bytes written into buf, -1 on error or when it didn't go out in time
+ * (TX_TIMEOUT after its line time, what is left in the tx buffer is sent when CTS comes back)
  */
 int SerialSend(char *buf, unsigned int size) {
+    soft_timer timer = {0};
+    volatile bool expired = false;
     uint32_t read_size = 0;
     unsigned int remain_size = size;
+    int rc = (int) size;
+    tx_timer_start(&timer, size + txBuf.pendingBytes, &expired);
     while(remain_size > 0) {
         read_size = remain_size;
         if (read_size > CIRCULAR_BUF_SIZE) {
             read_size = CIRCULAR_BUF_SIZE;
         }
         remain_size -= read_size;
-        UartPutData(buf, read_size);
+        if (UartPutData((const uint8_t *) buf, read_size, &expired) == -1) {
+            rc = -1;
+            break;
+        }
         buf += read_size;
     }
-    while(txBuf.pendingBytes);
-    return (int) size;
+    if (rc != -1 && uart_wait(tx_pending, 0, &expired) == -1) {
+        rc = -1;
+    }
+    soft_timer_stop(&timer);
+    return rc;
 }
 
 
@@ -180,9 +445,54 @@ int SerialSend(char *buf, unsigned int size) {
  * Empties the input buffer and resets the writing and reading location.
  */
 void SerialFlushInputBuff(void) {
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_CRITICAL();
     rxBuf.rdI = rxBuf.wrI;
     rxBuf.pendingBytes = 0;
     rxBuf.overflow = false;
+    CORE_EXIT_CRITICAL();
+    rx_resume();
+}
+
+
+/**
+ * @return number of received bytes waiting in the input buffer, safe with interrupts masked.
+ */
+unsigned int SerialAvailable(void) {
+    return rxBuf.pendingBytes;
+}
+
+
+/**
+ * Sets a function the rx interrupt calls after it received data, e.g. to wake the task that reads it.
+ * @param cb: the function, called from the interrupt, NULL for none.
+ */
+void SerialSetRxNotify(void (*cb)(void)) {
+    rx_notify = cb;
+}
+
+
+/**
+ * Sets work to do while a read or a write waits on the uart, see serial_io.h.
+ * @param ready: true if run has work, cheap and safe with interrupts masked. NULL for none.
+ * @param run: does the work.
+ */
+void SerialSetWaitHook(bool (*ready)(void), void (*run)(void)) {
+    hook_run = run;
+    hook_ready = ready;
+}
+
+
+/**
+ * Reports how the time since SerialInit was split between running and sleeping
+ * while waiting on the uart.
+ * @param active_us: output, microseconds the core was awake.
+ * @param sleep_us: output, microseconds the core slept in EM1 waiting on the uart.
+ */
+void SerialGetPowerStats(uint64_t *active_us, uint64_t *sleep_us) {
+    uint64_t total = cur_time_us() - init_time_us;
+    *sleep_us = sleep_time_us;
+    *active_us = total - sleep_time_us;
 }
 
 
@@ -203,15 +513,29 @@ int SerialDisable(void) {
  * UART2 RX IRQ Handler
  */
 void USART0_RX_IRQHandler(void) {
+    METRIC_INC(METRIC_UART_IRQS);
+    if (flow_control && rxBuf.pendingBytes == CIRCULAR_BUF_SIZE) {
+        /* leave the byte in the USART, RTS goes down once its buffer is full too */
+        USART_IntDisable(uart, USART_IF_RXDATAV);
+        return;
+    }
     if (uart->STATUS & USART_STATUS_RXDATAV) {
         uint8_t rxData = USART_Rx(uart);
-        rxBuf.data[rxBuf.wrI] = rxData;
-        rxBuf.wrI = (rxBuf.wrI + 1) & (CIRCULAR_BUF_SIZE - 1);  // Efficient modulo for power of 2 numbers
-        rxBuf.pendingBytes++;
-        if (rxBuf.pendingBytes > CIRCULAR_BUF_SIZE) {
+        METRIC_INC(METRIC_UART_RX_BYTES);
+        if (rxBuf.pendingBytes == CIRCULAR_BUF_SIZE) {
+            /* drop the new byte rather than overwrite data that wasn't read yet */
             rxBuf.overflow = true;
+            METRIC_INC(METRIC_UART_RX_OVERFLOWS);
+        } else {
+            rxBuf.data[rxBuf.wrI] = rxData;
+            rxBuf.wrI = (rxBuf.wrI + 1) & (CIRCULAR_BUF_SIZE - 1);  // Efficient modulo for power of 2 numbers
+            rxBuf.pendingBytes++;
         }
         USART_IntClear(USART0, USART_IF_RXDATAV);
+        UART_WAKE();
+        if (rx_notify) {
+            rx_notify();
+        }
     }
 }
 
@@ -221,14 +545,17 @@ void USART0_RX_IRQHandler(void) {
  */
 void USART0_TX_IRQHandler(void) {
     USART_IntGet(USART0);
+    METRIC_INC(METRIC_UART_IRQS);
     if (uart->STATUS & USART_STATUS_TXBL) {
         if (txBuf.pendingBytes > 0) {
             USART_Tx(uart, txBuf.data[txBuf.rdI]);
+            METRIC_INC(METRIC_UART_TX_BYTES);
             txBuf.rdI = (txBuf.rdI + 1) & (CIRCULAR_BUF_SIZE - 1);  // Efficient modulo for power of 2 numbers
             txBuf.pendingBytes--;
         }
         if (txBuf.pendingBytes == 0) {
             USART_IntDisable(uart, USART_IF_TXBL);
         }
+        UART_WAKE();
     }
 }
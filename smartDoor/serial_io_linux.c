@@ -0,0 +1,386 @@
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include "serial_io.h"
+#include "timer.h"
+#include "metrics.h"
+
+/*
+ * serial port of a Linux gateway, e.g. the EHS6 concept board on USB (cdc-acm).
+ * the port is non blocking and the waits sleep in epoll_wait, so a read that waits on the
+ * modem doesn't use the cpu. the uart metrics count the same things as on the MCU, with an
+ * epoll wake up in place of an interrupt (see SerialGetPowerStats to compare the two).
+ */
+
+#ifndef SERIAL_PORT
+#define SERIAL_PORT "/dev/ttyACM0"  /* used when SerialInit gets no port and SERIAL_PORT_ENV isn't set */
+#endif
+#define SERIAL_PORT_ENV "SMART_DOOR_SERIAL"
+#define TX_TIMEOUT 2000  /* ms a send may take on top of its line time, as on the EFR32 */
+#define WAIT_HOOK_POLL_MS 2  /* epoll_wait slice while a wait hook is set, nothing wakes it for the hook */
+
+static int fd = -1;
+static int epfd = -1;
+static unsigned int line_baud = 0;  /* for the line time of a send */
+static uint64_t init_time_us = 0;  /* time SerialInit was called */
+static uint64_t sleep_time_us = 0;  /* time spent in epoll_wait */
+static void (*rx_notify)(void) = NULL;  /* see SerialSetRxNotify */
+static pthread_t notify_thread;
+static int notify_fd = -1;  /* edge triggered epoll set of the notify thread */
+static bool notify_running = false;
+static bool (*hook_ready)(void) = NULL;  /* see SerialSetWaitHook */
+static void (*hook_run)(void) = NULL;
+static bool in_hook = false;
+
+
+/**
+ * @param baud: baud rate, e.g. 115200.
+ * @return: the termios speed, B0 if the rate isn't supported
+ */
+static speed_t to_speed(unsigned int baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+
+/**
+ * waits until the port is ready for events, sleeps in epoll_wait.
+ * with a wait hook (see SerialSetWaitHook) it sleeps in slices of WAIT_HOOK_POLL_MS and runs
+ * the hook in between, the host stand in for the interrupt of its event waking the core.
+ * @param events: EPOLLIN or EPOLLOUT.
+ * @param timeout_ms: -1 to wait without a timeout.
+ * @return: 1 when ready, 0 on timeout, -1 on error
+ */
+static int port_wait(uint32_t events, int timeout_ms) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        return -1;
+    }
+    uint64_t deadline = cur_time() + (timeout_ms < 0 ? 0 : timeout_ms);
+    int n;
+    while (1) {
+        int slice = timeout_ms;
+        bool hooked = hook_ready && !in_hook;
+        if (hooked) {
+            if (hook_ready()) {
+                in_hook = true;
+                hook_run();
+                in_hook = false;
+            }
+            uint64_t now = cur_time();
+            slice = WAIT_HOOK_POLL_MS;
+            if (timeout_ms >= 0 && deadline - now < WAIT_HOOK_POLL_MS) {
+                slice = now < deadline ? (int) (deadline - now) : 0;
+            }
+        }
+        uint64_t sleep_start = cur_time_us();
+        n = epoll_wait(epfd, &ev, 1, slice);
+        sleep_time_us += cur_time_us() - sleep_start;
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 && hooked && (timeout_ms < 0 || cur_time() < deadline)) {
+            continue;
+        }
+        break;
+    }
+    if (n > 0) {
+        METRIC_INC(METRIC_UART_IRQS);
+    }
+    return n;
+}
+
+
+/**
+ * calls rx_notify when data arrives, the host stand in for the rx interrupt.
+ * it waits on notify_fd, edge triggered, so it wakes once per burst and not for data
+ * that is already waiting.
+ * @param arg: unused.
+ * @return: NULL
+ */
+static void *notify_main(void *arg) {
+    (void) arg;
+    struct epoll_event ev;
+    while (1) {
+        if (epoll_wait(notify_fd, &ev, 1, -1) > 0 && rx_notify) {
+            rx_notify();
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Initialises the serial connection.
+ * @param port: the port to connected to. e.g: /dev/ttyUSB0, /dev/ttyS1 for Linux and COM8, COM10, COM53 for Windows.
+ * @param baud: the baud rate of the communication. For example: 9600, 115200
+ * @return 0 if succeeded in opening the port and -1 otherwise.
+ */
+int SerialInit(char* port, unsigned int baud) {
+    struct termios tio;
+    speed_t speed = to_speed(baud);
+    if (fd != -1) {
+        SerialDisable();  /* opened again, e.g. by a modem restart: don't leak the port and the epoll sets */
+    }
+    our_timer_init();
+    init_time_us = cur_time_us();
+    sleep_time_us = 0;
+    if (speed == B0) {
+        return -1;
+    }
+    line_baud = baud;
+    if (port == NULL) {
+        port = getenv(SERIAL_PORT_ENV);
+    }
+    fd = open(port ? port : SERIAL_PORT, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (tcgetattr(fd, &tio) == -1) {
+        SerialDisable();
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) == -1) {
+        SerialDisable();
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        SerialDisable();
+        return -1;
+    }
+    if (rx_notify) {
+        SerialSetRxNotify(rx_notify);  /* the notify thread of the old port was stopped */
+    }
+    return 0;
+}
+
+
+/**
+ * Enables or disables RTS/CTS hardware flow control.
+ * @param enable: 1 to enable, 0 to disable.
+ * @return 0 on success, -1 otherwise.
+ */
+int SerialSetFlowControl(int enable) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == -1) {
+        return -1;
+    }
+    if (enable) {
+        tio.c_cflag |= CRTSCTS;
+    } else {
+        tio.c_cflag &= ~CRTSCTS;
+    }
+    return tcsetattr(fd, TCSANOW, &tio);
+}
+
+
+/**
+ * Changes the baud rate, the pending output is sent with the old rate first.
+ * @param baud: the new baud rate.
+ * @return 0 on success, -1 otherwise.
+ */
+int SerialSetBaud(unsigned int baud) {
+    struct termios tio;
+    speed_t speed = to_speed(baud);
+    if (speed == B0 || tcdrain(fd) == -1 || tcgetattr(fd, &tio) == -1) {
+        return -1;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) == -1) {
+        return -1;
+    }
+    line_baud = baud;
+    SerialFlushInputBuff();
+    return 0;
+}
+
+
+/**
+ * @brief Receives data from serial connection.
+ * @param buf: the buffer that receives the input.
+ * @param max_len: maximum bytes to read into buf (buf must be equal or greater than max_len).
+ * @param timeout_ms: read operation timeout milliseconds.
+ * @return amount of bytes read into buf, -1 on error.
+*/
+int SerialRecv(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    uint64_t deadline = cur_time() + timeout_ms;
+    unsigned int total_read = 0;
+    while (total_read < max_len) {
+        ssize_t rc = read(fd, buf + total_read, max_len - total_read);
+        if (rc > 0) {
+            total_read += rc;
+            metric_add(METRIC_UART_RX_BYTES, (uint32_t) rc);
+            continue;
+        }
+        if (rc == -1 && errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+        uint64_t now = cur_time();
+        if (now >= deadline || port_wait(EPOLLIN, (int) (deadline - now)) <= 0) {
+            break;
+        }
+    }
+    return (int) total_read;
+}
+
+
+/**
+ * @brief Sends data through the serial connection.
+ * writev picks up a partial write where it stopped, the call returns once the data is in the
+ * output buffer of the port, the kernel sends it from there.
+ * @param buf: the buffer that contains the data to send
+ * @param size: number of bytes to send
+ * @return amount of bytes written into buf, -1 on error or when it didn't fit in time
+ * (TX_TIMEOUT after its line time, e.g. CTS held down by a hung modem)
+ */
+int SerialSend(char *buf, unsigned int size) {
+    struct iovec iov = {buf, size};
+    uint64_t deadline = cur_time() + TX_TIMEOUT + (line_baud ? (uint64_t) size * 10 * 1000 / line_baud : 0);
+    while (iov.iov_len > 0) {
+        ssize_t rc = writev(fd, &iov, 1);
+        if (rc > 0) {
+            iov.iov_base = (char *) iov.iov_base + rc;
+            iov.iov_len -= rc;
+            metric_add(METRIC_UART_TX_BYTES, (uint32_t) rc);
+            continue;
+        }
+        if (rc == -1 && errno != EAGAIN && errno != EINTR) {
+            return -1;
+        }
+        /* the port buffer is full (or CTS is down), wait for room */
+        uint64_t now = cur_time();
+        if (now >= deadline || port_wait(EPOLLOUT, (int) (deadline - now)) <= 0) {
+            return -1;
+        }
+    }
+    return (int) size;
+}
+
+
+/**
+ * Empties the input buffer and resets the writing and reading location.
+ */
+void SerialFlushInputBuff(void) {
+    tcflush(fd, TCIFLUSH);
+}
+
+
+/**
+ * @return number of received bytes waiting in the input buffer, safe with interrupts masked.
+ */
+unsigned int SerialAvailable(void) {
+    int n = 0;
+    if (ioctl(fd, FIONREAD, &n) == -1) {
+        return 0;
+    }
+    return (unsigned int) n;
+}
+
+
+/**
+ * Sets a function the rx interrupt calls after it received data, e.g. to wake the task that reads it.
+ * on Linux a thread waits on the port and calls it.
+ * @param cb: the function, called from the interrupt, NULL for none.
+ */
+void SerialSetRxNotify(void (*cb)(void)) {
+    rx_notify = cb;
+    if (!cb || notify_running || fd == -1) {
+        return;
+    }
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = fd;
+    notify_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (notify_fd == -1 || epoll_ctl(notify_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        return;
+    }
+    notify_running = (pthread_create(&notify_thread, NULL, notify_main, NULL) == 0);
+}
+
+
+/**
+ * Sets work to do while a read or a write waits on the uart, see serial_io.h.
+ * @param ready: true if run has work. NULL for none.
+ * @param run: does the work.
+ */
+void SerialSetWaitHook(bool (*ready)(void), void (*run)(void)) {
+    hook_run = run;
+    hook_ready = ready;
+}
+
+
+/**
+ * Reports how the time since SerialInit was split between running and sleeping
+ * while waiting on the uart.
+ * @param active_us: output, microseconds the process was out of epoll_wait.
+ * @param sleep_us: output, microseconds the process slept in epoll_wait waiting on the port.
+ */
+void SerialGetPowerStats(uint64_t *active_us, uint64_t *sleep_us) {
+    uint64_t total = cur_time_us() - init_time_us;
+    *sleep_us = sleep_time_us;
+    *active_us = total - sleep_time_us;
+}
+
+
+/**
+ * Disable the serial connection of the uart.
+ * return: 0 if succeeded in closing the port and -1 otherwise.
+ */
+int SerialDisable(void) {
+    int rc = 0;
+    if (notify_running) {
+        pthread_cancel(notify_thread);
+        pthread_join(notify_thread, NULL);
+        notify_running = false;
+    }
+    if (notify_fd != -1) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+    if (epfd != -1) {
+        close(epfd);
+        epfd = -1;
+    }
+    if (fd != -1) {
+        rc = close(fd);
+        fd = -1;
+    }
+    return rc;
+}
+
+#endif // __linux__
@@ -0,0 +1,230 @@
+#include "sighting.h"
+#include <string.h>
+#include "timer.h"
+#include "rpa.h"
+#include "trace.h"
+#include "metrics.h"
+#if defined(__linux__)
+/* the host replay reports and takes the devices from one thread */
+#define CORE_ATOMIC_SECTION(yourcode) { yourcode }
+#else
+#include "em_core.h"
+#endif
+
+typedef struct _bt_device_lst{
+    bt_device device_lst[BT_LST_SIZE];
+    soft_timer timers[BT_LST_SIZE];  // clears the matching device after BT_DEVICE_LIFETIME
+    uint8_t i;
+} _bt_device_lst;
+
+static _bt_device_lst bt_lst = {0};
+static _bt_device_lst prefetch_lst = {0};
+static bt_device sent_lst[SENT_LST_SIZE] = {0};
+static soft_timer sent_timers[SENT_LST_SIZE] = {0};
+static bt_device last_sighting = {0};
+static void (*notify)(void) = NULL;  // see sighting_set_notify
+
+
+/**
+ * clears a device entry when its lifetime ends.
+ * @param timer: the timer of the entry.
+ * @param data: the bt_device to clear.
+ */
+static void device_expired(soft_timer *timer, void *data) {
+    (void) timer;
+    bzero(data, sizeof(bt_device));
+}
+
+
+/**
+ * sets a function that is called when a new device is waiting in a tier, e.g. to wake the task
+ * that sends them (see sighting_take).
+ * @param cb: the function, NULL for none.
+ */
+void sighting_set_notify(void (*cb)(void)) {
+    notify = cb;
+}
+
+
+/**
+ * checks if addr in device, entries are cleared by their timer when their lifetime ends.
+ * @param device: strcut that represent bluetooth device.
+ * @param addr: bluetooth address
+ * @return: 1 if bluetooth differ or the entry is empty else 0
+ */
+int is_available(bt_device* device, const uint8_t* addr) {
+    for (int i = 0; i < 6; i++) {
+        if (device->addr[i] != addr[i]) {
+            return 1;
+        }
+    }
+    return device->timestamp == 0;
+}
+
+
+/**
+ * checks if we need to add this device to the given list
+ * @param lst: the list to add the device to.
+ * @param addr: the device address.
+ * @return the index of the device in lst on success else -1
+ */
+static int add_to_lst(_bt_device_lst *lst, const uint8_t *addr) {
+    int idx = lst->i;
+    for (int i = 0; i < BT_LST_SIZE; i++) {
+        if (!is_available(lst->device_lst + i, addr)) {
+            return -1;
+        }
+    }
+    lst->i = (lst->i + 1) % BT_LST_SIZE;
+    soft_timer_stop(lst->timers + idx);
+    for (int i = 0; i < 6; i++) {
+        lst->device_lst[idx].addr[i] = addr[i];
+    }
+    lst->device_lst[idx].timestamp = cur_time();
+    soft_timer_start(lst->timers + idx, BT_DEVICE_LIFETIME, device_expired, lst->device_lst + idx);
+    return idx;
+}
+
+
+/**
+ * adds a device seen at the door tier, unless it is already waiting or was sent in the last
+ * BT_DEVICE_LIFETIME (both count in METRIC_SIGHTINGS_DEDUPED).
+ * @param addr: the device address.
+ * @return the index in the device list on success else -1
+ */
+int add_bt_device(const uint8_t *addr) {
+    /* sent in the last BT_DEVICE_LIFETIME, sighting_take would hold it back */
+    bool sent = !is_available(sent_lst + (addr[0] & (SENT_LST_SIZE - 1)), addr);
+    int idx = sent ? -1 : add_to_lst(&bt_lst, addr);
+    TRACE_POINT(TRACE_ADD_DEVICE, idx);
+    METRIC_INC((idx < 0) ? METRIC_SIGHTINGS_DEDUPED : METRIC_ADVERTS_ACCEPTED);
+    if (idx >= 0 || sent) {
+        memcpy(last_sighting.addr, addr, sizeof(last_sighting.addr));
+        last_sighting.timestamp = cur_time();
+    }
+    if (idx >= 0 && notify) {
+        notify();
+    }
+    return idx;
+}
+
+
+/**
+ * adds a device seen at the outer tier to the prefetch list
+ * @param addr: the device address.
+ * @return the index in the prefetch list on success else -1
+ */
+int add_prefetch_device(const uint8_t *addr) {
+    int idx = add_to_lst(&prefetch_lst, addr);
+    if (idx >= 0 && notify) {
+        notify();
+    }
+    return idx;
+}
+
+
+/**
+ * sorts a scanned device into the door or the prefetch tier.
+ * @param addr: the advertiser address (little endian).
+ * @param address_type: the advertiser address type.
+ * @param rssi: signal strength of the report.
+ */
+void sighting_report(const uint8_t *addr, uint8_t address_type, int8_t rssi) {
+    uint8_t identity[6];
+    // devices using privacy rotate their address, report them by identity
+    if(rssi > PREFETCH_RSSI_THRESHOLD && rpa_is_resolvable(addr, address_type) &&
+       rpa_resolve(addr, identity) == 0) {
+        addr = identity;
+    }
+    if(rssi > OPEN_RSSI_THRESHOLD) {
+        add_bt_device(addr);
+    }
+    else if(rssi > PREFETCH_RSSI_THRESHOLD) {
+        add_prefetch_device(addr);
+    }
+}
+
+
+/**
+ * takes the devices at the door that weren't sent in the last BT_DEVICE_LIFETIME,
+ * they count as sent from now on.
+ * @param out: output, up to BT_LST_SIZE devices.
+ * @return: number of devices in out
+ */
+int sighting_take(bt_device *out) {
+    int count = 0;
+    int last_index = -1;
+    for (int i = 0; i < BT_LST_SIZE; i++) {
+        bt_device cur;
+        CORE_ATOMIC_SECTION(cur = bt_lst.device_lst[i];)
+        int idx = cur.addr[0] & (SENT_LST_SIZE - 1);
+        if (idx != last_index && cur.timestamp != 0 && is_available(sent_lst + idx, cur.addr)) {
+            last_index = idx;
+            TRACE_POINT(TRACE_SEND_DEVICE, i);
+            soft_timer_stop(bt_lst.timers + i);
+            /* with a kernel the bluetooth task may have reused the slot meanwhile */
+            CORE_ATOMIC_SECTION(
+                if (bt_lst.device_lst[i].timestamp == cur.timestamp) {
+                    bzero(bt_lst.device_lst + i, sizeof(bt_device));
+                }
+            )
+            uint64_t age = cur_time() - cur.timestamp;
+            soft_timer_stop(sent_timers + idx);
+            memcpy(sent_lst + idx, &cur, sizeof(bt_device));
+            soft_timer_start(sent_timers + idx, (age < BT_DEVICE_LIFETIME) ? BT_DEVICE_LIFETIME - age : 1,
+                             device_expired, sent_lst + idx);
+            out[count++] = cur;
+        }
+        else if (idx == last_index && cur.timestamp != 0) {
+            if (notify) {
+                notify();  /* same slot as the last one, it goes on the next run */
+            }
+        }
+        else if (cur.timestamp != 0) {
+            /* sent meanwhile (added while the last take moved it to sent_lst), a duplicate too */
+            soft_timer_stop(bt_lst.timers + i);
+            CORE_ATOMIC_SECTION(
+                if (bt_lst.device_lst[i].timestamp == cur.timestamp) {
+                    bzero(bt_lst.device_lst + i, sizeof(bt_device));
+                }
+            )
+            METRIC_INC(METRIC_SIGHTINGS_DEDUPED);
+        }
+    }
+    return count;
+}
+
+
+/**
+ * takes the devices waiting in the prefetch tier.
+ * @param out: output, up to BT_LST_SIZE devices.
+ * @return: number of devices in out
+ */
+int sighting_take_prefetch(bt_device *out) {
+    int count = 0;
+    for (int i = 0; i < BT_LST_SIZE; i++) {
+        bt_device cur;
+        CORE_ATOMIC_SECTION(cur = prefetch_lst.device_lst[i];)
+        if (cur.timestamp == 0) {
+            continue;
+        }
+        soft_timer_stop(prefetch_lst.timers + i);
+        CORE_ATOMIC_SECTION(
+            if (prefetch_lst.device_lst[i].timestamp == cur.timestamp) {
+                bzero(prefetch_lst.device_lst + i, sizeof(bt_device));
+            }
+        )
+        out[count++] = cur;
+    }
+    return count;
+}
+
+
+/**
+ * @param addr: output, the last device that reached the door tier.
+ * @return: cur_time it was seen, 0 if none was
+ */
+uint64_t sighting_last(uint8_t *addr) {
+    memcpy(addr, last_sighting.addr, sizeof(last_sighting.addr));
+    return last_sighting.timestamp;
+}
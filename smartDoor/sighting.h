@@ -0,0 +1,83 @@
+#ifndef SIGHTING_H_
+#define SIGHTING_H_
+
+#include <stdint.h>
+
+/*
+ * the devices the scanner found: sorted by signal strength into the door and the prefetch
+ * tier, with repeated adverts of a device dropped. only depends on timer.h, so the same code
+ * runs on the door and in the trace replay on a host (see adv_replay.c).
+ */
+
+#define BT_LST_SIZE 5
+#define BT_DEVICE_LIFETIME 34000
+#define SENT_LST_SIZE 32
+#define OPEN_RSSI_THRESHOLD (-50)      // inner tier: the device is at the door
+#define PREFETCH_RSSI_THRESHOLD (-75)  // outer tier: ask the server ahead of time
+
+typedef struct bt_device{
+    uint64_t timestamp;
+    uint8_t addr[6];
+} bt_device;
+
+/**
+ * sets a function that is called when a new device is waiting in a tier, e.g. to wake the task
+ * that sends them (see sighting_take).
+ * @param cb: the function, NULL for none.
+ */
+void sighting_set_notify(void (*cb)(void));
+
+/**
+ * sorts a scanned device into the door or the prefetch tier.
+ * devices using privacy rotate their address, they are reported by identity (see rpa.h).
+ * @param addr: the advertiser address (little endian).
+ * @param address_type: the advertiser address type.
+ * @param rssi: signal strength of the report.
+ */
+void sighting_report(const uint8_t *addr, uint8_t address_type, int8_t rssi);
+
+/**
+ * checks if addr in device, entries are cleared by their timer when their lifetime ends.
+ * @param device: strcut that represent bluetooth device.
+ * @param addr: bluetooth address
+ * @return: 1 if bluetooth differ or the entry is empty else 0
+ */
+int is_available(bt_device* device, const uint8_t* addr);
+
+/**
+ * adds a device seen at the door tier, unless it is already waiting or was sent in the last
+ * BT_DEVICE_LIFETIME (both count in METRIC_SIGHTINGS_DEDUPED).
+ * @param addr: the device address.
+ * @return the index in the device list on success else -1
+ */
+int add_bt_device(const uint8_t *addr);
+
+/**
+ * adds a device seen at the outer tier to the prefetch list
+ * @param addr: the device address.
+ * @return the index in the prefetch list on success else -1
+ */
+int add_prefetch_device(const uint8_t *addr);
+
+/**
+ * takes the devices at the door that weren't sent in the last BT_DEVICE_LIFETIME,
+ * they count as sent from now on.
+ * @param out: output, up to BT_LST_SIZE devices.
+ * @return: number of devices in out
+ */
+int sighting_take(bt_device *out);
+
+/**
+ * takes the devices waiting in the prefetch tier.
+ * @param out: output, up to BT_LST_SIZE devices.
+ * @return: number of devices in out
+ */
+int sighting_take_prefetch(bt_device *out);
+
+/**
+ * @param addr: output, the last device that reached the door tier.
+ * @return: cur_time it was seen, 0 if none was
+ */
+uint64_t sighting_last(uint8_t *addr);
+
+#endif /* SIGHTING_H_ */
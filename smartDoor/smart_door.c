@@ -8,6 +8,7 @@
 
 #include <unistd.h>
 #include <stdbool.h>
+#include <ctype.h>
 #include <math.h>
 #include "em_common.h"
 #include "sl_bluetooth.h"
@@ -19,35 +20,86 @@
 #endif // SL_CATALOG_CLI_PRESENT
 #include <smart_door.h>
 #include <string.h>
+#include "em_core.h"
+#include "em_system.h"
 #include "sl_system_init.h"
+#if !defined(SL_CATALOG_KERNEL_PRESENT)
 #include "sl_system_process_action.h"
+#endif // SL_CATALOG_KERNEL_PRESENT
 #include "sl_simple_button_instances.h"
 #include "timer.h"
 #include "serial_io.h"
 #include "MQTTClient.h"
 #include "sl_simple_led_instances.h"
+#include "rpa.h"
+#include "sighting.h"
+#include "trace.h"
+#include "adv_trace.h"
+#include "adv_filter.h"
+#include "metrics.h"
+#include "ram.h"
+#include "ota.h"
+#include "boot_prof.h"
+#include "sched.h"
+#include "rtos.h"
+#ifdef STATUS_SCREEN
+#include "print.h"
+#endif
 
 /* MQTT DEFINES */
-#define DEFAULT_BROKER_HOST "broker.mqttdashboard.com"//"18.158.198.79"
+#define DEFAULT_BROKER_HOST "broker.mqttdashboard.com"  /* resolved once and cached, see socket_linux_modem.c */
+#ifdef MQTT_NET_TLS
+#define DEFUALT_BROKER_PORT 8883
+#define DEFAULT_USE_TLS 1
+#else
 #define DEFUALT_BROKER_PORT 1883
+#define DEFAULT_USE_TLS 0
+#endif
 #define DEFAULT_KEEP_ALIVE_SEC 720
 #define DEFAULT_MQTT_QOS 1
 #define CLIENT_ID "hujiIotMichIdo "
 #define TOPIC_SEND "smart_door_lock/iot/device_send"
 #define TOPIC_RECV "smart_door_lock/iot/device_recv"
+#define TOPIC_TRACE "smart_door_lock/iot/trace"
+#define TOPIC_ADV "smart_door_lock/iot/adv"
+#define TOPIC_METRICS "smart_door_lock/iot/metrics"
+#define TOPIC_OTA "smart_door_lock/iot/ota/"          // + the door id, an update is for one door
+#define TOPIC_OTA_ACK "smart_door_lock/iot/ota_ack/"  // + the door id
+#define DOOR_ID_SIZE 17  // 16 hex digits of the unique id of the chip and '\0'
+#define TOPIC_BOOT "smart_door_lock/iot/boot"
+#define METRICS_PERIOD 60000
+#define METRICS_MSG_SIZE 448  // fits in MQTT_MAX_PACKET_SZ with the topic, the metrics take as many messages as they need
 #define OPEN_DOOR_CMD "open_door"
 #define LOCK_DOOR_CMD "lock"
 #define UNLOCK_DOOR_CMD "unlock"
 #define NORMAL_DOOR_STAT "normal"
+#define VERDICT_CMD "verdict "
+#define PREFETCH_MSG "prefetch "
+#define OPENED_MSG "opened "
+#define IRK_CMD "irk "
+#define IRK_CLEAR_CMD "irk_clear"
+#define FILTER_CMD "filter "
+#define FILTER_CLEAR_CMD "filter_clear"
+#define TRACE_DUMP_CMD "trace_dump"
+#define ADV_DUMP_CMD "adv_dump"
+#define OTA_BEGIN_CMD "ota_begin "
+#define BOOT_REPORT_CMD "boot_report"
 #define LWT "{\n    \"DisconnectedGracefully\":false\n}"
 #define CLEAN_SEASON 0
 #define LWT_STAT 1
 #define RETAIN 0
 #define MQTT_MAX_PACKET_SZ 512
 #define TIMEOUT 15000
+#define KEEPALIVE_MARGIN_SEC 60  // ping this long before the modem inactivity timeout
 #define FAIL (-1)
 
-static byte mReadBuf[MQTT_MAX_PACKET_SZ] = {0};
+//#define STATUS_SCREEN  /* show the door, link and last sighting on the LCD */
+#define STATUS_PERIOD 250
+#if defined(STATUS_SCREEN) && defined(DEBUG)
+#error "STATUS_SCREEN and DEBUG both use the LCD"
+#endif
+
+static byte mReadBuf[MQTT_MAX_PACKET_SZ + 1] = {0};  // + 1 for the '\0' mqtt_message_cb puts after the payload
 static byte mSendBuf[MQTT_MAX_PACKET_SZ] = {0};
 static volatile word16 mPacketIdLast;
 
@@ -71,9 +123,10 @@ static volatile word16 mPacketIdLast;
 #define SCAN_WINDOW                   16   //10ms
 #define SCAN_PASSIVE                  0
 #define CHECK_BIT(var,pos) ( (((var) & (pos)) > 0 ) ? (1) : (0) )
-#define BT_LST_SIZE 5
-#define BT_DEVICE_LIFETIME 34000
-#define SENT_LST_SIZE 32
+#define VERDICT_LST_SIZE 16
+#define PREFETCH_RETRY_TIME 30000      // don't ask again for a pending address
+#define BT_ADDR_STR_SIZE 18
+#define DOOR_OPEN_TIME 30000
 
 typedef enum doorStatus{
     closed = 0,//!< closed
@@ -84,23 +137,236 @@ typedef enum doorStatus{
 
 typedef struct door{
     doorStatus stat;
-    uint32_t open_time;
+    uint64_t open_time;
 } door;
 
 door dr_iot={0};
 
-typedef struct bt_device{
-    uint32_t timestamp;
+#ifdef STATUS_SCREEN
+static const char *door_names[] = {"closed", "open", "unlocked", "locked"};
+static const char *link_state = "down";
+static soft_timer status_timer;
+static volatile bool status_due = false;
+#define SET_LINK_STATE(STATE) link_state = (STATE)
+#else
+#define SET_LINK_STATE(STATE)
+#endif
+
+typedef enum connectTier{
+    tier_client = 1,  //!< MQTT client init
+    tier_socket,      //!< modem bring-up and TCP connection
+    tier_connect,     //!< MQTT CONNECT
+    tier_subscribe    //!< MQTT SUBSCRIBE
+} connectTier;
+
+typedef enum verdictStatus{
+    no_verdict = 0, //!< nothing known about the address
+    pending,        //!< prefetch sent, waiting for the server
+    allowed,        //!< server authorized the address
+    denied          //!< server doesn't know the address
+} verdictStatus;
+
+typedef struct verdict{
+    uint64_t timestamp;  // prefetch time while pending, expiry time otherwise
     uint8_t addr[6];
-} bt_device;
+    verdictStatus stat;
+} verdict;
+
+verdict verdict_lst[VERDICT_LST_SIZE] = {0};
+static soft_timer door_timer;
+static uint32_t keepalive_interval_ms = 0;
+static volatile bool trace_dump_due = false;
+static volatile bool adv_dump_due = false;
+static soft_timer metrics_timer;
+static volatile bool metrics_due = false;
+static bool ota_ack_due = false;
+static char door_id[DOOR_ID_SIZE] = "";   // see door_id_init
+static char topic_ota[sizeof(TOPIC_OTA) + DOOR_ID_SIZE] = "";
+static char topic_ota_ack[sizeof(TOPIC_OTA_ACK) + DOOR_ID_SIZE] = "";
+static bool ota_msg = false;  // the message being received is an ota chunk
+static bool boot_due = false;
+static soft_timer keepalive_timer;
+static volatile bool connected = false;
+static volatile bool sightings_due = false;  // new devices for send_device / send_prefetch
+#ifdef RTOS_PRESENT
+#define SIGHTING_QUEUE_SIZE 16
+#define DOOR_QUEUE_SIZE 4
+
+typedef struct sighting {
+    uint64_t time;  // cur_time the stack reported it
+    bd_addr address;
+    uint8_t address_type;
+    int8_t rssi;
+} sighting;
+
+typedef struct door_msg {
+    uint64_t since;  // arrival of the message with the command
+    doorStatus stat;
+} door_msg;
+
+static rtos_queue sighting_queue;  // scan reports, from the bluetooth stack to the bluetooth task
+static rtos_queue door_queue;      // door commands, to the door task
+static rtos_event link_event;      // wakes the MQTT task
+static rtos_event telemetry_event; // wakes the telemetry task
+static rtos_mutex link_lock;       // the MQTT client and the modem, one task at a time
+static uint64_t link_woke = 0;     // cur_time the MQTT task last woke
+#define WAKE_LINK() rtos_event_signal(&link_event)
+#define WAKE_TELEMETRY() rtos_event_signal(&telemetry_event)
+#else
+static volatile int door_cmd = -1;        // doorStatus the server asked for, -1 if none
+static uint64_t door_cmd_since = 0;       // earliest arrival of the message with door_cmd
+static sched_task mqtt_task;            // defined with the other tasks at the end
+/* the scheduler checks the ready predicates again after every interrupt */
+#define WAKE_LINK()
+#define WAKE_TELEMETRY()
+#endif
+
+
+/**
+ * controls the leds based on the statues of the door
+ */
+static void update_leds(void) {
+    if(dr_iot.stat == open || dr_iot.stat == unlocked) {
+        sl_led_turn_on(&LED_INSTANCE0);
+        TRACE_POINT(TRACE_LED, 1);
+    }
+    else {
+        sl_led_turn_off(&LED_INSTANCE0);
+        TRACE_POINT(TRACE_LED, 0);
+    }
+}
+
+
+/**
+ * closes the door when the open window ends.
+ * @param timer: the door timer.
+ * @param data: additional data.
+ */
+static void door_timeout(soft_timer *timer, void *data) {
+    (void) timer;
+    (void) data;
+    TRACE_POINT(TRACE_DOOR_TIMEOUT, dr_iot.stat);
+    if(dr_iot.stat == open) {
+        dr_iot.stat = closed;
+    }
+    update_leds();
+    WAKE_LINK();  /* the sightings wait for the door to close */
+}
+
+
+/**
+ * opens the door for DOOR_OPEN_TIME milliseconds.
+ */
+static void door_open(void) {
+    TRACE_POINT(TRACE_DOOR_OPEN, 0);
+    dr_iot.open_time = cur_time();
+    dr_iot.stat = open;
+    soft_timer_start(&door_timer, DOOR_OPEN_TIME, door_timeout, NULL);
+    update_leds();
+}
 
-typedef struct _bt_device_lst{
-    bt_device device_lst[BT_LST_SIZE];
-    uint8_t i;
-} _bt_device_lst;
 
-_bt_device_lst bt_lst = {0};
-bt_device sent_lst[SENT_LST_SIZE] = {0};
+/**
+ * sets the door status and the leds.
+ * @param stat: the new door status.
+ */
+static void door_set(doorStatus stat) {
+    soft_timer_stop(&door_timer);
+    dr_iot.stat = stat;
+    update_leds();
+}
+
+
+/**
+ * hands a door command to the door task.
+ * @param stat: the door status the server asked for, open for a DOOR_OPEN_TIME opening.
+ */
+static void door_request(doorStatus stat) {
+#ifdef RTOS_PRESENT
+    door_msg msg = {link_woke, stat};
+    rtos_queue_put(&door_queue, &msg);
+#else
+    door_cmd_since = sched_idle_since(&mqtt_task);
+    door_cmd = stat;
+#endif
+}
+
+
+/**
+ * marks that the metrics should be published.
+ * @param timer: the metrics timer.
+ * @param data: additional data.
+ */
+static void metrics_timeout(soft_timer *timer, void *data) {
+    (void) timer;
+    (void) data;
+    metrics_due = true;
+    WAKE_TELEMETRY();
+}
+
+
+/**
+ * wakes the scheduler when the keepalive is due, moves itself on while we keep sending.
+ * @param timer: the keepalive timer.
+ * @param data: additional data.
+ */
+static void keepalive_wake(soft_timer *timer, void *data) {
+    uint64_t idle = cur_time() - MqttClientNet_LastWrite();
+    if (idle < keepalive_interval_ms) {
+        soft_timer_start(timer, (uint32_t) (keepalive_interval_ms - idle), keepalive_wake, data);
+    }
+    else {
+        WAKE_LINK();
+    }
+}
+
+
+/**
+ * sets how long the link may stay quiet before we ping: 3/4 of the MQTT keepalive, so the
+ * broker hears from us in time, and before the modem closes the idle connection profile.
+ * @param keep_alive_sec: the MQTT keepalive.
+ */
+static void keepalive_init(word16 keep_alive_sec) {
+    uint32_t mqtt_ms = keep_alive_sec * 750;
+    uint32_t modem_ms = (CELLULAR_INACT_TIMEOUT_SEC - KEEPALIVE_MARGIN_SEC) * 1000;
+    keepalive_interval_ms = (mqtt_ms < modem_ms) ? mqtt_ms : modem_ms;
+}
+
+
+/**
+ * any packet we send (publish, subscribe...) resets the broker keepalive and the modem
+ * inactivity timer, so a ping is needed only after keepalive_interval_ms without sending.
+ * @return: true if it's time to ping
+ */
+static bool keepalive_due(void) {
+    return cur_time() - MqttClientNet_LastWrite() >= keepalive_interval_ms;
+}
+
+
+#ifdef STATUS_SCREEN
+/**
+ * marks that the status screen should be refreshed.
+ * @param timer: the status timer.
+ * @param data: additional data.
+ */
+static void status_timeout(soft_timer *timer, void *data) {
+    (void) timer;
+    (void) data;
+    status_due = true;
+    WAKE_TELEMETRY();
+}
+#endif
+
+
+/**
+ * names the door after the unique id of its chip (what Simplicity Commander shows as Unique ID),
+ * the per door topics of the firmware updates use it.
+ */
+static void door_id_init(void) {
+    snprintf(door_id, sizeof(door_id), "%016llx", (unsigned long long) SYSTEM_GetUnique());
+    snprintf(topic_ota, sizeof(topic_ota), "%s%s", TOPIC_OTA, door_id);
+    snprintf(topic_ota_ack, sizeof(topic_ota_ack), "%s%s", TOPIC_OTA_ACK, door_id);
+}
 
 
 /**
@@ -109,6 +375,7 @@ bt_device sent_lst[SENT_LST_SIZE] = {0};
 void mqtt_init_ctx(MQTTCtx* mqttCtx) {
     mqttCtx->host = DEFAULT_BROKER_HOST;
     mqttCtx->port = DEFUALT_BROKER_PORT;
+    mqttCtx->use_tls = DEFAULT_USE_TLS;
     mqttCtx->qos = DEFAULT_MQTT_QOS;
     mqttCtx->clean_session = CLEAN_SEASON;
     mqttCtx->keep_alive_sec = DEFAULT_KEEP_ALIVE_SEC;
@@ -121,6 +388,111 @@ void mqtt_init_ctx(MQTTCtx* mqttCtx) {
     mqttCtx->rx_buf = mReadBuf;
     mqttCtx->client.ctx=&mqttCtx;
     mqttCtx->topics[0].qos = DEFAULT_MQTT_QOS;
+    door_id_init();
+}
+
+
+/**
+ * writes a bluetooth address in the "AA:BB:CC:DD:EE:FF" format the server uses.
+ * @param buf: output buffer with at least BT_ADDR_STR_SIZE bytes.
+ * @param addr: address bytes as received from the stack (little endian).
+ */
+static void format_addr(char *buf, const uint8_t *addr) {
+    snprintf(buf, BT_ADDR_STR_SIZE, "%02X:%02X:%02X:%02X:%02X:%02X",
+             addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+}
+
+
+/**
+ * @param addr: bluetooth address.
+ * @return: the verdict cache entry of the address.
+ */
+static verdict *get_verdict(const uint8_t *addr) {
+    return verdict_lst + (addr[0] & (VERDICT_LST_SIZE - 1));
+}
+
+
+/**
+ * reads a bluetooth address in the "AA:BB:CC:DD:EE:FF" format the server uses.
+ * @param str: the string to parse.
+ * @param addr: output, 6 bytes address (little endian, as the stack uses).
+ * @return: pointer to the first char after the address or NULL if str isn't an address.
+ */
+static const char *parse_addr(const char *str, uint8_t *addr) {
+    unsigned int a[6] = {0};
+    int end = 0;
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%n", a + 5, a + 4, a + 3, a + 2, a + 1, a, &end) != 6) {
+        return NULL;
+    }
+    for (int i = 0; i < 6; i++) {
+        addr[i] = (uint8_t) a[i];
+    }
+    return str + end;
+}
+
+
+/**
+ * enrolls an identity resolving key sent by the server.
+ * @param args: "AA:BB:CC:DD:EE:FF <32 hex digits of the IRK>"
+ */
+static void set_irk(const char *args) {
+    uint8_t identity[6];
+    uint8_t irk[RPA_IRK_SIZE];
+    unsigned int byte = 0;
+    const char *ptr = parse_addr(args, identity);
+    if (!ptr) {
+        PRINTF_DEBUG("bad irk: %s\n", args)
+        return;
+    }
+    while (*ptr == ' ') {
+        ptr++;
+    }
+    /* exactly 32 hex digits, %2x alone would skip spaces, take a sign and read past a short key */
+    int valid = (strlen(ptr) == 2 * RPA_IRK_SIZE);
+    for (int i = 0; valid && i < 2 * RPA_IRK_SIZE; i++) {
+        valid = isxdigit((unsigned char) ptr[i]);
+    }
+    if (!valid) {
+        PRINTF_DEBUG("bad irk: %s\n", args)
+        return;
+    }
+    for (int i = 0; i < RPA_IRK_SIZE; i++) {
+        sscanf(ptr + 2 * i, "%2x", &byte);
+        irk[i] = (uint8_t) byte;
+    }
+    if (rpa_add_irk(identity, irk)) {
+        PRINT_DEBUG("irk table is full")
+    }
+}
+
+
+/**
+ * stores a prefetch answer from the server.
+ * @param args: "AA:BB:CC:DD:EE:FF <1 allowed / 0 denied> <ttl in seconds>"
+ */
+static void set_verdict(const char *args) {
+    uint8_t addr[6];
+    unsigned int allow = 0;
+    unsigned int ttl = 0;
+    const char *ptr = parse_addr(args, addr);
+    if (!ptr || sscanf(ptr, "%u %u", &allow, &ttl) != 2) {
+        PRINTF_DEBUG("bad verdict: %s\n", args)
+        return;
+    }
+    verdict *v = get_verdict(addr);
+    memcpy(v->addr, addr, 6);
+    v->stat = allow ? allowed : denied;
+    v->timestamp = cur_time() + (uint64_t) ttl * 1000;
+}
+
+
+/**
+ * @param addr: bluetooth address.
+ * @return: 1 if the server already authorized addr and the verdict is still valid else 0
+ */
+static int is_allowed(const uint8_t *addr) {
+    verdict *v = get_verdict(addr);
+    return v->stat == allowed && memcmp(v->addr, addr, 6) == 0 && v->timestamp > cur_time();
 }
 
 
@@ -133,31 +505,92 @@ void mqtt_init_ctx(MQTTCtx* mqttCtx) {
  * @return : 0
  */
 static int mqtt_message_cb(MqttClient *client, MqttMessage *msg, byte msg_new, byte msg_done) {
-    byte buf[MQTT_MAX_PACKET_SZ + 1];
+    /* the payload is the end of the packet in mReadBuf, so it is terminated in place */
+    char *buf = (char *) msg->buffer;
     word32 len = 0;
     (void) client;
     len = msg->buffer_len;
+    if (msg_new) {
+        TRACE_POINT(TRACE_MQTT_MSG, msg->total_len);
+        ota_msg = msg->topic_name_len == strlen(topic_ota) &&
+                  memcmp(msg->topic_name, topic_ota, strlen(topic_ota)) == 0;
+    }
+    if (ota_msg) {
+        /* big chunks come in pieces of up to MQTT_MAX_PACKET_SZ, straight to the flash */
+        ota_chunk(msg->buffer, len, msg_new, msg_done);
+        ota_ack_due |= msg_done;
+        return MQTT_CODE_SUCCESS;
+    }
+    if (!msg_new) {
+        return MQTT_CODE_SUCCESS;
+    }
     if (len > MQTT_MAX_PACKET_SZ) {
         len = MQTT_MAX_PACKET_SZ;
     }
-    memcpy(buf, msg->buffer, len);
     buf[len] = '\0';
+    if(strncmp(buf, VERDICT_CMD, strlen(VERDICT_CMD)) == 0) {
+        set_verdict(buf + strlen(VERDICT_CMD));
+        return 0;
+    }
+    if(strncmp(buf, IRK_CMD, strlen(IRK_CMD)) == 0) {
+        set_irk(buf + strlen(IRK_CMD));
+        return 0;
+    }
+    if(strcmp(buf, IRK_CLEAR_CMD) == 0) {
+        rpa_clear();
+        return 0;
+    }
+    if(strncmp(buf, FILTER_CMD, strlen(FILTER_CMD)) == 0) {
+        if (adv_filter_command(buf + strlen(FILTER_CMD)) == -1) {
+            PRINTF_DEBUG("bad filter: %s\n", buf)
+        }
+        return 0;
+    }
+    if(strcmp(buf, FILTER_CLEAR_CMD) == 0) {
+        adv_filter_clear();
+        return 0;
+    }
+    if(strcmp(buf, TRACE_DUMP_CMD) == 0) {
+        trace_dump_due = true;
+        WAKE_TELEMETRY();
+        return 0;
+    }
+    if(strcmp(buf, ADV_DUMP_CMD) == 0) {
+        adv_dump_due = true;
+        WAKE_TELEMETRY();
+        return 0;
+    }
+    if(strcmp(buf, BOOT_REPORT_CMD) == 0) {
+        boot_due = true;
+        WAKE_TELEMETRY();
+        return 0;
+    }
+    if(strncmp(buf, OTA_BEGIN_CMD, strlen(OTA_BEGIN_CMD)) == 0) {
+        /* "ota_begin <door id> <size> <sha256>", the command topic is shared by the doors */
+        char *args = buf + strlen(OTA_BEGIN_CMD);
+        if (strncmp(args, door_id, strlen(door_id)) != 0 || args[strlen(door_id)] != ' ') {
+            return 0;
+        }
+        /* the telemetry task erases the storage and answers then (see erase_ota), a failure right away */
+        ota_ack_due = (ota_begin(args + strlen(door_id) + 1) == -1);
+        WAKE_TELEMETRY();
+        return 0;
+    }
     if((dr_iot.stat != locked && strcmp(buf, OPEN_DOOR_CMD) == 0) ||
        (dr_iot.stat == unlocked && strcmp(buf, NORMAL_DOOR_STAT) == 0)) {
-        dr_iot.open_time = cur_time();
-        dr_iot.stat = open;
+        door_request(open);
         return 0;
       }
       else if(strcmp(buf, UNLOCK_DOOR_CMD) == 0) {
-          dr_iot.stat = unlocked;
+          door_request(unlocked);
           return 0;
       }
       else if(dr_iot.stat == locked && strcmp(buf, NORMAL_DOOR_STAT) == 0){
-          dr_iot.stat = closed;
+          door_request(closed);
           return 0;
       }
       else if(strcmp(buf, LOCK_DOOR_CMD) == 0) {
-          dr_iot.stat = locked;
+          door_request(locked);
           return  0;
       }
       return MQTT_CODE_SUCCESS;
@@ -184,7 +617,8 @@ int connect_mqtt(MQTTCtx *mqt) {
     mqt->connect.keep_alive_sec = mqt->keep_alive_sec;
     mqt->connect.clean_session = mqt->clean_session;
     mqt->connect.client_id = mqt->client_id;
-    int rc = MqttClient_NetConnect(&mqt->client, mqt->host, mqt->port, 5000, mqt->use_tls, NULL);
+    /* TLS is done by our Net callbacks (MQTTClient.c), not by wolfMQTT */
+    int rc = MqttClient_NetConnect(&mqt->client, mqt->host, mqt->port, 5000, 0, NULL);
     if (rc != MQTT_CODE_SUCCESS) {
         return FAIL;
     }
@@ -209,10 +643,16 @@ int lwt_connect(MQTTCtx *mqt) {
         mqt->lwt_msg.buffer = (byte *) LWT;
         mqt->lwt_msg.total_len = (word16) XSTRLEN(LWT);
     }
+#ifdef WOLFMQTT_V5
+    mqt->connect.protocol_level = MQTT_CONNECT_PROTOCOL_LEVEL_5;
+#endif
     int rc = MqttClient_Connect(&mqt->client, &mqt->connect);
     if (rc != MQTT_CODE_SUCCESS) {
         return FAIL;
     }
+#ifdef WOLFMQTT_V5
+    MqttClientAlias_Reset(&mqt->connect.ack);
+#endif
     return 0;
 }
 
@@ -225,6 +665,8 @@ int lwt_connect(MQTTCtx *mqt) {
 int subscribes(MQTTCtx *mqt) {
     mqt->subscribe.packet_id = mqtt_get_packetid();
     mqt->topics[0].topic_filter = TOPIC_RECV;
+    mqt->topics[1].topic_filter = topic_ota;
+    mqt->topics[1].qos = MQTT_QOS_1;
     mqt->subscribe.topic_count = sizeof(mqt->topics) / sizeof(MqttTopic);
     mqt->subscribe.topics = mqt->topics;
     int rc = MqttClient_Subscribe(&mqt->client, &mqt->subscribe);
@@ -237,46 +679,184 @@ int subscribes(MQTTCtx *mqt) {
 
 
 /**
- * publish a message to the given topic
+ * publish a binary message to the given topic
  * @param mqt : MQTTCtx object
  * @param topic : the topic we want to publish our msg
- * @param msg : the message we want to publish
+ * @param buf : the message we want to publish
+ * @param len : the message length
  * @return : -1 if encountered with an error else 0
  */
-int publish_msg(MQTTCtx mqt,const char *topic,const char *msg) {
+int publish_bin(MQTTCtx mqt, const char *topic, const byte *buf, word16 len) {
     mqt.publish.qos = mqt.qos;
     mqt.publish.topic_name = topic;
     mqt.publish.packet_id = mqtt_get_packetid();
-    mqt.publish.buffer = (byte*)msg;
-    mqt.publish.total_len = (word16)XSTRLEN(msg);
+    mqt.publish.buffer = (byte*)buf;
+    mqt.publish.total_len = len;
+#ifdef WOLFMQTT_V5
+    MqttClientAlias_Apply(&mqt.publish);
+#endif
+    TRACE_POINT(TRACE_PUBLISH_START, len);
+    uint64_t start = cur_time();
     int rc = MqttClient_Publish(&mqt.client, &mqt.publish);
-    PRINTF_DEBUG("MQTT Pub: Topic: %s\nMessage:\n%s\n%s (%d)\n",
-                 mqt.publish.topic_name,msg, MqttClient_ReturnCodeToString(rc), rc)
+    uint32_t latency = (uint32_t) (cur_time() - start);
+#ifdef WOLFMQTT_V5
+    MqttClientAlias_Done(&mqt.publish, rc);
+#endif
+    TRACE_POINT(TRACE_PUBLISH_END, rc);
+    metric_set(METRIC_PUBLISH_MS, latency);
+    metric_max(METRIC_PUBLISH_MAX_MS, latency);
+    PRINTF_DEBUG("MQTT Pub: Topic: %s\n%s (%d)\n",
+                 topic, MqttClient_ReturnCodeToString(rc), rc)
     return (rc != MQTT_CODE_SUCCESS) ? -1:0;
 }
 
 
 /**
- * waits for a message
+ * publish a message to the given topic
+ * @param mqt : MQTTCtx object
+ * @param topic : the topic we want to publish our msg
+ * @param msg : the message we want to publish
+ * @return : -1 if encountered with an error else 0
+ */
+int publish_msg(MQTTCtx mqt,const char *topic,const char *msg) {
+    return publish_bin(mqt, topic, (const byte*)msg, (word16)XSTRLEN(msg));
+}
+
+
+#ifdef STATUS_SCREEN
+/**
+ * writes the status screen to the LCD framebuffer, only the lines that changed are drawn
+ * by the following flush.
+ */
+static void status_screen(void) {
+    static uint64_t last_refresh = 0;
+    uint64_t now = cur_time();
+    if (last_refresh) {
+        metric_max(METRIC_SCREEN_GAP_MS, (uint32_t) (now - last_refresh));
+    }
+    last_refresh = now;
+    char addr_str[BT_ADDR_STR_SIZE] = "-";
+    uint8_t last_sighting[6];
+    uint64_t last_sighting_time = sighting_last(last_sighting);
+    uint32_t ago = 0;
+    if (last_sighting_time) {
+        format_addr(addr_str, last_sighting);
+        ago = (uint32_t) ((now - last_sighting_time) / 1000);
+    }
+    lcd_set_line(0, "Smart door");
+    lcd_set_line(1, "door: %s", door_names[dr_iot.stat]);
+    lcd_set_line(2, "link: %s", link_state);
+    lcd_set_line(3, "ping: %lu ms", (unsigned long) metric_get(METRIC_PING_RTT_MS));
+    lcd_set_line(4, "last sighting:");
+    lcd_set_line(5, "%s", addr_str);
+    lcd_set_line(6, "%lu s ago", (unsigned long) ago);
+    lcd_flush_async();
+}
+#endif
+
+
+/**
+ * publishes the runtime metrics on the metrics topic, in METRICS_MSG_SIZE messages.
+ */
+static void publish_metrics(void) {
+    char buf[METRICS_MSG_SIZE];
+    uint64_t active_us, sleep_us;
+    SerialGetPowerStats(&active_us, &sleep_us);
+    metric_set(METRIC_ACTIVE_MS, (uint32_t) (active_us / 1000));
+    metric_set(METRIC_SLEEP_MS, (uint32_t) (sleep_us / 1000));
+    metric_set(METRIC_STACK_PEAK, stack_peak());
+    metric_set(METRIC_SCRATCH_PEAK, scratch_peak());
+#ifdef RTOS_PRESENT
+    rtos_cpu_report();
+    rtos_stack_report();
+#endif
+    int next = 0;
+    while (next < METRIC_COUNT && metrics_format(buf, METRICS_MSG_SIZE, &next) > 0) {
+        publish_msg(mqt, TOPIC_METRICS, buf);
+    }
+}
+
+
+/**
+ * answers the ota server, reboots into the new image once it is done.
+ */
+static void publish_ota_status(void) {
+    char buf[OTA_STATUS_SIZE];
+    ota_status(buf, sizeof(buf));
+    if (publish_msg(mqt, topic_ota_ack, buf) == 0) {
+        ota_install();
+    }
+}
+
+
+/**
+ * publishes the boot timeline of this boot and the stored ones before it, one message each.
+ */
+static void publish_boot(void) {
+    char buf[BOOT_MSG_SIZE];
+    for (int i = 0; i < BOOT_HISTORY; i++) {
+        if (boot_format(i, buf, sizeof(buf)) == -1 || publish_msg(mqt, TOPIC_BOOT, buf) != 0) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * sends a trace dump chunk on the trace topic.
+ * @param buf: the chunk.
+ * @param len: the chunk length.
+ * @return : -1 if encountered with an error else 0
+ */
+static int publish_trace(const uint8_t *buf, uint32_t len) {
+    return publish_bin(mqt, TOPIC_TRACE, buf, (word16) len);
+}
+
+
+/**
+ * sends an advertisement dump chunk on the adv topic.
+ * @param buf: the chunk.
+ * @param len: the chunk length.
+ * @return : -1 if encountered with an error else 0
+ */
+static int publish_adv(const uint8_t *buf, uint32_t len) {
+    return publish_bin(mqt, TOPIC_ADV, buf, (word16) len);
+}
+
+
+/**
+ * reads a message once the broker sent something, pings when the link was quiet for too long.
+ * a packet that started arriving is read to its end (wolfMQTT can't resume a cut packet).
  * @param mqt : MQTTCtx object
  * @return : -1 if encountered with an error else 0
  */
 int read_msg() {
     int rc;
-    rc = MqttClient_WaitMessage(&mqt.client, mqt.cmd_timeout_ms);
-    if(rc == MQTT_CODE_SUCCESS) {
-        PRINT_DEBUG("read from sub topics\n")
-        return 0;
+    if(MqttClientNet_Pending()) {
+        rc = MqttClient_WaitMessage(&mqt.client, mqt.cmd_timeout_ms);
+        if(rc == MQTT_CODE_SUCCESS) {
+            PRINT_DEBUG("read from sub topics\n")
+            return 0;
+        }
+        if(rc != MQTT_CODE_ERROR_TIMEOUT) {
+            PRINTF_DEBUG("error num: %d\n", rc)
+            SET_LINK_STATE("error");
+            return rc;
+        }
     }
-    if(rc != MQTT_CODE_ERROR_TIMEOUT) {
-        PRINTF_DEBUG("error num: %d\n", rc)
-        return rc;
+    if(!keepalive_due()) {
+        return 0;
     }
+    uint64_t start = cur_time();
     rc = MqttClient_Ping_ex(&mqt.client, &mqt.ping);
+    soft_timer_start(&keepalive_timer, keepalive_interval_ms, keepalive_wake, NULL);
+    metric_set(METRIC_PING_RTT_MS, (uint32_t) (cur_time() - start));
     if (rc != MQTT_CODE_SUCCESS) {
         PRINTF_DEBUG("connection err: %d\n", rc)
+        SET_LINK_STATE("no ping");
         return FAIL;
     }
+    SET_LINK_STATE("up");
     return 0;
 }
 
@@ -305,6 +885,19 @@ void on_fail(MQTTCtx *mqt) {
 }
 
 
+/**
+ * counts a failed connection attempt.
+ * @param tier: the connection step that failed.
+ * @return: -1
+ */
+static int connect_failed(connectTier tier) {
+    SET_LINK_STATE("down");
+    METRIC_INC(METRIC_RECONNECTS);
+    metric_set(METRIC_RECONNECT_TIER, tier);
+    return FAIL;
+}
+
+
 /**
  * connects to broker and publish /read as instructed in the submission
  * @return: 0 on success otherwise -1
@@ -318,115 +911,137 @@ int run_mqtt() {
                              mqt.rx_buf, MQTT_MAX_PACKET_SZ, mqt.cmd_timeout_ms);
     if(rc < 0) {
         PRINT_DEBUG("Mqtt client init failed")
-        return FAIL;
+        return connect_failed(tier_client);
     }
     sl_led_turn_on(&LED_INSTANCE1);
     if (connect_mqtt(&mqt) == FAIL) {
         PRINT_DEBUG("Mqtt failed to connect")
         on_fail(&mqt);
-        return FAIL;
+        return connect_failed(tier_socket);
     }
     sl_led_turn_off(&LED_INSTANCE1);
 
     if (lwt_connect(&mqt) == FAIL) {
         PRINT_DEBUG("Mqtt lwt failed")
         on_fail(&mqt);
-        return FAIL;
+        return connect_failed(tier_connect);
     }
+    boot_mark(BOOT_MQTT_CONNECT);
     mqt.topic_name = TOPIC_RECV;
     if (subscribes(&mqt) == FAIL) {
         PRINT_DEBUG("Mqtt failed to subscribe")
         on_fail(&mqt);
-        return FAIL;
+        return connect_failed(tier_subscribe);
     }
+    boot_mark(BOOT_SUBSCRIBE);
     mqt.topic_name = TOPIC_SEND;
     publish_msg(mqt,TOPIC_SEND,"connected");
+    boot_mark(BOOT_PUBLISH);
+    /* tells the server where to resume an update that the disconnection cut */
+    ota_ack_due = ota_active();
+    keepalive_init(mqt.keep_alive_sec);
+    soft_timer_start(&keepalive_timer, keepalive_interval_ms, keepalive_wake, NULL);
+    soft_timer_start_periodic(&metrics_timer, METRICS_PERIOD, metrics_timeout, NULL);
+    SET_LINK_STATE("up");
+#ifdef DEBUG
+    uint64_t active_us, sleep_us;
+    SerialGetPowerStats(&active_us, &sleep_us);
+    PRINTF_DEBUG("bring-up: active %lu ms, sleep %lu ms\n",
+                 (unsigned long) (active_us / 1000), (unsigned long) (sleep_us / 1000))
+#endif
 
     return 0;
 }
 
 
+/**
+ * a new device is waiting in a tier, wakes the sender.
+ */
+static void sightings_notify(void) {
+    sightings_due = true;
+    WAKE_LINK();
+}
+
+
 /**
  * initialize the application
  * @return 0 on success else -1
  */
 int app_init(void) {
     sl_system_init();
+#if !defined(SL_CATALOG_KERNEL_PRESENT)
     sl_system_process_action();
+#endif // SL_CATALOG_KERNEL_PRESENT
+    sighting_set_notify(sightings_notify);
     return 0;
 }
 
 
 /**
- * checks if addr in device, if yes then the interval between
- * its creation to the cur time.
- * @param device: strcut that represent bluetooth device.
- * @param addr: bluetooth address
- * @return: 1 if bluetooth differ or time passed too long else 0
+ * sends bluetooth devices to MQTT.
+ * devices the server already authorized (see send_prefetch) open the door
+ * right away and are reported as opened instead of waiting for a round trip.
  */
-int is_available(bt_device* device, const uint8_t* addr) {
-    for (int i = 0; i < 6; i++) {
-        if (device->addr[i] != addr[i]) {
-            return 1;
-        }
-    }
-    return cur_time() - device->timestamp >= BT_DEVICE_LIFETIME;
-}
-
-
-/**
- * checks if we need to add this device to
- * @param address: bd_addr from bluetooth scanning event handler
- * @return 0 on success else -1
- */
-int add_bt_device(bd_addr address) {
-    int idx = bt_lst.i;
-    bt_lst.i = (bt_lst.i + 1) % BT_LST_SIZE;
-    for (int i = 0; i < BT_LST_SIZE; i++) {
-        bool contains = ((cur_time() - bt_lst.device_lst[i].timestamp) < BT_DEVICE_LIFETIME);
-        for (int j = 0; j < 6; j++) {
-            contains &= (bt_lst.device_lst[i].addr[j] == address.addr[j]);
+void send_device() {
+    bt_device devices[BT_LST_SIZE];
+    int count = sighting_take(devices);
+    for (int i = 0; i < count; i++) {
+        bt_device *cur = devices + i;
+        char buf[sizeof(OPENED_MSG) + BT_ADDR_STR_SIZE] = OPENED_MSG;
+        char *addr_str = buf;
+        if (dr_iot.stat == closed && is_allowed(cur->addr)) {
+#ifdef RTOS_PRESENT
+            door_request(open);  /* the door task owns the door */
+#else
+            door_open();
+#endif
+            addr_str = buf + strlen(OPENED_MSG);
+            format_addr(addr_str, cur->addr);
+            publish_msg(mqt, TOPIC_SEND, buf);
         }
-        if (!is_available(bt_lst.device_lst + i, address.addr)) {
-            return -1;
+        else {
+            format_addr(addr_str, cur->addr);
+            publish_msg(mqt, TOPIC_SEND, addr_str);
         }
+        METRIC_INC(METRIC_SIGHTINGS_PUBLISHED);
     }
-    for (int i = 0; i < 6; i++) {
-        bt_lst.device_lst[idx].addr[i] = address.addr[i];
-    }
-    bt_lst.device_lst[idx].timestamp = cur_time();
-    return idx;
 }
 
 
 /**
- * sends bluetooth devices to MQTT
+ * asks the server for a verdict on devices seen at the outer tier.
+ * runs after send_device so it never delays a device that is already at the door.
  */
-void send_device() {
-    int last_index = -1;
-    for (int i = 0; i < BT_LST_SIZE; i++) {
-        bt_device cur = bt_lst.device_lst[i];
-        int idx = cur.addr[0] & (SENT_LST_SIZE - 1);
-        if (idx != last_index && cur.timestamp != 0 && is_available(sent_lst + idx, cur.addr)) {
-            last_index = idx;
-            bzero(bt_lst.device_lst + i, sizeof(bt_device));
-            char buf[18] = {0};
-            snprintf(buf, 18, "%02X:%02X:%02X:%02X:%02X:%02X",
-                     cur.addr[5], cur.addr[4], cur.addr[3],
-                     cur.addr[2], cur.addr[1], cur.addr[0]);
-            publish_msg(mqt,TOPIC_SEND,buf);
-            memcpy(sent_lst + idx, &cur, sizeof(bt_device));
+void send_prefetch() {
+    bt_device devices[BT_LST_SIZE];
+    int count = sighting_take_prefetch(devices);
+    for (int i = 0; i < count; i++) {
+        bt_device *cur = devices + i;
+        verdict *v = get_verdict(cur->addr);
+        if (memcmp(v->addr, cur->addr, 6) == 0 &&
+            ((v->stat == pending && cur_time() - v->timestamp < PREFETCH_RETRY_TIME) ||
+             (v->stat != pending && v->timestamp > cur_time()))) {
+            continue;
         }
+        char buf[sizeof(PREFETCH_MSG) + BT_ADDR_STR_SIZE] = PREFETCH_MSG;
+        format_addr(buf + strlen(PREFETCH_MSG), cur->addr);
+        memcpy(v->addr, cur->addr, 6);
+        v->stat = pending;
+        v->timestamp = cur_time();
+        publish_msg(mqt, TOPIC_SEND, buf);
     }
 }
 
 
 /**
  * occurs if there was a bluetooth event caught by the system.
+ * scan reports go through the payload filter (see adv_filter.h) before the device lists,
+ * with a kernel it runs on the event task of the stack and they go to the bluetooth task.
  * @param evt: bluetooth event
  */
 void sl_bt_on_event(sl_bt_msg_t* evt) {
     sl_status_t sc;
+    sl_bt_evt_scanner_scan_report_t *report;
     // Handle stack events
     switch (SL_BT_MSG_ID(evt->header)) {
         // -------------------------------
@@ -447,9 +1062,20 @@ void sl_bt_on_event(sl_bt_msg_t* evt) {
         // This event is generated when an advertisement packet or a scan response
         // is received from a responder
         case sl_bt_evt_scanner_scan_report_id:
-            if(evt->data.evt_scanner_scan_report.rssi > -50) {
-                add_bt_device(((sl_bt_evt_scanner_scan_report_t*)&(evt->data))->address);
+            report = (sl_bt_evt_scanner_scan_report_t*)&(evt->data);
+            TRACE_POINT(TRACE_BT_SCAN_REPORT, report->rssi);
+            ADV_CAPTURE(report->address.addr, report->address_type, report->rssi, report->data.data, report->data.len);
+            METRIC_INC(METRIC_ADVERTS_SEEN);
+            if(report->rssi <= PREFETCH_RSSI_THRESHOLD ||
+               !adv_filter_match(report->address_type, report->data.data, report->data.len)) {
+                break;  /* too far, or nothing an enrolled phone sends */
             }
+#ifdef RTOS_PRESENT
+            sighting s = {cur_time(), report->address, report->address_type, report->rssi};
+            rtos_queue_put(&sighting_queue, &s);
+#else
+            sighting_report(report->address.addr, report->address_type, report->rssi);
+#endif
             break;
         default:
             break;
@@ -457,6 +1083,7 @@ void sl_bt_on_event(sl_bt_msg_t* evt) {
 }
 
 
+#ifndef RTOS_PRESENT
 /**
  * scans for bluetooth devices in case the door is closed
  */
@@ -464,52 +1091,484 @@ void bt_scan(){
   if(dr_iot.stat == closed){
       sl_bt_step();
       send_device();
+      send_prefetch();
   }
 }
+#endif // RTOS_PRESENT
 
 
 /**
- * controls the leds based on the statues of the door
- * @param handle: sleeptimer handler
- * @param data: additional data.
+ * erases the storage of a firmware update a page per call, answers the server when it is done.
+ * @return: true while there is more to erase
  */
-static void periodic_timeout(sl_sleeptimer_timer_handle_t *handle, void *data) {
-    if(dr_iot.stat == open && cur_time() - dr_iot.open_time < 30000) {
-        sl_led_turn_on(&LED_INSTANCE0);
-        return;
+static bool erase_ota(void) {
+    if (!ota_erasing()) {
+        return false;
     }
-    if(dr_iot.stat == locked) {
-        sl_led_turn_off(&LED_INSTANCE0);
-        return;
+    if (ota_erase_step()) {
+        return true;
     }
-    if(dr_iot.stat == unlocked) {
-        sl_led_turn_on(&LED_INSTANCE0);
-        return;
+    ota_ack_due = true;
+    return false;
+}
+
+
+/**
+ * @return: true if a timer or a command asked for something to publish
+ */
+static bool publish_pending(void) {
+    return connected && (trace_dump_due || adv_dump_due || metrics_due || ota_ack_due || boot_due);
+}
+
+
+/**
+ * publishes what the timers and the commands asked for: trace and advertisement dumps,
+ * metrics, ota answers and boot timelines.
+ */
+static void publish_due(void) {
+    if(connected && trace_dump_due) {
+        trace_dump_due = false;
+        trace_dump(publish_trace, MQTT_MAX_PACKET_SZ - sizeof(TOPIC_TRACE) - 8);
+    }
+    if(connected && adv_dump_due) {
+        adv_dump_due = false;
+        adv_trace_dump(publish_adv, MQTT_MAX_PACKET_SZ - sizeof(TOPIC_ADV) - 8);
+    }
+    if(connected && metrics_due) {
+        metrics_due = false;
+        publish_metrics();
+    }
+    if(connected && ota_ack_due) {
+        ota_ack_due = false;
+        publish_ota_status();
+    }
+    if(connected && boot_due) {
+        boot_due = false;
+        publish_boot();
+    }
+}
+
+
+#ifdef RTOS_PRESENT
+/* estimates, the metrics report the fewest bytes each task had left (stkdr, stkbt, stkmdm, stkmq, stktl) */
+#define DOOR_STACK 512
+#define BT_STACK 1024
+#ifdef MQTT_NET_TLS
+#define LINK_STACK 6144  // the wolfSSL handshake
+#else
+#define LINK_STACK 3072
+#endif
+#define TELEMETRY_STACK 1536
+#ifdef DEBUG
+#define TELEMETRY_IDLE_MS 100  // drains the debug log
+#else
+#define TELEMETRY_IDLE_MS RTOS_FOREVER
+#endif
+
+
+/**
+ * door task, carries out the commands of the server and of the cached verdicts.
+ * it has the highest priority, a command preempts scanning and telemetry.
+ * @param task: the task.
+ */
+static void door_main(rtos_task *task) {
+    (void) task;
+    door_msg msg;
+    while (1) {
+        rtos_queue_get(&door_queue, &msg, RTOS_FOREVER);
+        if (msg.stat == open) {
+            door_open();
+        }
+        else {
+            door_set(msg.stat);
+        }
+        metric_max(METRIC_DOOR_LATENCY_MS, (uint32_t) (cur_time() - msg.since));
     }
-    dr_iot.stat = closed;
-    sl_led_turn_off(&LED_INSTANCE0);
 }
 
 
+/**
+ * bluetooth task, resolves and sorts the scan reports the stack queued (see sl_bt_on_event).
+ * the reports that come while the door isn't closed are dropped.
+ * @param task: the task.
+ */
+static void bt_main(rtos_task *task) {
+    (void) task;
+    sighting s;
+    while (1) {
+        rtos_queue_get(&sighting_queue, &s, RTOS_FOREVER);
+        metric_max(METRIC_BT_LATENCY_MS, (uint32_t) (cur_time() - s.time));
+        if (dr_iot.stat == closed) {
+            sighting_report(s.address.addr, s.address_type, s.rssi);
+        }
+    }
+}
+
+
+/**
+ * modem task, brings the modem and the MQTT connection up and hands the link to the MQTT task.
+ * @param task: the task.
+ */
+static void modem_main(rtos_task *task) {
+    (void) task;
+    rtos_mutex_lock(&link_lock);
+    boot_attempt();
+    while (run_mqtt()) {
+        boot_attempt();
+    }
+    rtos_mutex_unlock(&link_lock);
+    boot_done();
+    boot_due = true;
+    connected = true;
+    WAKE_LINK();
+    WAKE_TELEMETRY();
+}
+
+
+/**
+ * MQTT task, reads the messages of the broker, keeps the connection alive and reports the
+ * devices the bluetooth task found. the uart rx interrupt, the keepalive timer and the
+ * bluetooth task wake it.
+ * @param task: the task.
+ */
+static void mqtt_main(rtos_task *task) {
+    (void) task;
+    while (1) {
+        rtos_event_wait(&link_event, RTOS_FOREVER);
+        link_woke = cur_time();
+        if (!connected) {
+            continue;
+        }
+        rtos_mutex_lock(&link_lock);
+        read_msg(mqt);
+        if (dr_iot.stat == closed && sightings_due) {
+            sightings_due = false;
+            send_device();
+            send_prefetch();
+        }
+        rtos_mutex_unlock(&link_lock);
+        if (MqttClientNet_Pending()) {
+            WAKE_LINK();
+        }
+    }
+}
+
+
+/**
+ * telemetry task: trace dumps, metrics, ota erase and answers, boot timelines and the status screen.
+ * it has the lowest priority, it runs when nothing else has work.
+ * @param task: the task.
+ */
+static void telemetry_main(rtos_task *task) {
+    (void) task;
+    while (1) {
+        rtos_event_wait(&telemetry_event, TELEMETRY_IDLE_MS);
+        while (erase_ota()) {
+        }
+        if (publish_pending()) {
+            rtos_mutex_lock(&link_lock);
+            publish_due();
+            rtos_mutex_unlock(&link_lock);
+        }
+#ifdef STATUS_SCREEN
+        if (status_due) {
+            status_due = false;
+            status_screen();
+            while (lcd_process()) {
+            }
+        }
+#endif
+        DEBUG_DRAIN();
+    }
+}
+
+
+/**
+ * rx interrupt hook of the serial port, the broker may have sent something.
+ */
+static void link_notify(void) {
+    WAKE_LINK();
+}
+
+
+static rtos_task door_task = RTOS_TASK("door", door_main, RTOS_PRIO_DOOR, DOOR_STACK, METRIC_CPU_DOOR,
+                                       METRIC_STACK_DOOR);
+static rtos_task bt_task = RTOS_TASK("bt", bt_main, RTOS_PRIO_BT, BT_STACK, METRIC_CPU_BT, METRIC_STACK_BT);
+static rtos_task modem_task = RTOS_TASK("modem", modem_main, RTOS_PRIO_LINK, LINK_STACK, METRIC_CPU_MODEM,
+                                        METRIC_STACK_MODEM);
+static rtos_task mqtt_task = RTOS_TASK("mqtt", mqtt_main, RTOS_PRIO_LINK, LINK_STACK, METRIC_CPU_MQTT,
+                                       METRIC_STACK_MQTT);
+static rtos_task telemetry_task = RTOS_TASK("telemetry", telemetry_main, RTOS_PRIO_TELEMETRY, TELEMETRY_STACK,
+                                            METRIC_CPU_TELEMETRY, METRIC_STACK_TELEMETRY);
+
+
 /**
  * main application routine that controls the bluetooth discovery and door.
+ * the work is split into preemptive tasks (see rtos.h), door commands preempt scanning and
+ * scanning preempts telemetry.
  */
 void run_app(void) {
-    sl_sleeptimer_timer_handle_t periodic_time;
-    int ret = 0;
-    do {
-        ret = run_mqtt();
-    } while (ret);
-    sl_sleeptimer_start_periodic_timer(
-        &periodic_time, 10000, periodic_timeout, NULL, 0,
-        SL_SLEEPTIMER_NO_HIGH_PRECISION_HF_CLOCKS_REQUIRED_FLAG);
-    while(1) {
-        if(dr_iot.stat == closed) {
-            for(int i = 0; i < 10; i++) {
-                sl_bt_step();
-            }
-            send_device();
+#ifdef STATUS_SCREEN
+    lcd_init(small);
+    soft_timer_start_periodic(&status_timer, STATUS_PERIOD, status_timeout, NULL);
+#endif
+    if (rtos_queue_init(&sighting_queue, SIGHTING_QUEUE_SIZE, sizeof(sighting)) == -1 ||
+        rtos_queue_init(&door_queue, DOOR_QUEUE_SIZE, sizeof(door_msg)) == -1 ||
+        rtos_event_init(&link_event) == -1 || rtos_event_init(&telemetry_event) == -1 ||
+        rtos_mutex_init(&link_lock) == -1) {
+        PRINT_DEBUG("rtos init failed")
+        return;
+    }
+    SerialSetRxNotify(link_notify);
+    if (rtos_task_create(&door_task) == -1 || rtos_task_create(&bt_task) == -1 ||
+        rtos_task_create(&modem_task) == -1 || rtos_task_create(&mqtt_task) == -1 ||
+        rtos_task_create(&telemetry_task) == -1) {
+        PRINT_DEBUG("rtos task create failed")
+        return;
+    }
+    rtos_start();
+}
+#else
+/**
+ * @return: true while the door task has a command to carry out
+ */
+static bool door_ready(void) {
+    return door_cmd != -1;
+}
+
+
+/**
+ * door actuator task, carries out the commands of the server.
+ * @param task: the task.
+ * @return: PT_WAITING
+ */
+static int door_run(sched_task *task) {
+    PT_BEGIN(&task->pt);
+    while (1) {
+        PT_WAIT_UNTIL(&task->pt, door_ready());
+        if (door_cmd == open) {
+            door_open();
+        }
+        else {
+            door_set((doorStatus) door_cmd);
         }
+        door_cmd = -1;
+        metric_max(METRIC_DOOR_LATENCY_MS, (uint32_t) (cur_time() - door_cmd_since));
+    }
+    PT_END(&task->pt);
+}
+
+
+/**
+ * @return: true if the bluetooth stack has an event for us, scanning pauses while the door isn't closed
+ */
+static bool bt_ready(void) {
+    return dr_iot.stat == closed && sl_bt_event_pending();
+}
+
+
+/**
+ * bluetooth event pump, one event per run so the other tasks get their turn in between.
+ * @param task: the task.
+ * @return: PT_WAITING
+ */
+static int bt_run(sched_task *task) {
+    (void) task;
+    sl_bt_step();
+    return PT_WAITING;
+}
+
+
+/**
+ * @return: true if the broker sent something or the keepalive is due
+ */
+static bool mqtt_ready(void) {
+    return connected && (MqttClientNet_Pending() || keepalive_due());
+}
+
+
+/**
+ * MQTT task, reads the messages of the broker and keeps the connection alive.
+ * @param task: the task.
+ * @return: PT_WAITING
+ */
+static int mqtt_run(sched_task *task) {
+    (void) task;
+    if (connected) {
         read_msg(mqt);
     }
+    return PT_WAITING;
+}
+
+
+/**
+ * @return: true if there are devices to report
+ */
+static bool sender_ready(void) {
+    return connected && dr_iot.stat == closed && sightings_due;
+}
+
+
+/**
+ * reports the devices the bluetooth task found.
+ * @param task: the task.
+ * @return: PT_WAITING
+ */
+static int sender_run(sched_task *task) {
+    (void) task;
+    if (!sender_ready()) {
+        return PT_WAITING;
+    }
+    sightings_due = false;
+    send_device();
+    send_prefetch();
+    return PT_WAITING;
+}
+
+
+/**
+ * @return: true if a timer or a command asked for something to publish, or an update has storage to erase
+ */
+static bool telemetry_ready(void) {
+    if (ota_erasing()) {
+        return true;
+    }
+    return publish_pending();
+}
+
+
+/**
+ * telemetry task: trace dumps, metrics, ota erase and answers, boot timelines.
+ * @param task: the task.
+ * @return: PT_WAITING, PT_YIELDED or PT_ENDED
+ */
+static int telemetry_run(sched_task *task) {
+    PT_BEGIN(&task->pt);
+    /* a page per run, the other tasks run in between */
+    while (erase_ota()) {
+        PT_YIELD(&task->pt);
+    }
+    publish_due();
+    PT_END(&task->pt);
+}
+
+
+#ifdef STATUS_SCREEN
+/**
+ * @return: true when the status timer asked for a refresh
+ */
+static bool screen_ready(void) {
+    return status_due;
+}
+
+
+/**
+ * status screen task, refreshes the LCD every STATUS_PERIOD. it doesn't use the modem, so it
+ * runs inside the uart waits too.
+ * @param task: the task.
+ * @return: PT_YIELDED or PT_ENDED
+ */
+static int screen_run(sched_task *task) {
+    PT_BEGIN(&task->pt);
+    status_due = false;
+    status_screen();
+    /* one line per run, the other tasks run in between */
+    while (lcd_process()) {
+        PT_YIELD(&task->pt);
+    }
+    PT_END(&task->pt);
+}
+#endif
+
+
+/**
+ * connection task, connects to the broker and hands the link to the other tasks.
+ * the attempts block, the other tasks (e.g. the door) get a turn between them.
+ * @param task: the task.
+ * @return: PT_YIELDED or PT_ENDED
+ */
+static int conn_run(sched_task *task) {
+    PT_BEGIN(&task->pt);
+    boot_attempt();
+    while (run_mqtt()) {
+        PT_YIELD(&task->pt);
+        boot_attempt();
+    }
+    boot_done();
+    boot_due = true;
+    connected = true;
+    PT_END(&task->pt);
+}
+
+
+/**
+ * runs after every pass of the scheduler.
+ * @return: false, nothing is left for later
+ */
+static bool app_pass(void) {
+    DEBUG_DRAIN();
+    return false;
+}
+
+
+static sched_task door_task = SCHED_TASK("door", door_run, door_ready, SCHED_NO_METRIC);
+static sched_task bt_task = SCHED_TASK("bt", bt_run, bt_ready, METRIC_BT_LATENCY_MS);
+static sched_task mqtt_task = SCHED_TASK("mqtt", mqtt_run, mqtt_ready, SCHED_NO_METRIC);
+static sched_task sender_task = SCHED_TASK("sender", sender_run, sender_ready, SCHED_NO_METRIC);
+static sched_task telemetry_task = SCHED_TASK("telemetry", telemetry_run, telemetry_ready, SCHED_NO_METRIC);
+static sched_task conn_task = SCHED_TASK("conn", conn_run, NULL, SCHED_NO_METRIC);
+#ifdef STATUS_SCREEN
+static sched_task screen_task = SCHED_TASK("screen", screen_run, screen_ready, SCHED_NO_METRIC);
+#endif
+
+
+/**
+ * @return: true if the door, the bluetooth or the screen task has work, while another task waits on the modem
+ */
+static bool uart_wait_ready(void) {
+#ifdef STATUS_SCREEN
+    if (sched_is_ready(&screen_task)) {
+        return true;
+    }
+#endif
+    return sched_is_ready(&door_task) || sched_is_ready(&bt_task);
+}
+
+
+/**
+ * runs the door, the bluetooth and the screen task from inside the uart waits (see
+ * SerialSetWaitHook): the AT exchanges of a connection attempt block for up to a few minutes,
+ * the door commands, the scan reports and the status screen don't wait for them. the other tasks
+ * use the modem and can't run there.
+ */
+static void uart_wait_run(void) {
+    sched_poll(&door_task);
+    sched_poll(&bt_task);
+#ifdef STATUS_SCREEN
+    sched_poll(&screen_task);
+#endif
+}
+
+
+/**
+ * main application routine that controls the bluetooth discovery and door.
+ * the work is split into cooperative tasks (see sched.h), the door commands go first.
+ */
+void run_app(void) {
+#ifdef STATUS_SCREEN
+    lcd_init(small);
+    soft_timer_start_periodic(&status_timer, STATUS_PERIOD, status_timeout, NULL);
+#endif
+    sched_add(&door_task);
+    sched_add(&bt_task);
+    sched_add(&mqtt_task);
+    sched_add(&sender_task);
+    sched_add(&telemetry_task);
+    sched_add(&conn_task);
+#ifdef STATUS_SCREEN
+    sched_add(&screen_task);
+#endif
+    SerialSetWaitHook(uart_wait_ready, uart_wait_run);
+    sched_run(app_pass);
 }
+#endif // RTOS_PRESENT
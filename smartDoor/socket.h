@@ -47,5 +47,42 @@ int SocketClose(void);
 */
 void SocketDeInit(void);
 
+/* handle of the socket of SocketInit, the functions without a handle use it */
+#define SOCKET_MAIN 0
+
+#ifdef CELLULAR_SOCKET_URC
+/**
+* Opens another connection on its own service profile (after SocketInit), e.g. for
+* bulk downloads that shouldn't hold the MQTT connection.
+* the transparent mode has one connection, so it exists only with CELLULAR_SOCKET_URC.
+* Host and Port as in SocketInit.
+* Returns the socket handle on success, -1 on failure
+*/
+int SocketOpen(char *host, int port);
+
+/**
+* Closes the connection of sock (from SocketOpen) and frees its handle.
+* Returns 0 on success, -1 on failure
+*/
+int SocketRelease(int sock);
+#endif
+
+/**
+* Writes len bytes from the payload buffer to the connection of sock.
+* Returns the number of bytes written on success, -1 on failure
+*/
+int SocketSend(int sock, unsigned char *payload, unsigned int len);
+
+/**
+* Reads up to max_len bytes from the connection of sock, for up to timeout_ms.
+* Returns the number of bytes read on success, -1 on failure
+*/
+int SocketRecv(int sock, unsigned char *buf, unsigned int max_len, unsigned int timeout_ms);
+
+/**
+* Returns 1 if a SocketRecv on sock has something to pick up right away, 0 otherwise.
+*/
+int SocketPending(int sock);
+
 
 #endif //EX5_SOCKET_H
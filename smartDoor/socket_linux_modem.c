@@ -1,11 +1,145 @@
 #include "socket.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "ram.h"
+#include "timer.h"
+#include "metrics.h"
+#include "boot_prof.h"
 
+#define MAX_OPERATORS 10
+#define SERVICE_KEEPINTVL_SEC 80
+#define DNS_CACHE_SIZE CELLULAR_MAX_SOCKETS
+#define DNS_HOST_SIZE 64
+#define DNS_IP_SIZE 46                      /* IPv6 text form */
+#define DNS_TTL_MS (60 * 60 * 1000)         /* the modem doesn't report the record TTL */
+
+/**
+ * a host name resolved by the modem.
+ */
+typedef struct dns_entry {
+    char host[DNS_HOST_SIZE];
+    char ip[DNS_IP_SIZE];
+    uint64_t expire;                        // cur_time the address must be resolved again at
+} dns_entry;
+
+static bool in_use[CELLULAR_MAX_SOCKETS];  // service profiles given to a socket
+static dns_entry dns_cache[DNS_CACHE_SIZE];
+static char *main_host = NULL;              // name of the SocketInit host, for the fallback
+static int main_port = 0;
+static bool main_cached = false;            // profile 0 was set up with a cached address
+static uint64_t init_start = 0;             // cur_time of SocketInit, METRIC_CONNECT_MS counts from it
+
+
+/**
+* Registers with the first operator in range that accepts the modem.
+* the operator list only lives in the scratch arena while this runs.
+* Returns 0 on success, -1 on failure
+*/
+static int select_operator(void) {
+    int opsFound = 0;
+    SCRATCH_SCOPE();
+    OPERATOR_INFO *oplist = scratch_alloc(MAX_OPERATORS * sizeof(OPERATOR_INFO));
+    if (!oplist) {
+        PRINT_DEBUG("Socket Linux Modem: scratch arena is full")
+        return -1;
+    }
+    if(CellularGetOperators(oplist, MAX_OPERATORS, &opsFound) == -1) {
+        PRINT_DEBUG("Socket Linux Modem: can not get operators");
+        return -1;
+    }
+    boot_mark(BOOT_OPERATORS);
+    for (int i = 0; i < opsFound; i++) {
+        if (!CellularSetOperator(SET_OPT_MODE_MANUAL, oplist[i].operator_code)) {
+            if (!CellularWaitUntilRegistered()) {
+                PRINTF_DEBUG("Socket Linux Modem: connected to operator '%s' successfully\n", oplist[i].operator_name)
+                boot_mark(BOOT_REGISTERED);
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/**
+* Returns true if host is already an IPv4 or IPv6 address.
+*/
+static bool is_ip_literal(const char *host) {
+    if (strchr(host, ':')) {
+        return true;
+    }
+    for (; *host; host++) {
+        if (!isdigit((unsigned char) *host) && *host != '.') {
+            return false;
+        }
+    }
+    return true;
+}
 
-static OPERATOR_INFO oplist[25] = {0};
-static int opsFound = 0;
-static char opsBuf[2048];
+
+/**
+* Returns the cache entry of host, NULL if host isn't cached.
+*/
+static dns_entry *dns_find(const char *host) {
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (dns_cache[i].host[0] && strcmp(dns_cache[i].host, host) == 0) {
+            return dns_cache + i;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+* Drops host from the cache, e.g. when its address stopped answering.
+*/
+static void dns_forget(const char *host) {
+    dns_entry *entry = dns_find(host);
+    if (entry) {
+        entry->host[0] = '\0';
+    }
+}
+
+
+/**
+* Returns the address to connect to host with:
+* the cached IP while it is fresh, else the IP the modem resolves now (and caches),
+* else host itself so the modem resolves it when it connects.
+* cached is set if the returned address came from a lookup.
+*/
+static char *dns_resolve(char *host, bool *cached) {
+    dns_entry *entry = NULL;
+    *cached = false;
+    if (is_ip_literal(host) || strlen(host) >= DNS_HOST_SIZE) {
+        return host;
+    }
+    entry = dns_find(host);
+    if (entry && cur_time() < entry->expire) {
+        *cached = true;
+        return entry->ip;
+    }
+    if (!entry) {
+        /* a free entry, else the one that expires first */
+        entry = dns_cache;
+        for (int i = 1; i < DNS_CACHE_SIZE && entry->host[0]; i++) {
+            if (!dns_cache[i].host[0] || dns_cache[i].expire < entry->expire) {
+                entry = dns_cache + i;
+            }
+        }
+    }
+    entry->host[0] = '\0';
+    METRIC_INC(METRIC_DNS_LOOKUPS);
+    if (CellularResolveHost(host, entry->ip, DNS_IP_SIZE) == -1) {
+        PRINT_DEBUG("Socket Linux Modem: lookup failed, connecting by name")
+        return host;
+    }
+    strcpy(entry->host, host);
+    entry->expire = cur_time() + DNS_TTL_MS;
+    *cached = true;
+    return entry->ip;
+}
 
 
 /**
@@ -19,36 +153,33 @@ static char opsBuf[2048];
 int SocketInit(char *host, int port) {
     if (host == NULL || port < 0 || port > 65535) {
         PRINT_DEBUG("Socket Linux Modem: input is not valid")
+        return -1;
     }
-    bzero(oplist,25 * sizeof(OPERATOR_INFO));
-    opsFound = 0;
+    init_start = cur_time();
     if (CellularInit(NULL) == -1) {
         return -1;
     }
+    boot_mark(BOOT_MODEM);
     if(CellularWaitUntilModemResponds() == -1) {
         PRINT_DEBUG("Socket Linux Modem: failed to send AT commands");
         return -1;
     }
-    if(CellularGetOperators(oplist, 25, &opsFound) == -1) {
-        PRINT_DEBUG("Socket Linux Modem: can not get operators");
+    if (select_operator() == -1) {
         return -1;
     }
-    for (int i = 0; i < opsFound; i++) {
-        if (!CellularSetOperator(SET_OPT_MODE_MANUAL, oplist[i].operator_code)) {
-            if (!CellularWaitUntilRegistered()) {
-                PRINTF_DEBUG("Socket Linux Modem: connected to operator '%s' successfully\n", oplist[i].operator_name)
-                break;
-            }
-        }
-    }
-    if (CellularSetupInternetConnectionProfile(20) == -1) {
+    if (CellularSetupInternetConnectionProfile(CELLULAR_INACT_TIMEOUT_SEC) == -1) {
         PRINT_DEBUG("Socket Linux Modem: setup internet connection profile failed");
         return -1;
     }
-    if (CellularSetupInternetServiceProfile(host, port, 80) == -1) {
+    main_host = host;
+    main_port = port;
+    /* a name in the address makes the modem ask the DNS on every connect, over the cellular link */
+    if (CellularSetupInternetServiceProfile(dns_resolve(host, &main_cached), port, SERVICE_KEEPINTVL_SEC) == -1) {
         PRINT_DEBUG("Socket Linux Modem: setup internet service profile failed");
         return -1;
     }
+    in_use[SOCKET_MAIN] = true;
+    boot_mark(BOOT_PROFILES);
     return 0;
 }
 
@@ -59,10 +190,26 @@ int SocketInit(char *host, int port) {
 * Returns 0 on success, -1 on failure
 */
 int SocketConnect(void) {
-    if(CellularConnect() == -1) {
+    /* the bring up is SocketInit and the connect, the lookup of the name is in SocketInit */
+    uint64_t start = init_start ? init_start : cur_time();
+    int rc = CellularConnect();
+    if (rc == -1 && main_cached) {
+        /* the host may have moved, forget the address and let the modem resolve the name */
+        PRINT_DEBUG("Socket Linux Modem: cached address failed, connecting by name")
+        dns_forget(main_host);
+        main_cached = false;
+        rc = CellularSetupInternetServiceProfile(main_host, main_port, SERVICE_KEEPINTVL_SEC);
+        if (rc == 0) {
+            rc = CellularConnect();
+        }
+    }
+    if (rc == -1) {
         PRINT_DEBUG("Socket Linux Modem: could not connect")
         return -1;
     }
+    metric_set(METRIC_CONNECT_MS, (uint32_t) (cur_time() - start));
+    init_start = 0;
+    boot_mark(BOOT_SOCKET);
     return 0;
 }
 
@@ -73,11 +220,90 @@ int SocketConnect(void) {
 * Returns the number of bytes written on success, -1 on failure
 */
 int SocketWrite(unsigned char *payload, unsigned int len) {
+    return SocketSend(SOCKET_MAIN, payload, len);
+}
+
+
+/**
+* Reads up to max_len bytes from the established connection
+* to the provided buf buffer,
+* for up to timeout_ms (doesn’t block longer than that,
+* even if not all max_len bytes were received).
+* Returns the number of bytes read on success, -1 on failure
+*/
+int SocketRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    return SocketRecv(SOCKET_MAIN, buf, max_len, timeout_ms);
+}
+
+
+#ifdef CELLULAR_SOCKET_URC
+/**
+* Opens another connection on its own service profile (after SocketInit).
+* the transparent mode has one connection, so it exists only with CELLULAR_SOCKET_URC.
+* Returns the socket handle on success, -1 on failure
+*/
+int SocketOpen(char *host, int port) {
+    int sock = 0;
+    if (host == NULL || port < 0 || port > 65535) {
+        PRINT_DEBUG("Socket Linux Modem: input is not valid")
+        return -1;
+    }
+    while (sock < CELLULAR_MAX_SOCKETS && in_use[sock]) {
+        sock++;
+    }
+    if (sock == CELLULAR_MAX_SOCKETS) {
+        PRINT_DEBUG("Socket Linux Modem: no free service profile")
+        return -1;
+    }
+    bool cached = false;
+    char *addr = dns_resolve(host, &cached);
+    if (CellularSetupServiceProfile(sock, addr, port, SERVICE_KEEPINTVL_SEC) == -1 ||
+        CellularConnectProfile(sock) == -1) {
+        if (!cached) {
+            PRINTF_DEBUG("Socket Linux Modem: could not open socket %d\n", sock)
+            return -1;
+        }
+        dns_forget(host);
+        if (CellularSetupServiceProfile(sock, host, port, SERVICE_KEEPINTVL_SEC) == -1 ||
+            CellularConnectProfile(sock) == -1) {
+            PRINTF_DEBUG("Socket Linux Modem: could not open socket %d\n", sock)
+            return -1;
+        }
+    }
+    in_use[sock] = true;
+    return sock;
+}
+
+
+/**
+* Closes the connection of sock (from SocketOpen) and frees its handle.
+* Returns 0 on success, -1 on failure
+*/
+int SocketRelease(int sock) {
+    if (sock < 0 || sock >= CELLULAR_MAX_SOCKETS || sock == SOCKET_MAIN) {
+        PRINT_DEBUG("Socket Linux Modem: invalid input")
+        return -1;
+    }
+    in_use[sock] = false;
+    if (CellularCloseProfile(sock) == -1) {
+        PRINT_DEBUG("Socket Linux Modem: could not close connection")
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+
+/**
+* Writes len bytes from the payload buffer to the connection of sock.
+* Returns the number of bytes written on success, -1 on failure
+*/
+int SocketSend(int sock, unsigned char *payload, unsigned int len) {
     if (payload == NULL) {
         PRINT_DEBUG("Socket Linux Modem: invalid input")
         return -1;
     }
-    int rc = CellularWrite(payload, len);
+    int rc = CellularWriteProfile(sock, payload, len);
     if (rc == -1) {
         PRINT_DEBUG("Socket Linux Modem: could not write")
         return -1;
@@ -87,18 +313,15 @@ int SocketWrite(unsigned char *payload, unsigned int len) {
 
 
 /**
-* Reads up to max_len bytes from the established connection
-* to the provided buf buffer,
-* for up to timeout_ms (doesn’t block longer than that,
-* even if not all max_len bytes were received).
+* Reads up to max_len bytes from the connection of sock, for up to timeout_ms.
 * Returns the number of bytes read on success, -1 on failure
 */
-int SocketRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+int SocketRecv(int sock, unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
     if (buf == NULL) {
         PRINT_DEBUG("Socket Linux Modem: invalid input")
         return -1;
     }
-    int rc = CellularRead(buf, max_len, timeout_ms);
+    int rc = CellularReadProfile(sock, buf, max_len, timeout_ms);
     if (rc == -1) {
         PRINT_DEBUG("Socket Linux Modem: could not read")
         return -1;
@@ -107,6 +330,14 @@ int SocketRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms
 }
 
 
+/**
+* Returns 1 if a SocketRecv on sock has something to pick up right away, 0 otherwise.
+*/
+int SocketPending(int sock) {
+    return CellularReadPending(sock);
+}
+
+
 /**
 * Closes the established connection.
 * Returns 0 on success, -1 on failure
@@ -124,6 +355,12 @@ int SocketClose(void) {
 * Frees any resources that were allocated by SocketInit
 */
 void SocketDeInit(void) {
+    for (int sock = 0; sock < CELLULAR_MAX_SOCKETS; sock++) {
+        if (in_use[sock] && sock != SOCKET_MAIN) {
+            CellularCloseProfile(sock);
+        }
+        in_use[sock] = false;
+    }
     CellularClose();
     CellularDisable();
 }
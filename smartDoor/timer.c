@@ -1,16 +1,32 @@
 #include "timer.h"
+#if defined(__linux__)
+#include "timer_linux.h"
+#else
 #include "em_timer.h"
-
-static char _isInit = false;
-volatile uint32_t time_since_start;  // time in milliseconds
-
+#include "em_core.h"
+#endif
 
 /**
- * increment the amounts of ticks by 1
+ * hierarchical timer wheel with 1ms resolution.
+ * level l has WHEEL_SLOTS slots of 64^l ms each, timers are placed by the time left
+ * and cascade one level down when their slot comes up, so start/stop/expire are O(1).
+ * a single sleeptimer is programmed to the next tick where a slot expires or cascades.
  */
-void SysTick_Handler(void) {
-    time_since_start++;
-}
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define LEVEL_SHIFT(level) ((level) * WHEEL_BITS)
+#define WHEEL_RANGE (1ULL << LEVEL_SHIFT(WHEEL_LEVELS))
+
+static char _isInit = false;
+
+static soft_timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t wheel_used[WHEEL_LEVELS];  /* bit per non empty slot */
+static uint64_t wheel_now;  /* the wheel is up to date until this time */
+static uint64_t wheel_next;  /* the time the hardware timer is programmed to, 0 when idle */
+static bool wheel_advancing;  /* wheel_advance is running callbacks */
+static sl_sleeptimer_timer_handle_t wheel_hw;
 
 
 /**
@@ -21,24 +37,267 @@ void our_timer_init() {
         _isInit = true;
         sl_sleeptimer_init();
         CMU_ClockEnable(cmuClock_RTCC, true);
-        SysTick_Config(CMU_ClockFreqGet(cmuClock_CORE) / 1000);
+        wheel_now = cur_time();
     }
 }
 
 
+/**
+ * converts sleeptimer ticks to the given resolution without overflowing the multiplication.
+ * @param ticks: amount of ticks since the sleeptimer started.
+ * @param units_per_sec: 1000 for milliseconds, 1000000 for microseconds.
+ */
+static uint64_t ticks_to_units(uint64_t ticks, uint64_t units_per_sec) {
+    uint64_t freq = sl_sleeptimer_get_timer_frequency();
+    return (ticks / freq) * units_per_sec + ((ticks % freq) * units_per_sec) / freq;
+}
+
+
 /**
  * @return: the current time passed in milliseconds since timer_init
  */
-uint32_t cur_time() {
-  return time_since_start;
+uint64_t cur_time() {
+  return ticks_to_units(sl_sleeptimer_get_tick_count64(), 1000);
+}
+
+
+/**
+ * @return: the current time passed in microseconds since timer_init
+ */
+uint64_t cur_time_us() {
+  return ticks_to_units(sl_sleeptimer_get_tick_count64(), 1000000);
+}
+
+
+/**
+ * puts a timer in the slot matching its expiration time. must run in a critical section.
+ */
+static void wheel_insert(soft_timer *timer) {
+    uint64_t delta = timer->expire - wheel_now;
+    uint64_t at = timer->expire;
+    int level = 0;
+    if (timer->expire < wheel_now) {
+        at = wheel_now;
+        delta = 0;
+    }
+    else if (delta >= WHEEL_RANGE) {
+        /* too far, park it in the last slot of the top level and re-place it when it cascades */
+        at = wheel_now + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+    while (delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+    int slot = (at >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+    timer->bucket = &wheel[level][slot];
+    timer->prev = NULL;
+    timer->next = *timer->bucket;
+    if (timer->next) {
+        timer->next->prev = timer;
+    }
+    *timer->bucket = timer;
+    wheel_used[level] |= 1ULL << slot;
+}
+
+
+/**
+ * removes a timer from its slot. must run in a critical section.
+ */
+static void wheel_remove(soft_timer *timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    }
+    else {
+        *timer->bucket = timer->next;
+        if (!timer->next) {
+            int idx = (int) (timer->bucket - &wheel[0][0]);
+            wheel_used[idx / WHEEL_SLOTS] &= ~(1ULL << (idx % WHEEL_SLOTS));
+        }
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = timer->prev = timer;  /* marks the timer as stopped */
+}
+
+
+/**
+ * @return: the next tick after wheel_now where a slot expires or cascades, 0 if the wheel is empty
+ */
+static uint64_t wheel_next_event(void) {
+    uint64_t next = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (!wheel_used[level]) {
+            continue;
+        }
+        uint64_t base = wheel_now >> LEVEL_SHIFT(level);
+        int from = (int) ((base + 1) & WHEEL_MASK);
+        uint64_t rotated = (wheel_used[level] >> from) | (from ? wheel_used[level] << (WHEEL_SLOTS - from) : 0);
+        uint64_t at = (base + 1 + __builtin_ctzll(rotated)) << LEVEL_SHIFT(level);
+        if (!next || at < next) {
+            next = at;
+        }
+    }
+    return next;
+}
+
+
+/**
+ * sleeptimer callback, advances the wheel up to now.
+ */
+static void wheel_hw_cb(sl_sleeptimer_timer_handle_t *handle, void *data);
+
+
+/**
+ * programs the hardware timer to the next wheel event. must run in a critical section.
+ */
+static void wheel_program(void) {
+    uint64_t next = wheel_next_event();
+    if (next && next == wheel_next) {
+        return;
+    }
+    wheel_next = next;
+    if (!next) {
+        sl_sleeptimer_stop_timer(&wheel_hw);
+        return;
+    }
+    uint64_t now = cur_time();
+    uint32_t timeout = (next > now) ? (uint32_t) (next - now) : 0;
+    sl_sleeptimer_restart_timer_ms(&wheel_hw, timeout, wheel_hw_cb, NULL, 0,
+                                   SL_SLEEPTIMER_NO_HIGH_PRECISION_HF_CLOCKS_REQUIRED_FLAG);
+}
+
+
+/**
+ * processes the wheel tick by tick (skipping ticks without events) up to now,
+ * cascading higher levels and running the callbacks of expired timers.
+ */
+static void wheel_advance(uint64_t now) {
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_CRITICAL();
+    uint64_t next;
+    wheel_advancing = true;
+    while ((next = wheel_next_event()) && next <= now) {
+        wheel_now = next;
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if (wheel_now & ((1ULL << LEVEL_SHIFT(level)) - 1)) {
+                continue;
+            }
+            int slot = (wheel_now >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+            soft_timer *timer = wheel[level][slot];
+            wheel[level][slot] = NULL;
+            wheel_used[level] &= ~(1ULL << slot);
+            while (timer) {
+                soft_timer *cascade = timer->next;
+                wheel_insert(timer);
+                timer = cascade;
+            }
+        }
+        int slot = wheel_now & WHEEL_MASK;
+        soft_timer *timer;
+        while ((timer = wheel[0][slot])) {
+            wheel_remove(timer);
+            if (timer->period) {
+                timer->expire += timer->period;
+                wheel_insert(timer);
+            }
+            CORE_EXIT_CRITICAL();
+            timer->cb(timer, timer->data);
+            CORE_ENTER_CRITICAL();
+        }
+    }
+    wheel_advancing = false;
+    wheel_now = now;
+    wheel_next = 0;
+    wheel_program();
+    CORE_EXIT_CRITICAL();
+}
+
+
+static void wheel_hw_cb(sl_sleeptimer_timer_handle_t *handle, void *data) {
+    (void) handle;
+    (void) data;
+    wheel_advance(cur_time());
+}
+
+
+/**
+ * adds the timer to the wheel, stopping it first if it's already running.
+ */
+static void soft_timer_arm(soft_timer *timer, uint32_t timeout_ms, uint32_t period_ms,
+                           soft_timer_cb cb, void *data) {
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_CRITICAL();
+    if (soft_timer_is_running(timer)) {
+        wheel_remove(timer);
+    }
+    /* skip the wheel forward when nothing is due in between, so slots stay fine grained */
+    uint64_t now = cur_time();
+    uint64_t next = wheel_next_event();
+    if (!wheel_advancing && now > wheel_now && (!next || next > now)) {
+        wheel_now = now;
+    }
+    timer->cb = cb;
+    timer->data = data;
+    timer->period = period_ms;
+    timer->expire = now + (timeout_ms ? timeout_ms : 1);
+    wheel_insert(timer);
+    wheel_program();
+    CORE_EXIT_CRITICAL();
+}
+
+
+/**
+ * starts (or restarts) a one shot timer.
+ * @param timer: the timer to start.
+ * @param timeout_ms: time until the callback runs.
+ * @param cb: the callback.
+ * @param data: additional data for the callback.
+ */
+void soft_timer_start(soft_timer *timer, uint32_t timeout_ms, soft_timer_cb cb, void *data) {
+    soft_timer_arm(timer, timeout_ms, 0, cb, data);
+}
+
+
+/**
+ * starts (or restarts) a periodic timer.
+ * @param timer: the timer to start.
+ * @param period_ms: time between the callbacks.
+ * @param cb: the callback.
+ * @param data: additional data for the callback.
+ */
+void soft_timer_start_periodic(soft_timer *timer, uint32_t period_ms, soft_timer_cb cb, void *data) {
+    soft_timer_arm(timer, period_ms, period_ms ? period_ms : 1, cb, data);
+}
+
+
+/**
+ * stops the timer, does nothing if the timer isn't running.
+ */
+void soft_timer_stop(soft_timer *timer) {
+    CORE_DECLARE_IRQ_STATE;
+    CORE_ENTER_CRITICAL();
+    if (soft_timer_is_running(timer)) {
+        wheel_remove(timer);
+    }
+    CORE_EXIT_CRITICAL();
+}
+
+
+/**
+ * @return: true if the timer is running
+ */
+bool soft_timer_is_running(const soft_timer *timer) {
+    /* zero initialized timers have never run, stopped timers point to themselves */
+    return timer->cb && timer->next != timer;
 }
 
 
 /**
  * callback function to increase the timout_counter
  */
-static void timer_handler(sl_sleeptimer_timer_handle_t *handle, void *data) {
-    (void)&handle;
+static void timer_handler(soft_timer *timer, void *data) {
+    (void) timer;
     (*((int*) data))++;
 }
 
@@ -46,19 +305,14 @@ static void timer_handler(sl_sleeptimer_timer_handle_t *handle, void *data) {
 /**
  * function that gets a timer object and runs it with timeout_ms and timeout_counter to be updated each time
  * we get a time out.
- * use sl_sleeptimer_stop_timer(sl_sleeptimer_timer_handle_t *handle) to stop the timer.
- * @param handle: s1_speetimer type
+ * use soft_timer_stop(soft_timer *timer) to stop the timer.
+ * @param timer: soft_timer type
  * @param timeout_ms: uint32_t type
  * @param timeout_counter: pointer to int that will be updated each timeout
  * @return
  */
-int set_periodic_timer(sl_sleeptimer_timer_handle_t *handle, uint32_t timeout_ms, int* timeout_counter) {
-  uint32_t timeout;
-  if (sl_sleeptimer_ms32_to_tick(timeout_ms, &timeout) != SL_STATUS_OK) return -1;
-  if (sl_sleeptimer_start_periodic_timer(
-      handle, timeout, timer_handler, timeout_counter, 0, SL_SLEEPTIMER_NO_HIGH_PRECISION_HF_CLOCKS_REQUIRED_FLAG
-      ) != SL_STATUS_OK) return -1;
+int set_periodic_timer(soft_timer *timer, uint32_t timeout_ms, int* timeout_counter) {
+  if (!timeout_ms || !timeout_counter) return -1;
+  soft_timer_start_periodic(timer, timeout_ms, timer_handler, timeout_counter);
   return 0;
 }
-
-
@@ -1,7 +1,33 @@
 #ifndef TIMER_H_
 #define TIMER_H_
+#include <stdbool.h>
+#include <stdint.h>
+#if !defined(__linux__)
 #include "em_cmu.h"
 #include "sl_sleeptimer.h"
+#endif
+
+struct soft_timer;
+
+/**
+ * soft timer callback, runs in the sleeptimer interrupt context so keep it short
+ * (set a flag, clear an entry). it may start or stop timers, including its own.
+ */
+typedef void (*soft_timer_cb)(struct soft_timer *timer, void *data);
+
+/**
+ * application timer driven by the timer wheel.
+ * the struct is owned by the caller and must stay valid while the timer runs.
+ */
+typedef struct soft_timer {
+    struct soft_timer *next;
+    struct soft_timer *prev;
+    struct soft_timer **bucket;  // the wheel slot holding the timer
+    uint64_t expire;     // expiration time in milliseconds (see cur_time)
+    uint32_t period;     // 0 for one shot timers
+    soft_timer_cb cb;
+    void *data;
+} soft_timer;
 
 /**
  * initialize the timer of the system
@@ -10,18 +36,64 @@ void our_timer_init();
 
 /**
  * return the current time passed in milliseconds since program starting.
+ * the time is read from the sleeptimer 64 bit tick counter, so it doesn't wrap
+ * and doesn't need a periodic interrupt to advance.
+ */
+uint64_t cur_time();
+
+/**
+ * return the current time passed in microseconds since program starting.
+ */
+uint64_t cur_time_us();
+
+/**
+ * starts (or restarts) a one shot timer.
+ * @param timer: the timer to start.
+ * @param timeout_ms: time until the callback runs.
+ * @param cb: the callback.
+ * @param data: additional data for the callback.
  */
-uint32_t cur_time();
+void soft_timer_start(soft_timer *timer, uint32_t timeout_ms, soft_timer_cb cb, void *data);
+
+/**
+ * starts (or restarts) a periodic timer.
+ * @param timer: the timer to start.
+ * @param period_ms: time between the callbacks.
+ * @param cb: the callback.
+ * @param data: additional data for the callback.
+ */
+void soft_timer_start_periodic(soft_timer *timer, uint32_t period_ms, soft_timer_cb cb, void *data);
+
+/**
+ * stops the timer, does nothing if the timer isn't running.
+ */
+void soft_timer_stop(soft_timer *timer);
+
+/**
+ * @return: true if the timer is running
+ */
+bool soft_timer_is_running(const soft_timer *timer);
 
 /**
  * function that gets a timer object and runs it with timeout_ms and timeout_counter to be updated each time
  * we get a time out.
- * use sl_sleeptimer_stop_timer(sl_sleeptimer_timer_handle_t *handle) to stop the timer.
- * @param handle: s1_speetimer type
+ * use soft_timer_stop(soft_timer *timer) to stop the timer.
+ * @param timer: soft_timer type
  * @param timeout_ms: uint32_t type
  * @param timeout_counter: pointer to int that will be updated each timeout
  * @return
  */
-int set_periodic_timer(sl_sleeptimer_timer_handle_t *handle, uint32_t timeout_ms, int* timeout_counter);
+int set_periodic_timer(soft_timer *timer, uint32_t timeout_ms, int* timeout_counter);
+
+#if defined(__linux__)
+/**
+ * host builds have no timer interrupt: moves the sleeptimer tick counter to now_ms and fires
+ * the sleeptimer of the wheel each time it expires on the way, so the callbacks run in order
+ * (see timer_linux.c). from the first call on cur_time follows the caller (e.g. a trace replay)
+ * instead of the monotonic clock.
+ * @param now_ms: the new time, not before the current one.
+ */
+void timer_advance(uint64_t now_ms);
+#endif
 
 #endif /* TIMER_H_ */
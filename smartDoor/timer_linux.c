@@ -0,0 +1,118 @@
+#include "timer.h"
+#if defined(__linux__)
+#include <stddef.h>
+#include <time.h>
+#include "timer_linux.h"
+
+/*
+ * the tick source of the timer wheel (timer.c) on a Linux host build: the modem stack on a
+ * gateway (cellular.c, socket_linux_modem.c), the trace replay (adv_replay.c) and the tests.
+ * there is no timer interrupt, the sleeptimer fires from timer_advance, which also moves the
+ * tick counter, so a replay gives the same results at any speed.
+ */
+
+pthread_mutex_t timer_linux_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t start_us = 0;
+static bool virtual_clock = false;  // the tick counter follows timer_advance
+static uint64_t virtual_ticks = 0;
+static sl_sleeptimer_timer_handle_t *armed = NULL;  // the running sleeptimer, timer.c has one
+
+
+/**
+ * @return: microseconds on the monotonic clock
+ */
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+ * @param ms: milliseconds.
+ * @return: the first tick at or after ms
+ */
+static uint64_t ms_to_ticks(uint64_t ms) {
+    return (ms / 1000) * SLEEPTIMER_FREQUENCY + ((ms % 1000) * SLEEPTIMER_FREQUENCY + 999) / 1000;
+}
+
+
+sl_status_t sl_sleeptimer_init(void) {
+    if (start_us == 0) {
+        start_us = monotonic_us();
+    }
+    return SL_STATUS_OK;
+}
+
+
+uint64_t sl_sleeptimer_get_tick_count64(void) {
+    if (virtual_clock) {
+        return virtual_ticks;
+    }
+    sl_sleeptimer_init();
+    uint64_t us = monotonic_us() - start_us;
+    return (us / 1000000) * SLEEPTIMER_FREQUENCY + ((us % 1000000) * SLEEPTIMER_FREQUENCY) / 1000000;
+}
+
+
+uint32_t sl_sleeptimer_get_timer_frequency(void) {
+    return SLEEPTIMER_FREQUENCY;
+}
+
+
+sl_status_t sl_sleeptimer_restart_timer_ms(sl_sleeptimer_timer_handle_t *handle, uint32_t timeout_ms,
+                                           sl_sleeptimer_timer_callback_t callback, void *callback_data,
+                                           uint8_t priority, uint16_t option_flags) {
+    (void) priority;
+    (void) option_flags;
+    /* from the start of the current millisecond, so a timer due at a millisecond fires when the
+       caller advances to it, not a fraction of a tick later */
+    uint64_t now = sl_sleeptimer_get_tick_count64();
+    uint64_t now_ms = (now / SLEEPTIMER_FREQUENCY) * 1000 + ((now % SLEEPTIMER_FREQUENCY) * 1000) / SLEEPTIMER_FREQUENCY;
+    handle->expire = ms_to_ticks(now_ms + timeout_ms);
+    handle->callback = callback;
+    handle->callback_data = callback_data;
+    armed = handle;
+    return SL_STATUS_OK;
+}
+
+
+sl_status_t sl_sleeptimer_stop_timer(sl_sleeptimer_timer_handle_t *handle) {
+    if (armed == handle) {
+        armed = NULL;
+    }
+    return SL_STATUS_OK;
+}
+
+
+/**
+ * moves the tick counter to now_ms and fires the sleeptimer each time it expires on the way,
+ * with the counter at its expiry tick, so the wheel runs the callbacks in order.
+ * @param now_ms: the new time, not before the current one.
+ */
+void timer_advance(uint64_t now_ms) {
+    pthread_mutex_lock(&timer_linux_lock);
+    if (!virtual_clock) {
+        virtual_ticks = sl_sleeptimer_get_tick_count64();
+        virtual_clock = true;
+    }
+    uint64_t target = ms_to_ticks(now_ms);
+    sl_sleeptimer_timer_handle_t *due;
+    while ((due = armed) && due->expire <= target) {
+        armed = NULL;
+        if (due->expire > virtual_ticks) {
+            virtual_ticks = due->expire;
+        }
+        /* the callback takes the lock itself, like an interrupt that a critical section holds off */
+        pthread_mutex_unlock(&timer_linux_lock);
+        due->callback(due, due->callback_data);
+        pthread_mutex_lock(&timer_linux_lock);
+    }
+    if (target > virtual_ticks) {
+        virtual_ticks = target;
+    }
+    pthread_mutex_unlock(&timer_linux_lock);
+}
+
+#endif // __linux__
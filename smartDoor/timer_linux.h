@@ -0,0 +1,48 @@
+#ifndef TIMER_LINUX_H_
+#define TIMER_LINUX_H_
+#if defined(__linux__)
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * the part of the sleeptimer and em_core that timer.c uses, for Linux host builds
+ * (see timer_linux.c). the tick counter runs at the RTCC frequency and follows the monotonic
+ * clock, or the caller once it calls timer_advance. the hardware timer has no interrupt,
+ * it fires from timer_advance.
+ */
+
+#define SL_STATUS_OK 0
+#define SL_SLEEPTIMER_NO_HIGH_PRECISION_HF_CLOCKS_REQUIRED_FLAG 0x01
+#define SLEEPTIMER_FREQUENCY 32768  // the RTCC runs from the 32768 Hz LFXO
+
+typedef uint32_t sl_status_t;
+
+struct sl_sleeptimer_timer_handle;
+
+typedef void (*sl_sleeptimer_timer_callback_t)(struct sl_sleeptimer_timer_handle *handle, void *data);
+
+typedef struct sl_sleeptimer_timer_handle {
+    uint64_t expire;  // tick of the callback
+    sl_sleeptimer_timer_callback_t callback;
+    void *callback_data;
+} sl_sleeptimer_timer_handle_t;
+
+sl_status_t sl_sleeptimer_init(void);
+uint64_t sl_sleeptimer_get_tick_count64(void);
+uint32_t sl_sleeptimer_get_timer_frequency(void);
+sl_status_t sl_sleeptimer_restart_timer_ms(sl_sleeptimer_timer_handle_t *handle, uint32_t timeout_ms,
+                                           sl_sleeptimer_timer_callback_t callback, void *callback_data,
+                                           uint8_t priority, uint16_t option_flags);
+sl_status_t sl_sleeptimer_stop_timer(sl_sleeptimer_timer_handle_t *handle);
+
+/* the clocks are always on, a critical section keeps the other threads out of the wheel */
+#define cmuClock_RTCC 0
+#define CMU_ClockEnable(clock, enable) ((void) (clock), (void) (enable))
+
+extern pthread_mutex_t timer_linux_lock;
+#define CORE_DECLARE_IRQ_STATE
+#define CORE_ENTER_CRITICAL() pthread_mutex_lock(&timer_linux_lock)
+#define CORE_EXIT_CRITICAL() pthread_mutex_unlock(&timer_linux_lock)
+
+#endif // __linux__
+#endif /* TIMER_LINUX_H_ */
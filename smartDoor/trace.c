@@ -0,0 +1,75 @@
+#include "trace.h"
+#include <string.h>
+#include <stdbool.h>
+#include "sl_sleeptimer.h"
+
+#define TRACE_MASK (TRACE_RING_SIZE - 1)
+
+static trace_record trace_ring[TRACE_RING_SIZE];
+static volatile uint32_t trace_head = 0;
+static volatile bool trace_paused = false;
+
+
+/**
+ * writes a record to the trace ring. safe to call from interrupts and main context:
+ * the slot is reserved with an atomic increment and the sequence is written last,
+ * so a record interrupted in the middle is detected (and dropped) by the reader.
+ * @param id: trace_event.
+ * @param arg: event argument.
+ */
+void trace_write(uint16_t id, uint32_t arg) {
+    if (trace_paused) {
+        return;
+    }
+    uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record *rec = trace_ring + (idx & TRACE_MASK);
+    rec->seq = (uint16_t) ~idx;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    rec->tick = sl_sleeptimer_get_tick_count();
+    rec->id = id;
+    rec->arg = arg;
+    __atomic_signal_fence(__ATOMIC_RELEASE);
+    rec->seq = (uint16_t) idx;
+}
+
+
+/**
+ * sends the trace ring in chunks of at most max_len bytes, oldest record first.
+ * tracing is paused while dumping, so the dump doesn't trace itself.
+ * @param out: sends a chunk.
+ * @param max_len: max chunk size in bytes.
+ * @return: 0 on success else -1
+ */
+int trace_dump(trace_out out, uint32_t max_len) {
+    static uint8_t chunk[sizeof(trace_dump_header) + 40 * sizeof(trace_record)];
+    if (max_len > sizeof(chunk)) {
+        max_len = sizeof(chunk);
+    }
+    uint32_t per_chunk = (max_len - sizeof(trace_dump_header)) / sizeof(trace_record);
+    if (max_len <= sizeof(trace_dump_header) || per_chunk == 0) {
+        return -1;
+    }
+    trace_paused = true;
+    trace_dump_header header = {
+        .tick_freq = sl_sleeptimer_get_timer_frequency(),
+        .head = trace_head,
+    };
+    uint32_t first = (header.head > TRACE_RING_SIZE) ? header.head - TRACE_RING_SIZE : 0;
+    int rc = 0;
+    while (first < header.head && rc == 0) {
+        uint32_t count = header.head - first;
+        if (count > per_chunk) {
+            count = per_chunk;
+        }
+        header.first = first;
+        memcpy(chunk, &header, sizeof(header));
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(chunk + sizeof(header) + i * sizeof(trace_record),
+                   trace_ring + ((first + i) & TRACE_MASK), sizeof(trace_record));
+        }
+        rc = out(chunk, sizeof(header) + count * sizeof(trace_record));
+        first += count;
+    }
+    trace_paused = false;
+    return rc;
+}
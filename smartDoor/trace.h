@@ -0,0 +1,75 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+//#define TRACE_ENABLE
+#define TRACE_RING_SIZE 256  /* records, must be a power of 2 */
+
+/**
+ * tracepoint ids, keep in sync with tools/trace_decode.py
+ */
+typedef enum trace_event {
+    TRACE_BT_SCAN_REPORT = 1,  //!< arg: rssi
+    TRACE_ADD_DEVICE,          //!< arg: index in the device list, -1 if dropped
+    TRACE_SEND_DEVICE,         //!< arg: index in the device list
+    TRACE_PUBLISH_START,       //!< arg: payload length
+    TRACE_PUBLISH_END,         //!< arg: return code
+    TRACE_NET_READ_START,      //!< arg: requested length
+    TRACE_NET_READ_END,        //!< arg: read length or error code
+    TRACE_NET_WRITE_START,     //!< arg: length
+    TRACE_NET_WRITE_END,       //!< arg: written length or error code
+    TRACE_MQTT_MSG,            //!< arg: payload length
+    TRACE_DOOR_OPEN,           //!< arg: 0
+    TRACE_DOOR_TIMEOUT,        //!< arg: door status
+    TRACE_LED,                 //!< arg: 1 on, 0 off
+} trace_event;
+
+/**
+ * binary trace record, written lock free into the trace ring.
+ */
+typedef struct trace_record {
+    uint32_t tick;  // sleeptimer tick count
+    uint16_t id;    // trace_event
+    uint16_t seq;   // low bits of the record index, written last (torn record detection)
+    uint32_t arg;
+} trace_record;
+
+/**
+ * header of every dump chunk, followed by the records.
+ */
+typedef struct trace_dump_header {
+    uint32_t tick_freq;  // sleeptimer ticks per second
+    uint32_t head;       // index of the next record to be written
+    uint32_t first;      // index of the first record in this chunk
+} trace_dump_header;
+
+/**
+ * callback that sends one dump chunk.
+ * @return: 0 on success else -1
+ */
+typedef int (*trace_out)(const uint8_t *buf, uint32_t len);
+
+#ifdef TRACE_ENABLE
+#define TRACE_POINT(ID, ARG) trace_write((ID), (uint32_t) (ARG))
+#else
+#define TRACE_POINT(ID, ARG)
+#endif
+
+/**
+ * writes a record to the trace ring. safe to call from interrupts and main context.
+ * @param id: trace_event.
+ * @param arg: event argument.
+ */
+void trace_write(uint16_t id, uint32_t arg);
+
+/**
+ * sends the trace ring in chunks of at most max_len bytes, oldest record first.
+ * tracing is paused while dumping, so the dump doesn't trace itself.
+ * @param out: sends a chunk.
+ * @param max_len: max chunk size in bytes.
+ * @return: 0 on success else -1
+ */
+int trace_dump(trace_out out, uint32_t max_len);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,40 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+#include <stdio.h>
+
+/*
+ * the checks of the host tests: a failed check prints where and goes on,
+ * check_report prints the result and gives the exit code of the test.
+ */
+
+static int check_failed = 0;
+static int check_count = 0;
+
+#define CHECK(cond) do { \
+        check_count++; \
+        if (!(cond)) { \
+            check_failed++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long _a = (long long) (a), _b = (long long) (b); \
+        check_count++; \
+        if (_a != _b) { \
+            check_failed++; \
+            fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+        } \
+    } while (0)
+
+
+/**
+ * @param name: the name of the test.
+ * @return: the exit code, 0 if every check passed else 1
+ */
+static inline int check_report(const char *name) {
+    printf("%s: %d checks, %d failed\n", name, check_count, check_failed);
+    return check_failed ? 1 : 0;
+}
+
+#endif /* CHECK_H_ */
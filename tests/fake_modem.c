@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "fake_modem.h"
+
+#define LINE_MAX_SIZE 256
+#define QUEUE_SIZE 65536   /* data a socket holds for AT^SISR */
+#define GUARD_MS 50        /* quiet time after +++ that ends the transparent mode */
+#define POLL_MS 10
+#define COPS_LIST "\r\n+COPS: (2,\"Orange\",\"Orange\",\"27099\",0),(1,\"Tango\",\"Tango\",\"27077\",2),,(0-4),(0-2)\r\n"
+
+/**
+ * a service profile of the modem, its socket echoes what is written to it.
+ */
+typedef struct profile {
+    bool open;
+    bool announce;              // send ^SISR: <p>,1 when data comes (the last read drained it)
+    unsigned int len;           // bytes in queue
+    uint8_t queue[QUEUE_SIZE];  // echoed data not read yet
+} profile;
+
+static fake_modem *script;
+static int master = -1;
+static pthread_t thread;
+static volatile bool running = false;
+static profile profiles[FAKE_MODEM_PROFILES];
+static int transparent = -1;    // profile in transparent mode, -1 in command mode
+static int plus_count = 0;      // '+' held back in transparent mode, may be the escape
+static int raw_profile = -1;    // AT^SISW data goes to this profile
+static unsigned int raw_left = 0;
+static char line[LINE_MAX_SIZE];
+static unsigned int line_len = 0;
+static bool after_cr = false;   // the last byte ended a command, a '\n' after it isn't data
+static bool garbled = false;    // switched to bad_baud, only AT+IPR gets through
+
+
+static void sleep_ms(unsigned int ms) {
+    if (ms) {
+        usleep(ms * 1000);
+    }
+}
+
+
+/**
+ * writes to the pty, paced at the baud rate of the script.
+ */
+static void out(const void *buf, unsigned int len) {
+    const char *p = buf;
+    unsigned int left = len;
+    while (left > 0) {
+        ssize_t rc = write(master, p, left);
+        if (rc > 0) {
+            p += rc;
+            left -= rc;
+            continue;
+        }
+        struct pollfd pfd = {master, POLLOUT, 0};
+        poll(&pfd, 1, POLL_MS);
+        if (!running) {
+            return;
+        }
+    }
+    if (script->baud) {
+        usleep((useconds_t) ((uint64_t) len * 10 * 1000000 / script->baud));
+    }
+}
+
+
+static void out_str(const char *s) {
+    out(s, strlen(s));
+}
+
+
+/**
+ * @return: the profile number after prefix, -1 if it isn't valid
+ */
+static int profile_of(const char *cmd, const char *prefix) {
+    int p = atoi(cmd + strlen(prefix));
+    return (p >= 0 && p < FAKE_MODEM_PROFILES) ? p : -1;
+}
+
+
+static void socket_write(int p, unsigned int len) {
+    char buf[64];
+    profile *prof = profiles + p;
+    unsigned int room = QUEUE_SIZE - prof->len;
+    unsigned int cnf = len < room ? len : room;
+    snprintf(buf, sizeof(buf), "\r\n^SISW: %d,%u,%u\r\n", p, cnf, prof->len + cnf);
+    out_str(buf);
+    raw_profile = p;
+    raw_left = cnf;
+    if (cnf == 0) {
+        out_str("\r\nOK\r\n");
+    }
+}
+
+
+static void socket_read(int p, unsigned int len) {
+    static char buf[QUEUE_SIZE + 64];
+    profile *prof = profiles + p;
+    unsigned int cnf = len < prof->len ? len : prof->len;
+    int n = snprintf(buf, sizeof(buf), "\r\n^SISR: %d,%u\r\n", p, cnf);
+    memcpy(buf + n, prof->queue, cnf);
+    n += cnf;
+    memcpy(buf + n, "\r\nOK\r\n", 6);
+    memmove(prof->queue, prof->queue + cnf, prof->len - cnf);
+    prof->len -= cnf;
+    if (cnf < len) {
+        prof->announce = true;
+    }
+    out(buf, n + 6);
+}
+
+
+/**
+ * answers one AT command.
+ */
+static void command(const char *cmd) {
+    char buf[128];
+    int p = 0;
+    unsigned int len = 0;
+    script->commands++;
+    if (garbled && strncmp(cmd, "AT+IPR=", 7) != 0) {
+        return;
+    }
+    sleep_ms(script->reply_ms);
+    if (strcmp(cmd, "AT") == 0 || strcmp(cmd, "ATE0") == 0 || strncmp(cmd, "AT^SCFG=", 8) == 0 ||
+        strncmp(cmd, "AT\\Q", 4) == 0 || strncmp(cmd, "AT^SICS=", 8) == 0 ||
+        (strncmp(cmd, "AT+COPS=", 8) == 0 && cmd[8] != '?')) {
+        out_str("\r\nOK\r\n");
+    } else if (strncmp(cmd, "AT+IPR=", 7) == 0) {
+        out_str("\r\nOK\r\n");
+        script->baud = (unsigned int) atoi(cmd + 7);
+        garbled = script->bad_baud && script->baud == script->bad_baud;
+    } else if (strcmp(cmd, "AT+COPS=?") == 0) {
+        sleep_ms(script->cops_ms);
+        out_str(COPS_LIST "\r\nOK\r\n");
+    } else if (strcmp(cmd, "AT+CREG?") == 0) {
+        out_str("\r\n+CREG: 0,1\r\n\r\nOK\r\n");
+    } else if (strncmp(cmd, "AT^SISS=", 8) == 0 && (p = profile_of(cmd, "AT^SISS=")) != -1) {
+        const char *addr = strstr(cmd, "socktcp://");
+        if (addr) {
+            addr += strlen("socktcp://");
+            len = (unsigned int) strcspn(addr, ":");
+            len = len < sizeof(script->address[p]) - 1 ? len : sizeof(script->address[p]) - 1;
+            memcpy(script->address[p], addr, len);
+            script->address[p][len] = '\0';
+        }
+        out_str("\r\nOK\r\n");
+    } else if (strncmp(cmd, "AT^SISX=\"HostByName\",", 21) == 0) {
+        script->lookups++;
+        if (script->resolve_fails) {
+            out_str("\r\nERROR\r\n");
+            return;
+        }
+        sleep_ms(script->resolve_ms);
+        out_str("\r\n^SISX: \"HostByName\",\"" FAKE_MODEM_IP "\"\r\n\r\nOK\r\n");
+    } else if (strncmp(cmd, "AT^SISO=", 8) == 0 && (p = profile_of(cmd, "AT^SISO=")) != -1) {
+        script->connects++;
+        sleep_ms(script->connect_ms);
+        if (strcmp(script->address[p], FAKE_MODEM_IP) != 0) {
+            sleep_ms(script->resolve_ms);  /* a name in the profile, the modem asks the DNS first */
+        } else if (script->refuse_ip) {
+            out_str("\r\nERROR\r\n");
+            return;
+        }
+        profiles[p].open = true;
+        profiles[p].announce = true;
+        profiles[p].len = 0;
+        snprintf(buf, sizeof(buf), "\r\nOK\r\n\r\n^SISW: %d,1\r\n", p);
+        out_str(buf);
+    } else if (strncmp(cmd, "AT^SIST=", 8) == 0 && (p = profile_of(cmd, "AT^SIST=")) != -1 && profiles[p].open) {
+        transparent = p;
+        plus_count = 0;
+        out_str("\r\nCONNECT\r\n");
+    } else if (sscanf(cmd, "AT^SISW=%d,%u", &p, &len) == 2 && p >= 0 && p < FAKE_MODEM_PROFILES && profiles[p].open) {
+        socket_write(p, len);
+    } else if (sscanf(cmd, "AT^SISR=%d,%u", &p, &len) == 2 && p >= 0 && p < FAKE_MODEM_PROFILES && profiles[p].open) {
+        socket_read(p, len);
+    } else if (strncmp(cmd, "AT^SISC=", 8) == 0 && (p = profile_of(cmd, "AT^SISC=")) != -1) {
+        profiles[p].open = false;
+        profiles[p].len = 0;
+        out_str("\r\nOK\r\n");
+    } else {
+        out_str("\r\nERROR\r\n");
+    }
+}
+
+
+/**
+ * takes the bytes of the port in the state the modem is in.
+ * @return: bytes to echo in transparent mode, in echo
+ */
+static unsigned int feed(const uint8_t *in, unsigned int n, uint8_t *echo) {
+    unsigned int echo_len = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        uint8_t c = in[i];
+        bool skip_lf = after_cr;
+        after_cr = false;
+        if (c == '\n' && skip_lf) {
+            continue;
+        }
+        if (raw_left > 0) {
+            profile *prof = profiles + raw_profile;
+            prof->queue[prof->len++] = c;
+            if (--raw_left == 0) {
+                char urc[32];
+                out_str("\r\nOK\r\n");
+                if (prof->announce) {
+                    prof->announce = false;
+                    snprintf(urc, sizeof(urc), "\r\n^SISR: %d,1\r\n", raw_profile);
+                    out_str(urc);
+                }
+            }
+        } else if (transparent >= 0) {
+            if (c == '+' && plus_count < 3) {
+                plus_count++;
+                continue;
+            }
+            for (; plus_count > 0; plus_count--) {
+                echo[echo_len++] = '+';
+            }
+            echo[echo_len++] = c;
+        } else if (c == '\r') {
+            line[line_len] = '\0';
+            if (line_len > 0) {
+                command(line);
+            }
+            line_len = 0;
+            after_cr = true;
+        } else if (c != '\n' && line_len < sizeof(line) - 1) {
+            line[line_len++] = (char) c;
+        }
+    }
+    return echo_len;
+}
+
+
+static void *modem_main(void *arg) {
+    (void) arg;
+    static uint8_t in[4096], echo[2 * sizeof(in)];
+    struct timespec quiet_since;
+    clock_gettime(CLOCK_MONOTONIC, &quiet_since);
+    while (running) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        ssize_t n = 0;
+        if (poll(&pfd, 1, POLL_MS) > 0) {
+            n = read(master, in, sizeof(in));
+        }
+        if (n > 0) {
+            unsigned int echo_len = feed(in, (unsigned int) n, echo);
+            if (echo_len) {
+                out(echo, echo_len);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &quiet_since);
+            continue;
+        }
+        if (n < 0) {
+            sleep_ms(POLL_MS);  /* the port is closed, wait for it to open again */
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long quiet_ms = (now.tv_sec - quiet_since.tv_sec) * 1000 + (now.tv_nsec - quiet_since.tv_nsec) / 1000000;
+        if (transparent >= 0 && plus_count == 3 && quiet_ms >= GUARD_MS) {
+            /* +++ and the guard time: back to command mode, the connection stays up */
+            transparent = -1;
+            plus_count = 0;
+            out_str("\r\nOK\r\n");
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * opens a pty and starts answering on it.
+ * @param modem: the script, must live until fake_modem_stop.
+ * @return: path of the port to open with SerialInit, NULL on failure
+ */
+char *fake_modem_start(fake_modem *modem) {
+    struct termios tio;
+    script = modem;
+    memset(profiles, 0, sizeof(profiles));
+    transparent = raw_profile = -1;
+    plus_count = 0;
+    raw_left = line_len = 0;
+    after_cr = false;
+    garbled = false;
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master == -1 || grantpt(master) != 0 || unlockpt(master) != 0 || tcgetattr(master, &tio) != 0) {
+        return NULL;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    running = true;
+    if (pthread_create(&thread, NULL, modem_main, NULL) != 0) {
+        running = false;
+        return NULL;
+    }
+    return ptsname(master);
+}
+
+
+/**
+ * stops the modem and closes the pty.
+ */
+void fake_modem_stop(void) {
+    if (running) {
+        running = false;
+        pthread_join(thread, NULL);
+    }
+    if (master != -1) {
+        close(master);
+        master = -1;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef FAKE_MODEM_H_
+#define FAKE_MODEM_H_
+
+#include <stdint.h>
+
+/*
+ * a scripted Cinterion EHS6 on a pseudo terminal for the host tests of the modem stack.
+ * it answers the AT commands cellular.c sends, and its sockets echo what is written to them:
+ * transparent (AT^SIST, until +++) and with URCs (AT^SISW / AT^SISR and ^SISR: <p>,1).
+ */
+
+#define FAKE_MODEM_PROFILES 10
+#define FAKE_MODEM_IP "10.20.30.40"  /* address every ^SISX lookup gets */
+
+/**
+ * what the fake modem does and what it saw, the fields can be changed while it runs.
+ */
+typedef struct fake_modem {
+    unsigned int baud;           // line rate its output is paced at, AT+IPR changes it. 0: no pacing
+    unsigned int reply_ms;       // before every response
+    unsigned int cops_ms;        // before the AT+COPS=? response (the network scan)
+    unsigned int resolve_ms;     // before the ^SISX response (a DNS round trip)
+    unsigned int connect_ms;     // before the AT^SISO response, and resolve_ms more to a host name
+    int resolve_fails;           // ^SISX answers ERROR
+    int refuse_ip;               // AT^SISO to FAKE_MODEM_IP answers ERROR (the host moved)
+    unsigned int bad_baud;       // AT+IPR to this rate answers OK, then the line is garbage until the next AT+IPR
+    volatile int commands;       // AT commands seen
+    volatile int lookups;        // AT^SISX commands seen
+    volatile int connects;       // AT^SISO commands seen
+    char address[FAKE_MODEM_PROFILES][64];  // host of the last AT^SISS address of each profile
+} fake_modem;
+
+/**
+ * opens a pty and starts answering on it.
+ * @param modem: the script, must live until fake_modem_stop.
+ * @return: path of the port to open with SerialInit, NULL on failure
+ */
+char *fake_modem_start(fake_modem *modem);
+
+/**
+ * stops the modem and closes the pty.
+ */
+void fake_modem_stop(void);
+
+#endif // FAKE_MODEM_H_
@@ -0,0 +1,41 @@
+#ifndef TESTS_MBEDTLS_SHA256_H_
+#define TESTS_MBEDTLS_SHA256_H_
+#include <openssl/sha.h>
+
+/*
+ * the part of mbedtls/sha256.h that ota.c uses, on OpenSSL (libcrypto) for the host tests.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+typedef SHA256_CTX mbedtls_sha256_context;
+
+static inline void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    SHA256_Init(ctx);
+}
+
+static inline void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+    (void) ctx;
+}
+
+static inline int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) {
+    (void) is224;
+    return SHA256_Init(ctx) == 1 ? 0 : -1;
+}
+
+static inline int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *data, size_t len) {
+    return SHA256_Update(ctx, data, len) == 1 ? 0 : -1;
+}
+
+static inline int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char *out) {
+    return SHA256_Final(out, ctx) == 1 ? 0 : -1;
+}
+
+static inline void mbedtls_sha256_clone(mbedtls_sha256_context *dst, const mbedtls_sha256_context *src) {
+    *dst = *src;
+}
+
+#pragma GCC diagnostic pop
+
+#endif // TESTS_MBEDTLS_SHA256_H_
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include "adv_filter.h"
+#include "metrics.h"
+#include "check.h"
+
+/*
+ * host tests of the advertisement payload filter (adv_filter.c): every rule kind in the UUID
+ * list and the service data forms, the manufacturer prefix, the address types, broken AD
+ * structures, the filter commands that must not parse (odd or too long hex, trailing words)
+ * and a full rule table. the hex parser and the byte order show through the adverts that
+ * match: the rules are written most significant byte first, the adverts are little endian.
+ */
+
+#define PUBLIC 0
+#define RANDOM 1
+
+/* the advert given as its bytes */
+#define MATCH(TYPE, ...) \
+    adv_filter_match((TYPE), (const uint8_t[]) {__VA_ARGS__}, sizeof((const uint8_t[]) {__VA_ARGS__}))
+
+/* 6e400001-b5a3-f393-e0a9-e50e24dcca9e, little endian */
+#define NUS_UUID 0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x01, 0x00, 0x40, 0x6e
+
+
+static void test_no_rules(void) {
+    adv_filter_clear();
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06), 1);
+    CHECK_EQ(MATCH(RANDOM, 0xFF, 0x00), 1);  /* not even parsed */
+    CHECK_EQ(adv_filter_match(PUBLIC, NULL, 0), 1);
+}
+
+
+static void test_uuid16(void) {
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 180F"), 0);
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0x02, 0x0F, 0x18), 1);                       /* incomplete list */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06, 0x05, 0x03, 0x0A, 0x18, 0x0F, 0x18), 1);  /* complete, second */
+    CHECK_EQ(MATCH(PUBLIC, 0x04, 0x16, 0x0F, 0x18, 0x64), 1);                 /* service data */
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0x03, 0x18, 0x0F), 0);                       /* the other byte order */
+    CHECK_EQ(MATCH(PUBLIC, 0x05, 0x03, 0x00, 0x0F, 0x18, 0x00), 0);           /* across two elements */
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0xFF, 0x0F, 0x18), 0);                       /* not a UUID structure */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x16, 0x0F), 0);                             /* service data too short */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06), 0);                             /* no UUID at all */
+}
+
+
+static void test_uuid128(void) {
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 6e400001-b5a3-f393-e0a9-e50e24dcca9e"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x06, NUS_UUID), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x07, NUS_UUID), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x13, 0x21, NUS_UUID, 0x01, 0x02), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x21, 0x00, NUS_UUID), 0);  /* cut by one byte */
+    CHECK_EQ(MATCH(RANDOM, 0x03, 0x03, 0x01, 0x00), 0);
+    /* dashes anywhere, upper case */
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 6E40-0001B5A3F393E0A9E50E24DCCA9E"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x07, NUS_UUID), 1);
+}
+
+
+static void test_base_uuid(void) {
+    /* a 16 bit UUID written on the base UUID is matched in its short form */
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 0000fd6f-0000-1000-8000-00805f9b34fb"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x03, 0x03, 0x6F, 0xFD), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0x16, 0x6F, 0xFD, 0xAA, 0xBB), 1);
+    /* a 32 bit UUID on the base, and one off the base, stay 128 bit */
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 1234fd6f-0000-1000-8000-00805f9b34fb"), 0);
+    CHECK_EQ(adv_filter_command("uuid 0000fd6f-0001-1000-8000-00805f9b34fb"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x03, 0x03, 0x6F, 0xFD), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x07, 0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00,
+                   0x6F, 0xFD, 0x34, 0x12), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x11, 0x07, 0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x01, 0x00,
+                   0x6F, 0xFD, 0x00, 0x00), 1);
+}
+
+
+static void test_mfr(void) {
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("mfr 004C 0215"), 0);  /* iBeacon */
+    CHECK_EQ(MATCH(RANDOM, 0x07, 0xFF, 0x4C, 0x00, 0x02, 0x15, 0xAA, 0xBB), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0xFF, 0x4C, 0x00, 0x02, 0x15), 1);         /* the prefix and nothing else */
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0xFF, 0x4C, 0x00, 0x12, 0x19), 0);         /* another Apple advert */
+    CHECK_EQ(MATCH(RANDOM, 0x04, 0xFF, 0x4C, 0x00, 0x02), 0);               /* shorter than the prefix */
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0xFF, 0x00, 0x4C, 0x02, 0x15), 0);         /* company ID big endian */
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0x16, 0x4C, 0x00, 0x02, 0x15), 0);         /* service data */
+    /* no prefix: every advert of the company */
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("mfr 0075"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x03, 0xFF, 0x75, 0x00), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x02, 0xFF, 0x75), 0);
+    /* the longest prefix */
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("mfr 0059 0102030405060708"), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x0B, 0xFF, 0x59, 0x00, 1, 2, 3, 4, 5, 6, 7, 8), 1);
+    CHECK_EQ(MATCH(RANDOM, 0x0B, 0xFF, 0x59, 0x00, 1, 2, 3, 4, 5, 6, 7, 9), 0);
+}
+
+
+static void test_addr(void) {
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("addr 0 2"), 0);
+    CHECK_EQ(MATCH(0, 0x02, 0x01, 0x06), 1);
+    CHECK_EQ(MATCH(1, 0x02, 0x01, 0x06), 0);
+    CHECK_EQ(MATCH(2, 0x02, 0x01, 0x06), 1);
+    CHECK_EQ(MATCH(3, 0x02, 0x01, 0x06), 0);
+    CHECK_EQ(MATCH(0xFF, 0x02, 0x01, 0x06), 0);  /* no type in the mask */
+    /* the type and the payload must both pass */
+    CHECK_EQ(adv_filter_command("uuid 180F"), 0);
+    CHECK_EQ(MATCH(0, 0x03, 0x03, 0x0F, 0x18), 1);
+    CHECK_EQ(MATCH(1, 0x03, 0x03, 0x0F, 0x18), 0);
+    CHECK_EQ(MATCH(0, 0x02, 0x01, 0x06), 0);
+    /* a bad command keeps the mask */
+    CHECK_EQ(adv_filter_command("addr 8"), -1);
+    CHECK_EQ(adv_filter_command("addr 12"), -1);
+    CHECK_EQ(adv_filter_command("addr x"), -1);
+    CHECK_EQ(adv_filter_command("addr  "), -1);
+    CHECK_EQ(MATCH(1, 0x03, 0x03, 0x0F, 0x18), 0);
+    CHECK_EQ(adv_filter_command("addr 1"), 0);
+    CHECK_EQ(MATCH(1, 0x03, 0x03, 0x0F, 0x18), 1);
+    CHECK_EQ(MATCH(0, 0x03, 0x03, 0x0F, 0x18), 0);
+    adv_filter_clear();
+    CHECK_EQ(MATCH(7, 0x02, 0x01, 0x06), 1);
+}
+
+
+static void test_broken_payload(void) {
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 180F"), 0);
+    CHECK_EQ(MATCH(PUBLIC, 0x05, 0x03, 0x0F, 0x18), 0);                 /* longer than the payload */
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0x03, 0x0F), 0);                       /* cut in the UUID */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06, 0x09, 0x03, 0x0F, 0x18), 0);  /* the second one is cut */
+    CHECK_EQ(MATCH(PUBLIC, 0x00, 0x03, 0x03, 0x0F, 0x18), 0);           /* zero length: the end */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06, 0x00, 0x03, 0x03, 0x0F, 0x18), 0);
+    CHECK_EQ(MATCH(PUBLIC, 0x01, 0x03, 0x03, 0x03, 0x0F, 0x18), 1);     /* an empty list, then the UUID */
+    CHECK_EQ(MATCH(PUBLIC, 0x03), 0);
+    CHECK_EQ(adv_filter_match(PUBLIC, NULL, 0), 0);
+}
+
+
+static void test_bad_commands(void) {
+    adv_filter_clear();
+    const char *bad[] = {
+        "uuid 180",                                       /* odd number of digits */
+        "uuid 18G0",                                      /* not hex */
+        "uuid 180F1",
+        "uuid 123456",                                    /* 3 bytes */
+        "uuid 6e400001-b5a3-f393-e0a9-e50e24dcca9e00",    /* 17 bytes */
+        "uuid 6e400001-b5a3-f393-e0a9-e50e24dcca",        /* 15 bytes */
+        "uuid 180F 180A",                                 /* one UUID per command */
+        "uuid",
+        "uuid ",
+        "mfr 4C",                                         /* company ID of 1 byte */
+        "mfr 00004C",
+        "mfr 004C 021",                                   /* odd prefix */
+        "mfr 004C 010203040506070809",                    /* prefix longer than ADV_FILTER_PREFIX_MAX */
+        "mfr 004C 0215 00",
+        "uuid180F",
+        "service 180F",
+        "",
+    };
+    for (unsigned int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (adv_filter_command(bad[i]) != -1) {
+            fprintf(stderr, "accepted \"%s\"\n", bad[i]);
+            CHECK(0);
+        }
+    }
+    /* nothing was added, so every payload still passes */
+    CHECK_EQ(MATCH(PUBLIC, 0x02, 0x01, 0x06), 1);
+    /* spaces around the words */
+    CHECK_EQ(adv_filter_command("mfr  004C  0215 "), 0);
+    CHECK_EQ(MATCH(RANDOM, 0x05, 0xFF, 0x4C, 0x00, 0x02, 0x15), 1);
+}
+
+
+static void test_full_table(void) {
+    char cmd[32];
+    adv_filter_clear();
+    for (int i = 0; i < ADV_FILTER_MAX_RULES; i++) {
+        snprintf(cmd, sizeof(cmd), "uuid 18%02X", i);
+        CHECK_EQ(adv_filter_command(cmd), 0);
+    }
+    CHECK_EQ(adv_filter_command("uuid 1900"), -1);
+    CHECK_EQ(adv_filter_command("mfr 004C"), -1);
+    CHECK_EQ(adv_filter_command("addr 1"), 0);  /* not a rule */
+    for (int i = 0; i < ADV_FILTER_MAX_RULES; i++) {
+        CHECK_EQ(MATCH(RANDOM, 0x03, 0x03, (uint8_t) i, 0x18), 1);
+    }
+    CHECK_EQ(MATCH(RANDOM, 0x03, 0x03, 0x00, 0x19), 0);
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 1900"), 0);
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0x03, 0x00, 0x19), 1);
+    CHECK_EQ(MATCH(PUBLIC, 0x03, 0x03, 0x00, 0x18), 0);
+}
+
+
+static void test_metrics(void) {
+    uint32_t passed = metric_get(METRIC_FILTER_PASSED), ignored = metric_get(METRIC_FILTER_IGNORED);
+    adv_filter_clear();
+    CHECK_EQ(adv_filter_command("uuid 180F"), 0);
+    MATCH(PUBLIC, 0x03, 0x03, 0x0F, 0x18);
+    MATCH(PUBLIC, 0x03, 0x03, 0x0A, 0x18);
+    MATCH(PUBLIC, 0x03, 0x03, 0x0B, 0x18);
+    CHECK_EQ(metric_get(METRIC_FILTER_PASSED) - passed, 1);
+    CHECK_EQ(metric_get(METRIC_FILTER_IGNORED) - ignored, 2);
+}
+
+
+int main(void) {
+    test_no_rules();
+    test_uuid16();
+    test_uuid128();
+    test_base_uuid();
+    test_mfr();
+    test_addr();
+    test_broken_payload();
+    test_bad_commands();
+    test_full_table();
+    test_metrics();
+    return check_report("adv_filter");
+}
@@ -0,0 +1,70 @@
+"""
+host test of tools/boot_report.py with the boot messages of a door over two builds:
+the first without BOOT_PROF_NVM (seq=0 on every boot, boot_report asked twice), the second
+with it (every boot publishes the ones before it again) and a slower operator scan.
+run from the root of the repository: python3 tests/test_boot_report.py
+"""
+import contextlib
+import io
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'tools'))
+import boot_report  # noqa: E402
+
+OLD = 'Oct 10 2026 09:12:40'
+NEW = 'Oct 12 2026 17:03:11'
+
+# what the broker got, in order: one line per message on the boot topic
+LOG = [
+    # OLD, no NVM: each boot publishes only itself
+    f'seq=0,build={OLD},try=1,uart=12,mdm=1630,ops=24310,reg=26120,prof=26480,sock=27930,conn=29010,sub=29400,pub=29650',
+    f'seq=0,build={OLD},try=1,uart=12,mdm=1590,ops=22870,reg=24530,prof=24900,sock=26310,conn=27480,sub=27860,pub=28100',
+    # boot_report while the second boot is up
+    f'seq=0,build={OLD},try=1,uart=12,mdm=1590,ops=22870,reg=24530,prof=24900,sock=26310,conn=27480,sub=27860,pub=28100',
+    f'seq=0,build={OLD},try=2,uart=12,mdm=1610,ops=25940,reg=27700,prof=28050,sock=29620,conn=30710,sub=31120,pub=31370',
+    f'seq=0,build={OLD},try=2,uart=12,mdm=1610,ops=25940,reg=27700,prof=28050,sock=29620,conn=30710,sub=31120,pub=31370',
+    # NEW, with NVM: the history comes again after every boot
+    f'seq=1,build={NEW},try=1,uart=12,mdm=1620,ops=41220,reg=43010,prof=43380,sock=44790,conn=45900,sub=46290,pub=46530',
+    f'seq=2,build={NEW},try=1,uart=12,mdm=1600,ops=39870,reg=41600,prof=41950,sock=43400,conn=44520,sub=44900,pub=45150',
+    f'seq=1,build={NEW},try=1,uart=12,mdm=1620,ops=41220,reg=43010,prof=43380,sock=44790,conn=45900,sub=46290,pub=46530',
+    f'seq=3,build={NEW},try=1,uart=12,mdm=1640,ops=42560,reg=44330,prof=44700,sock=46150,conn=47260,sub=47650,pub=47900',
+    f'seq=2,build={NEW},try=1,uart=12,mdm=1600,ops=39870,reg=41600,prof=41950,sock=43400,conn=44520,sub=44900,pub=45150',
+    f'seq=1,build={NEW},try=1,uart=12,mdm=1620,ops=41220,reg=43010,prof=43380,sock=44790,conn=45900,sub=46290,pub=46530',
+    'connect',
+]
+
+checks = failed = 0
+
+
+def check(cond, what):
+    global checks, failed
+    checks += 1
+    if not cond:
+        failed += 1
+        print(f'{__file__}: {what} failed', file=sys.stderr)
+
+
+def main():
+    boots = [b for b in map(boot_report.parse, LOG) if b]
+    check(len(boots) == len(LOG) - 1, 'parse')
+    builds = boot_report.by_build(boots)
+    check([build for build, _ in builds] == [OLD, NEW], 'builds in order')
+    counts = dict((build, len(b)) for build, b in builds)
+    check(counts.get(OLD) == 3, f'boots of the build without NVM: {counts.get(OLD)}')
+    check(counts.get(NEW) == 3, f'boots of the build with NVM: {counts.get(NEW)}')
+    check(sorted(b['seq'] for b in dict(builds)[NEW]) == [1, 2, 3], 'seq of the build with NVM')
+
+    with contextlib.redirect_stdout(io.StringIO()) as out:
+        regressions = boot_report.report(builds, 1000, 0.2)
+    check(regressions == ['ops', 'total'], f'regressions: {regressions}')
+    check('operator scan 22680ms -> 39600ms' in out.getvalue(), 'regression line')
+    med = boot_report.medians(dict(builds)[OLD])
+    check(med['ops'] == 22680 and med['mdm'] == 1598, f'medians: {med}')
+
+    print(f'boot_report: {checks} checks, {failed} failed')
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
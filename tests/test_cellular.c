@@ -0,0 +1,410 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "socket.h"
+#include "cellular.h"
+#include "serial_io.h"
+#include "timer.h"
+#include "metrics.h"
+#include "fake_modem.h"
+#include "check.h"
+
+/*
+ * host tests of the modem stack (socket_linux_modem.c, cellular.c, serial_io_linux.c) against
+ * the fake modem: bring up, echo through the socket and closing it, and the broker address
+ * cache: the bring up time without it, with the first lookup, from the cache, and the fallback
+ * to the name when the cached address doesn't connect.
+ * run.sh builds it twice, in the transparent mode and with CELLULAR_SOCKET_URC, which adds a
+ * second socket next to the main one and checks that only a real ^SISR flags a socket.
+ * the wait hook (SerialSetWaitHook) gets events every EVENT_MS, the bluetooth stand in, and
+ * refreshes the status screen stand in every SCREEN_MS while a slow modem is brought up: without
+ * the hook the events wait for the whole bring up and the screen stops, with it the events wait
+ * about one slice of the epoll wait and the screen keeps its rate.
+ * CellularSetBaud goes back to the old rate when the modem doesn't answer on the new one
+ * (transparent build only, it waits out the retries of CellularWaitUntilModemResponds).
+ * prints the bring up times (METRIC_CONNECT_MS), the event latencies, echo throughput and lost
+ * bytes after switching to each rate of BENCH_BAUDS, and ends with one line of numbers of the
+ * mode: AT command round trip before connecting and while connected, and echo throughput
+ * (bytes/s both ways) with the fake modem paced at the baud rate.
+ * the rate lines also give the cpu the door's thread used (serial_io_linux.c and the modem stack,
+ * not the fake modem) in permille of the run, and the epoll wake ups per kB, the host side of
+ * the comparison with the MCU driver (cpu and uirq from the metrics topic of the door).
+ * a pty has no line rate of its own, the fake modem paces its output and nothing is lost on the
+ * wire, so the lost bytes count what the driver and the socket code drop.
+ */
+
+#ifdef CELLULAR_SOCKET_URC
+#define MODE "urc"
+#else
+#define MODE "transparent"
+#endif
+#define HOST FAKE_MODEM_IP
+#define HOST_NAME "echo.example.com"
+#define DNS_MS 300  /* a DNS round trip over the cellular link */
+#define PORT 7
+#define ECHO_CHUNK 256
+#define ECHO_BYTES 8192
+#define BENCH_BYTES 32768
+#define BENCH_COMMANDS 200
+#define BENCH_CONNECTED 10
+#define READ_TIMEOUT 2000
+#define EVENT_MS 5         /* a scan report every 5 ms */
+#define LOADED_MS 500      /* the modem answers every command this late */
+#define EVENT_LATENCY_MS 50
+#define SCREEN_MS 250      /* STATUS_PERIOD of the door, 4 Hz */
+#define BAD_BAUD 460800
+static const unsigned int BENCH_BAUDS[] = {115200, 230400, 460800, 921600};
+
+static fake_modem modem = {.baud = CELLULAR_BAUD};
+static volatile uint64_t event_at = 0;   /* cur_time of the pending event, 0 if none */
+static volatile int events_running = 0;
+static uint64_t event_worst = 0;
+static uint64_t screen_last = 0;  /* cur_time of the last status screen refresh */
+static uint64_t screen_gap = 0;   /* worst time between two refreshes */
+static int screens = 0;
+
+
+/**
+ * echoes total bytes through sock in chunks and checks they come back.
+ * @return: bytes that came back right
+ */
+static unsigned int echo(int sock, unsigned int total) {
+    unsigned char out[ECHO_CHUNK], in[ECHO_CHUNK];
+    unsigned int sent = 0;
+    while (sent < total) {
+        unsigned int len = (total - sent < ECHO_CHUNK) ? total - sent : ECHO_CHUNK;
+        for (unsigned int i = 0; i < len; i++) {
+            out[i] = (unsigned char) (sent + i + sock);
+        }
+        if (SocketSend(sock, out, len) != (int) len) {
+            break;
+        }
+        unsigned int got = 0;
+        while (got < len) {
+            int rc = SocketRecv(sock, in + got, len - got, READ_TIMEOUT);
+            if (rc <= 0) {
+                return sent;
+            }
+            got += rc;
+        }
+        if (memcmp(in, out, len) != 0) {
+            break;
+        }
+        sent += len;
+    }
+    return sent;
+}
+
+
+/**
+ * @return: 1 if sock has nothing to read and SocketPending tells so
+ */
+static int drained(int sock) {
+    unsigned char c;
+    return SocketRecv(sock, &c, 1, 50) == 0 && SocketPending(sock) == 0;
+}
+
+
+static void test_bring_up(void) {
+    CHECK_EQ(SocketInit(NULL, PORT), -1);
+    CHECK_EQ(SocketInit(HOST, 65536), -1);
+    uint64_t start = cur_time();
+    CHECK_EQ(SocketInit(HOST, PORT), 0);
+    CHECK(strcmp(modem.address[0], FAKE_MODEM_IP) == 0);
+    CHECK_EQ(SocketConnect(), 0);
+    CHECK_EQ(modem.connects, 1);
+    /* the exchanges end at the final result code, not at their timeouts */
+    CHECK(cur_time() - start < 2000);
+    CHECK_EQ(echo(SOCKET_MAIN, ECHO_BYTES), ECHO_BYTES);
+    CHECK(drained(SOCKET_MAIN));
+}
+
+
+#ifdef CELLULAR_SOCKET_URC
+static void test_second_socket(void) {
+    unsigned char in[8];
+    int sock = SocketOpen(HOST, PORT);
+    CHECK_EQ(sock, 1);
+    CHECK_EQ(SocketOpen(HOST, PORT), -1);  /* every profile is taken */
+    CHECK_EQ(echo(sock, ECHO_BYTES), ECHO_BYTES);
+    CHECK_EQ(echo(SOCKET_MAIN, ECHO_BYTES), ECHO_BYTES);
+    CHECK(drained(SOCKET_MAIN));
+
+    /* the ^SISR of sock comes while another command runs, it flags sock and nothing else */
+    CHECK_EQ(SocketSend(sock, (unsigned char *) "ping", 4), 4);
+    usleep(20000);
+    int status = 0;
+    CHECK_EQ(CellularGetRegistrationStatus(&status), 0);
+    CHECK_EQ(SocketPending(sock), 1);
+    CHECK_EQ(SocketPending(SOCKET_MAIN), 0);
+    CHECK_EQ(SocketRecv(sock, in, sizeof(in), READ_TIMEOUT), 4);
+    CHECK(memcmp(in, "ping", 4) == 0);
+    CHECK(drained(sock));
+
+    CHECK_EQ(SocketRelease(sock), 0);
+    CHECK_EQ(SocketRelease(SOCKET_MAIN), -1);
+}
+#endif
+
+
+/**
+ * @return: microseconds of an AT command while the socket is connected: in the transparent
+ * mode it has to leave the connection (+++) and connect again
+ */
+static uint64_t connected_command_us(void) {
+    uint64_t start = cur_time_us();
+    for (int i = 0; i < BENCH_CONNECTED; i++) {
+#ifdef CELLULAR_SOCKET_URC
+        CHECK_EQ(CellularCheckModem(), 0);
+#else
+        CHECK_EQ(SocketClose(), 0);
+        CHECK_EQ(CellularCheckModem(), 0);
+        CHECK_EQ(SocketConnect(), 0);
+#endif
+    }
+    return (cur_time_us() - start) / BENCH_CONNECTED;
+}
+
+
+/**
+ * brings the socket up to host and down again.
+ * @return: METRIC_CONNECT_MS of the bring up, 0 if it failed
+ */
+static uint32_t bring_up(char *host) {
+    uint32_t ms = 0;
+    if (SocketInit(host, PORT) == 0 && SocketConnect() == 0) {
+        ms = metric_get(METRIC_CONNECT_MS);
+    }
+    SocketClose();
+    SocketDeInit();
+    return ms;
+}
+
+
+static void test_dns(void) {
+    modem.resolve_ms = DNS_MS;
+    /* without an address the name goes in the profile, the modem resolves it on every connect */
+    modem.resolve_fails = 1;
+    uint32_t name_ms = bring_up(HOST_NAME);
+    CHECK(strcmp(modem.address[0], HOST_NAME) == 0);
+    modem.resolve_fails = 0;
+
+    int lookups = modem.lookups;
+    uint32_t lookup_ms = bring_up(HOST_NAME);
+    CHECK_EQ(modem.lookups, lookups + 1);
+    CHECK(strcmp(modem.address[0], FAKE_MODEM_IP) == 0);
+    uint32_t cached_ms = bring_up(HOST_NAME);
+    CHECK_EQ(modem.lookups, lookups + 1);
+    CHECK(name_ms >= DNS_MS && lookup_ms >= DNS_MS);
+    CHECK(cached_ms > 0 && cached_ms < DNS_MS);
+
+    /* the cached address doesn't connect: the profile gets the name and the entry is dropped */
+    modem.refuse_ip = 1;
+    CHECK(bring_up(HOST_NAME) > 0);
+    CHECK(strcmp(modem.address[0], HOST_NAME) == 0);
+    modem.refuse_ip = 0;
+    CHECK(bring_up(HOST_NAME) > 0);
+    CHECK_EQ(modem.lookups, lookups + 2);
+    modem.resolve_ms = 0;
+    printf("dns_ms=%d,by_name_ms=%lu,lookup_ms=%lu,cached_ms=%lu\n", DNS_MS, (unsigned long) name_ms,
+           (unsigned long) lookup_ms, (unsigned long) cached_ms);
+}
+
+
+/**
+ * makes an event every EVENT_MS unless one is pending, the radio of the test.
+ */
+static void *event_main(void *arg) {
+    (void) arg;
+    while (events_running) {
+        if (event_at == 0) {
+            event_at = cur_time();
+        }
+        usleep(EVENT_MS * 1000);
+    }
+    return NULL;
+}
+
+
+static bool event_ready(void) {
+    return event_at != 0;
+}
+
+
+static bool screen_due(void) {
+    return cur_time() - screen_last >= SCREEN_MS;
+}
+
+
+static bool wait_ready(void) {
+    return event_ready() || screen_due();
+}
+
+
+/**
+ * the main loop of the test: the event, then the status screen when it is due.
+ */
+static void wait_run(void) {
+    uint64_t now = cur_time();
+    if (event_ready()) {
+        uint64_t latency = now - event_at;
+        event_worst = latency > event_worst ? latency : event_worst;
+        event_at = 0;
+    }
+    if (screen_due()) {
+        screen_gap = now - screen_last > screen_gap ? now - screen_last : screen_gap;
+        screen_last = now;
+        screens++;
+    }
+}
+
+
+/**
+ * brings up a slow modem and echoes through it while the events come.
+ * @param screen_hz: output, status screen refreshes per second over the run.
+ * @return: worst event latency, ms
+ */
+static uint64_t loaded_bring_up(double *screen_hz) {
+    pthread_t thread;
+    event_worst = 0;
+    event_at = 0;
+    events_running = 1;
+    screens = 0;
+    screen_gap = 0;
+    screen_last = cur_time();
+    uint64_t start = screen_last;
+    CHECK_EQ(pthread_create(&thread, NULL, event_main, NULL), 0);
+    modem.reply_ms = LOADED_MS;
+    CHECK_EQ(SocketInit(HOST, PORT), 0);
+    CHECK_EQ(SocketConnect(), 0);
+    modem.reply_ms = 0;
+    CHECK_EQ(echo(SOCKET_MAIN, ECHO_BYTES), ECHO_BYTES);
+    if (wait_ready()) {
+        wait_run();  /* the main loop gets its turn */
+    }
+    *screen_hz = screens * 1000.0 / (double) (cur_time() - start);
+    events_running = 0;
+    pthread_join(thread, NULL);
+    SocketClose();
+    SocketDeInit();
+    return event_worst;
+}
+
+
+static void test_wait_hook(void) {
+    double without_hz, with_hz;
+    uint64_t without_ms = loaded_bring_up(&without_hz);
+    uint64_t without_gap = screen_gap;
+    SerialSetWaitHook(wait_ready, wait_run);
+    uint64_t with_ms = loaded_bring_up(&with_hz);
+    SerialSetWaitHook(NULL, NULL);
+    CHECK(without_ms >= LOADED_MS);
+    CHECK(with_ms < EVENT_LATENCY_MS);
+    CHECK(without_gap >= LOADED_MS);
+    CHECK(screen_gap < SCREEN_MS + EVENT_LATENCY_MS);
+    printf("event_latency_ms: without_hook=%lu,with_hook=%lu\n", (unsigned long) without_ms,
+           (unsigned long) with_ms);
+    printf("screen_hz: without_hook=%.2f,with_hook=%.2f,worst_gap_ms: without_hook=%lu,with_hook=%lu\n",
+           without_hz, with_hz, (unsigned long) without_gap, (unsigned long) screen_gap);
+}
+
+
+#ifndef CELLULAR_SOCKET_URC
+static void test_baud_fallback(void) {
+    CHECK_EQ(SocketInit(HOST, PORT), 0);
+    modem.bad_baud = BAD_BAUD;
+    CHECK_EQ(CellularSetBaud(BAD_BAUD), -1);
+    modem.bad_baud = 0;
+    CHECK_EQ(CellularCheckModem(), 0);
+    CHECK_EQ(modem.baud, CELLULAR_BAUD);  /* asked to go back on the new rate */
+    CHECK_EQ(SocketConnect(), 0);
+    CHECK_EQ(echo(SOCKET_MAIN, ECHO_BYTES), ECHO_BYTES);
+    CHECK_EQ(SocketClose(), 0);
+    SocketDeInit();
+}
+#endif
+
+
+/**
+ * @return: microseconds of cpu the calling thread used, user and system
+ */
+static uint64_t thread_cpu_us(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+/**
+ * echoes BENCH_BYTES after switching the link to each rate of BENCH_BAUDS.
+ */
+static void bench_baud(void) {
+    for (unsigned int i = 0; i < sizeof(BENCH_BAUDS) / sizeof(BENCH_BAUDS[0]); i++) {
+        CHECK_EQ(SocketInit(HOST, PORT), 0);
+        CHECK_EQ(CellularSetBaud(BENCH_BAUDS[i]), 0);
+        CHECK_EQ(modem.baud, BENCH_BAUDS[i]);
+        CHECK_EQ(SocketConnect(), 0);
+        uint32_t wakes = metric_get(METRIC_UART_IRQS);
+        uint64_t cpu = thread_cpu_us();
+        uint64_t start = cur_time_us();
+        unsigned int bytes = echo(SOCKET_MAIN, BENCH_BYTES);
+        uint64_t us = cur_time_us() - start;
+        cpu = thread_cpu_us() - cpu;
+        wakes = metric_get(METRIC_UART_IRQS) - wakes;
+        CHECK_EQ(bytes, BENCH_BYTES);
+        CHECK_EQ(SocketClose(), 0);
+        CHECK_EQ(CellularSetBaud(CELLULAR_BAUD), 0);
+        SocketDeInit();
+        printf("baud=%u,bps=%lu,lost=%u,cpu_permille=%lu,wakes_per_kb=%lu\n", BENCH_BAUDS[i],
+               (unsigned long) (us ? bytes * 2 * 1000000ULL / us : 0), BENCH_BYTES - bytes,
+               (unsigned long) (us ? cpu * 1000 / us : 0), (unsigned long) (wakes * 1024 / (bytes * 2)));
+    }
+}
+
+
+static void bench(void) {
+    CHECK_EQ(SocketInit(HOST, PORT), 0);
+    uint64_t start = cur_time_us();
+    for (int i = 0; i < BENCH_COMMANDS; i++) {
+        CHECK_EQ(CellularCheckModem(), 0);
+    }
+    uint64_t at_us = (cur_time_us() - start) / BENCH_COMMANDS;
+    CHECK_EQ(SocketConnect(), 0);
+    uint64_t connected_us = connected_command_us();
+    start = cur_time_us();
+    unsigned int bytes = echo(SOCKET_MAIN, BENCH_BYTES);
+    uint64_t us = cur_time_us() - start;
+    CHECK_EQ(bytes, BENCH_BYTES);
+    CHECK_EQ(SocketClose(), 0);
+    SocketDeInit();
+    printf("mode=%s,baud=%u,at_us=%lu,connected_at_us=%lu,bytes=%u,ms=%lu,bps=%lu\n", MODE, modem.baud,
+           (unsigned long) at_us, (unsigned long) connected_us, bytes, (unsigned long) (us / 1000),
+           (unsigned long) (us ? bytes * 2 * 1000000ULL / us : 0));
+}
+
+
+int main(void) {
+    char *port = fake_modem_start(&modem);
+    CHECK(port != NULL);
+    setenv("SMART_DOOR_SERIAL", port, 1);
+    test_bring_up();
+#ifdef CELLULAR_SOCKET_URC
+    test_second_socket();
+#endif
+    CHECK_EQ(SocketClose(), 0);
+    SocketDeInit();
+    test_dns();
+    test_wait_hook();
+#ifndef CELLULAR_SOCKET_URC
+    test_baud_fallback();
+#endif
+    bench_baud();
+    bench();
+    fake_modem_stop();
+    return check_report("cellular " MODE);
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+#include "check.h"
+
+/*
+ * host tests of the metrics message (metrics.c): with every counter at its largest value the
+ * metrics go out in several messages of the door's size, each one key=value,... on its own,
+ * and every key comes exactly once per round. a buffer too small for one metric fails.
+ */
+
+#define MSG_SIZE 448  /* METRICS_MSG_SIZE of smart_door.c */
+#define MAX_MESSAGES (METRIC_COUNT + 1)  /* a round that doesn't end */
+
+
+/**
+ * @return: entries in msg, -1 if one isn't key=number
+ */
+static int entries(const char *msg) {
+    int count = 0;
+    for (const char *p = msg; *p; count++) {
+        const char *eq = strchr(p, '=');
+        const char *end = strchr(p, ',');
+        end = end ? end : p + strlen(p);
+        if (!eq || eq > end || eq == p || eq + 1 == end || strspn(eq + 1, "0123456789") != (size_t) (end - eq - 1)) {
+            return -1;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return count;
+}
+
+
+/**
+ * sets every metric to value and formats them all in messages of size bytes.
+ * @param total: output, entries over all the messages.
+ * @return: the number of messages
+ */
+static int round_of(uint32_t value, int size, int *total) {
+    char buf[MSG_SIZE];
+    int next = 0, messages = 0;
+    *total = 0;
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        metric_set((metric_id) i, value);
+    }
+    while (next < METRIC_COUNT && messages < MAX_MESSAGES) {
+        int len = metrics_format(buf, size, &next);
+        CHECK(len > 0 && len < size);
+        CHECK_EQ((int) strlen(buf), len);
+        int n = entries(buf);
+        CHECK(n > 0);
+        *total += n;
+        messages++;
+    }
+    return messages;
+}
+
+
+int main(void) {
+    char buf[MSG_SIZE];
+    int total = 0;
+
+    CHECK_EQ(round_of(0, MSG_SIZE, &total), 1);
+    CHECK_EQ(total, METRIC_COUNT);
+
+    int messages = round_of(UINT32_MAX, MSG_SIZE, &total);
+    CHECK(messages > 1);
+    CHECK_EQ(total, METRIC_COUNT);
+
+    /* the smallest message that still takes one metric */
+    CHECK_EQ(round_of(UINT32_MAX, METRIC_ENTRY_SIZE, &total), METRIC_COUNT);
+    CHECK_EQ(total, METRIC_COUNT);
+
+    int next = 0;
+    CHECK_EQ(metrics_format(buf, 4, &next), -1);
+    CHECK_EQ(next, 0);
+    next = METRIC_COUNT;
+    CHECK_EQ(metrics_format(buf, MSG_SIZE, &next), -1);
+
+    printf("metrics: %d keys, %d messages of %d bytes at the largest values\n", METRIC_COUNT, messages, MSG_SIZE);
+    return check_report("metrics");
+}
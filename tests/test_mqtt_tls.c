@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include "MQTTClient.h"
+#include "metrics.h"
+#include "tls_certs.h"
+#include "check.h"
+
+/*
+ * host test of the TLS in the Net layer of MQTTClient.c (MQTT_NET_TLS), against a TLS server
+ * on loopback in a thread. the socket layer (socket.h) is a TCP socket here, wolfSSL is
+ * tests/wolfssl/ssl.h (on OpenSSL). covers the full handshake with the broker verified
+ * against TLS_CA_CERT and SNI, reads and writes over TLS with a record read in pieces and a
+ * read timeout, the session resumed on the reconnect (tlsr), a broker with a certificate of
+ * another CA, a handshake cut by the broker (the session isn't offered again), and, built
+ * with TLS_BAD_CA, a CA that doesn't load: every connect fails before the handshake.
+ */
+
+#define HOST "localhost"
+#define TIMEOUT_MS 2000
+
+typedef enum serve_mode {
+    SERVE_ECHO,   //!< handshake with the broker certificate, then echo until close_notify
+    SERVE_ROGUE,  //!< handshake with the certificate of another CA
+    SERVE_DROP,   //!< close the connection in the middle of the handshake
+} serve_mode;
+
+/* the server, the fields after listen_fd under lock */
+static struct {
+    int listen_fd;
+    int port;
+    SSL_CTX *ctx;
+    SSL_CTX *rogue_ctx;
+    pthread_mutex_t lock;
+    serve_mode mode;
+    int accepted;  /* TCP connections */
+    int handshakes;  /* handshakes that succeeded */
+    int resumed;   /* the last handshake resumed a session */
+    char sni[64];  /* the host name the client sent */
+} srv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int sock_fd = -1;
+static int sock_port;
+
+
+/* --- socket.h on a TCP socket to the server --- */
+
+int SocketInit(char *host, int port) {
+    if (host == NULL) {
+        return -1;
+    }
+    sock_port = port;
+    return 0;
+}
+
+
+int SocketConnect(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(sock_port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_fd == -1 || connect(sock_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+
+int SocketWrite(unsigned char *payload, unsigned int len) {
+    unsigned int sent = 0;
+    while (sent < len) {
+        ssize_t n = send(sock_fd, payload + sent, len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return (int) len;
+}
+
+
+int SocketRead(unsigned char *buf, unsigned int max_len, unsigned int timeout_ms) {
+    struct pollfd pfd = {.fd = sock_fd, .events = POLLIN};
+    int rc = poll(&pfd, 1, (int) timeout_ms);
+    if (rc <= 0) {
+        return rc;
+    }
+    ssize_t n = recv(sock_fd, buf, max_len, 0);
+    return n > 0 ? (int) n : -1;
+}
+
+
+int SocketClose(void) {
+    if (sock_fd != -1) {
+        close(sock_fd);
+        sock_fd = -1;
+    }
+    return 0;
+}
+
+
+void SocketDeInit(void) {
+}
+
+
+int SocketPending(int sock) {
+    struct pollfd pfd = {.fd = sock_fd, .events = POLLIN};
+    (void) sock;
+    return sock_fd != -1 && poll(&pfd, 1, 0) > 0;
+}
+
+
+int CellularGetIMEI(char *imei, int maxlen) {
+    snprintf(imei, maxlen, "test imei");
+    return 0;
+}
+
+
+/* --- the server --- */
+
+/**
+ * @return: a server context with the certificate and the key
+ */
+static SSL_CTX *server_ctx(const char *cert_pem, const char *key_pem) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    BIO *bio = BIO_new_mem_buf(cert_pem, -1);
+    X509 *cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    bio = BIO_new_mem_buf(key_pem, -1);
+    EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    if (!ctx || SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1) {
+        fprintf(stderr, "test_mqtt_tls: no server context\n");
+        exit(1);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ctx;
+}
+
+
+/**
+ * serves one connection in the current mode.
+ */
+static void serve(int fd) {
+    pthread_mutex_lock(&srv.lock);
+    serve_mode mode = srv.mode;
+    srv.accepted++;
+    pthread_mutex_unlock(&srv.lock);
+    if (mode == SERVE_DROP) {
+        unsigned char hello[64];
+        (void) recv(fd, hello, sizeof(hello), 0);  /* part of the ClientHello */
+        return;
+    }
+    SSL *ssl = SSL_new(mode == SERVE_ROGUE ? srv.rogue_ctx : srv.ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) == 1) {
+        const char *sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+        pthread_mutex_lock(&srv.lock);
+        srv.handshakes++;
+        srv.resumed = SSL_session_reused(ssl);
+        snprintf(srv.sni, sizeof(srv.sni), "%s", sni ? sni : "");
+        pthread_mutex_unlock(&srv.lock);
+        char buf[256];
+        int n;
+        while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+            SSL_write(ssl, buf, n);
+        }
+        SSL_shutdown(ssl);
+    }
+    SSL_free(ssl);
+}
+
+
+static void *server_run(void *arg) {
+    (void) arg;
+    for (;;) {
+        int fd = accept(srv.listen_fd, NULL, NULL);
+        if (fd == -1) {
+            return NULL;
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+
+static void server_start(void) {
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    socklen_t len = sizeof(addr);
+    pthread_t thread;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    srv.ctx = server_ctx(TEST_SERVER_PEM, TEST_SERVER_KEY);
+    srv.rogue_ctx = server_ctx(TEST_ROGUE_PEM, TEST_ROGUE_KEY);
+    srv.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(srv.listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(srv.listen_fd, 1) == -1 ||
+        getsockname(srv.listen_fd, (struct sockaddr *) &addr, &len) == -1) {
+        perror("test_mqtt_tls: server");
+        exit(1);
+    }
+    srv.port = ntohs(addr.sin_port);
+    pthread_create(&thread, NULL, server_run, NULL);
+    pthread_detach(thread);
+}
+
+
+static void server_mode(serve_mode mode) {
+    pthread_mutex_lock(&srv.lock);
+    srv.mode = mode;
+    pthread_mutex_unlock(&srv.lock);
+}
+
+
+/**
+ * @param field: one of the int fields of srv.
+ * @return: its value
+ */
+static int server_get(const int *field) {
+    pthread_mutex_lock(&srv.lock);
+    int value = *field;
+    pthread_mutex_unlock(&srv.lock);
+    return value;
+}
+
+
+/* --- the tests --- */
+
+#ifndef TLS_BAD_CA
+/**
+ * sends a message over the connection and reads the echo back, the first read takes a
+ * part of the TLS record only so the rest is pending.
+ * the server notes the handshake before it echoes, so srv is up to date after it.
+ */
+static void check_echo(MqttNet *net) {
+    const byte msg[] = "hello broker";
+    byte buf[sizeof(msg)];
+    CHECK_EQ(net->write(net->context, msg, sizeof(msg), TIMEOUT_MS), sizeof(msg));
+    CHECK_EQ(net->read(net->context, buf, 5, TIMEOUT_MS), 5);
+    CHECK_EQ(MqttClientNet_Pending(), 1);
+    CHECK_EQ(net->read(net->context, buf + 5, sizeof(buf) - 5, TIMEOUT_MS), sizeof(buf) - 5);
+    CHECK(memcmp(buf, msg, sizeof(msg)) == 0);
+    CHECK_EQ(MqttClientNet_Pending(), 0);
+    /* nothing more from the broker, the read runs into WANT_READ */
+    CHECK_EQ(net->read(net->context, buf, sizeof(buf), 50), MQTT_CODE_ERROR_TIMEOUT);
+}
+
+
+static void test_handshakes(MqttNet *net, MQTTCtx *ctx) {
+    server_mode(SERVE_ECHO);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_SUCCESS);
+    CHECK(ctx->app_name && strcmp(ctx->app_name, "test imei") == 0);
+    check_echo(net);
+    CHECK_EQ(server_get(&srv.handshakes), 1);
+    CHECK_EQ(server_get(&srv.resumed), 0);
+    pthread_mutex_lock(&srv.lock);
+    CHECK(strcmp(srv.sni, HOST) == 0);
+    pthread_mutex_unlock(&srv.lock);
+    CHECK_EQ(metric_get(METRIC_TLS_RESUMED), 0);
+    uint32_t full_bytes = metric_get(METRIC_TLS_HANDSHAKE_BYTES);
+    CHECK(full_bytes > 1000);  /* the certificate goes over */
+    CHECK_EQ(net->disconnect(net->context), MQTT_CODE_SUCCESS);
+
+    /* reconnect: the session is resumed, no certificate */
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_SUCCESS);
+    check_echo(net);
+    CHECK_EQ(server_get(&srv.handshakes), 2);
+    CHECK_EQ(server_get(&srv.resumed), 1);
+    CHECK_EQ(metric_get(METRIC_TLS_RESUMED), 1);
+    uint32_t resumed_bytes = metric_get(METRIC_TLS_HANDSHAKE_BYTES);
+    CHECK(resumed_bytes + 400 < full_bytes);  /* without the certificate, 400 bytes in DER */
+    CHECK_EQ(net->disconnect(net->context), MQTT_CODE_SUCCESS);
+    printf("test_mqtt_tls: handshake %u bytes, resumed %u bytes\n", full_bytes, resumed_bytes);
+
+    /* a broker the CA didn't sign */
+    server_mode(SERVE_ROGUE);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_ERROR_NETWORK);
+    CHECK_EQ(server_get(&srv.handshakes), 2);
+    CHECK_EQ(MqttClientNet_Pending(), 0);
+
+    /* the failed handshake dropped the session, the next one is a full handshake */
+    server_mode(SERVE_ECHO);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_SUCCESS);
+    check_echo(net);
+    CHECK_EQ(server_get(&srv.resumed), 0);
+    CHECK_EQ(metric_get(METRIC_TLS_RESUMED), 1);
+    CHECK(metric_get(METRIC_TLS_HANDSHAKE_BYTES) > 1000);
+    CHECK_EQ(net->disconnect(net->context), MQTT_CODE_SUCCESS);
+
+    /* the broker cuts the handshake, same again */
+    server_mode(SERVE_DROP);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_ERROR_NETWORK);
+    server_mode(SERVE_ECHO);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_SUCCESS);
+    check_echo(net);
+    CHECK_EQ(server_get(&srv.resumed), 0);
+    CHECK_EQ(net->disconnect(net->context), MQTT_CODE_SUCCESS);
+    CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_SUCCESS);
+    check_echo(net);
+    CHECK_EQ(server_get(&srv.resumed), 1);
+    CHECK_EQ(metric_get(METRIC_TLS_RESUMED), 2);
+    CHECK_EQ(server_get(&srv.handshakes), 5);
+    CHECK_EQ(server_get(&srv.accepted), 7);
+}
+
+#else
+static void test_handshakes(MqttNet *net, MQTTCtx *ctx) {
+    (void) ctx;
+    server_mode(SERVE_ECHO);
+    /* the context is freed, so every connect tries to load the CA again and fails */
+    for (int i = 0; i < 2; i++) {
+        CHECK_EQ(net->connect(net->context, HOST, srv.port, TIMEOUT_MS), MQTT_CODE_ERROR_SYSTEM);
+        CHECK_EQ(sock_fd, -1);
+    }
+    CHECK_EQ(metric_get(METRIC_TLS_HANDSHAKE_BYTES), 0);
+    CHECK_EQ(metric_get(METRIC_TLS_RESUMED), 0);
+    CHECK_EQ(server_get(&srv.handshakes), 0);
+}
+#endif
+
+
+int main(void) {
+    static MQTTCtx ctx;
+    MqttNet net;
+    server_start();
+    ctx.use_tls = 1;
+    CHECK_EQ(MqttClientNet_Init(&net, &ctx), MQTT_CODE_SUCCESS);
+    test_handshakes(&net, &ctx);
+    CHECK_EQ(MqttClientNet_DeInit(&net), MQTT_CODE_SUCCESS);
+#ifdef TLS_BAD_CA
+    return check_report("test_mqtt_tls_bad_ca");
+#else
+    return check_report("test_mqtt_tls");
+#endif
+}
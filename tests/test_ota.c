@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+#include "ota.h"
+#include "ota_flash.h"
+#include "check.h"
+
+/*
+ * host test of the firmware update (ota.c) on the file storage (ota_flash_linux.c), end to end
+ * as the door sees it: ota_begin, the erase steps of the main loop, then the chunks of
+ * server/ota.py in MQTT rx buffer pieces, each one after the ack of the one before, with a chunk
+ * cut by a reconnect, a duplicate and one that came too early. the file has to hold the image
+ * at the end. a second image goes over the first one (the erase has to clear it), then a bad
+ * hash and an image too big for the storage.
+ */
+
+#define CHUNK_SIZE 1024    /* server/ota.py */
+#define PIECE_SIZE 512     /* MQTT_MAX_PACKET_SZ of the door */
+#define IMAGE_SIZE 70001
+#define MAX_STEPS 1000
+
+static char path[] = "/tmp/ota_slot_XXXXXX";
+
+
+/**
+ * delivers a chunk message to ota_chunk in pieces.
+ * @param cut: bytes of the message that arrive before the link drops, 0 for all of it.
+ */
+static void send_chunk(const uint8_t *image, uint32_t size, uint32_t offset, uint32_t cut) {
+    uint8_t msg[OTA_HEADER_SIZE + CHUNK_SIZE];
+    uint32_t len = size - offset < CHUNK_SIZE ? size - offset : CHUNK_SIZE;
+    msg[0] = (uint8_t) offset;
+    msg[1] = (uint8_t) (offset >> 8);
+    msg[2] = (uint8_t) (offset >> 16);
+    msg[3] = (uint8_t) (offset >> 24);
+    memcpy(msg + OTA_HEADER_SIZE, image + offset, len);
+    uint32_t total = OTA_HEADER_SIZE + len;
+    uint32_t limit = cut ? cut : total;
+    for (uint32_t at = 0; at < limit; at += PIECE_SIZE) {
+        uint32_t n = limit - at < PIECE_SIZE ? limit - at : PIECE_SIZE;
+        ota_chunk(msg + at, n, at == 0, at + n >= total);
+    }
+}
+
+
+/**
+ * @param args: output, "<size> <sha256 hex>" of the image.
+ * @param bad_hash: flip a bit of the hash.
+ */
+static void begin_args(char *args, const uint8_t *image, uint32_t size, int bad_hash) {
+    uint8_t digest[OTA_DIGEST_SIZE];
+    SHA256(image, size, digest);
+    digest[0] ^= (uint8_t) bad_hash;
+    int len = sprintf(args, "%lu ", (unsigned long) size);
+    for (int i = 0; i < OTA_DIGEST_SIZE; i++) {
+        len += sprintf(args + len, "%02x", digest[i]);
+    }
+}
+
+
+/**
+ * runs an update like the door: erases from the main loop, then answers every chunk.
+ * @return: the last answer of the door
+ */
+static const char *update(const uint8_t *image, uint32_t size, int bad_hash) {
+    static char status[OTA_STATUS_SIZE];
+    char args[16 + 2 * OTA_DIGEST_SIZE];
+    begin_args(args, image, size, bad_hash);
+    CHECK_EQ(ota_begin(args), 0);
+    CHECK(ota_erasing());
+    send_chunk(image, size, 0, 0);  /* too early, the server waits for the ack */
+    int steps = 1;
+    while (ota_erase_step()) {
+        steps++;
+    }
+    CHECK_EQ(steps, (size + OTA_ERASE_SIZE - 1) / OTA_ERASE_SIZE);
+    CHECK(!ota_erasing());
+    for (int step = 0; step < MAX_STEPS; step++) {
+        ota_status(status, sizeof(status));
+        if (strncmp(status, "ota_ack ", 8) != 0) {
+            break;
+        }
+        uint32_t offset = (uint32_t) strtoul(status + 8, NULL, 10);
+        if (step == 4) {
+            send_chunk(image, size, offset, CHUNK_SIZE / 2 + 100);  /* the link drops */
+            continue;
+        }
+        if (step == 8) {
+            send_chunk(image, size, offset - CHUNK_SIZE, 0);  /* the ack was lost, the chunk comes again */
+        }
+        if (step == 12 && offset + CHUNK_SIZE < size) {
+            send_chunk(image, size, offset + CHUNK_SIZE, 0);  /* after a lost one */
+        }
+        send_chunk(image, size, offset, 0);
+    }
+    return status;
+}
+
+
+/**
+ * @return: 1 if the storage file starts with image
+ */
+static int stored(const uint8_t *image, uint32_t size) {
+    uint8_t *buf = malloc(size);
+    FILE *f = fopen(path, "rb");
+    int same = f && buf && fread(buf, 1, size, f) == size && memcmp(buf, image, size) == 0;
+    if (f) {
+        fclose(f);
+    }
+    free(buf);
+    return same;
+}
+
+
+int main(void) {
+    char status[OTA_STATUS_SIZE];
+    char args[16 + 2 * OTA_DIGEST_SIZE];
+    uint8_t *image = malloc(IMAGE_SIZE);
+    uint8_t *second = malloc(IMAGE_SIZE);
+    int fd = mkstemp(path);
+    CHECK(fd != -1 && image && second);
+    close(fd);
+    unlink(path);  /* ota_flash_open makes it, every bit cleared */
+    setenv("SMART_DOOR_OTA_FILE", path, 1);
+    srand(1);
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++) {
+        image[i] = (uint8_t) rand();
+        second[i] = (uint8_t) ~image[i];
+    }
+
+    CHECK(strcmp(update(image, IMAGE_SIZE, 0), "ota_done") == 0);
+    CHECK(stored(image, IMAGE_SIZE));
+    CHECK_EQ(ota_install(), 0);
+
+    /* every bit the first image cleared is set in the second one */
+    CHECK(strcmp(update(second, IMAGE_SIZE - 1000, 0), "ota_done") == 0);
+    CHECK(stored(second, IMAGE_SIZE - 1000));
+
+    CHECK(strcmp(update(image, IMAGE_SIZE, 1), "ota_fail hash") == 0);
+    CHECK_EQ(ota_install(), -1);
+
+    uint32_t room = 0;
+    CHECK_EQ(ota_flash_open(&room), 0);
+    begin_args(args, image, IMAGE_SIZE, 0);
+    char big[sizeof(args) + 8];
+    sprintf(big, "%lu%s", (unsigned long) room + 1, strchr(args, ' '));
+    CHECK_EQ(ota_begin(big), -1);
+    ota_status(status, sizeof(status));
+    CHECK(strcmp(status, "ota_fail size") == 0);
+
+    unlink(path);
+    free(image);
+    free(second);
+    return check_report("ota");
+}
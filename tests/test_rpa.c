@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rpa.h"
+#include "check.h"
+
+/*
+ * host tests of the private address resolution (rpa.c, software AES): the sample data of the
+ * core specification (Vol 3, Part H, D.7), the address cache and the key table.
+ * ends with the cost per advert: a cached address, and a new address tried against 1 and
+ * RPA_MAX_IRKS keys (the AES runs once per key). the door does the AES on the CRYPTO peripheral.
+ */
+
+#define BENCH_ROUNDS 200000
+
+/* ah(IRK, prand) sample data: IRK ec0234a357c8ad05341010a60a397d9b, prand 708194, hash 0dfbaa */
+static const uint8_t sample_irk[RPA_IRK_SIZE] = {
+    0xec, 0x02, 0x34, 0xa3, 0x57, 0xc8, 0xad, 0x05, 0x34, 0x10, 0x10, 0xa6, 0x0a, 0x39, 0x7d, 0x9b
+};
+static const uint8_t sample_rpa[RPA_ADDR_SIZE] = {0xaa, 0xfb, 0x0d, 0x94, 0x81, 0x70};  // 70:81:94:0D:FB:AA
+static const uint8_t identity[RPA_ADDR_SIZE] = {0x01, 0x02, 0x03, 0x04, 0x05, 0xc6};
+
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * @param addr: output, a new random resolvable private address.
+ */
+static void random_rpa(uint8_t *addr) {
+    for (int i = 0; i < RPA_ADDR_SIZE; i++) {
+        addr[i] = (uint8_t) rand();
+    }
+    addr[RPA_ADDR_SIZE - 1] = (addr[RPA_ADDR_SIZE - 1] & 0x3F) | 0x40;
+}
+
+
+static void test_resolve(void) {
+    uint8_t out[RPA_ADDR_SIZE] = {0};
+    uint8_t other[RPA_ADDR_SIZE];
+    rpa_clear();
+    CHECK(rpa_is_resolvable(sample_rpa, 1));
+    CHECK(!rpa_is_resolvable(sample_rpa, 0));
+    CHECK_EQ(rpa_resolve(sample_rpa, out), -1);  /* no keys, the miss is cached */
+    CHECK_EQ(rpa_add_irk(identity, sample_irk), 0);  /* drops the cached miss */
+    CHECK_EQ(rpa_resolve(sample_rpa, out), 0);
+    CHECK(memcmp(out, identity, RPA_ADDR_SIZE) == 0);
+    CHECK_EQ(rpa_resolve(sample_rpa, out), 0);  /* from the cache */
+    memcpy(other, sample_rpa, RPA_ADDR_SIZE);
+    other[3] ^= 1;  /* another prand, the hash doesn't match */
+    CHECK_EQ(rpa_resolve(other, out), -1);
+    CHECK_EQ(rpa_resolve(sample_rpa, out), 0);
+
+    /* the table holds RPA_MAX_IRKS keys, adding a known identity replaces its key */
+    uint8_t id[RPA_ADDR_SIZE] = {0};
+    uint8_t irk[RPA_IRK_SIZE] = {0};
+    for (int i = 1; i < RPA_MAX_IRKS; i++) {
+        id[0] = (uint8_t) i;
+        irk[0] = (uint8_t) i;
+        CHECK_EQ(rpa_add_irk(id, irk), 0);
+    }
+    id[0] = RPA_MAX_IRKS;
+    CHECK_EQ(rpa_add_irk(id, irk), -1);
+    CHECK_EQ(rpa_add_irk(identity, sample_irk), 0);
+    CHECK_EQ(rpa_resolve(sample_rpa, out), 0);
+    rpa_clear();
+    CHECK_EQ(rpa_resolve(sample_rpa, out), -1);
+}
+
+
+/**
+ * @param keys: number of keys that don't resolve the addresses.
+ * @return: nanoseconds per new address
+ */
+static uint64_t bench_new(int keys) {
+    uint8_t id[RPA_ADDR_SIZE] = {0};
+    uint8_t irk[RPA_IRK_SIZE] = {0};
+    uint8_t addr[RPA_ADDR_SIZE], out[RPA_ADDR_SIZE];
+    rpa_clear();
+    for (int i = 0; i < keys; i++) {
+        id[0] = (uint8_t) i;
+        irk[0] = (uint8_t) (i + 1);
+        rpa_add_irk(id, irk);
+    }
+    int resolved = 0;
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        random_rpa(addr);
+        resolved += (rpa_resolve(addr, out) == 0);
+    }
+    uint64_t ns = (monotonic_ns() - start) / BENCH_ROUNDS;
+    CHECK(resolved < BENCH_ROUNDS / 1000);  /* a random hash matches a key 1 in 2^24 */
+    return ns;
+}
+
+
+static void bench(void) {
+    uint8_t out[RPA_ADDR_SIZE];
+    srand(3);
+    rpa_clear();
+    rpa_add_irk(identity, sample_irk);
+    rpa_resolve(sample_rpa, out);
+    int resolved = 0;
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        resolved += (rpa_resolve(sample_rpa, out) == 0);
+    }
+    uint64_t cached = (monotonic_ns() - start) / BENCH_ROUNDS;
+    CHECK_EQ(resolved, BENCH_ROUNDS);
+    uint64_t one = bench_new(1);
+    uint64_t all = bench_new(RPA_MAX_IRKS);
+    printf("cached_ns=%lu,new_1key_ns=%lu,new_%dkeys_ns=%lu\n", (unsigned long) cached, (unsigned long) one,
+           RPA_MAX_IRKS, (unsigned long) all);
+}
+
+
+int main(void) {
+    test_resolve();
+    bench();
+    return check_report("rpa");
+}
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rtos.h"
+#include "check.h"
+
+/*
+ * host tests of the POSIX port of rtos.h (rtos_posix.c): tasks wait for rtos_start, events
+ * keep one signal, queues keep their order, drop when full and wake a task from an
+ * "interrupt" thread, the recursive mutex, the cpu shares (the time a task was preempted isn't
+ * its own) and the stack high water marks.
+ * the tester task runs the checks against the helper tasks and ends the process. the process runs
+ * on one core, like the door, so the tasks preempt each other.
+ */
+
+#define STACK 2048
+#define TIMEOUT_MS 50
+#define QUEUE_COUNT 4
+#define SPIN_MS 200
+#define SPIN_LIMIT_MS 2000
+
+static rtos_event ping, pong, deeper, spin_go;
+static rtos_queue echo_in, echo_out;
+static rtos_mutex lock;
+static volatile bool started = false;
+static volatile bool task_before_start = false;
+static volatile bool spinning = true;
+static volatile bool locked_out = false;
+
+
+/**
+ * @return: milliseconds on the monotonic clock
+ */
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/**
+ * touches bytes of stack below the caller.
+ */
+static __attribute__((noinline)) uint8_t use_stack(uint32_t bytes) {
+    volatile uint8_t buf[bytes];
+    for (uint32_t i = 0; i < bytes; i++) {
+        buf[i] = (uint8_t) i;
+    }
+    return buf[bytes / 2];
+}
+
+
+/**
+ * answers every ping with a pong, doubles what comes on echo_in.
+ */
+static void echo_main(rtos_task *task) {
+    (void) task;
+    task_before_start = !started;
+    while (1) {
+        uint32_t v;
+        if (rtos_event_wait(&ping, 10) == 0) {
+            rtos_event_signal(&pong);
+        }
+        if (rtos_queue_get(&echo_in, &v, 0) == 0) {
+            v *= 2;
+            rtos_queue_put(&echo_out, &v);
+        }
+    }
+}
+
+
+/**
+ * busy from spin_go until the tester measured the cpu shares, then takes the mutex once it is free.
+ */
+static void spin_main(rtos_task *task) {
+    (void) task;
+    rtos_event_wait(&spin_go, RTOS_FOREVER);
+    uint64_t start = now_ms();
+    while (spinning && now_ms() - start < SPIN_LIMIT_MS) {
+        /* a real time spin starves the whole host, bounded in case the tester fails */
+    }
+    rtos_mutex_lock(&lock);
+    locked_out = false;
+    rtos_mutex_unlock(&lock);
+}
+
+
+/**
+ * uses 1000 bytes of its STACK byte stack, then 3000.
+ */
+static void deep_main(rtos_task *task) {
+    (void) task;
+    use_stack(1000);
+    rtos_event_wait(&deeper, RTOS_FOREVER);
+    use_stack(3000);
+}
+
+
+static rtos_task echo_task = RTOS_TASK("echo", echo_main, RTOS_PRIO_BT, STACK, METRIC_CPU_BT, METRIC_STACK_BT);
+static rtos_task spin_task = RTOS_TASK("spin", spin_main, RTOS_PRIO_TELEMETRY, STACK, METRIC_CPU_TELEMETRY,
+                                       METRIC_COUNT);
+static rtos_task deep_task = RTOS_TASK("deep", deep_main, RTOS_PRIO_LINK, STACK, METRIC_COUNT, METRIC_STACK_MODEM);
+
+
+/**
+ * an interrupt of the host build: a thread outside the tasks.
+ */
+static void *irq_main(void *arg) {
+    (void) arg;
+    uint32_t v = 21;
+    struct timespec ts = {0, 20 * 1000000};
+    nanosleep(&ts, NULL);
+    rtos_queue_put(&echo_in, &v);
+    return NULL;
+}
+
+
+static void test_events(void) {
+    rtos_event ev;
+    CHECK_EQ(rtos_event_init(&ev), 0);
+    uint64_t start = now_ms();
+    CHECK_EQ(rtos_event_wait(&ev, TIMEOUT_MS), -1);
+    CHECK(now_ms() - start >= TIMEOUT_MS);
+    rtos_event_signal(&ev);
+    rtos_event_signal(&ev);
+    CHECK_EQ(rtos_event_wait(&ev, 0), 0);
+    CHECK_EQ(rtos_event_wait(&ev, 0), -1);  /* the two signals are kept as one */
+    rtos_event_signal(&ping);
+    CHECK_EQ(rtos_event_wait(&pong, 1000), 0);
+}
+
+
+static void test_queues(void) {
+    rtos_queue q;
+    uint32_t v = 0;
+    CHECK_EQ(rtos_queue_init(&q, QUEUE_COUNT, sizeof(uint32_t)), 0);
+    CHECK_EQ(rtos_queue_get(&q, &v, 0), -1);
+    uint32_t drops = metric_get(METRIC_QUEUE_DROPS);
+    for (uint32_t i = 0; i < QUEUE_COUNT + 2; i++) {
+        CHECK_EQ(rtos_queue_put(&q, &i), i < QUEUE_COUNT ? 0 : -1);
+    }
+    CHECK_EQ(metric_get(METRIC_QUEUE_DROPS), drops + 2);
+    for (uint32_t i = 0; i < QUEUE_COUNT; i++) {
+        CHECK_EQ(rtos_queue_get(&q, &v, 0), 0);
+        CHECK_EQ(v, i);
+    }
+    /* the wrap of the ring */
+    for (uint32_t i = 0; i < 3 * QUEUE_COUNT; i++) {
+        rtos_queue_put(&q, &i);
+        CHECK_EQ(rtos_queue_get(&q, &v, 0), 0);
+        CHECK_EQ(v, i);
+    }
+    pthread_t irq;
+    pthread_create(&irq, NULL, irq_main, NULL);
+    CHECK_EQ(rtos_queue_get(&echo_out, &v, 1000), 0);
+    CHECK_EQ(v, 42);
+    pthread_join(irq, NULL);
+}
+
+
+static void test_mutex(void) {
+    rtos_mutex_lock(&lock);
+    rtos_mutex_lock(&lock);  /* recursive */
+    locked_out = true;
+    spinning = false;
+    struct timespec ts = {0, TIMEOUT_MS * 1000000};
+    nanosleep(&ts, NULL);
+    rtos_mutex_unlock(&lock);
+    CHECK(locked_out);  /* still held once */
+    rtos_mutex_unlock(&lock);
+    for (int i = 0; i < 100 && locked_out; i++) {
+        nanosleep(&ts, NULL);  /* the spin task has the lowest priority */
+    }
+    CHECK(!locked_out);
+}
+
+
+static void test_cpu(void) {
+    rtos_event_signal(&spin_go);
+    rtos_cpu_report();
+    struct timespec ts = {0, SPIN_MS * 1000000};
+    nanosleep(&ts, NULL);
+    rtos_cpu_report();
+    printf("rtos: cpu permille spin %lu echo %lu\n", (unsigned long) metric_get(METRIC_CPU_TELEMETRY),
+           (unsigned long) metric_get(METRIC_CPU_BT));
+    CHECK(metric_get(METRIC_CPU_TELEMETRY) > 900);
+    CHECK(metric_get(METRIC_CPU_BT) < 100);  /* waits on its event most of the time */
+    CHECK(metric_get(METRIC_CPU_DOOR) < 100);
+
+    /* the tester is busy for half of the period: the spin task is preempted meanwhile, or shares
+     * the core without real time priorities, and that time isn't counted for it */
+    uint64_t start = now_ms();
+    while (now_ms() - start < SPIN_MS / 2) {
+    }
+    ts.tv_nsec = SPIN_MS / 2 * 1000000;
+    nanosleep(&ts, NULL);
+    rtos_cpu_report();
+    uint32_t spin = metric_get(METRIC_CPU_TELEMETRY), tester = metric_get(METRIC_CPU_DOOR);
+    printf("rtos: cpu permille with the tester busy, spin %lu tester %lu\n", (unsigned long) spin,
+           (unsigned long) tester);
+    CHECK(tester > 200 && tester < 600);
+    CHECK(spin > 400);
+    CHECK(spin + tester + metric_get(METRIC_CPU_BT) <= 1020);
+}
+
+
+static void test_stack(void) {
+    uint32_t echo = rtos_stack_free(&echo_task);
+    uint32_t deep = rtos_stack_free(&deep_task);
+    printf("rtos: stack left of %d, echo %lu, deep after 1000 bytes %lu\n", STACK, (unsigned long) echo,
+           (unsigned long) deep);
+    CHECK(echo > STACK - 1000 && echo < STACK);
+    CHECK(deep <= STACK - 1000 && deep > STACK - 1000 - 1000);
+    rtos_event_signal(&deeper);
+    struct timespec ts = {0, TIMEOUT_MS * 1000000};
+    nanosleep(&ts, NULL);
+    CHECK_EQ(rtos_stack_free(&deep_task), 0);  /* past its stack_size */
+    rtos_stack_report();
+    CHECK_EQ(metric_get(METRIC_STACK_BT), rtos_stack_free(&echo_task));
+    CHECK_EQ(metric_get(METRIC_STACK_MODEM), 0);
+}
+
+
+/**
+ * runs the checks, above the spin task so a real time spin doesn't starve it on one core.
+ */
+static void tester_main(rtos_task *task) {
+    (void) task;
+    CHECK(started);
+    CHECK(!task_before_start);
+    test_events();
+    test_queues();
+    test_cpu();
+    test_mutex();
+    test_stack();
+    exit(check_report("rtos"));
+}
+
+
+static rtos_task tester_task = RTOS_TASK("tester", tester_main, RTOS_PRIO_DOOR, 4 * STACK, METRIC_CPU_DOOR, METRIC_COUNT);
+
+
+int main(void) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(0, &one);
+    sched_setaffinity(0, sizeof(one), &one);  /* the threads take it over */
+    CHECK_EQ(rtos_event_init(&ping), 0);
+    CHECK_EQ(rtos_event_init(&pong), 0);
+    CHECK_EQ(rtos_event_init(&deeper), 0);
+    CHECK_EQ(rtos_event_init(&spin_go), 0);
+    CHECK_EQ(rtos_queue_init(&echo_in, QUEUE_COUNT, sizeof(uint32_t)), 0);
+    CHECK_EQ(rtos_queue_init(&echo_out, QUEUE_COUNT, sizeof(uint32_t)), 0);
+    CHECK_EQ(rtos_mutex_init(&lock), 0);
+    CHECK_EQ(rtos_task_create(&echo_task), 0);
+    CHECK_EQ(rtos_task_create(&spin_task), 0);
+    CHECK_EQ(rtos_task_create(&deep_task), 0);
+    CHECK_EQ(rtos_task_create(&tester_task), 0);
+    struct timespec ts = {0, TIMEOUT_MS * 1000000};
+    nanosleep(&ts, NULL);  /* the tasks wait for rtos_start */
+    started = true;
+    rtos_start();
+    return 1;
+}
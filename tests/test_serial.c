@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "serial_io.h"
+#include "timer.h"
+#include "check.h"
+
+/*
+ * host tests of the Linux serial port (serial_io_linux.c) on a pseudo terminal: send and
+ * receive, the receive timeout, the rx notify thread, opening the port again without
+ * leaking descriptors, and a send that times out when the other side stops reading.
+ */
+
+#define REOPEN_COUNT 50
+#define STUCK_SIZE 32768  /* more than the pty buffers (20 KB) */
+#define TX_TIMEOUT 2000   /* serial_io_linux.c */
+
+static volatile int notified = 0;
+
+
+static void on_rx(void) {
+    notified++;
+}
+
+
+/**
+ * @return: number of open descriptors of the process
+ */
+static int open_fds(void) {
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    while (readdir(dir)) {
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+
+/**
+ * @param master: the master side of the pty.
+ * @param buf: output.
+ * @param len: bytes to read.
+ * @return: bytes read within a second
+ */
+static int read_master(int master, char *buf, int len) {
+    int total = 0;
+    uint64_t deadline = cur_time() + 1000;
+    while (total < len && cur_time() < deadline) {
+        ssize_t rc = read(master, buf + total, len - total);
+        if (rc > 0) {
+            total += rc;
+        }
+        else {
+            usleep(1000);
+        }
+    }
+    return total;
+}
+
+
+int main(void) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    CHECK(master != -1 && grantpt(master) == 0 && unlockpt(master) == 0);
+    char *port = ptsname(master);
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    CHECK_EQ(SerialInit(port, 12345), -1);  /* not a baud rate */
+    CHECK_EQ(SerialInit(port, 115200), 0);
+    int fds = open_fds();
+    for (int i = 0; i < REOPEN_COUNT; i++) {
+        CHECK_EQ(SerialInit(port, 115200), 0);
+    }
+    CHECK_EQ(open_fds(), fds);
+
+    char out[16] = {0};
+    CHECK_EQ(SerialSend("AT\r", 3), 3);
+    CHECK_EQ(read_master(master, out, 3), 3);
+    CHECK(memcmp(out, "AT\r", 3) == 0);
+
+    unsigned char in[16] = {0};
+    CHECK_EQ(write(master, "\r\nOK\r\n", 6), 6);
+    CHECK_EQ(SerialRecv(in, 6, 1000), 6);
+    CHECK(memcmp(in, "\r\nOK\r\n", 6) == 0);
+    uint64_t start = cur_time();
+    CHECK_EQ(SerialRecv(in, sizeof(in), 100), 0);
+    CHECK(cur_time() - start >= 100 && cur_time() - start < 500);
+
+    /* the notify thread follows the port when it's opened again */
+    SerialSetRxNotify(on_rx);
+    fds = open_fds();
+    CHECK_EQ(SerialInit(port, 115200), 0);
+    CHECK_EQ(open_fds(), fds);
+    CHECK_EQ(write(master, "+", 1), 1);
+    for (int i = 0; i < 1000 && !notified; i++) {
+        usleep(1000);
+    }
+    CHECK(notified > 0);
+    CHECK_EQ(SerialAvailable(), 1);
+    CHECK_EQ(SerialRecv(in, 1, 100), 1);
+
+    SerialSetRxNotify(NULL);
+
+    /* the master doesn't read, like a modem holding CTS down: the send gives up after its
+     * line time and TX_TIMEOUT */
+    static char stuck[STUCK_SIZE];
+    CHECK_EQ(SerialInit(port, 921600), 0);
+    start = cur_time();
+    CHECK_EQ(SerialSend(stuck, STUCK_SIZE), -1);
+    uint64_t line_ms = (uint64_t) STUCK_SIZE * 10 * 1000 / 921600;
+    CHECK(cur_time() - start >= TX_TIMEOUT + line_ms && cur_time() - start < TX_TIMEOUT + line_ms + 500);
+    while (read(master, stuck, sizeof(stuck)) > 0) {
+    }
+
+    CHECK_EQ(SerialDisable(), 0);
+    CHECK(open_fds() < fds);
+    close(master);
+    return check_report("serial");
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "timer.h"
+#include "check.h"
+
+/*
+ * host tests of the timer wheel (timer.c) on the tick shim (timer_linux.c): one shot, periodic,
+ * stop and restart, thousands of live timers in order, timeouts past the range of the wheel,
+ * and the clock across the 32 bit millisecond and tick counter wraps.
+ * ends with the cost of arm, stop and expire with TIMER_BENCH live timers.
+ */
+
+#define TIMER_COUNT 5000
+#define TIMER_BENCH 10000
+#define MS_WRAP (1ULL << 32)                     // where a 32 bit millisecond counter wrapped (49.7 days)
+#define TICK_WRAP ((1ULL << 32) / 32768 * 1000)  // where the 32 bit RTCC counter wraps, in ms (36.4 hours)
+
+typedef struct fired_log {
+    uint64_t at[TIMER_COUNT];
+    int count;
+} fired_log;
+
+static soft_timer timers[TIMER_BENCH];
+static uint64_t expected[TIMER_COUNT];
+static fired_log fired;
+
+
+static void log_fire(soft_timer *timer, void *data) {
+    (void) timer;
+    int idx = (int) (intptr_t) data;
+    fired.at[idx] = cur_time();
+    fired.count++;
+}
+
+
+static void count_fire(soft_timer *timer, void *data) {
+    (void) timer;
+    (*(int *) data)++;
+}
+
+
+static void restart_self(soft_timer *timer, void *data) {
+    int *count = data;
+    if (++*count < 3) {
+        soft_timer_start(timer, 7, restart_self, data);
+    }
+}
+
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void test_one_shot(uint64_t start) {
+    soft_timer t = {0};
+    int count = 0;
+    timer_advance(start);
+    CHECK(!soft_timer_is_running(&t));
+    soft_timer_start(&t, 100, count_fire, &count);
+    CHECK(soft_timer_is_running(&t));
+    timer_advance(start + 99);
+    CHECK_EQ(count, 0);
+    timer_advance(start + 100);
+    CHECK_EQ(count, 1);
+    CHECK(!soft_timer_is_running(&t));
+    timer_advance(start + 1000);
+    CHECK_EQ(count, 1);
+    CHECK_EQ(cur_time(), start + 1000);
+    CHECK_EQ(cur_time_us() / 1000, start + 1000);
+}
+
+
+static void test_stop_restart(uint64_t start) {
+    soft_timer t = {0};
+    int count = 0;
+    timer_advance(start);
+    soft_timer_start(&t, 50, count_fire, &count);
+    soft_timer_stop(&t);
+    CHECK(!soft_timer_is_running(&t));
+    timer_advance(start + 100);
+    CHECK_EQ(count, 0);
+    soft_timer_stop(&t);  /* stopping a stopped timer does nothing */
+    soft_timer_start(&t, 50, count_fire, &count);
+    timer_advance(start + 120);
+    soft_timer_start(&t, 50, count_fire, &count);  /* restart pushes it back */
+    timer_advance(start + 169);
+    CHECK_EQ(count, 0);
+    timer_advance(start + 170);
+    CHECK_EQ(count, 1);
+
+    /* a callback may restart its own timer */
+    count = 0;
+    soft_timer_start(&t, 7, restart_self, &count);
+    timer_advance(start + 170 + 21);
+    CHECK_EQ(count, 3);
+    CHECK(!soft_timer_is_running(&t));
+}
+
+
+static void test_periodic(uint64_t start) {
+    soft_timer t = {0};
+    int count = 0;
+    timer_advance(start);
+    CHECK_EQ(set_periodic_timer(&t, 0, &count), -1);
+    CHECK_EQ(set_periodic_timer(&t, 250, &count), 0);
+    timer_advance(start + 999);
+    CHECK_EQ(count, 3);
+    timer_advance(start + 10000);
+    CHECK_EQ(count, 40);
+    soft_timer_stop(&t);
+    timer_advance(start + 20000);
+    CHECK_EQ(count, 40);
+}
+
+
+/**
+ * arms TIMER_COUNT timers from 1 ms to past the range of the wheel and checks each one fires
+ * exactly at its time, advancing the clock in uneven steps.
+ */
+static void test_many(uint64_t start, uint32_t max_timeout) {
+    srand(7);
+    timer_advance(start);
+    fired.count = 0;
+    uint64_t last = start;
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        uint32_t timeout = 1 + (uint32_t) (((uint64_t) rand() * rand()) % max_timeout);
+        expected[i] = start + timeout;
+        fired.at[i] = 0;
+        if (expected[i] > last) {
+            last = expected[i];
+        }
+        soft_timer_start(timers + i, timeout, log_fire, (void *) (intptr_t) i);
+    }
+    for (uint64_t now = start; now < last; now += 1 + (uint64_t) rand() % (max_timeout / 50 + 1)) {
+        timer_advance(now);
+    }
+    timer_advance(last);
+    CHECK_EQ(fired.count, TIMER_COUNT);
+    int late = 0;
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        late += (fired.at[i] != expected[i]);
+    }
+    CHECK_EQ(late, 0);
+}
+
+
+/**
+ * the clock and a timer across a wrap: the timer is armed before it and due after it.
+ */
+static void test_wrap(uint64_t wrap_ms) {
+    soft_timer t = {0};
+    int count = 0;
+    timer_advance(wrap_ms - 500);
+    uint64_t before = cur_time();
+    soft_timer_start(&t, 1000, count_fire, &count);
+    timer_advance(wrap_ms - 1);
+    timer_advance(wrap_ms);
+    timer_advance(wrap_ms + 499);
+    CHECK_EQ(count, 0);
+    CHECK(cur_time() > before);
+    timer_advance(wrap_ms + 500);
+    CHECK_EQ(count, 1);
+    CHECK_EQ(cur_time(), wrap_ms + 500);
+    CHECK_EQ(cur_time() - before, 1000);
+}
+
+
+static void bench(uint64_t start) {
+    srand(11);
+    timer_advance(start);
+    int count = 0;
+    uint64_t t0 = monotonic_ns();
+    for (int i = 0; i < TIMER_BENCH; i++) {
+        soft_timer_start(timers + i, 1 + rand() % 600000, count_fire, &count);
+    }
+    uint64_t t1 = monotonic_ns();
+    for (int i = 0; i < TIMER_BENCH; i += 2) {
+        soft_timer_stop(timers + i);
+    }
+    uint64_t t2 = monotonic_ns();
+    timer_advance(start + 600000);
+    uint64_t t3 = monotonic_ns();
+    CHECK_EQ(count, TIMER_BENCH / 2);
+    printf("timers=%d,arm_ns=%lu,stop_ns=%lu,expire_ns=%lu\n", TIMER_BENCH,
+           (unsigned long) ((t1 - t0) / TIMER_BENCH), (unsigned long) ((t2 - t1) / (TIMER_BENCH / 2)),
+           (unsigned long) ((t3 - t2) / (TIMER_BENCH / 2)));
+}
+
+
+int main(void) {
+    test_one_shot(1000);
+    test_stop_restart(5000);
+    test_periodic(10000);
+    test_many(100000, 60000);
+    test_many(1000000, 20000000);  /* past the 2^24 ms range of the wheel */
+    test_wrap(TICK_WRAP);
+    test_wrap(MS_WRAP);
+    test_one_shot(MS_WRAP + 10000);
+    bench(MS_WRAP + 100000);
+    return check_report("timer");
+}
@@ -0,0 +1,14 @@
+#ifndef TESTS_WOLFMQTT_MQTT_CLIENT_H_
+#define TESTS_WOLFMQTT_MQTT_CLIENT_H_
+#include "wolfmqtt/mqtt_socket.h"
+
+/*
+ * the wolfMQTT client, only as far as MQTTCtx (MQTTClient.h) holds it.
+ */
+
+typedef struct MqttClient {
+    MqttNet *net;
+    void *ctx;
+} MqttClient;
+
+#endif // TESTS_WOLFMQTT_MQTT_CLIENT_H_
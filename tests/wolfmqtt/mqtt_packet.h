@@ -0,0 +1,45 @@
+#ifndef TESTS_WOLFMQTT_MQTT_PACKET_H_
+#define TESTS_WOLFMQTT_MQTT_PACKET_H_
+#include "wolfmqtt/mqtt_types.h"
+
+/*
+ * the wolfMQTT packets, only as far as MQTTCtx (MQTTClient.h) holds them.
+ */
+
+typedef enum MqttQoS { MQTT_QOS_0, MQTT_QOS_1, MQTT_QOS_2 } MqttQoS;
+
+typedef struct MqttMessage {
+    word16 packet_id;
+    MqttQoS qos;
+    const char *topic_name;
+    byte *buffer;
+    word32 total_len;
+} MqttMessage;
+typedef MqttMessage MqttPublish;
+
+typedef struct MqttTopic {
+    const char *topic_filter;
+    MqttQoS qos;
+} MqttTopic;
+
+typedef struct MqttConnect {
+    word16 keep_alive_sec;
+    const char *client_id;
+} MqttConnect;
+
+typedef struct MqttSubscribe {
+    word16 packet_id;
+    int topic_count;
+    MqttTopic *topics;
+} MqttSubscribe;
+typedef MqttSubscribe MqttUnsubscribe;
+
+typedef struct MqttDisconnect {
+    int reason_code;
+} MqttDisconnect;
+
+typedef struct MqttPing {
+    int unused;
+} MqttPing;
+
+#endif // TESTS_WOLFMQTT_MQTT_PACKET_H_
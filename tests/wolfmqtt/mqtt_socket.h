@@ -0,0 +1,22 @@
+#ifndef TESTS_WOLFMQTT_MQTT_SOCKET_H_
+#define TESTS_WOLFMQTT_MQTT_SOCKET_H_
+#include "wolfmqtt/mqtt_types.h"
+
+/*
+ * the wolfMQTT network callbacks, set by MqttClientNet_Init.
+ */
+
+typedef int (*MqttNetConnectCb)(void *context, const char *host, word16 port, int timeout_ms);
+typedef int (*MqttNetReadCb)(void *context, byte *buf, int buf_len, int timeout_ms);
+typedef int (*MqttNetWriteCb)(void *context, const byte *buf, int buf_len, int timeout_ms);
+typedef int (*MqttNetDisconnectCb)(void *context);
+
+typedef struct MqttNet {
+    void *context;
+    MqttNetConnectCb connect;
+    MqttNetReadCb read;
+    MqttNetWriteCb write;
+    MqttNetDisconnectCb disconnect;
+} MqttNet;
+
+#endif // TESTS_WOLFMQTT_MQTT_SOCKET_H_
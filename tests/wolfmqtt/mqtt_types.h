@@ -0,0 +1,22 @@
+#ifndef TESTS_WOLFMQTT_MQTT_TYPES_H_
+#define TESTS_WOLFMQTT_MQTT_TYPES_H_
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * the part of wolfMQTT that MQTTClient.c (the Net layer) uses, for the host tests.
+ */
+
+typedef uint8_t byte;
+typedef uint16_t word16;
+typedef uint32_t word32;
+
+enum MqttPacketResponseCodes {
+    MQTT_CODE_SUCCESS = 0,
+    MQTT_CODE_ERROR_TIMEOUT = -7,
+    MQTT_CODE_ERROR_NETWORK = -8,
+    MQTT_CODE_ERROR_SYSTEM = -12,
+};
+
+#endif // TESTS_WOLFMQTT_MQTT_TYPES_H_
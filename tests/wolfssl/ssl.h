@@ -0,0 +1,214 @@
+#ifndef TESTS_WOLFSSL_SSL_H_
+#define TESTS_WOLFSSL_SSL_H_
+#include <stdlib.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+
+/*
+ * the part of wolfssl/ssl.h that MQTTClient.c uses, on OpenSSL (libssl) for the host tests.
+ * the wolfSSL IO callbacks run under a BIO of their own, so the records go through
+ * tls_recv / tls_send and the socket layer like on the door.
+ */
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+typedef SSL WOLFSSL;
+typedef SSL_CTX WOLFSSL_CTX;
+typedef SSL_SESSION WOLFSSL_SESSION;
+typedef const SSL_METHOD WOLFSSL_METHOD;
+typedef int (*CallbackIORecv)(WOLFSSL *ssl, char *buf, int sz, void *ctx);
+typedef int (*CallbackIOSend)(WOLFSSL *ssl, char *buf, int sz, void *ctx);
+
+#define WOLFSSL_SUCCESS 1
+#define WOLFSSL_FAILURE 0
+#define WOLFSSL_FILETYPE_PEM 1
+#define WOLFSSL_VERIFY_NONE SSL_VERIFY_NONE
+#define WOLFSSL_VERIFY_PEER SSL_VERIFY_PEER
+#define WOLFSSL_ERROR_WANT_READ SSL_ERROR_WANT_READ
+#define WOLFSSL_CBIO_ERR_GENERAL (-1)
+#define WOLFSSL_CBIO_ERR_WANT_READ (-2)
+#define WOLFSSL_SNI_HOST_NAME 0
+
+/* one context in MQTTClient.c, so the callbacks are kept here and not per context */
+static CallbackIORecv wolfssl_io_recv;
+static CallbackIOSend wolfssl_io_send;
+static BIO_METHOD *wolfssl_io_method;
+
+/* the BIO data: the connection and the contexts given to the callbacks */
+typedef struct wolfssl_io {
+    WOLFSSL *ssl;
+    void *read_ctx;
+    void *write_ctx;
+} wolfssl_io;
+
+static int wolfssl_io_read(BIO *bio, char *buf, int sz) {
+    wolfssl_io *io = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    int n = wolfssl_io_recv(io->ssl, buf, sz, io->read_ctx);
+    if (n == WOLFSSL_CBIO_ERR_WANT_READ) {
+        BIO_set_retry_read(bio);
+    }
+    return n < 0 ? -1 : n;
+}
+
+static int wolfssl_io_write(BIO *bio, const char *buf, int sz) {
+    wolfssl_io *io = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    int n = wolfssl_io_send(io->ssl, (char *) buf, sz, io->write_ctx);
+    return n < 0 ? -1 : n;
+}
+
+static long wolfssl_io_ctrl(BIO *bio, int cmd, long num, void *ptr) {
+    (void) bio;
+    (void) num;
+    (void) ptr;
+    return cmd == BIO_CTRL_FLUSH;
+}
+
+static int wolfssl_io_create(BIO *bio) {
+    BIO_set_data(bio, calloc(1, sizeof(wolfssl_io)));
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+static int wolfssl_io_destroy(BIO *bio) {
+    free(BIO_get_data(bio));
+    BIO_set_data(bio, NULL);
+    return 1;
+}
+
+static inline int wolfSSL_Init(void) {
+    if (!wolfssl_io_method) {
+        OPENSSL_init_ssl(0, NULL);
+        wolfssl_io_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "wolfssl io");
+        BIO_meth_set_read(wolfssl_io_method, wolfssl_io_read);
+        BIO_meth_set_write(wolfssl_io_method, wolfssl_io_write);
+        BIO_meth_set_ctrl(wolfssl_io_method, wolfssl_io_ctrl);
+        BIO_meth_set_create(wolfssl_io_method, wolfssl_io_create);
+        BIO_meth_set_destroy(wolfssl_io_method, wolfssl_io_destroy);
+    }
+    return WOLFSSL_SUCCESS;
+}
+
+static inline WOLFSSL_METHOD *wolfTLSv1_2_client_method(void) {
+    return TLSv1_2_client_method();
+}
+
+static inline WOLFSSL_CTX *wolfSSL_CTX_new(WOLFSSL_METHOD *method) {
+    return SSL_CTX_new(method);
+}
+
+static inline void wolfSSL_CTX_free(WOLFSSL_CTX *ctx) {
+    SSL_CTX_free(ctx);
+}
+
+static inline void wolfSSL_CTX_SetIORecv(WOLFSSL_CTX *ctx, CallbackIORecv cb) {
+    (void) ctx;
+    wolfssl_io_recv = cb;
+}
+
+static inline void wolfSSL_CTX_SetIOSend(WOLFSSL_CTX *ctx, CallbackIOSend cb) {
+    (void) ctx;
+    wolfssl_io_send = cb;
+}
+
+/* WOLFSSL_SUCCESS if at least one certificate of the PEM buffer was loaded */
+static inline int wolfSSL_CTX_load_verify_buffer(WOLFSSL_CTX *ctx, const unsigned char *buf, long sz, int format) {
+    (void) format;
+    BIO *bio = BIO_new_mem_buf(buf, (int) sz);
+    X509 *cert;
+    int loaded = 0;
+    while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL))) {
+        loaded += X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), cert) == 1;
+        X509_free(cert);
+    }
+    ERR_clear_error();
+    BIO_free(bio);
+    return loaded ? WOLFSSL_SUCCESS : WOLFSSL_FAILURE;
+}
+
+static inline void wolfSSL_CTX_set_verify(WOLFSSL_CTX *ctx, int mode, void *verify_cb) {
+    (void) verify_cb;
+    SSL_CTX_set_verify(ctx, mode, NULL);
+}
+
+static inline WOLFSSL *wolfSSL_new(WOLFSSL_CTX *ctx) {
+    WOLFSSL *ssl = SSL_new(ctx);
+    BIO *bio = ssl ? BIO_new(wolfssl_io_method) : NULL;
+    if (!bio) {
+        SSL_free(ssl);
+        return NULL;
+    }
+    ((wolfssl_io *) BIO_get_data(bio))->ssl = ssl;
+    SSL_set_bio(ssl, bio, bio);
+    return ssl;
+}
+
+static inline void wolfSSL_free(WOLFSSL *ssl) {
+    SSL_free(ssl);
+}
+
+static inline void wolfSSL_SetIOReadCtx(WOLFSSL *ssl, void *ctx) {
+    ((wolfssl_io *) BIO_get_data(SSL_get_rbio(ssl)))->read_ctx = ctx;
+}
+
+static inline void wolfSSL_SetIOWriteCtx(WOLFSSL *ssl, void *ctx) {
+    ((wolfssl_io *) BIO_get_data(SSL_get_wbio(ssl)))->write_ctx = ctx;
+}
+
+static inline int wolfSSL_UseSNI(WOLFSSL *ssl, unsigned char type, const void *data, unsigned short size) {
+    (void) type;
+    (void) size;  /* data is the host name, NUL terminated */
+    return SSL_set_tlsext_host_name(ssl, (const char *) data) == 1 ? WOLFSSL_SUCCESS : WOLFSSL_FAILURE;
+}
+
+static inline int wolfSSL_UseSessionTicket(WOLFSSL *ssl) {
+    (void) ssl;  /* OpenSSL asks for a ticket by default */
+    return WOLFSSL_SUCCESS;
+}
+
+static inline int wolfSSL_set_session(WOLFSSL *ssl, WOLFSSL_SESSION *session) {
+    return SSL_set_session(ssl, session) == 1 ? WOLFSSL_SUCCESS : WOLFSSL_FAILURE;
+}
+
+static inline WOLFSSL_SESSION *wolfSSL_get1_session(WOLFSSL *ssl) {
+    return SSL_get1_session(ssl);
+}
+
+static inline void wolfSSL_SESSION_free(WOLFSSL_SESSION *session) {
+    SSL_SESSION_free(session);
+}
+
+static inline int wolfSSL_session_reused(WOLFSSL *ssl) {
+    return SSL_session_reused(ssl);
+}
+
+static inline int wolfSSL_connect(WOLFSSL *ssl) {
+    return SSL_connect(ssl);
+}
+
+static inline int wolfSSL_get_error(WOLFSSL *ssl, int ret) {
+    return SSL_get_error(ssl, ret);
+}
+
+static inline int wolfSSL_read(WOLFSSL *ssl, void *buf, int sz) {
+    return SSL_read(ssl, buf, sz);
+}
+
+static inline int wolfSSL_write(WOLFSSL *ssl, const void *buf, int sz) {
+    return SSL_write(ssl, buf, sz);
+}
+
+static inline int wolfSSL_pending(WOLFSSL *ssl) {
+    return SSL_pending(ssl);
+}
+
+static inline int wolfSSL_shutdown(WOLFSSL *ssl) {
+    return SSL_shutdown(ssl);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // TESTS_WOLFSSL_SSL_H_
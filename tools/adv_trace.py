@@ -0,0 +1,165 @@
+"""
+Advertisement traces for the replay backend (see smartDoor/adv_trace.h, smartDoor/adv_replay.c).
+
+Record the last scan reports of a door built with `ADV_TRACE_ENABLE`, or make up a busy lobby:
+    python adv_trace.py capture --broker broker.mqttdashboard.com door.advt
+    python adv_trace.py lobby --phones 200 --minutes 10 lobby.advt
+    python adv_trace.py show lobby.advt
+Then replay it on the host: `adv_replay lobby.advt 0`.
+"""
+import argparse
+import random
+import struct
+import sys
+import time
+
+MAGIC = 0x54564441  # "ADVT"
+VERSION = 1
+DATA_MAX = 31
+FILE_HEADER = struct.Struct('<IHH')  # magic, version, record size
+DUMP_HEADER = struct.Struct('<II')  # head, first
+RECORD = struct.Struct(f'<I6sBbB{DATA_MAX}s')  # time, addr, address type, rssi, data len, data
+TOPIC_ADV = 'smart_door_lock/iot/adv'
+TOPIC_CMD = 'smart_door_lock/iot/device_recv'
+
+
+def write_trace(path, records):
+    """
+    write a trace file, times are moved to start at 0.
+    :param path: output file.
+    :param records: list of (time ms, addr bytes little endian, address type, rssi, data bytes).
+    """
+    records = sorted(records, key=lambda r: r[0])
+    start = records[0][0] if records else 0
+    with open(path, 'wb') as f:
+        f.write(FILE_HEADER.pack(MAGIC, VERSION, RECORD.size))
+        for t, addr, addr_type, rssi, data in records:
+            data = data[:DATA_MAX]
+            f.write(RECORD.pack(t - start, addr, addr_type, rssi, len(data), data))
+
+
+def read_trace(path):
+    """
+    :param path: trace file.
+    :return: list of (time ms, addr bytes, address type, rssi, data bytes)
+    """
+    raw = open(path, 'rb').read()
+    magic, version, size = FILE_HEADER.unpack_from(raw)
+    if magic != MAGIC or version != VERSION or size != RECORD.size:
+        sys.exit(f'{path}: not an advertisement trace')
+    records = []
+    for off in range(FILE_HEADER.size, len(raw) - RECORD.size + 1, RECORD.size):
+        t, addr, addr_type, rssi, length, data = RECORD.unpack_from(raw, off)
+        records.append((t, addr, addr_type, rssi, data[:length]))
+    return records
+
+
+def parse_chunks(chunks):
+    """
+    parse adv dump chunks into records sorted by their index.
+    :param chunks: iterable of raw chunk payloads.
+    :return: list of records as in read_trace
+    """
+    records = {}
+    for chunk in chunks:
+        _, first = DUMP_HEADER.unpack_from(chunk)
+        for i, off in enumerate(range(DUMP_HEADER.size, len(chunk) - RECORD.size + 1, RECORD.size)):
+            t, addr, addr_type, rssi, length, data = RECORD.unpack_from(chunk, off)
+            records[first + i] = (t, addr, addr_type, rssi, data[:length])
+    return [records[i] for i in sorted(records)]
+
+
+def fetch_dump(broker, wait):
+    """
+    ask the door for its advertisement ring and collect the chunks.
+    :param broker: mqtt broker host.
+    :param wait: seconds to collect chunks.
+    :return: list of chunks.
+    """
+    from paho.mqtt.client import Client
+    chunks = []
+    client = Client()
+    client.on_message = lambda c, u, m: chunks.append(m.payload)
+    client.connect(broker, 1883)
+    client.subscribe(TOPIC_ADV, 1)
+    client.loop_start()
+    client.publish(TOPIC_CMD, 'adv_dump', 1)
+    time.sleep(wait)
+    client.loop_stop()
+    client.disconnect()
+    return chunks
+
+
+def lobby(phones, minutes, interval, rotate, seed):
+    """
+    make up the scan of a busy lobby: phones walk by the door, advertise every interval
+    (with jitter) and rotate their random address every rotate seconds, like phones with privacy.
+    :return: list of records as in read_trace
+    """
+    rnd = random.Random(seed)
+    duration = int(minutes * 60000)
+    records = []
+    for _ in range(phones):
+        # resolvable private address: the two most significant bits are 01
+        def new_addr():
+            addr = bytearray(rnd.getrandbits(8) for _ in range(6))
+            addr[5] = (addr[5] & 0x3F) | 0x40
+            return bytes(addr)
+        addr = new_addr()
+        rotate_at = rnd.randrange(rotate * 1000)
+        # apple style manufacturer data or an exposure notification style service uuid
+        if rnd.random() < 0.6:
+            data = bytes([2, 0x01, 0x1A, 10, 0xFF, 0x4C, 0x00]) + bytes(rnd.getrandbits(8) for _ in range(7))
+        else:
+            data = bytes([2, 0x01, 0x1A, 3, 0x03, 0x6F, 0xFD])
+        arrive = rnd.randrange(duration)
+        stay = rnd.randrange(5000, 180000)
+        closest = -40 - rnd.randrange(50)  # some come close to the door, most pass by
+        t = arrive
+        while t < min(arrive + stay, duration):
+            if t >= rotate_at:
+                addr = new_addr()
+                rotate_at += rotate * 1000
+            # rssi rises to the closest point half way through the stay and falls again
+            progress = abs((t - arrive) / stay * 2 - 1)
+            rssi = int(closest - 45 * progress + rnd.gauss(0, 3))
+            if rssi > -100:
+                records.append((t, addr, 1, max(rssi, -127), data))
+            t += interval + rnd.randrange(10)
+    return records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='cmd', required=True)
+    capture = sub.add_parser('capture', help='record the advertisement ring of a door')
+    capture.add_argument('out')
+    capture.add_argument('--broker', required=True)
+    capture.add_argument('--wait', type=float, default=30, help='seconds to collect chunks')
+    make = sub.add_parser('lobby', help='make up a busy lobby')
+    make.add_argument('out')
+    make.add_argument('--phones', type=int, default=200)
+    make.add_argument('--minutes', type=float, default=10)
+    make.add_argument('--interval', type=int, default=200, help='advertising interval ms')
+    make.add_argument('--rotate', type=int, default=900, help='address rotation seconds')
+    make.add_argument('--seed', type=int, default=1)
+    show = sub.add_parser('show', help='print a trace')
+    show.add_argument('trace')
+    args = parser.parse_args()
+    if args.cmd == 'capture':
+        records = parse_chunks(fetch_dump(args.broker, args.wait))
+        if not records:
+            sys.exit('no advertisement chunks, is the door built with ADV_TRACE_ENABLE?')
+        write_trace(args.out, records)
+        print(f'{len(records)} records')
+    elif args.cmd == 'lobby':
+        records = lobby(args.phones, args.minutes, args.interval, args.rotate, args.seed)
+        write_trace(args.out, records)
+        print(f'{len(records)} records')
+    else:
+        for t, addr, addr_type, rssi, data in read_trace(args.trace):
+            print(f'{t:10}ms {addr[::-1].hex(":").upper()} type={addr_type} rssi={rssi:4} {data.hex()}')
+
+
+if __name__ == '__main__':
+    main()
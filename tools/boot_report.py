@@ -0,0 +1,171 @@
+"""
+Compares the boot to connected timelines of the smart door across firmware builds
+(see smartDoor/boot_prof.h).
+
+The door publishes its last timelines on the boot topic after it connects, or when it gets
+`boot_report`. Collect them into a log file that keeps growing across builds:
+    python boot_report.py --broker broker.mqttdashboard.com --request --log boots.txt
+    python boot_report.py --log boots.txt
+The output is the median time of every phase per build, and the phases of the newest build
+that got slower than the build before it (exit code 1 if there are any).
+"""
+import argparse
+import statistics
+import sys
+import time
+
+TOPIC_BOOT = 'smart_door_lock/iot/boot'
+TOPIC_CMD = 'smart_door_lock/iot/device_recv'
+
+# keys of the boot phases in the order they end, as in boot_keys (boot_prof.c)
+PHASES = [
+    ('uart', 'serial port up'),
+    ('mdm', 'modem answers'),
+    ('ops', 'operator scan'),
+    ('reg', 'registration'),
+    ('prof', 'profile setup'),
+    ('sock', 'socket open'),
+    ('conn', 'mqtt connect'),
+    ('sub', 'subscribe'),
+    ('pub', 'first publish'),
+]
+
+
+def parse(line):
+    """
+    parse one boot message.
+    :param line: "seq=N,build=...,try=N,uart=ms,...".
+    :return: dict of the fields, the numbers as int, None if the line isn't a boot message
+    """
+    fields = dict(f.split('=', 1) for f in line.strip().split(',') if '=' in f)
+    if 'seq' not in fields or 'build' not in fields:
+        return None
+    return {k: v if k == 'build' else int(v) for k, v in fields.items()}
+
+
+def durations(boot):
+    """
+    :param boot: a parsed boot message.
+    :return: dict of phase key -> ms the phase took, phases that weren't reached are left out
+    """
+    result, prev = {}, 0
+    for key, _ in PHASES:
+        end = boot.get(key, 0)
+        if end:
+            result[key] = end - prev
+            prev = end
+    if prev:
+        result['total'] = prev
+    return result
+
+
+def by_build(boots):
+    """
+    a timeline comes again every time the door publishes its history (after each boot with
+    BOOT_PROF_NVM, and on every boot_report), always with the same fields. seq alone doesn't tell
+    the boots apart: without BOOT_PROF_NVM it is 0 on every boot. so a boot is its whole message,
+    two boots with the same ms in every phase are taken as one.
+    :param boots: parsed boot messages, duplicates allowed.
+    :return: list of (build, list of boots) in the order the builds first appear
+    """
+    seen, builds = set(), {}
+    for boot in boots:
+        key = tuple(sorted(boot.items()))
+        if key not in seen:
+            seen.add(key)
+            builds.setdefault(boot['build'], []).append(boot)
+    return list(builds.items())
+
+
+def medians(boots):
+    """
+    :param boots: boots of one build.
+    :return: dict of phase key -> median ms
+    """
+    values = {}
+    for boot in boots:
+        for key, ms in durations(boot).items():
+            values.setdefault(key, []).append(ms)
+    return {key: statistics.median(v) for key, v in values.items()}
+
+
+def report(builds, threshold_ms, ratio):
+    """
+    prints the phase medians of every build and compares the newest build with the one before it.
+    :param builds: output of by_build.
+    :param threshold_ms: a phase regressed if it got slower by more than that...
+    :param ratio: ...and by more than this fraction.
+    :return: list of the phases that regressed
+    """
+    keys = [key for key, _ in PHASES] + ['total']
+    names = dict(PHASES, total='total')
+    table = [(build, len(boots), medians(boots)) for build, boots in builds]
+    print(f'{"phase":16}' + ''.join(f'{build:>24}' for build, _, _ in table))
+    print(f'{"boots":16}' + ''.join(f'{n:>24}' for _, n, _ in table))
+    for key in keys:
+        row = ''.join(f'{m[key]:>22.0f}ms' if key in m else f'{"-":>24}' for _, _, m in table)
+        print(f'{names[key]:16}{row}')
+    if len(table) < 2:
+        return []
+    (_, _, old), (_, _, new) = table[-2], table[-1]
+    regressions = []
+    for key in keys:
+        if key in old and key in new and new[key] - old[key] > threshold_ms and new[key] > old[key] * (1 + ratio):
+            regressions.append(key)
+            print(f'regression: {names[key]} {old[key]:.0f}ms -> {new[key]:.0f}ms')
+    return regressions
+
+
+def fetch_boots(broker, request, wait):
+    """
+    collect the boot messages the door publishes.
+    :param broker: the broker host.
+    :param request: send boot_report to the door first.
+    :param wait: seconds to collect.
+    :return: list of raw messages
+    """
+    from paho.mqtt.client import Client
+    lines = []
+    client = Client('TgBootReport')
+    client.on_message = lambda c, u, m: lines.append(m.payload.decode())
+    client.connect(broker, 1883)
+    client.subscribe(TOPIC_BOOT, 1)
+    client.loop_start()
+    if request:
+        client.publish(TOPIC_CMD, 'boot_report', 1)
+    time.sleep(wait)
+    client.loop_stop()
+    client.disconnect()
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--log', help='file of boot messages, one per line, new ones are appended')
+    parser.add_argument('--broker', help='collect the boot messages from this broker')
+    parser.add_argument('--request', action='store_true', help='ask the door for its boot timelines')
+    parser.add_argument('--wait', type=float, default=30, help='seconds to collect messages')
+    parser.add_argument('--threshold', type=float, default=1000, help='ms a phase may grow by')
+    parser.add_argument('--ratio', type=float, default=0.2, help='fraction a phase may grow by')
+    args = parser.parse_args()
+    lines = []
+    if args.log:
+        try:
+            lines = open(args.log).read().splitlines()
+        except FileNotFoundError:
+            pass
+    if args.broker:
+        new = fetch_boots(args.broker, args.request, args.wait)
+        lines += new
+        if args.log:
+            with open(args.log, 'a') as f:
+                f.writelines(line + '\n' for line in new)
+    boots = [b for b in map(parse, lines) if b]
+    if not boots:
+        sys.exit('no boot messages')
+    if report(by_build(boots), args.threshold, args.ratio):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
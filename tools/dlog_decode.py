@@ -0,0 +1,123 @@
+"""
+Decoder for the smart door deferred debug log streamed on SWO (see smartDoor/dlog.h).
+
+Build the firmware with DEBUG and DLOG_SWO, capture ITM stimulus port 1 to a file
+(e.g. with the J-Link SWO viewer) and decode it with the firmware image:
+    python dlog_decode.py smartDoor.axf swo_port1.bin
+The records only hold the address of the format string and the raw arguments,
+the strings are read back from the ELF file.
+"""
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+FRAME = struct.Struct('<HBBII4I16s')  # magic, nargs, lost, tick, fmt, args, str
+FRAME_MAGIC = 0x5AA5
+FLASH_SIZE = 256 * 1024  # EFR32BG1P232F256GM48, addresses below are in the firmware image
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t)?([diouxXcsp%])')
+
+
+class Image:
+    """
+    reads strings out of the loadable sections of the firmware ELF.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            elf = ELFFile(f)
+            self.sections = [(s['sh_addr'], s.data()) for s in elf.iter_sections()
+                             if s['sh_addr'] and s['sh_type'] == 'SHT_PROGBITS']
+
+    def string(self, addr):
+        """
+        :param addr: address of a C string.
+        :return: the string, None if addr isn't in the image.
+        """
+        for start, data in self.sections:
+            if start <= addr < start + len(data):
+                end = data.find(b'\0', addr - start)
+                return data[addr - start:end].decode(errors='replace')
+        return None
+
+
+def parse_frames(data):
+    """
+    finds the records in the captured stream, resyncs on the magic after garbage.
+    :param data: raw bytes of the stimulus port.
+    :return: list of (lost, tick, fmt address, args, str)
+    """
+    frames = []
+    off = 0
+    magic = struct.pack('<H', FRAME_MAGIC)
+    while off + FRAME.size <= len(data):
+        if data[off:off + 2] != magic:
+            off = data.find(magic, off + 1)
+            if off < 0:
+                break
+            continue
+        _, nargs, lost, tick, fmt, *rest = FRAME.unpack_from(data, off)
+        args, text = rest[:4], rest[4].split(b'\0')[0].decode(errors='replace')
+        frames.append((lost, tick, fmt, args[:nargs], text))
+        off += FRAME.size
+    return frames
+
+
+def render(image, fmt_addr, args, text):
+    """
+    formats a record the way printf on the device would.
+    :param image: the firmware image.
+    :param fmt_addr: address of the format string.
+    :param args: raw 32 bit arguments.
+    :param text: copy of the first %s argument that was in RAM.
+    :return: the message
+    """
+    fmt = image.string(fmt_addr)
+    if fmt is None:
+        return f'<unknown format 0x{fmt_addr:08x}> {args}'
+    args = iter(args)
+    used_text = False
+
+    def convert(match):
+        nonlocal used_text
+        flags, conv = match.groups()
+        if conv == '%':
+            return '%'
+        value = next(args, 0)
+        if conv == 's':
+            if value < FLASH_SIZE:
+                return ('%' + flags + 's') % image.string(value)
+            if used_text:
+                return '?'
+            used_text = True
+            return ('%' + flags + 's') % text
+        if conv in 'di':
+            value -= (value & 0x80000000) << 1
+        if conv == 'p':
+            return f'0x{value:08x}'
+        return ('%' + flags + conv.replace('u', 'd')) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('elf', help='the firmware image the log was captured from')
+    parser.add_argument('capture', help='raw bytes of ITM stimulus port 1')
+    parser.add_argument('--tick-freq', type=int, default=32768, help='sleeptimer frequency')
+    args = parser.parse_args()
+    image = Image(args.elf)
+    frames = parse_frames(open(args.capture, 'rb').read())
+    if not frames:
+        sys.exit('no log records')
+    for lost, tick, fmt, values, text in frames:
+        if lost:
+            print(f'... {lost} records lost')
+        msg = render(image, fmt, values, text).rstrip('\r\n')
+        print(f'{tick * 1000.0 / args.tick_freq:12.3f}ms {msg}')
+
+
+if __name__ == '__main__':
+    main()
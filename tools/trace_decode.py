@@ -0,0 +1,153 @@
+"""
+Decoder for the smart door trace ring (see smartDoor/trace.h).
+
+Collect a dump by sending `trace_dump` to the door and saving the chunks it
+publishes on the trace topic, or let this script do it:
+    python trace_decode.py --broker broker.mqttdashboard.com --request
+    python trace_decode.py dump1.bin dump2.bin
+The output is the per-stage latency histograms of the traced hot paths.
+"""
+import argparse
+import struct
+import sys
+import time
+from collections import defaultdict
+
+HEADER = struct.Struct('<III')  # tick_freq, head, first
+RECORD = struct.Struct('<IHHi')  # tick, id, seq, arg (signed, rssi and error codes)
+TOPIC_TRACE = 'smart_door_lock/iot/trace'
+TOPIC_CMD = 'smart_door_lock/iot/device_recv'
+
+EVENTS = {
+    1: 'bt_scan_report',
+    2: 'add_device',
+    3: 'send_device',
+    4: 'publish_start',
+    5: 'publish_end',
+    6: 'net_read_start',
+    7: 'net_read_end',
+    8: 'net_write_start',
+    9: 'net_write_end',
+    10: 'mqtt_msg',
+    11: 'door_open',
+    12: 'door_timeout',
+    13: 'led',
+}
+
+# (stage name, start event, end event): the latency of a stage is measured from a
+# start event to the first end event that follows it.
+STAGES = [
+    ('advert -> accepted', 'bt_scan_report', 'add_device'),
+    ('accepted -> sent', 'add_device', 'send_device'),
+    ('sent -> published', 'send_device', 'publish_end'),
+    ('publish', 'publish_start', 'publish_end'),
+    ('net write', 'net_write_start', 'net_write_end'),
+    ('net read', 'net_read_start', 'net_read_end'),
+    ('open_door -> led on', 'mqtt_msg', 'led'),
+]
+
+
+def parse_chunks(chunks):
+    """
+    parse dump chunks into a list of records sorted by their index.
+    :param chunks: iterable of raw chunk payloads.
+    :return: (tick frequency, list of (index, tick, event name, arg))
+    """
+    freq = None
+    records = {}
+    for chunk in chunks:
+        freq, _, first = HEADER.unpack_from(chunk)
+        for i, off in enumerate(range(HEADER.size, len(chunk) - RECORD.size + 1, RECORD.size)):
+            tick, event, seq, arg = RECORD.unpack_from(chunk, off)
+            idx = first + i
+            if seq != idx & 0xFFFF:
+                continue  # torn record, the writer was interrupted
+            records[idx] = (idx, tick, EVENTS.get(event, f'event_{event}'), arg)
+    return freq, [records[i] for i in sorted(records)]
+
+
+def stage_latencies(freq, records):
+    """
+    match start and end events of every stage.
+    :param freq: tick frequency.
+    :param records: parsed records.
+    :return: dict of stage name to list of latencies in milliseconds.
+    """
+    latencies = defaultdict(list)
+    for name, start, end in STAGES:
+        start_tick = None
+        for _, tick, event, arg in records:
+            if event == start:
+                start_tick = tick
+            elif event == end and start_tick is not None:
+                if end == 'led' and not arg:
+                    continue
+                latencies[name].append(((tick - start_tick) & 0xFFFFFFFF) * 1000.0 / freq)
+                start_tick = None
+    return latencies
+
+
+def print_histogram(name, values, buckets=(1, 5, 10, 50, 100, 500, 1000, 5000, 15000)):
+    """
+    print a text histogram of latencies.
+    :param name: stage name.
+    :param values: latencies in milliseconds.
+    :param buckets: upper bounds of the buckets in milliseconds.
+    """
+    values = sorted(values)
+    print(f'{name}: n={len(values)} min={values[0]:.2f}ms '
+          f'p50={values[len(values) // 2]:.2f}ms max={values[-1]:.2f}ms')
+    lower = 0
+    for upper in buckets + (float('inf'),):
+        count = sum(lower <= v < upper for v in values)
+        if count:
+            print(f'  {lower:>6} - {upper:<6} ms | {"#" * min(count, 60)} {count}')
+        lower = upper
+
+
+def fetch_dump(broker, request, wait):
+    """
+    subscribe to the trace topic and collect dump chunks.
+    :param broker: mqtt broker host.
+    :param request: send `trace_dump` to the door first.
+    :param wait: seconds to collect chunks.
+    :return: list of chunks.
+    """
+    from paho.mqtt.client import Client
+    chunks = []
+    client = Client()
+    client.on_message = lambda c, u, m: chunks.append(m.payload)
+    client.connect(broker, 1883)
+    client.subscribe(TOPIC_TRACE, 1)
+    client.loop_start()
+    if request:
+        client.publish(TOPIC_CMD, 'trace_dump', 1)
+    time.sleep(wait)
+    client.loop_stop()
+    client.disconnect()
+    return chunks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('files', nargs='*', help='raw dump chunks saved from the trace topic')
+    parser.add_argument('--broker', help='collect the dump from this broker')
+    parser.add_argument('--request', action='store_true', help='ask the door for a dump')
+    parser.add_argument('--wait', type=float, default=60, help='seconds to collect chunks')
+    parser.add_argument('--raw', action='store_true', help='also print the decoded records')
+    args = parser.parse_args()
+    chunks = [open(f, 'rb').read() for f in args.files]
+    if args.broker:
+        chunks += fetch_dump(args.broker, args.request, args.wait)
+    if not chunks:
+        sys.exit('no trace chunks')
+    freq, records = parse_chunks(chunks)
+    if args.raw:
+        for idx, tick, event, arg in records:
+            print(f'{idx:8} {tick * 1000.0 / freq:12.3f}ms {event:16} {arg}')
+    for name, values in stage_latencies(freq, records).items():
+        print_histogram(name, values)
+
+
+if __name__ == '__main__':
+    main()